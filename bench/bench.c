@@ -0,0 +1,712 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "libmatrix.h"
+
+// exponent used to benchmark matrix_power (four multiplications)
+#define BENCH_POWER 10
+#define BENCH_POWER_MULTIPLICATIONS 4
+// number of matrices combined to benchmark matrix_linearCombination
+#define BENCH_COMBINATION_TERMS 3
+
+/**
+ * Allocation counters. The benchmark is linked with --wrap for the allocation
+ * functions so that every allocation made by the library passes through here.
+ */
+static atomic_size_t allocatedBytes;
+static atomic_size_t allocationCount;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void* __real_aligned_alloc(size_t alignment, size_t size);
+
+void* __wrap_malloc(size_t size) {
+	atomic_fetch_add_explicit(&allocatedBytes, size, memory_order_relaxed);
+	atomic_fetch_add_explicit(&allocationCount, 1, memory_order_relaxed);
+	return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+	atomic_fetch_add_explicit(&allocatedBytes, count * size, memory_order_relaxed);
+	atomic_fetch_add_explicit(&allocationCount, 1, memory_order_relaxed);
+	return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+	atomic_fetch_add_explicit(&allocatedBytes, size, memory_order_relaxed);
+	atomic_fetch_add_explicit(&allocationCount, 1, memory_order_relaxed);
+	return __real_realloc(ptr, size);
+}
+
+void* __wrap_aligned_alloc(size_t alignment, size_t size) {
+	atomic_fetch_add_explicit(&allocatedBytes, size, memory_order_relaxed);
+	atomic_fetch_add_explicit(&allocationCount, 1, memory_order_relaxed);
+	return __real_aligned_alloc(alignment, size);
+}
+
+typedef enum Shape {
+	SQUARE,
+	TALL,
+	WIDE
+} Shape;
+
+static const char* shapeNames[] = { "square", "tall", "wide" };
+
+typedef enum Format {
+	TEXT,
+	CSV,
+	JSON
+} Format;
+
+/**
+ * Operands of a benchmark, created before timing starts. a and b are
+ * compatible for addition, product is compatible with a for multiplication,
+ * copy is equal to a, dst and transposed have the sizes of a and of its
+ * transpose. minors and cofactors are only computed for the benchmarks that
+ * use them (see prepareMinors), and inPlace, a copy of a that is transposed
+ * in place back and forth, is only created for the benchmark doing so.
+ */
+typedef struct Fixture {
+	int rows;
+	int cols;
+	Matrix* a;
+	Matrix* b;
+	Matrix* product;
+	Matrix* dst;
+	Matrix* copy;
+	Matrix* transposed;
+	Matrix* productDst;
+	Matrix* zero;
+	Matrix* identity;
+	Matrix* minors;
+	Matrix* cofactors;
+	Matrix* inPlace;
+	double* elements;
+	double** rowPointers;
+	void* storage;
+	// results are accumulated here so that no call can be optimized away
+	volatile double sink;
+} Fixture;
+
+typedef void (*BenchFunction)(Fixture* f);
+typedef double (*FlopCount)(int rows, int cols);
+
+/**
+ * A function to benchmark along with the largest size at which it is
+ * feasible to run it (more expensive functions are run at smaller sizes)
+ * and, for functions that need more than the operands every fixture has,
+ * a function preparing the fixture before timing starts
+ */
+typedef struct Benchmark {
+	const char* name;
+	BenchFunction run;
+	FlopCount flops;
+	int squareOnly;
+	int maxSize;
+	BenchFunction prepare;
+} Benchmark;
+
+static double noFlops(int rows, int cols) {
+	return 0;
+}
+
+static double elementFlops(int rows, int cols) {
+	return (double)rows * cols;
+}
+
+static double axpbyFlops(int rows, int cols) {
+	return 3.0 * rows * cols;
+}
+
+static double linearCombinationFlops(int rows, int cols) {
+	return (2.0 * BENCH_COMBINATION_TERMS - 1) * rows * cols;
+}
+
+static double multiplyFlops(int rows, int cols) {
+	return 2.0 * rows * cols * rows;
+}
+
+static double multiplyAccumulateFlops(int rows, int cols) {
+	return multiplyFlops(rows, cols) + 3.0 * rows * rows;
+}
+
+static double powerFlops(int rows, int cols) {
+	return BENCH_POWER_MULTIPLICATIONS * 2.0 * rows * rows * rows;
+}
+
+static double luFlops(int rows, int cols) {
+	return 2.0 / 3 * rows * rows * rows;
+}
+
+static double invertFlops(int rows, int cols) {
+	return 2.0 * rows * rows * rows;
+}
+
+static double minorsFlops(int rows, int cols) {
+	return 2.0 * rows * rows * rows;
+}
+
+static double adjugateInvertFlops(int rows, int cols) {
+	return minorsFlops(rows, cols) + invertFlops(rows, cols);
+}
+
+/**
+ * Computes the minors and cofactors of a, once per fixture. Computing the
+ * minors takes as long as an inversion, so above 1024 the minors are
+ * replaced by a copy of a, which takes the same time to use.
+ */
+static void prepareMinors(Fixture* f) {
+	if (f->minors) {
+		return;
+	}
+	f->minors = matrix_createMatrix(f->rows, f->cols);
+	f->cofactors = matrix_createMatrix(f->rows, f->cols);
+	if (f->rows == f->cols && f->rows <= 1024) {
+		matrix_minors(f->minors, f->a);
+	} else {
+		matrix_copyEntries(f->minors, f->a);
+	}
+	matrix_cofactors(f->cofactors, f->minors);
+}
+
+static void prepareInPlace(Fixture* f) {
+	if (!f->inPlace) {
+		f->inPlace = matrix_copyMatrix(f->a);
+	}
+}
+
+static void benchCreateMatrix(Fixture* f) {
+	matrix_destroyMatrix(matrix_createMatrix(f->rows, f->cols));
+}
+
+static void benchStorageSize(Fixture* f) {
+	f->sink += matrix_storageSize(f->rows, f->cols);
+}
+
+static void benchPlaceMatrix(Fixture* f) {
+	f->sink += matrix_placeMatrix(f->storage, f->rows, f->cols)->stride;
+}
+
+static void benchHeaderSize(Fixture* f) {
+	f->sink += matrix_headerSize(f->rows, f->cols);
+}
+
+static void benchPlaceWrappedMatrix(Fixture* f) {
+	f->sink += matrix_placeWrappedMatrix(f->storage, f->elements, f->rows, f->cols, f->cols)->stride;
+}
+
+static void benchCreateZeroMatrix(Fixture* f) {
+	matrix_destroyMatrix(matrix_createZeroMatrix(f->rows, f->cols));
+}
+
+static void benchCreateIdentityMatrix(Fixture* f) {
+	matrix_destroyMatrix(matrix_createIdentityMatrix(f->rows));
+}
+
+static void benchCreateMatrixWithElements(Fixture* f) {
+	double* e = f->elements;
+	Matrix* m;
+	if (f->rows * f->cols == 4) {
+		m = matrix_createMatrixWithElements(f->rows, f->cols, e[0], e[1], e[2], e[3]);
+	} else {
+		m = matrix_createMatrixWithElements(f->rows, f->cols,
+			e[0], e[1], e[2], e[3], e[4], e[5], e[6], e[7],
+			e[8], e[9], e[10], e[11], e[12], e[13], e[14], e[15]);
+	}
+	matrix_destroyMatrix(m);
+}
+
+static void benchCreateMatrixWithElementsFrom1D(Fixture* f) {
+	matrix_destroyMatrix(matrix_createMatrixWithElementsFrom1D(f->rows, f->cols, f->elements));
+}
+
+static void benchCreateMatrixWithElementsFrom2D(Fixture* f) {
+	matrix_destroyMatrix(matrix_createMatrixWithElementsFrom2D(f->rows, f->cols, f->rowPointers));
+}
+
+static void benchWrapMatrix(Fixture* f) {
+	matrix_destroyMatrix(matrix_wrapMatrix(f->elements, f->rows, f->cols, f->cols));
+}
+
+static void benchSubMatrix(Fixture* f) {
+	// the central block, half the size of the matrix in each direction
+	matrix_destroyMatrix(matrix_subMatrix(f->a, f->rows / 4, f->cols / 4, f->rows / 2, f->cols / 2));
+}
+
+static void benchIsContiguous(Fixture* f) {
+	f->sink += matrix_isContiguous(f->a);
+}
+
+static void benchCopyMatrix(Fixture* f) {
+	matrix_destroyMatrix(matrix_copyMatrix(f->a));
+}
+
+static void benchCopyEntries(Fixture* f) {
+	matrix_copyEntries(f->dst, f->a);
+}
+
+static void benchTranspose(Fixture* f) {
+	matrix_transpose(f->transposed, f->a);
+}
+
+static void benchTransposeInPlace(Fixture* f) {
+	f->sink += matrix_transposeInPlace(f->inPlace);
+}
+
+static void benchZeroMatrix(Fixture* f) {
+	matrix_zeroMatrix(f->dst);
+}
+
+static void benchIsZero(Fixture* f) {
+	f->sink += matrix_isZero(f->zero);
+}
+
+static void benchMakeIdentity(Fixture* f) {
+	matrix_makeIdentity(f->dst);
+}
+
+static void benchIsIdentity(Fixture* f) {
+	f->sink += matrix_isIdentity(f->identity);
+}
+
+static void benchAreEqual(Fixture* f) {
+	f->sink += matrix_areEqual(f->a, f->copy, 0);
+}
+
+static void benchIsSquare(Fixture* f) {
+	f->sink += matrix_isSquare(f->a);
+}
+
+static void benchAdd(Fixture* f) {
+	matrix_add(f->dst, f->a, f->b);
+}
+
+static void benchSubtract(Fixture* f) {
+	matrix_subtract(f->dst, f->a, f->b);
+}
+
+static void benchAxpby(Fixture* f) {
+	matrix_axpby(f->dst, 1.5, f->a, -0.5, f->b);
+}
+
+static void benchLinearCombination(Fixture* f) {
+	static const double coefficients[BENCH_COMBINATION_TERMS] = { 1.5, -0.5, 2 };
+	const Matrix* matrices[BENCH_COMBINATION_TERMS] = { f->a, f->b, f->copy };
+	matrix_linearCombination(f->dst, BENCH_COMBINATION_TERMS, coefficients, matrices);
+}
+
+static void benchMultiplyScalar(Fixture* f) {
+	matrix_multiplyScalar(f->dst, f->a, 1.5);
+}
+
+static void benchMultiplyMatrix(Fixture* f) {
+	matrix_multiplyMatrix(f->productDst, f->a, f->product);
+}
+
+static void benchMultiplyAccumulate(Fixture* f) {
+	// a beta below 1 keeps the accumulated product bounded over the iterations
+	matrix_multiplyAccumulate(f->productDst, 1.5, f->a, f->product, 0.5);
+}
+
+static void benchPower(Fixture* f) {
+	f->sink += matrix_power(f->dst, f->a, BENCH_POWER);
+}
+
+static void benchMinors(Fixture* f) {
+	matrix_minors(f->minors, f->a);
+}
+
+static void benchCofactors(Fixture* f) {
+	matrix_cofactors(f->cofactors, f->minors);
+}
+
+static void benchAdjugate(Fixture* f) {
+	matrix_adjugate(f->dst, f->a);
+}
+
+static void benchDeterminant(Fixture* f) {
+	f->sink += matrix_determinant(f->a, NULL);
+}
+
+static void benchDeterminantFromCofactors(Fixture* f) {
+	f->sink += matrix_determinant(f->a, f->cofactors);
+}
+
+static void benchInvert(Fixture* f) {
+	f->sink += matrix_invert(f->dst, f->a, NULL, NULL);
+}
+
+static void benchInvertWithAdjugate(Fixture* f) {
+	f->sink += matrix_invert(f->dst, f->a, f->minors, f->cofactors);
+}
+
+static const Benchmark benchmarks[] = {
+	{ "createMatrix", benchCreateMatrix, noFlops, 0, 4096 },
+	{ "storageSize", benchStorageSize, noFlops, 0, 4096 },
+	{ "placeMatrix", benchPlaceMatrix, noFlops, 0, 4096 },
+	{ "headerSize", benchHeaderSize, noFlops, 0, 4096 },
+	{ "placeWrappedMatrix", benchPlaceWrappedMatrix, noFlops, 0, 4096 },
+	{ "createZeroMatrix", benchCreateZeroMatrix, noFlops, 0, 4096 },
+	{ "createIdentityMatrix", benchCreateIdentityMatrix, noFlops, 1, 4096 },
+	{ "createMatrixWithElements", benchCreateMatrixWithElements, noFlops, 0, 4 },
+	{ "createMatrixWithElementsFrom1D", benchCreateMatrixWithElementsFrom1D, noFlops, 0, 4096 },
+	{ "createMatrixWithElementsFrom2D", benchCreateMatrixWithElementsFrom2D, noFlops, 0, 4096 },
+	{ "wrapMatrix", benchWrapMatrix, noFlops, 0, 4096 },
+	{ "subMatrix", benchSubMatrix, noFlops, 0, 4096 },
+	{ "isContiguous", benchIsContiguous, noFlops, 0, 4096 },
+	{ "copyMatrix", benchCopyMatrix, noFlops, 0, 4096 },
+	{ "copyEntries", benchCopyEntries, noFlops, 0, 4096 },
+	{ "transpose", benchTranspose, noFlops, 0, 4096 },
+	{ "transposeInPlace", benchTransposeInPlace, noFlops, 0, 4096, prepareInPlace },
+	{ "zeroMatrix", benchZeroMatrix, noFlops, 0, 4096 },
+	{ "isZero", benchIsZero, noFlops, 0, 4096 },
+	{ "makeIdentity", benchMakeIdentity, noFlops, 1, 4096 },
+	{ "isIdentity", benchIsIdentity, noFlops, 1, 4096 },
+	{ "areEqual", benchAreEqual, noFlops, 0, 4096 },
+	{ "isSquare", benchIsSquare, noFlops, 0, 4096 },
+	{ "add", benchAdd, elementFlops, 0, 4096 },
+	{ "subtract", benchSubtract, elementFlops, 0, 4096 },
+	{ "axpby", benchAxpby, axpbyFlops, 0, 4096 },
+	{ "linearCombination", benchLinearCombination, linearCombinationFlops, 0, 4096 },
+	{ "multiplyScalar", benchMultiplyScalar, elementFlops, 0, 4096 },
+	{ "multiplyMatrix", benchMultiplyMatrix, multiplyFlops, 0, 4096 },
+	{ "multiplyAccumulate", benchMultiplyAccumulate, multiplyAccumulateFlops, 0, 4096 },
+	{ "power", benchPower, powerFlops, 1, 2048 },
+	{ "minors", benchMinors, minorsFlops, 1, 1024, prepareMinors },
+	{ "cofactors", benchCofactors, noFlops, 0, 4096, prepareMinors },
+	{ "adjugate", benchAdjugate, minorsFlops, 1, 1024 },
+	{ "determinant", benchDeterminant, luFlops, 1, 2048 },
+	{ "determinantFromCofactors", benchDeterminantFromCofactors, noFlops, 1, 4096, prepareMinors },
+	{ "invert", benchInvert, invertFlops, 1, 1024 },
+	{ "invertWithAdjugate", benchInvertWithAdjugate, adjugateInvertFlops, 1, 1024, prepareMinors }
+};
+
+static unsigned int seed = 1;
+
+static double randomEntry() {
+	seed = seed * 1103515245 + 12345;
+	return (double)((seed >> 8) & 0xffff) / 0x8000 - 1;
+}
+
+static void fillRandom(Matrix* m) {
+	for (int r = 0; r < m->rows; r++) {
+		for (int c = 0; c < m->cols; c++) {
+			m->matrix[r][c] = randomEntry();
+		}
+	}
+	// diagonal dominance keeps square operands well conditioned
+	int diag = m->rows < m->cols ? m->rows : m->cols;
+	for (int i = 0; i < diag; i++) {
+		m->matrix[i][i] += m->cols;
+	}
+}
+
+static void createFixture(Fixture* f, int rows, int cols) {
+	f->rows = rows;
+	f->cols = cols;
+	f->a = matrix_createMatrix(rows, cols);
+	f->b = matrix_createMatrix(rows, cols);
+	f->product = matrix_createMatrix(cols, rows);
+	fillRandom(f->a);
+	fillRandom(f->b);
+	fillRandom(f->product);
+	f->dst = matrix_copyMatrix(f->a);
+	f->copy = matrix_copyMatrix(f->a);
+	f->transposed = matrix_createMatrix(cols, rows);
+	// multiplyAccumulate reads the destination, so it starts out defined
+	f->productDst = matrix_createZeroMatrix(rows, rows);
+	f->zero = matrix_createZeroMatrix(rows, cols);
+	f->identity = rows == cols ? matrix_createIdentityMatrix(rows) : NULL;
+	f->minors = NULL;
+	f->cofactors = NULL;
+	f->inPlace = NULL;
+	f->elements = malloc((size_t)rows * cols * sizeof(double));
+	f->rowPointers = malloc(rows * sizeof(double*));
+	for (int r = 0; r < rows; r++) {
+		f->rowPointers[r] = f->a->matrix[r];
+		memcpy(f->elements + (size_t)r * cols, f->a->matrix[r], cols * sizeof(double));
+	}
+	f->storage = aligned_alloc(MATRIX_ALIGNMENT, MATRIX_ALIGN(matrix_storageSize(rows, cols)));
+	f->sink = 0;
+}
+
+static void destroyFixture(Fixture* f) {
+	matrix_destroyMatrix(f->a);
+	matrix_destroyMatrix(f->b);
+	matrix_destroyMatrix(f->product);
+	matrix_destroyMatrix(f->dst);
+	matrix_destroyMatrix(f->copy);
+	matrix_destroyMatrix(f->transposed);
+	matrix_destroyMatrix(f->productDst);
+	matrix_destroyMatrix(f->zero);
+	if (f->identity) {
+		matrix_destroyMatrix(f->identity);
+	}
+	if (f->minors) {
+		matrix_destroyMatrix(f->minors);
+		matrix_destroyMatrix(f->cofactors);
+	}
+	if (f->inPlace) {
+		matrix_destroyMatrix(f->inPlace);
+	}
+	free(f->elements);
+	free(f->rowPointers);
+	free(f->storage);
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Measurements of one function at one size
+ */
+typedef struct Result {
+	const char* name;
+	Shape shape;
+	int rows;
+	int cols;
+	long iterations;
+	double nsPerOp;
+	double gflops;
+	double bytesPerOp;
+	double allocationsPerOp;
+} Result;
+
+/**
+ * Times a function, doubling the number of iterations until a run takes at
+ * least the given time. The function is called once beforehand so that
+ * one-time setup (e.g. scratch arenas) isn't attributed to it.
+ */
+static Result measure(const Benchmark* bench, Fixture* f, Shape shape, double minTime) {
+	bench->run(f);
+	long iterations = 1;
+	double elapsed;
+	size_t bytes, count;
+	while (1) {
+		size_t bytesBefore = atomic_load(&allocatedBytes);
+		size_t countBefore = atomic_load(&allocationCount);
+		double start = now();
+		for (long i = 0; i < iterations; i++) {
+			bench->run(f);
+		}
+		elapsed = now() - start;
+		bytes = atomic_load(&allocatedBytes) - bytesBefore;
+		count = atomic_load(&allocationCount) - countBefore;
+		if (elapsed >= minTime) {
+			break;
+		}
+		// aim directly for the target once a run is long enough to extrapolate from
+		long next = iterations * 2;
+		if (elapsed > minTime / 100) {
+			next = (long)(iterations * minTime * 1.2 / elapsed) + 1;
+		}
+		iterations = next;
+	}
+	Result res;
+	res.name = bench->name;
+	res.shape = shape;
+	res.rows = f->rows;
+	res.cols = f->cols;
+	res.iterations = iterations;
+	res.nsPerOp = elapsed * 1e9 / iterations;
+	double flops = bench->flops(f->rows, f->cols);
+	res.gflops = flops > 0 ? flops / res.nsPerOp : 0;
+	res.bytesPerOp = (double)bytes / iterations;
+	res.allocationsPerOp = (double)count / iterations;
+	return res;
+}
+
+static void printHeader(Format format, int threads) {
+	switch (format) {
+		case TEXT:
+			printf("libmatrix benchmark, %d thread%s\n\n", threads, threads == 1 ? "" : "s");
+			printf("%-32s %-6s %11s %14s %10s %14s %10s\n",
+				"function", "shape", "size", "ns/op", "GFLOP/s", "bytes/op", "allocs/op");
+			break;
+		case CSV:
+			printf("function,shape,rows,cols,threads,iterations,ns_per_op,gflops,bytes_per_op,allocs_per_op\n");
+			break;
+		case JSON:
+			printf("{\n\t\"threads\": %d,\n\t\"results\": [", threads);
+			break;
+	}
+}
+
+static void printResult(Format format, const Result* res, int threads, int first) {
+	switch (format) {
+		case TEXT:
+		{
+			char size[32];
+			char gflops[32] = "-";
+			snprintf(size, sizeof(size), "%dx%d", res->rows, res->cols);
+			if (res->gflops > 0) {
+				snprintf(gflops, sizeof(gflops), "%.3f", res->gflops);
+			}
+			printf("%-32s %-6s %11s %14.1f %10s %14.0f %10.2f\n",
+				res->name, shapeNames[res->shape], size, res->nsPerOp, gflops,
+				res->bytesPerOp, res->allocationsPerOp);
+			break;
+		}
+		case CSV:
+			printf("%s,%s,%d,%d,%d,%ld,%.1f,", res->name, shapeNames[res->shape],
+				res->rows, res->cols, threads, res->iterations, res->nsPerOp);
+			if (res->gflops > 0) {
+				printf("%.4f", res->gflops);
+			}
+			printf(",%.0f,%.2f\n", res->bytesPerOp, res->allocationsPerOp);
+			break;
+		case JSON:
+			printf("%s\n\t\t{ \"function\": \"%s\", \"shape\": \"%s\", \"rows\": %d, \"cols\": %d, "
+				"\"iterations\": %ld, \"ns_per_op\": %.1f, ",
+				first ? "" : ",", res->name, shapeNames[res->shape],
+				res->rows, res->cols, res->iterations, res->nsPerOp);
+			if (res->gflops > 0) {
+				printf("\"gflops\": %.4f, ", res->gflops);
+			} else {
+				printf("\"gflops\": null, ");
+			}
+			printf("\"bytes_per_op\": %.0f, \"allocs_per_op\": %.2f }", res->bytesPerOp, res->allocationsPerOp);
+			break;
+	}
+	fflush(stdout);
+}
+
+static void printFooter(Format format) {
+	if (format == JSON) {
+		printf("\n\t]\n}\n");
+	}
+}
+
+static void usage(const char* prog) {
+	fprintf(stderr, "Usage: %s [options]\n\
+Options:\n\
+  --format=text|csv|json  Output format (default text)\n\
+  --min-size=N            Smallest size to run (default 2)\n\
+  --max-size=N            Largest size to run (default 4096)\n\
+  --shape=square|tall|wide  Only run the given shape (default all)\n\
+  --filter=NAME           Only run functions whose name contains NAME\n\
+  --min-time=SECONDS      Minimum measured time per result (default 0.05)\n\
+  --threads=N             Worker thread count, 0 for one per processor (default 1)\n\n\
+Sizes are powers of two. Tall and wide matrices are N x N/4 and N/4 x N.\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+	Format format = TEXT;
+	int minSize = 2;
+	int maxSize = 4096;
+	int onlyShape = -1;
+	const char* filter = NULL;
+	double minTime = 0.05;
+	int threads = 1;
+
+	for (int i = 1; i < argc; i++) {
+		char* arg = argv[i];
+		if (!strncmp(arg, "--format=", 9)) {
+			if (!strcmp(arg + 9, "text")) {
+				format = TEXT;
+			} else if (!strcmp(arg + 9, "csv")) {
+				format = CSV;
+			} else if (!strcmp(arg + 9, "json")) {
+				format = JSON;
+			} else {
+				usage(argv[0]);
+				return 1;
+			}
+		} else if (!strncmp(arg, "--min-size=", 11)) {
+			minSize = (int)strtol(arg + 11, NULL, 0);
+		} else if (!strncmp(arg, "--max-size=", 11)) {
+			maxSize = (int)strtol(arg + 11, NULL, 0);
+		} else if (!strncmp(arg, "--shape=", 8)) {
+			for (int s = SQUARE; s <= WIDE; s++) {
+				if (!strcmp(arg + 8, shapeNames[s])) {
+					onlyShape = s;
+				}
+			}
+			if (onlyShape < 0) {
+				usage(argv[0]);
+				return 1;
+			}
+		} else if (!strncmp(arg, "--filter=", 9)) {
+			filter = arg + 9;
+		} else if (!strncmp(arg, "--min-time=", 11)) {
+			minTime = strtod(arg + 11, NULL);
+		} else if (!strncmp(arg, "--threads=", 10)) {
+			threads = (int)strtol(arg + 10, NULL, 0);
+		} else {
+			usage(argv[0]);
+			return !(!strcmp(arg, "--help") || !strcmp(arg, "-h"));
+		}
+	}
+
+	threads = matrix_initThreads(threads);
+	printHeader(format, threads);
+	int first = 1;
+	int benchCount = sizeof(benchmarks) / sizeof(benchmarks[0]);
+	for (int shape = SQUARE; shape <= WIDE; shape++) {
+		if (onlyShape >= 0 && shape != onlyShape) {
+			continue;
+		}
+		for (int size = 2; size <= maxSize; size *= 2) {
+			if (size < minSize || (shape != SQUARE && size < 4)) {
+				continue;
+			}
+			int rows = shape == WIDE ? size / 4 : size;
+			int cols = shape == TALL ? size / 4 : size;
+
+			// operands are shared by every function run at this size
+			int needed = 0;
+			for (int b = 0; b < benchCount; b++) {
+				const Benchmark* bench = &benchmarks[b];
+				if (size <= bench->maxSize && !(bench->squareOnly && shape != SQUARE)
+						&& (!filter || strstr(bench->name, filter))) {
+					needed = 1;
+				}
+			}
+			if (!needed) {
+				continue;
+			}
+			Fixture f;
+			createFixture(&f, rows, cols);
+			for (int b = 0; b < benchCount; b++) {
+				const Benchmark* bench = &benchmarks[b];
+				if (size > bench->maxSize || (bench->squareOnly && shape != SQUARE)
+						|| (filter && !strstr(bench->name, filter))) {
+					continue;
+				}
+				if (bench->prepare) {
+					bench->prepare(&f);
+				}
+				Result res = measure(bench, &f, shape, minTime);
+				printResult(format, &res, threads, first);
+				first = 0;
+			}
+			destroyFixture(&f);
+		}
+	}
+	printFooter(format);
+	matrix_shutdownThreads();
+	return 0;
+}
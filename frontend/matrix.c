@@ -41,6 +41,7 @@ Matrix* inputMatrix() {
 int main(int argc, char* argv[]) {
 	printf("Matrix Calculator\nAvailable under GPLv3. See LICENSE for more details.\n");
 	char cmd[200];
+	matrix_initThreads(0);
 	while (1) {
 		printf("> ");
 		fgets(cmd, sizeof(cmd), stdin);
@@ -55,14 +56,29 @@ int main(int argc, char* argv[]) {
 		} else if (!strcmp(cmd, "inverse")) {
 			Matrix* m = inputMatrix();
 			Matrix *min = matrix_createMatrix(m->rows, m->cols), *cof = matrix_createMatrix(m->rows, m->cols);
-			double det = matrix_invert(m, m, min, cof);
+			// the determinant can underflow for invertible matrices, so singularity is read off the factorization
+			LUFactorization* lu = matrix_createLUFactorization(m->rows);
+			int square = matrix_isSquare(m);
+			double det = 0;
+			if (square) {
+				matrix_minors(min, m);
+				matrix_cofactors(cof, min);
+				matrix_factorLU(lu, m);
+				det = matrix_luDeterminant(lu);
+			}
 			printf("Minors:\n");
 			printMatrix(min);
 			printf("Cofactors:\n");
 			printMatrix(cof);
-			printf("Inverse:\n");
-			printMatrix(m);
+			if (!square || lu->singular) {
+				printf("Matrix is singular\n");
+			} else {
+				matrix_luInvert(m, lu);
+				printf("Inverse:\n");
+				printMatrix(m);
+			}
 			printf("Determinant: %lf\n", det);
+			matrix_destroyLUFactorization(lu);
 			matrix_destroyMatrix(m);
 			matrix_destroyMatrix(min);
 			matrix_destroyMatrix(cof);
@@ -81,20 +97,13 @@ int main(int argc, char* argv[]) {
 			printf("Power: ");
 			scanf("%d", &power);
 			getc(stdin);
-			if (power < 2) {
-				printf("Doing nothing\n");
-				matrix_destroyMatrix(m1);
-				continue;
+			Matrix* mp = matrix_createMatrix(m1->rows, m1->cols);
+			if (matrix_power(mp, m1, power)) {
+				printMatrix(mp);
+			} else {
+				printf("Cannot raise matrix to power %d\n", power);
 			}
-			Matrix* m2 = matrix_copyMatrix(m1);
-			Matrix* mp = matrix_copyMatrix(m1);
-			for (int i = 2; i <= power; i++) {
-				matrix_multiplyMatrix(mp, m1, m2);
-				matrix_copyEntries(m1, mp);
-			}
-			printMatrix(mp);
 			matrix_destroyMatrix(m1);
-			matrix_destroyMatrix(m2);
 			matrix_destroyMatrix(mp);
 		} else if (!strcmp(cmd, "conjugate")) {
 			printf("Enter U: ");
@@ -126,5 +135,6 @@ int main(int argc, char* argv[]) {
 		}
 		memset(cmd, 0, sizeof(cmd));
 	}
+	matrix_shutdownThreads();
 	return 0;
 }
@@ -0,0 +1,155 @@
+//Copyright (C) 2019-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+// size of the cache lines the reader slots are padded to
+#define EPOCH_CACHE_LINE 64
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "epoch.h"
+
+/**
+ * Slot in which a thread announces the epoch in which it entered a guard.
+ * Slots are never freed; a slot released by a thread that exited is reused
+ * by the next thread that needs one.
+ */
+struct EpochSlot {
+	// epoch read on entering the outermost guard, 0 outside of guards
+	std::atomic<unsigned long> epoch;
+	std::atomic<bool> taken;
+	EpochSlot* next;
+	// each slot is only written by its thread, so slots don't share cache lines
+	char padding[EPOCH_CACHE_LINE];
+};
+
+/**
+ * Object waiting for the readers that may refer to it
+ */
+struct RetiredObject {
+	void* object;
+	void (*destroy)(void*);
+	// epoch during which the object became unreachable
+	unsigned long epoch;
+};
+
+// starts at 1 so that 0 can mean outside of guards
+static std::atomic<unsigned long> globalEpoch(1);
+static std::atomic<EpochSlot*> slots(nullptr);
+
+/**
+ * Objects waiting for their readers; those still waiting at exit, when no
+ * reader is left, are destroyed along with the list
+ */
+static struct RetiredList {
+	std::vector<RetiredObject> objects;
+
+	~RetiredList() {
+		for (RetiredObject& candidate : objects) {
+			candidate.destroy(candidate.object);
+		}
+	}
+} retired;
+
+static std::mutex retiredLock;
+
+/**
+ * Slot of the current thread, released when the thread exits
+ */
+struct ThreadSlot {
+	EpochSlot* slot = nullptr;
+	int depth = 0;
+
+	~ThreadSlot() {
+		if (slot) {
+			slot->taken.store(false, std::memory_order_release);
+		}
+	}
+};
+
+static thread_local ThreadSlot threadSlot;
+
+/**
+ * Finds a slot no thread is using or adds a new one
+ * @return Slot owned by the current thread
+ */
+static EpochSlot* takeSlot() {
+	for (EpochSlot* slot = slots.load(std::memory_order_acquire); slot; slot = slot->next) {
+		bool taken = false;
+		if (!slot->taken.load(std::memory_order_relaxed) &&
+			slot->taken.compare_exchange_strong(taken, true, std::memory_order_acquire)) {
+			return slot;
+		}
+	}
+	EpochSlot* slot = new EpochSlot();
+	slot->epoch.store(0, std::memory_order_relaxed);
+	slot->taken.store(true, std::memory_order_relaxed);
+	slot->next = slots.load(std::memory_order_relaxed);
+	while (!slots.compare_exchange_weak(slot->next, slot, std::memory_order_release, std::memory_order_relaxed));
+	return slot;
+}
+
+EpochGuard::EpochGuard() {
+	ThreadSlot& current = threadSlot;
+	if (current.depth++) {
+		return;
+	}
+	if (!current.slot) {
+		current.slot = takeSlot();
+	}
+	// a stale epoch only delays reclamation, so it needn't be synchronized
+	current.slot->epoch.store(globalEpoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	// the announcement is visible to writers before any shared pointer is loaded
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+EpochGuard::~EpochGuard() {
+	ThreadSlot& current = threadSlot;
+	if (!--current.depth) {
+		current.slot->epoch.store(0, std::memory_order_release);
+	}
+}
+
+void epochRetire(void* object, void (*destroy)(void*)) {
+	std::vector<RetiredObject> expired;
+	{
+		std::lock_guard<std::mutex> lock(retiredLock);
+		// readers entering after this see the new epoch and can't reach the object
+		RetiredObject entry = { object, destroy, globalEpoch.fetch_add(1, std::memory_order_seq_cst) };
+		retired.objects.push_back(entry);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		unsigned long oldest = (unsigned long)-1;
+		for (EpochSlot* slot = slots.load(std::memory_order_acquire); slot; slot = slot->next) {
+			unsigned long epoch = slot->epoch.load(std::memory_order_acquire);
+			if (epoch && epoch < oldest) {
+				oldest = epoch;
+			}
+		}
+		// objects retired before the oldest reader entered can't be referred to any more
+		size_t kept = 0;
+		for (RetiredObject& candidate : retired.objects) {
+			if (candidate.epoch < oldest) {
+				expired.push_back(candidate);
+			} else {
+				retired.objects[kept++] = candidate;
+			}
+		}
+		retired.objects.resize(kept);
+	}
+	// destroying large matrices takes a while, so it happens outside the lock
+	for (RetiredObject& candidate : expired) {
+		candidate.destroy(candidate.object);
+	}
+}
@@ -0,0 +1,48 @@
+//Copyright (C) 2019-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/**
+ * Epoch-based reclamation of objects shared through atomic pointers.
+ * Readers dereference such pointers inside an EpochGuard, which only writes
+ * to a slot owned by the current thread. Writers replace a pointer and
+ * retire the object it pointed to; the object is destroyed once every
+ * reader that could have loaded the old pointer has left its guard.
+ */
+
+/**
+ * Read-side critical section. Objects loaded from atomic pointers while a
+ * guard exists stay valid until it is destroyed. Guards can be nested.
+ */
+class EpochGuard {
+public:
+	EpochGuard();
+	~EpochGuard();
+
+	EpochGuard(const EpochGuard&) = delete;
+	EpochGuard& operator=(const EpochGuard&) = delete;
+};
+
+/**
+ * Schedules an object for destruction once no reader can refer to it. The
+ * object must already be unreachable for readers that start after the call.
+ * Objects whose readers have all left are destroyed before returning.
+ * @param object Object to destroy
+ * @param destroy Function that destroys the object
+ */
+void epochRetire(void* object, void (*destroy)(void*));
+
+#endif
@@ -0,0 +1,64 @@
+//Copyright (C) 2019-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef EVALUATOR_H
+#define EVALUATOR_H
+
+#include <stdio.h>
+
+#include "libmatrix.h"
+
+/**
+ * State of one statement stream: where its output goes, where entered
+ * matrices are read from and the temporaries of the expression being
+ * evaluated. Every function that evaluates statements takes the evaluator
+ * it works for, so any number of evaluators can run on different threads;
+ * the only state they share is the matrix memory.
+ */
+struct Evaluator {
+	// temporaries created while evaluating an expression; reset after each statement
+	MatrixArena* arena;
+	// whether the expression being evaluated failed
+	int failed = 0;
+	// where results are printed (NULL discards them), where other messages are
+	// printed and where entered matrices are read from
+	FILE* resultStream = stdout;
+	FILE* messageStream = stdout;
+	FILE* inputStream = stdin;
+	// whether to prompt for input
+	int interactive = 1;
+	// whether expressions are read in infix rather than postfix notation
+	int infixMode = 1;
+
+	Evaluator() {
+		arena = matrix_createArena(MATRIX_ARENA_DEFAULT_CAPACITY);
+	}
+
+	~Evaluator() {
+		matrix_destroyArena(arena);
+	}
+
+	Evaluator(const Evaluator&) = delete;
+	Evaluator& operator=(const Evaluator&) = delete;
+};
+
+/**
+ * Runs a line of input, which is either a command or an expression
+ * @param ev Evaluator running the line
+ * @param input Line to run, without its terminator
+ * @return 1 if the line ran successfully, 0 if it failed, -1 if it asks to exit
+ */
+int runStatement(Evaluator& ev, char* input);
+
+#endif
@@ -12,22 +12,31 @@
 //You should have received a copy of the GNU General Public License
 //along with this program. If not, see <http://www.gnu.org/licenses/>.
 
-#ifdef THREADSAFE
-#define PARSE_TOKEN(expr, ptr) strtok_r(expr, " ", ptr)
-#else
-#define PARSE_TOKEN(expr, ptr) strtok(expr, " ")
-#endif
-
 #define MATRIX_MEMORY_SIZE 50
 
+// matrices with fewer entries are always stored densely
+#define SPARSE_MIN_ENTRIES 1024
+// largest fraction of nonzero entries for which matrices are stored in sparse format
+#define SPARSE_MAX_DENSITY 0.1
+
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <float.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <limits>
+#include <mutex>
+#include <type_traits>
+#include <vector>
 
 #include "exprfix.h"
 #include "libmatrix.h"
 
 #include "memory.h"
+#include "evaluator.h"
+#include "server.h"
 
 int isUn(char* str) {
 	char c = str[0];
@@ -36,7 +45,7 @@ int isUn(char* str) {
 
 int isBin(char* str) {
 	char c = str[0];
-	return c == '+' || c == '-' || c == '*' || c == '.' || c == '^' || c == '=';
+	return c == '+' || c == '-' || c == '*' || c == '.' || c == '^' || c == '=' || c == '\\';
 }
 
 void getOpProps(char* str, int* prec, int* left) {
@@ -53,6 +62,10 @@ void getOpProps(char* str, int* prec, int* left) {
 			*prec = 20;
 			*left = 1;
 			break;
+		case '\\':
+			*prec = 20;
+			*left = 1;
+			break;
 		case '^':
 			*prec = 30;
 			*left = 0;
@@ -80,107 +93,540 @@ int isValidMatrixName(char* name) {
 	return 0;
 }
 
-void printMatrix(Matrix* m) {
+void printMatrix(FILE* out, const Matrix* m) {
+	// each row is formatted into a buffer and written at once
+	size_t capacity = 64 * (size_t)m->cols + 2;
+	char* line = (char*)malloc(capacity);
 	for (int r = 0; r < m->rows; r++) {
+		size_t length = 0;
 		for (int c = 0; c < m->cols; c++) {
-			printf("%lf ", m->matrix[r][c]);
+			int written = snprintf(line + length, capacity - length, "%lf ", m->matrix[r][c]);
+			// entries of huge magnitude don't fit in the usual width
+			if (length + written >= capacity) {
+				capacity = 2 * (length + written) + 2;
+				line = (char*)realloc(line, capacity);
+				written = snprintf(line + length, capacity - length, "%lf ", m->matrix[r][c]);
+			}
+			length += written;
 		}
-		printf("\n");
+		line[length++] = '\n';
+		fwrite(line, 1, length, out);
 	}
+	free(line);
 }
 
-Matrix* inputMatrix() {
+/**
+ * Creates an uninitialized temporary matrix for the current expression
+ * @param ev Evaluator of the expression
+ * @param rows Desired number of rows in the matrix
+ * @param cols Desired number of columns in the matrix
+ * @return Handle to a matrix allocated from the evaluation arena
+ */
+MatrixHandle tempMatrix(Evaluator& ev, int rows, int cols) {
+	return MatrixHandle::borrowed(matrix_arenaMatrix(ev.arena, rows, cols));
+}
+
+Matrix* inputMatrix(Evaluator& ev) {
 	int rows, cols;
-	printf("Row, Col: ");
-	scanf("%d %d", &rows, &cols);
+	if (ev.interactive) {
+		fprintf(ev.messageStream, "Row, Col: ");
+	}
+	if (fscanf(ev.inputStream, "%d %d", &rows, &cols) != 2 || rows < 0 || cols < 0) {
+		return NULL;
+	}
 	Matrix* m = matrix_createMatrix(rows, cols);
 	for (int r = 0; r < rows; r++) {
 		for (int c = 0; c < cols; c++) {
-			scanf("%lf", &(m->matrix[r][c]));
+			if (fscanf(ev.inputStream, "%lf", &(m->matrix[r][c])) != 1) {
+				matrix_destroyMatrix(m);
+				return NULL;
+			}
 		}
 	}
-	getc(stdin);
+	// skip the rest of the line holding the last entry
+	int c;
+	while ((c = getc(ev.inputStream)) != EOF && c != '\n');
 	return m;
 }
 
-int evalFailed = 0;
+/**
+ * Chooses how to store a matrix in memory: mostly zero matrices are stored
+ * in sparse format and sparse matrices that filled in are expanded
+ * @param ev Evaluator of the expression
+ * @param m Matrix to store
+ * @return Handle to the matrix in the chosen format
+ */
+MatrixHandle storageFor(Evaluator& ev, const MatrixHandle& m) {
+	// only double precision matrices have a sparse format
+	if (m.isTyped()) {
+		return m;
+	}
+	if ((double)m.rows() * m.cols() < SPARSE_MIN_ENTRIES) {
+		return m.dense(ev.arena);
+	}
+	if (m.isSparse()) {
+		return matrix_sparseDensity(m.sparse()) > SPARSE_MAX_DENSITY ? m.dense(ev.arena) : m;
+	}
+	double nnz = 0;
+	for (int r = 0; r < m->rows; r++) {
+		for (int c = 0; c < m->cols; c++) {
+			nnz += m->matrix[r][c] != 0;
+		}
+	}
+	if (nnz > SPARSE_MAX_DENSITY * m->rows * m->cols) {
+		return m;
+	}
+	return MatrixHandle::ownedSparse(matrix_sparseFromDense(m.get(), MATRIX_CSR, 0));
+}
+
+/**
+ * Cases of typedArithmetic for an element type
+ * @param S Suffix of the element type
+ * @param T Element type
+ */
+#define TYPED_ARITHMETIC(S, T) \
+	case Precision::S: \
+	{ \
+		const Matrix##S* a = left.typed<Matrix##S>(); \
+		const Matrix##S* b = right.typed<Matrix##S>(); \
+		Matrix##S* res; \
+		switch (op) { \
+			case '*': \
+				res = matrix_createMatrix##S(a->rows, b->cols); \
+				matrix_multiplyMatrix##S(res, a, b); \
+				break; \
+			case '+': \
+			case '-': \
+				res = matrix_createMatrix##S(a->rows, a->cols); \
+				if (op == '-') { \
+					matrix_multiplyScalar##S(res, b, (T)-1); \
+					matrix_add##S(res, a, res); \
+				} else { \
+					matrix_add##S(res, a, b); \
+				} \
+				break; \
+			case '.': \
+				/* integer matrices are only scaled by integers they can represent */ \
+				if (!(scalar >= (double)std::numeric_limits<T>::lowest() && \
+					scalar < -(double)std::numeric_limits<T>::lowest()) || \
+					(std::is_integral<T>::value && (double)(T)scalar != scalar)) { \
+					return MatrixHandle(); \
+				} \
+				res = matrix_createMatrix##S(a->rows, a->cols); \
+				matrix_multiplyScalar##S(res, a, (T)scalar); \
+				break; \
+			case 't': \
+			default: \
+				res = matrix_createMatrix##S(a->cols, a->rows); \
+				matrix_transpose##S(res, a); \
+				break; \
+		} \
+		return MatrixHandle::ownedTyped(Precision::S, res); \
+	}
 
-Matrix* eval(char* expr, char** progress) {
-	evalFailed = 0;
-	Matrix* res = 0;
-	char* saveptr;
-	#ifdef THREADSAFE
-	if (progress) {
-		saveptr = *progress;
+/**
+ * Evaluates an operator with the kernels of its operands' element type
+ * @param op '+', '-' or '*' to combine the operands, '.' to scale left or 't' to transpose left
+ * @param left Left (or only) operand
+ * @param right Right operand (same as left for operators with one operand)
+ * @param scalar Scale applied by '.'
+ * @return Handle to the result, or an empty handle if the operands don't share an element type other than double
+ */
+MatrixHandle typedArithmetic(char op, const MatrixHandle& left, const MatrixHandle& right, double scalar) {
+	if (!left.isTyped() || right.precision() != left.precision()) {
+		return MatrixHandle();
+	}
+	switch (left.precision()) {
+		MATRIX_ELEMENT_TYPES(TYPED_ARITHMETIC)
+		default:
+			return MatrixHandle();
+	}
+}
+
+/**
+ * Computes the determinant of a matrix of another element type with that
+ * type's kernel, or inverts a single precision matrix in single precision
+ * @param ev Evaluator of the expression
+ * @param op 'd' for the determinant or 'i' for the inverse
+ * @param m Operand
+ * @return Handle to the result, or an empty handle if the operand has no such kernel or the operation failed (setting ev.failed)
+ */
+MatrixHandle typedDeterminantOrInverse(Evaluator& ev, char op, const MatrixHandle& m) {
+	if (!m.isTyped()) {
+		return MatrixHandle();
+	}
+	if (op == 'd') {
+		MatrixHandle res = tempMatrix(ev, 1, 1);
+		double* det = &res.mutate(ev.arena)->matrix[0][0];
+		switch (m.precision()) {
+			case Precision::F:
+				*det = matrix_determinantF(m.typed<MatrixF>());
+				break;
+			// integer determinants are exact as long as they fit in 64 bits
+			case Precision::I32:
+				*det = (double)matrix_determinantI32(m.typed<MatrixI32>());
+				break;
+			case Precision::I64:
+				*det = (double)matrix_determinantI64(m.typed<MatrixI64>());
+				break;
+			case Precision::Double:
+				break;
+		}
+		return res;
+	}
+	if (m.precision() != Precision::F) {
+		return MatrixHandle();
+	}
+	if (m.rows() != m.cols()) {
+		fprintf(ev.messageStream, "Cannot invert a non-square matrix\n");
+		ev.failed = 1;
+		return MatrixHandle();
+	}
+	MatrixF* inverse = matrix_createMatrixF(m.rows(), m.cols());
+	int singular;
+	matrix_invertF(inverse, m.typed<MatrixF>(), &singular);
+	if (singular) {
+		matrix_destroyMatrixF(inverse);
+		fprintf(ev.messageStream, "Matrix is singular\n");
+		ev.failed = 1;
+		return MatrixHandle();
+	}
+	return MatrixHandle::ownedTyped(Precision::F, inverse);
+}
+
+/**
+ * Value of an expression whose last step may still be pending, so that the
+ * operator using it can fold that step into a fused kernel. The value is the
+ * linear combination of matrices with coefficients, or, if factor is set,
+ * coefficients[0] * matrices[0] * factor. Combinations of more than one
+ * matrix and products only hold dense double precision matrices.
+ */
+struct Term {
+	std::vector<double> coefficients;
+	std::vector<MatrixHandle> matrices;
+	MatrixHandle factor;
+
+	Term() {}
+
+	Term(MatrixHandle m, double coefficient = 1) {
+		if (m) {
+			coefficients.push_back(coefficient);
+			matrices.push_back(std::move(m));
+		}
+	}
+
+	explicit operator bool() const {
+		return !matrices.empty();
+	}
+
+	int rows() const {
+		return matrices[0].rows();
+	}
+
+	int cols() const {
+		return factor ? factor.cols() : matrices[0].cols();
+	}
+};
+
+bool isDenseDouble(const MatrixHandle& m) {
+	return !m.isSparse() && !m.isTyped();
+}
+
+/**
+ * Carries out the pending step of a term
+ * @param ev Evaluator of the expression
+ * @param term Term to evaluate
+ * @return Handle to the value of the term
+ */
+MatrixHandle materialize(Evaluator& ev, Term term) {
+	if (!term) {
+		return MatrixHandle();
+	}
+	const std::vector<double>& coefficients = term.coefficients;
+	MatrixHandle res;
+	if (term.factor) {
+		res = tempMatrix(ev, term.rows(), term.cols());
+		matrix_multiplyAccumulate(res.mutate(ev.arena), coefficients[0], term.matrices[0].get(), term.factor.get(), 0);
+		return res;
+	}
+	if (term.matrices.size() == 1) {
+		res = std::move(term.matrices[0]);
+		if (coefficients[0] == 1) {
+			return res;
+		}
+		MatrixHandle scaled = typedArithmetic('.', res, res, coefficients[0]);
+		if (scaled) {
+			return scaled;
+		}
+		res = res.withPrecision(Precision::Double, ev.arena);
+		// scale in place unless the operand is shared (e.g. a stored matrix)
+		if (res.isSparse()) {
+			matrix_sparseMultiplyScalar(res.mutateSparse(), coefficients[0]);
+		} else {
+			Matrix* m1 = res.mutate(ev.arena);
+			matrix_multiplyScalar(m1, m1, coefficients[0]);
+		}
+		return res;
+	}
+	res = tempMatrix(ev, term.rows(), term.cols());
+	Matrix* dst = res.mutate(ev.arena);
+	if (term.matrices.size() == 2) {
+		const Matrix* a = term.matrices[0].get();
+		const Matrix* b = term.matrices[1].get();
+		if (coefficients[0] == 1 && coefficients[1] == 1) {
+			matrix_add(dst, a, b);
+		} else if (coefficients[0] == 1 && coefficients[1] == -1) {
+			matrix_subtract(dst, a, b);
+		} else {
+			matrix_axpby(dst, coefficients[0], a, coefficients[1], b);
+		}
+		return res;
+	}
+	std::vector<const Matrix*> matrices;
+	for (auto& m : term.matrices) {
+		matrices.push_back(m.get());
+	}
+	matrix_linearCombination(dst, (int)matrices.size(), coefficients.data(), matrices.data());
+	return res;
+}
+
+/**
+ * Reduces a term to a single matrix with a coefficient, carrying out its
+ * pending step if it is a product or a combination of several matrices
+ * @param ev Evaluator of the expression
+ * @param term Term to reduce
+ * @return Term holding one matrix and no factor
+ */
+Term single(Evaluator& ev, Term term) {
+	if (term.factor || term.matrices.size() > 1) {
+		return Term(materialize(ev, std::move(term)));
+	}
+	return term;
+}
+
+Term evalTerm(Evaluator& ev, char* expr, char** progress);
+
+/**
+ * Reads the next token of an expression
+ * @param ev Evaluator of the expression
+ * @param saveptr Position in the expression, as used by strtok_r
+ * @return The token, or NULL (setting ev.failed) if the expression has no tokens left
+ */
+char* nextToken(Evaluator& ev, char** saveptr) {
+	char* token = strtok_r(NULL, " ", saveptr);
+	if (!token) {
+		fprintf(ev.messageStream, "Expression ended unexpectedly\n");
+		ev.failed = 1;
+	}
+	return token;
+}
+
+MatrixHandle eval(Evaluator& ev, char* expr, char** progress) {
+	return materialize(ev, evalTerm(ev, expr, progress));
+}
+
+Term evalTerm(Evaluator& ev, char* expr, char** progress) {
+	ev.failed = 0;
+	MatrixHandle res;
+	Term term;
+	// the position in the expression is passed along rather than kept by strtok, so evaluators don't share it
+	char* saveptr = progress ? *progress : NULL;
+	char* token = progress ? nextToken(ev, &saveptr) : strtok_r(expr, " ", &saveptr);
+	if (!token) {
+		ev.failed = 1;
+		return MatrixHandle();
 	}
-	#endif
-	char* token = progress ? PARSE_TOKEN(NULL, &saveptr) : PARSE_TOKEN(expr, &saveptr);
 	switch (token[0]) {
 		case '+':
 		case '-':
 		case '*':
 		{
-			Matrix* left = eval(expr, &saveptr);
-			if (evalFailed) return NULL;
+			Term left = evalTerm(ev, expr, &saveptr);
+			if (ev.failed) return MatrixHandle();
 
-			Matrix* right = eval(expr, &saveptr);
-			if (evalFailed) {
-				matrix_destroyMatrix(left);
-				return NULL;
+			Term right = evalTerm(ev, expr, &saveptr);
+			if (ev.failed) return MatrixHandle();
+
+			if (token[0] == '*') {
+				if (left.cols() != right.rows()) {
+					fprintf(ev.messageStream, "Cannot multiply a %d x %d matrix by a %d x %d matrix\n",
+						left.rows(), left.cols(), right.rows(), right.cols());
+					ev.failed = 1;
+					return MatrixHandle();
+				}
+				left = single(ev, std::move(left));
+				right = single(ev, std::move(right));
+				MatrixHandle a = std::move(left.matrices[0]);
+				MatrixHandle b = std::move(right.matrices[0]);
+				double coefficient = left.coefficients[0] * right.coefficients[0];
+				if (a.isTyped() && b.precision() == a.precision()) {
+					a = materialize(ev, Term(a, left.coefficients[0]));
+					b = materialize(ev, Term(b, right.coefficients[0]));
+					if ((res = typedArithmetic('*', a, b, 0))) {
+						break;
+					}
+					coefficient = 1;
+				}
+				// operands of different element types are multiplied in double precision
+				a = a.withPrecision(Precision::Double, ev.arena);
+				b = b.withPrecision(Precision::Double, ev.arena);
+				if (isDenseDouble(a) && isDenseDouble(b)) {
+					// the product is computed by whichever kernel consumes it
+					term = Term(std::move(a), coefficient);
+					term.factor = std::move(b);
+					break;
+				}
+				if (a.isSparse() && b.isSparse()) {
+					res = MatrixHandle::ownedSparse(matrix_sparseMultiply(a.sparse(), b.sparse()));
+				} else {
+					res = tempMatrix(ev, a.rows(), b.cols());
+					if (a.isSparse()) {
+						matrix_sparseMultiplyDense(res.mutate(ev.arena), a.sparse(), b.get());
+					} else {
+						matrix_denseMultiplySparse(res.mutate(ev.arena), a.get(), b.sparse());
+					}
+				}
+				term = Term(std::move(res), coefficient);
+				break;
 			}
 
-			if (token[0] == '-') {
-				matrix_multiplyScalar(right, right, -1);
+			if (left.rows() != right.rows() || left.cols() != right.cols()) {
+				fprintf(ev.messageStream, "Cannot add a %d x %d matrix to a %d x %d matrix\n",
+					right.rows(), right.cols(), left.rows(), left.cols());
+				ev.failed = 1;
+				return MatrixHandle();
+			}
+			double sign = token[0] == '-' ? -1 : 1;
+			if (left.factor && right.factor) {
+				right = Term(materialize(ev, std::move(right)));
+			}
+			if (left.factor || right.factor) {
+				// the other operand is copied (unless it is a temporary) and the product accumulated into it
+				bool leftProduct = (bool)left.factor;
+				Term& product = leftProduct ? left : right;
+				Term other = single(ev, std::move(leftProduct ? right : left));
+				res = other.matrices[0].dense(ev.arena);
+				other.matrices[0] = MatrixHandle();
+				matrix_multiplyAccumulate(res.mutate(ev.arena), product.coefficients[0] * (leftProduct ? 1 : sign),
+					product.matrices[0].get(), product.factor.get(), other.coefficients[0] * (leftProduct ? sign : 1));
+				break;
+			}
+			bool dense = true;
+			for (auto& m : left.matrices) {
+				dense = dense && isDenseDouble(m);
+			}
+			for (auto& m : right.matrices) {
+				dense = dense && isDenseDouble(m);
+			}
+			if (dense) {
+				// sums of dense matrices are computed in one pass by whichever operator consumes them
+				term = std::move(left);
+				for (size_t i = 0; i < right.matrices.size(); i++) {
+					term.coefficients.push_back(sign * right.coefficients[i]);
+					term.matrices.push_back(std::move(right.matrices[i]));
+				}
+				break;
 			}
 
-			res = matrix_createMatrix(left->rows, right->cols);
-			if (token[0] == '*') {
-				matrix_multiplyMatrix(res, left, right);
+			left = single(ev, std::move(left));
+			right = single(ev, std::move(right));
+			MatrixHandle a = std::move(left.matrices[0]);
+			MatrixHandle b = std::move(right.matrices[0]);
+			double alpha = left.coefficients[0], beta = sign * right.coefficients[0];
+			if (a.isTyped() && b.precision() == a.precision()) {
+				a = materialize(ev, Term(a, left.coefficients[0]));
+				b = materialize(ev, Term(b, right.coefficients[0]));
+				if ((res = typedArithmetic(token[0], a, b, 0))) {
+					break;
+				}
+				alpha = 1;
+				beta = sign;
+			}
+			a = a.withPrecision(Precision::Double, ev.arena);
+			b = b.withPrecision(Precision::Double, ev.arena);
+			if (a.isSparse() && b.isSparse()) {
+				res = MatrixHandle::ownedSparse(matrix_sparseAdd(alpha, a.sparse(), beta, b.sparse()));
+			} else if (a.isSparse()) {
+				// accumulate the sparse operand into (a copy of) the dense one
+				res = std::move(b);
+				Matrix* sum = res.mutate(ev.arena);
+				if (beta != 1) {
+					matrix_multiplyScalar(sum, sum, beta);
+				}
+				matrix_sparseAddToDense(sum, alpha, a.sparse());
+			} else if (b.isSparse()) {
+				res = std::move(a);
+				Matrix* sum = res.mutate(ev.arena);
+				if (alpha != 1) {
+					matrix_multiplyScalar(sum, sum, alpha);
+				}
+				matrix_sparseAddToDense(sum, beta, b.sparse());
 			} else {
-				matrix_add(res, left, right);
+				res = tempMatrix(ev, a.rows(), a.cols());
+				matrix_axpby(res.mutate(ev.arena), alpha, a.get(), beta, b.get());
 			}
-
-			matrix_destroyMatrix(left);
-			matrix_destroyMatrix(right);
 			break;
 		}
 		case '.':
 		{
-			token = PARSE_TOKEN(NULL, &saveptr);
+			token = nextToken(ev, &saveptr);
+			if (!token) return MatrixHandle();
 			double scalar = (double)strtod(token, (char**)NULL);
 
-			Matrix* m1 = eval(expr, &saveptr);
-			if (evalFailed) return NULL;
+			term = evalTerm(ev, expr, &saveptr);
+			if (ev.failed) return MatrixHandle();
 
-			res = matrix_createMatrix(m1->rows, m1->cols);
-			matrix_multiplyScalar(res, m1, scalar);
-			matrix_destroyMatrix(m1);
+			// the scale is applied by whichever kernel consumes the term
+			for (double& coefficient : term.coefficients) {
+				coefficient *= scalar;
+			}
+			break;
+		}
+		case '\\':
+		{
+			MatrixHandle a = eval(ev, expr, &saveptr);
+			if (ev.failed) return MatrixHandle();
+
+			MatrixHandle b = eval(ev, expr, &saveptr);
+			if (ev.failed) return MatrixHandle();
+			a = a.dense(ev.arena);
+			b = b.dense(ev.arena);
+
+			if (!matrix_isSquare(a.get()) || a->rows != b->rows) {
+				fprintf(ev.messageStream, "Cannot solve a system with a %d x %d matrix and a %d x %d right hand side\n",
+					a->rows, a->cols, b->rows, b->cols);
+				ev.failed = 1;
+				return MatrixHandle();
+			}
+			// the system is solved through the factorization, never forming the inverse
+			LUFactorization* lu = matrix_arenaLUFactorization(ev.arena, a->rows);
+			if (!matrix_factorLU(lu, a.get())) {
+				fprintf(ev.messageStream, "Matrix is singular\n");
+				ev.failed = 1;
+				return MatrixHandle();
+			}
+			if (lu->rcond < DBL_EPSILON) {
+				fprintf(ev.messageStream, "Warning: matrix is close to singular (rcond = %g)\n", lu->rcond);
+			}
+			res = tempMatrix(ev, b->rows, b->cols);
+			matrix_luSolve(res.mutate(ev.arena), lu, b.get());
 			break;
 		}
 		case '^':
 		{
-			Matrix* m1 = eval(expr, &saveptr);
-			if (evalFailed) return NULL;
+			MatrixHandle m1 = eval(ev, expr, &saveptr);
+			if (ev.failed) return MatrixHandle();
+			m1 = m1.dense(ev.arena);
 
-			token = PARSE_TOKEN(NULL, &saveptr);
+			token = nextToken(ev, &saveptr);
+			if (!token) return MatrixHandle();
 			int power = (int)strtol(token, (char**)NULL, 0);
-			if (power == 0) {
-				res = matrix_createIdentityMatrix(m1->rows);
-				matrix_destroyMatrix(m1);
-				break;
-			} else if (power < 2) {
-				res = m1;
-				break;
+			res = tempMatrix(ev, m1->rows, m1->cols);
+			if (!matrix_power(res.mutate(ev.arena), m1.get(), power)) {
+				fprintf(ev.messageStream, "Cannot raise matrix to power %d\n", power);
+				ev.failed = 1;
+				return MatrixHandle();
 			}
-			Matrix* m2 = matrix_copyMatrix(m1);
-			Matrix* mp = matrix_copyMatrix(m1);
-			for (int i = 2; i <= power; i++) {
-				matrix_multiplyMatrix(mp, m1, m2);
-				matrix_copyEntries(m1, mp);
-			}
-			res = mp;
-			matrix_destroyMatrix(m1);
-			matrix_destroyMatrix(m2);
 			break;
 		}
 		case 'm':
@@ -189,105 +635,321 @@ Matrix* eval(char* expr, char** progress) {
 		case 'c':
 		{
 			if (!strcmp(token, "id")) {
-				token = PARSE_TOKEN(NULL, &saveptr);
+				token = nextToken(ev, &saveptr);
+				if (!token) return MatrixHandle();
 				int size = (int)strtol(token, (char**)NULL, 0);
-				res = matrix_createIdentityMatrix(size);
+				if (size < 0) {
+					fprintf(ev.messageStream, "Cannot create an identity matrix of size %d\n", size);
+					ev.failed = 1;
+					return MatrixHandle();
+				}
+				res = tempMatrix(ev, size, size);
+				matrix_makeIdentity(res.mutate(ev.arena));
 			} else {
-				Matrix* m1 = eval(expr, &saveptr);
-				if (evalFailed) return NULL;
+				MatrixHandle m1 = eval(ev, expr, &saveptr);
+				if (ev.failed) return MatrixHandle();
+				if (token[0] == 'd' || (token[0] == 'i' && m1.precision() == Precision::F)) {
+					if ((res = typedDeterminantOrInverse(ev, token[0], m1))) {
+						break;
+					}
+					if (ev.failed) return MatrixHandle();
+				}
+				// these operations have no sparse counterparts
+				m1 = m1.dense(ev.arena);
 
-				Matrix* minors = matrix_createMatrix(m1->rows, m1->cols);
-				Matrix* cofactors = matrix_createMatrix(m1->rows, m1->cols);
-				double det = matrix_invert(m1, m1, minors, cofactors);
 				switch (token[0]) {
 					case 'd':
-						res = matrix_createMatrixWithElements(1, 1, det);
+						res = tempMatrix(ev, 1, 1);
+						res.mutate(ev.arena)->matrix[0][0] = matrix_determinant(m1.get(), NULL);
 						break;
 					case 'i':
 					default:
-						res = matrix_copyMatrix(m1);
+					{
+						if (!matrix_isSquare(m1.get())) {
+							fprintf(ev.messageStream, "Cannot invert a non-square matrix\n");
+							ev.failed = 1;
+							break;
+						}
+						LUFactorization* lu = matrix_arenaLUFactorization(ev.arena, m1->rows);
+						if (matrix_factorLU(lu, m1.get())) {
+							if (lu->rcond < DBL_EPSILON) {
+								fprintf(ev.messageStream, "Warning: matrix is close to singular (rcond = %g)\n", lu->rcond);
+							}
+							res = tempMatrix(ev, m1->rows, m1->cols);
+							matrix_luInvert(res.mutate(ev.arena), lu);
+						} else {
+							fprintf(ev.messageStream, "Matrix is singular\n");
+							ev.failed = 1;
+						}
 						break;
+					}
 					case 'c':
-						res = matrix_copyMatrix(cofactors);
-						break;
 					case 'm':
-						res = matrix_copyMatrix(minors);
+					{
+						res = tempMatrix(ev, m1->rows, m1->cols);
+						Matrix* minors = res.mutate(ev.arena);
+						matrix_minors(minors, m1.get());
+						if (token[0] == 'c') {
+							matrix_cofactors(minors, minors);
+						}
 						break;
+					}
 				}
-				matrix_destroyMatrix(m1);
-				matrix_destroyMatrix(minors);
-				matrix_destroyMatrix(cofactors);
+				if (ev.failed) return MatrixHandle();
 			}
 			break;
 		}
 		case 't':
 		{
-			Matrix* m1 = eval(expr, &saveptr);
-			if (evalFailed) return NULL;
+			MatrixHandle m1 = eval(ev, expr, &saveptr);
+			if (ev.failed) return MatrixHandle();
 
-			res = matrix_createMatrix(m1->cols, m1->rows);
-			matrix_transpose(res, m1);
-			matrix_destroyMatrix(m1);
+			if ((res = typedArithmetic('t', m1, m1, 0))) {
+				break;
+			}
+			if (m1.isSparse()) {
+				res = MatrixHandle::ownedSparse(matrix_sparseTranspose(m1.sparse()));
+			} else {
+				// temporaries are transposed in place; shared matrices are copied first
+				res = std::move(m1);
+				if (!matrix_transposeInPlace(res.mutate(ev.arena))) {
+					m1 = std::move(res);
+					res = tempMatrix(ev, m1->cols, m1->rows);
+					matrix_transpose(res.mutate(ev.arena), m1.get());
+				}
+			}
 			break;
 		}
 		case '?':
 		{
-			res = inputMatrix();
+			Matrix* entered = inputMatrix(ev);
+			if (!entered) {
+				fprintf(ev.messageStream, "Failed to read matrix\n");
+				ev.failed = 1;
+				return MatrixHandle();
+			}
+			res = MatrixHandle::owned(entered);
 			break;
 		}
 		case '=':
 		{
-			token = PARSE_TOKEN(NULL, &saveptr);
+			token = nextToken(ev, &saveptr);
+			if (!token) return MatrixHandle();
 			if (!isValidMatrixName(token)) {
-				evalFailed = 1;
-				printf("Cannot save matrix with name %s\n", token);
-				return NULL;
+				ev.failed = 1;
+				fprintf(ev.messageStream, "Cannot save matrix with name %s\n", token);
+				return MatrixHandle();
 			}
-			res = eval(expr, &saveptr);
-			if (evalFailed) return NULL;
+			res = eval(ev, expr, &saveptr);
+			if (ev.failed) return MatrixHandle();
 
-			saveMatrixWithName(token, matrix_copyMatrix(res));
+			// stored and entered matrices are shared; only temporaries are copied out of the arena
+			res = saveMatrixWithName(token, storageFor(ev, res).persistent());
 			break;
 		}
 		default:
 			if (token[strlen(token) - 1] == '\n') {
 				token[strlen(token) - 1] = '\0';
 			}
-			Matrix* stored = getMatrixWithName(token);
-			if (!stored) {
-				evalFailed = 1;
-				printf("Failed to interpret token %s", token);
-				return NULL;
+			res = getMatrixWithName(token);
+			if (!res) {
+				ev.failed = 1;
+				fprintf(ev.messageStream, "Failed to interpret token %s\n", token);
+				return MatrixHandle();
 			}
-			res = matrix_copyMatrix(stored);
 			break;
 	}
-	#ifdef THREADSAFE
 	if (progress) {
 		*progress = saveptr;
 	}
-	#endif
-	return res;
+	if (!term) {
+		term = Term(std::move(res));
+	}
+	return term;
 }
 
-int main(int argc, char* argv[]) {
-	int infixMode = 1;
-	printf("Matrix Calculator\nAvailable under GPLv3. See LICENSE for more details.\n");
-	char input[200];
-	memset(input, 0, sizeof(input));
-	initMemory();
-	while (1) {
-		printf("\n> ");
-		if (fgets(input, sizeof(input), stdin) == NULL) {
-			printf("Received Ctrl+D. Exiting...\n");
+/**
+ * Writes a matrix to a matrix file in the precision in which it is stored;
+ * files have no sparse format, so sparse matrices are expanded
+ * @param matrix Matrix to write
+ * @param path Path of the file
+ * @return Whether the file was written successfully
+ */
+bool saveMatrixFile(const MatrixHandle& matrix, const char* path) {
+	switch (matrix.precision()) {
+		case Precision::Double:
 			break;
+		case Precision::F:
+			return matrix_saveMatrixF(matrix.typed<MatrixF>(), path);
+		case Precision::I32:
+			return matrix_saveMatrixI32(matrix.typed<MatrixI32>(), path);
+		case Precision::I64:
+			return matrix_saveMatrixI64(matrix.typed<MatrixI64>(), path);
+	}
+	return matrix_saveMatrix(matrix.dense(NULL).get(), path);
+}
+
+/**
+ * Runs a command that reads or writes matrix files if the input is one
+ * @param ev Evaluator running the command
+ * @param input Line entered by the user
+ * @return 1 if the input was a file command that succeeded, -1 if it failed, 0 if it wasn't a file command
+ */
+int fileCommand(Evaluator& ev, char* input) {
+	if (!strncmp(input, "snapshot ", 9)) {
+		if (snapshotMemory(input + 9)) {
+			fprintf(ev.messageStream, "Saved memory to %s\n", input + 9);
+			return 1;
 		}
-		input[strlen(input) - 1] = 0;
-		if (!strcmp(input, "exit")) {
-			printf("Exiting...\n");
-			break;
-		} else if (!strcmp(input, "help")) {
-			printf("Commands: exit, help\nEBNF:\n\
+		fprintf(ev.messageStream, "Failed to save memory to %s\n", input + 9);
+		return -1;
+	} else if (!strncmp(input, "restore ", 8)) {
+		int count = restoreMemory(input + 8);
+		if (count >= 0) {
+			fprintf(ev.messageStream, "Loaded %d matrices from %s\n", count, input + 8);
+			return 1;
+		}
+		fprintf(ev.messageStream, "Failed to load memory from %s\n", input + 8);
+		return -1;
+	}
+	int save = !strncmp(input, "save ", 5);
+	if (!save && strncmp(input, "load ", 5)) {
+		return 0;
+	}
+	// the name is followed by the path, which may contain spaces
+	char* name = input + 5;
+	char* path = strchr(name, ' ');
+	if (!path) {
+		fprintf(ev.messageStream, "Usage: %s (name) (file)\n", save ? "save" : "load");
+		return -1;
+	}
+	*path++ = '\0';
+	if (save) {
+		MatrixHandle matrix = getMatrixWithName(name);
+		if (!matrix) {
+			fprintf(ev.messageStream, "No matrix with name %s\n", name);
+		} else if (saveMatrixFile(matrix, path)) {
+			fprintf(ev.messageStream, "Saved %s to %s\n", name, path);
+			return 1;
+		} else {
+			fprintf(ev.messageStream, "Failed to save %s to %s\n", name, path);
+		}
+	} else if (!isValidMatrixName(name)) {
+		fprintf(ev.messageStream, "Cannot save matrix with name %s\n", name);
+	} else {
+		int dtype;
+		void* loaded = matrix_loadRecord(path, &dtype);
+		if (loaded) {
+			MatrixHandle matrix = MatrixHandle::ownedRecord(dtype, loaded);
+			fprintf(ev.messageStream, "Loaded %s (%d x %d) from %s\n", name, matrix.rows(), matrix.cols(), path);
+			loadMatrixWithName(name, matrix);
+			return 1;
+		} else {
+			fprintf(ev.messageStream, "Failed to load %s\n", path);
+		}
+	}
+	return -1;
+}
+
+/**
+ * Runs a command that declares the precision of stored matrices if the input is one
+ * @param ev Evaluator running the command
+ * @param input Line entered by the user
+ * @return 1 if the input was a precision command that succeeded, -1 if it failed, 0 if it wasn't one
+ */
+int precisionCommand(Evaluator& ev, char* input) {
+	if (strncmp(input, "precision", 9) || (input[9] && input[9] != ' ')) {
+		return 0;
+	}
+	char* saveptr;
+	char* first = strtok_r(input + 9, " ", &saveptr);
+	char* second = first ? strtok_r(NULL, " ", &saveptr) : NULL;
+	Precision precision;
+	if (!first) {
+		printPrecisions(ev.messageStream);
+	} else if (!second && parsePrecision(first, &precision)) {
+		setDefaultPrecision(precision);
+		fprintf(ev.messageStream, "Default precision: %s\n", first);
+	} else if (second && !strtok_r(NULL, " ", &saveptr) && parsePrecision(second, &precision)) {
+		if (!isValidMatrixName(first)) {
+			fprintf(ev.messageStream, "Cannot save matrix with name %s\n", first);
+			return -1;
+		}
+		declarePrecision(first, precision);
+		fprintf(ev.messageStream, "%s: %s\n", first, second);
+	} else {
+		fprintf(ev.messageStream, "Usage: precision [[name] (double | float | int32 | int64)]\n");
+		return -1;
+	}
+	return 1;
+}
+
+/**
+ * Runs a command that controls the library's instrumentation if the input is one
+ * @param ev Evaluator running the command
+ * @param input Line entered by the user
+ * @return 1 if the input was a statistics command that succeeded, -1 if it failed, 0 if it wasn't one
+ */
+int statsCommand(Evaluator& ev, char* input) {
+	int stats = !strncmp(input, "stats", 5) && (!input[5] || input[5] == ' ');
+	int trace = !strncmp(input, "trace ", 6);
+	if (!stats && !trace) {
+		return 0;
+	}
+	char* arg = input + (stats ? 5 : 6);
+	while (*arg == ' ') {
+		arg++;
+	}
+	if (stats && !*arg) {
+		if (!matrix_statsEnabled()) {
+			fprintf(ev.messageStream, "Statistics are off; turn them on with stats on\n");
+			return -1;
+		}
+		matrix_printStats(ev.messageStream);
+		return 1;
+	}
+	int available = 1;
+	if (stats && !strcmp(arg, "on")) {
+		available = matrix_enableStats(1);
+	} else if (stats && !strcmp(arg, "off")) {
+		matrix_enableStats(0);
+	} else if (stats && !strcmp(arg, "reset")) {
+		matrix_resetStats();
+	} else if (trace && !strcmp(arg, "start")) {
+		available = matrix_startTrace();
+	} else if (trace && !strncmp(arg, "stop ", 5)) {
+		if (!matrix_stopTrace(arg + 5)) {
+			fprintf(ev.messageStream, "Failed to write trace to %s\n", arg + 5);
+			return -1;
+		}
+		fprintf(ev.messageStream, "Saved trace to %s\n", arg + 5);
+	} else {
+		fprintf(ev.messageStream, "Usage: stats [on | off | reset], trace start, trace stop (file)\n");
+		return -1;
+	}
+	if (!available) {
+		fprintf(ev.messageStream, "Statistics are unavailable; rebuild the library with INSTRUMENT=1\n");
+		return -1;
+	}
+	return 1;
+}
+
+// ExprFix makes no promise of reentrancy, so evaluators convert expressions one at a time
+std::mutex exprfixLock;
+
+int runStatement(Evaluator& ev, char* input) {
+	if (!strcmp(input, "exit")) {
+		if (ev.interactive) {
+			fprintf(ev.messageStream, "Exiting...\n");
+		}
+		return -1;
+	} else if (!strcmp(input, "help")) {
+		fprintf(ev.messageStream, "Commands: exit, help, mode\n\
+File commands: save (name) (file), load (name) (file), snapshot (file), restore (file)\n\
+Statistics commands: stats [on | off | reset], trace start, trace stop (file)\n\
+Precision commands: precision, precision (type), precision (name) (type)\n\
+Types: double, float, int32, int64\n\
+EBNF:\n\
 expression = operator argument [argument]\n\
 argument = expression | matrix\n\
 matrix = (name) | '?'\n\n\
@@ -297,33 +959,206 @@ Available operators:\n\
 | + | 2 matrices | Adds the two matrices together |\n\
 | - | 2 matrices | Subtracts the second matrix from the first |\n\
 | * | 2 matrices | Multiplies the two matrices in their given order |\n\
+| \\ | 1 square matrix A, then 1 matrix B | Solves AX = B for X |\n\
 | . | 1 real number, then 1 matrix | Multiplies the matrix by the scalar |\n\
-| ^ | 1 square matrix, then 1 integer | Computes the matrix to the given power |\n\
+| ^ | 1 square matrix, then 1 integer | Computes the matrix to the given (possibly negative) power |\n\
 | i | 1 square matrix | Computes the inverse of the matrix |\n\
 | d | 1 matrix | Computes the determinant of the given matrix |\n\
 | m | 1 matrix | Computes the matrix of minors of the given matrix |\n\
 | c | 1 matrix | Computes the matrix of cofactors of the given matrix |\n\
 | t | 1 matrix | Computes the transpose of the matrix |\n\
 | id | 1 integer | Creates an identity matrix of the given size |\n");
-			continue;
-		} else if (!strcmp(input, "mode")) {
-			infixMode = !infixMode;
-			printf("Input mode: %s\n", infixMode ? "infix" : "postfix");
-			continue;
+		return 1;
+	} else if (!strcmp(input, "mode")) {
+		ev.infixMode = !ev.infixMode;
+		fprintf(ev.messageStream, "Input mode: %s\n", ev.infixMode ? "infix" : "postfix");
+		return 1;
+	}
+	int command = fileCommand(ev, input);
+	if (!command) {
+		command = statsCommand(ev, input);
+	}
+	if (!command) {
+		command = precisionCommand(ev, input);
+	}
+	if (command) {
+		return command > 0;
+	}
+	char* postfix = NULL;
+	if (ev.infixMode) {
+		std::lock_guard<std::mutex> lock(exprfixLock);
+		postfix = infixToPrefix(input, isBin, isUn, getOpProps);
+	}
+	int success;
+	{
+		MatrixHandle matrix = ev.infixMode && !postfix ? MatrixHandle() : eval(ev, ev.infixMode ? postfix : input, NULL);
+		success = (bool)matrix;
+		if (!matrix) {
+			fprintf(ev.messageStream, "No result\n");
+		} else if (ev.resultStream) {
+			printMatrix(ev.resultStream, matrix.dense(ev.arena).get());
+		}
+	}
+	if (postfix) {
+		free(postfix);
+	}
+	// release every temporary of the expression at once
+	matrix_resetArena(ev.arena);
+	return success;
+}
+
+void printUsage(const char* name) {
+	fprintf(stderr, "Usage: %s [-b] [-s script] [-q] [-o file] [-t] [-x] [-l socket [-w workers]] [snapshot]\n\
+  -b         Batch mode: read statements from standard input without prompts\n\
+  -s script  Run the statements in a file (- for standard input) in batch mode\n\
+  -q         Don't print results\n\
+  -o file    Print results to a file\n\
+  -t         Report the time taken by each statement on standard error\n\
+  -x         Stop at the first statement that fails\n\
+  -l socket  Server mode: evaluate the statements of clients connecting to a Unix domain socket\n\
+  -w workers Number of clients the server serves at once (default: one per processor)\n\
+  snapshot   Archive to restore before running any statement\n", name);
+}
+
+int main(int argc, char* argv[]) {
+	int batch = 0, quiet = 0, timing = 0, stopOnError = 0, workers = 0;
+	const char* script = NULL;
+	const char* outPath = NULL;
+	const char* socketPath = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "bs:qo:txl:w:")) != -1) {
+		switch (opt) {
+			case 'b':
+				batch = 1;
+				break;
+			case 's':
+				script = optarg;
+				batch = 1;
+				break;
+			case 'q':
+				quiet = 1;
+				break;
+			case 'o':
+				outPath = optarg;
+				break;
+			case 't':
+				timing = 1;
+				break;
+			case 'x':
+				stopOnError = 1;
+				break;
+			case 'l':
+				socketPath = optarg;
+				break;
+			case 'w':
+				workers = (int)strtol(optarg, (char**)NULL, 0);
+				break;
+			default:
+				printUsage(argv[0]);
+				return 2;
+		}
+	}
+	Evaluator ev;
+	if (socketPath) {
+		// clients have evaluators of their own, so the server's messages are diagnostics as in batch mode
+		batch = 1;
+	} else if (script && strcmp(script, "-")) {
+		ev.inputStream = fopen(script, "r");
+		if (!ev.inputStream) {
+			fprintf(stderr, "Failed to open %s\n", script);
+			return 2;
+		}
+	}
+	if (quiet || socketPath) {
+		ev.resultStream = NULL;
+	} else if (outPath) {
+		ev.resultStream = fopen(outPath, "w");
+		if (!ev.resultStream) {
+			fprintf(stderr, "Failed to open %s\n", outPath);
+			return 2;
 		}
-		char* postfix = infixMode ? infixToPrefix(input, isBin, isUn, getOpProps) : NULL;
-		Matrix* matrix = eval(infixMode ? postfix : input, NULL);
-		if (postfix) {
-			free(postfix);
+	}
+	if (batch) {
+		// results are the only output on standard output; everything else is a diagnostic
+		ev.interactive = 0;
+		ev.messageStream = stderr;
+		if (ev.resultStream) {
+			setvbuf(ev.resultStream, NULL, _IOFBF, 1 << 16);
 		}
-		if (matrix) {
-			printMatrix(matrix);
-			matrix_destroyMatrix(matrix);
+	} else {
+		printf("Matrix Calculator\nAvailable under GPLv3. See LICENSE for more details.\n");
+	}
+	initMemory();
+	matrix_initThreads(0);
+	int status = 0;
+	// a snapshot given on the command line is restored before the first prompt
+	if (optind < argc) {
+		int count = restoreMemory(argv[optind]);
+		if (count >= 0) {
+			fprintf(ev.messageStream, "Loaded %d matrices from %s\n", count, argv[optind]);
 		} else {
-			printf("No result\n");
+			fprintf(ev.messageStream, "Failed to load memory from %s\n", argv[optind]);
+			status = batch ? 2 : 0;
 		}
-		memset(input, 0, sizeof(input));
+	}
+	if (socketPath && status != 2) {
+		status = runServer(socketPath, workers);
+	}
+
+	char* input = NULL;
+	size_t capacity = 0;
+	int statements = 0, failures = 0;
+	double totalTime = 0;
+	while (!socketPath && status != 2) {
+		if (ev.interactive) {
+			printf("\n> ");
+		}
+		ssize_t length = getline(&input, &capacity, ev.inputStream);
+		if (length < 0) {
+			if (ev.interactive) {
+				printf("Received Ctrl+D. Exiting...\n");
+			}
+			break;
+		}
+		while (length > 0 && (input[length - 1] == '\n' || input[length - 1] == '\r')) {
+			input[--length] = '\0';
+		}
+		// blank lines and comments are skipped
+		if (input[strspn(input, " \t")] == '\0' || input[0] == '#') {
+			continue;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		int result = runStatement(ev, input);
+		if (result < 0) {
+			break;
+		}
+		double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		totalTime += elapsed;
+		statements++;
+		if (timing) {
+			fprintf(stderr, "statement %d: %.3f ms%s\n", statements, elapsed, result ? "" : " (failed)");
+		}
+		if (!result) {
+			failures++;
+			status = 1;
+			if (stopOnError) {
+				break;
+			}
+		}
+	}
+	if (timing) {
+		fprintf(stderr, "%d statements, %d failed, %.3f ms\n", statements, failures, totalTime);
+	}
+	free(input);
+	if (ev.resultStream && ev.resultStream != stdout && fclose(ev.resultStream)) {
+		status = 2;
+	}
+	if (ev.inputStream != stdin) {
+		fclose(ev.inputStream);
 	}
 	clearMemory();
-	return 0;
+	matrix_shutdownThreads();
+	// in batch mode, the exit code tells whether every statement succeeded
+	return batch ? status : 0;
 }
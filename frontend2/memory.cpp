@@ -12,36 +12,494 @@
 //You should have received a copy of the GNU General Public License
 //along with this program. If not, see <http://www.gnu.org/licenses/>.
 
+// number of independently locked parts of the matrix memory
+#define MEMORY_SHARDS 16
+// number of slots in a shard's table before anything is stored in it
+#define MEMORY_INITIAL_CAPACITY 8
+
+#include <limits.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <map>
+#include <mutex>
 #include <string>
+#include <vector>
 
+#include "epoch.h"
 #include "memory.h"
 
-std::map<std::string, Matrix*> matrixMemory;
+/**
+ * Name in matrix memory. Entries are never removed from their shard until
+ * the whole memory is cleared. The handle is replaced as a whole with an
+ * atomic exchange, so readers load either the old or the new matrix; the
+ * old handle is retired and destroyed once no reader can still be copying
+ * it, and its matrix once the last copy lets go of it.
+ */
+struct MemoryEntry {
+	std::string name;
+	size_t hash;
+	std::atomic<const MatrixHandle*> handle;
+};
+
+/**
+ * Open addressing table of entries with linear probing. Slots only ever go
+ * from empty to holding an entry, so readers probing without a lock find
+ * either an entry or the end of its probe sequence.
+ */
+struct MemoryTable {
+	// a power of two
+	size_t capacity;
+	std::atomic<MemoryEntry*>* slots;
+
+	explicit MemoryTable(size_t capacity) : capacity(capacity), slots(new std::atomic<MemoryEntry*>[capacity]()) {}
+
+	~MemoryTable() {
+		delete[] slots;
+	}
+};
+
+/**
+ * Part of the matrix memory holding the names that hash to it. Readers
+ * load the current table and the entries' handles with atomic loads inside
+ * an EpochGuard and never lock; writers serialize on the shard's lock.
+ * Adding a name to a table that is half full publishes a table twice as
+ * large holding the same entries, and the old one is retired.
+ */
+struct MemoryShard {
+	std::atomic<MemoryTable*> table;
+	// entries in the table, only accessed by writers
+	size_t count = 0;
+	std::mutex lock;
+
+	MemoryShard() : table(new MemoryTable(MEMORY_INITIAL_CAPACITY)) {}
+
+	~MemoryShard();
+};
+
+static MemoryShard matrixMemory[MEMORY_SHARDS];
+
+// guards declaredPrecisions and defaultPrecision; taken after a shard's lock, never before
+std::mutex precisionLock;
+std::map<std::string, Precision> declaredPrecisions;
+Precision defaultPrecision = Precision::Double;
+
+static const char* precisionNames[] = { "double", "float", "int32", "int64" };
+
+MatrixHandle MatrixHandle::owned(Matrix* m) {
+	MatrixHandle handle;
+	handle.matrix = std::shared_ptr<Matrix>(m, matrix_destroyMatrix);
+	return handle;
+}
+
+MatrixHandle MatrixHandle::borrowed(Matrix* m) {
+	MatrixHandle handle;
+	handle.matrix = std::shared_ptr<Matrix>(m, [](Matrix*) {});
+	handle.borrowedStorage = true;
+	return handle;
+}
+
+MatrixHandle MatrixHandle::ownedSparse(SparseMatrix* m) {
+	MatrixHandle handle;
+	handle.sparseMatrix = std::shared_ptr<SparseMatrix>(m, matrix_destroySparse);
+	return handle;
+}
+
+MatrixHandle MatrixHandle::ownedTyped(Precision precision, void* m) {
+	MatrixHandle handle;
+	switch (precision) {
+		case Precision::F:
+			handle.typedMatrix = std::shared_ptr<void>(m, [](void* p) { matrix_destroyMatrixF((MatrixF*)p); });
+			break;
+		case Precision::I32:
+			handle.typedMatrix = std::shared_ptr<void>(m, [](void* p) { matrix_destroyMatrixI32((MatrixI32*)p); });
+			break;
+		case Precision::I64:
+			handle.typedMatrix = std::shared_ptr<void>(m, [](void* p) { matrix_destroyMatrixI64((MatrixI64*)p); });
+			break;
+		case Precision::Double:
+			return handle;
+	}
+	handle.typedPrecision = precision;
+	return handle;
+}
+
+MatrixHandle MatrixHandle::ownedRecord(int dtype, void* m) {
+	switch (dtype) {
+		case MATRIX_DTYPE_CSR:
+			return ownedSparse((SparseMatrix*)m);
+		case MATRIX_DTYPE_F:
+			return ownedTyped(Precision::F, m);
+		case MATRIX_DTYPE_I32:
+			return ownedTyped(Precision::I32, m);
+		case MATRIX_DTYPE_I64:
+			return ownedTyped(Precision::I64, m);
+		default:
+			return owned((Matrix*)m);
+	}
+}
+
+Matrix* MatrixHandle::mutate(MatrixArena* arena) {
+	if (matrix.use_count() > 1) {
+		const Matrix* shared = matrix.get();
+		if (arena) {
+			Matrix* copy = matrix_arenaMatrix(arena, shared->rows, shared->cols);
+			matrix_copyEntries(copy, shared);
+			*this = borrowed(copy);
+		} else {
+			*this = owned(matrix_copyMatrix(shared));
+		}
+	}
+	return matrix.get();
+}
+
+SparseMatrix* MatrixHandle::mutateSparse() {
+	if (sparseMatrix.use_count() > 1) {
+		*this = ownedSparse(matrix_copySparse(sparseMatrix.get()));
+	}
+	return sparseMatrix.get();
+}
+
+MatrixHandle MatrixHandle::dense(MatrixArena* arena) const {
+	if (!sparseMatrix && !typedMatrix) {
+		return *this;
+	}
+	Matrix* expanded = arena ? matrix_arenaMatrix(arena, rows(), cols()) : matrix_createMatrix(rows(), cols());
+	switch (typedPrecision) {
+		case Precision::Double:
+			matrix_sparseToDense(expanded, sparseMatrix.get());
+			break;
+		case Precision::F:
+			matrix_convertFromF(expanded, typed<MatrixF>());
+			break;
+		case Precision::I32:
+			matrix_convertFromI32(expanded, typed<MatrixI32>());
+			break;
+		case Precision::I64:
+			matrix_convertFromI64(expanded, typed<MatrixI64>());
+			break;
+	}
+	return arena ? borrowed(expanded) : owned(expanded);
+}
+
+MatrixHandle MatrixHandle::withPrecision(Precision precision, MatrixArena* arena) const {
+	if (precision == typedPrecision) {
+		return *this;
+	}
+	MatrixHandle source = dense(arena);
+	void* converted = NULL;
+	switch (precision) {
+		case Precision::Double:
+			return source;
+		case Precision::F:
+			converted = matrix_createMatrixF(rows(), cols());
+			matrix_convertToF((MatrixF*)converted, source.get());
+			break;
+		case Precision::I32:
+			converted = matrix_createMatrixI32(rows(), cols());
+			matrix_convertToI32((MatrixI32*)converted, source.get());
+			break;
+		case Precision::I64:
+			converted = matrix_createMatrixI64(rows(), cols());
+			matrix_convertToI64((MatrixI64*)converted, source.get());
+			break;
+	}
+	return ownedTyped(precision, converted);
+}
+
+MatrixHandle MatrixHandle::persistent() const {
+	if (borrowedStorage) {
+		return owned(matrix_copyMatrix(matrix.get()));
+	}
+	return *this;
+}
+
+static void destroyHandle(void* handle) {
+	delete (const MatrixHandle*)handle;
+}
+
+static void destroyTable(void* table) {
+	delete (MemoryTable*)table;
+}
+
+/**
+ * Destroys a table along with its entries and their matrices
+ * @param table Table that no longer shares its entries with a reachable table
+ */
+static void destroyTableAndEntries(void* table) {
+	MemoryTable* entries = (MemoryTable*)table;
+	for (size_t i = 0; i < entries->capacity; i++) {
+		MemoryEntry* entry = entries->slots[i].load(std::memory_order_relaxed);
+		if (entry) {
+			delete entry->handle.load(std::memory_order_relaxed);
+			delete entry;
+		}
+	}
+	delete entries;
+}
+
+MemoryShard::~MemoryShard() {
+	destroyTableAndEntries(table.load(std::memory_order_relaxed));
+}
 
 void initMemory() {
-	matrixMemory = std::map<std::string, Matrix*>();
+	for (MemoryShard& shard : matrixMemory) {
+		std::lock_guard<std::mutex> lock(shard.lock);
+		MemoryTable* old = shard.table.exchange(new MemoryTable(MEMORY_INITIAL_CAPACITY), std::memory_order_acq_rel);
+		shard.count = 0;
+		// evaluations still holding a matrix keep it until they are done
+		epochRetire(old, destroyTableAndEntries);
+	}
 }
 
 void clearMemory() {
-	for (auto it = matrixMemory.cbegin(); it != matrixMemory.cend();) {
-		matrix_destroyMatrix(it->second);
-		matrixMemory.erase(it++);
+	initMemory();
+	std::lock_guard<std::mutex> lock(precisionLock);
+	declaredPrecisions.clear();
+	defaultPrecision = Precision::Double;
+}
+
+static size_t hashName(const std::string& name) {
+	return std::hash<std::string>()(name);
+}
+
+/**
+ * Determine the shard holding a name
+ * @param hash Hash of the matrix name
+ * @return Shard in which the name is stored if it is in memory
+ */
+static MemoryShard& shardFor(size_t hash) {
+	// the low bits pick the slot within the shard's table, so the shard is picked by the high ones
+	return matrixMemory[(hash >> (sizeof(size_t) * CHAR_BIT / 2)) % MEMORY_SHARDS];
+}
+
+/**
+ * Finds the entry of a name in a table
+ * @param table Table to search
+ * @param key Matrix name
+ * @param hash Hash of the name
+ * @return Entry of the name, or NULL if it isn't in the table
+ */
+static MemoryEntry* findEntry(const MemoryTable* table, const std::string& key, size_t hash) {
+	size_t mask = table->capacity - 1;
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		MemoryEntry* entry = table->slots[i].load(std::memory_order_acquire);
+		if (!entry) {
+			return NULL;
+		}
+		if (entry->hash == hash && entry->name == key) {
+			return entry;
+		}
+	}
+}
+
+/**
+ * Places an entry in the first empty slot of its probe sequence
+ * @param table Table with at least one empty slot
+ * @param entry Entry to add
+ */
+static void insertEntry(MemoryTable* table, MemoryEntry* entry) {
+	size_t mask = table->capacity - 1;
+	size_t i = entry->hash & mask;
+	while (table->slots[i].load(std::memory_order_relaxed)) {
+		i = (i + 1) & mask;
+	}
+	// the entry is fully initialized before readers can find it
+	table->slots[i].store(entry, std::memory_order_release);
+}
+
+/**
+ * Determine the precision in which to store a matrix
+ * @param name Matrix name
+ * @return Declared precision of the name, or the default precision if it has none
+ */
+static Precision precisionFor(const std::string& name) {
+	std::lock_guard<std::mutex> lock(precisionLock);
+	auto it = declaredPrecisions.find(name);
+	return it != declaredPrecisions.end() ? it->second : defaultPrecision;
+}
+
+/**
+ * Replaces the matrix stored under a name, adding the name if it isn't in
+ * memory yet; the caller holds the lock of the name's shard
+ * @param shard Shard of the name
+ * @param key Matrix name
+ * @param hash Hash of the name
+ * @param m Handle to the matrix to store
+ */
+static void publish(MemoryShard& shard, const std::string& key, size_t hash, const MatrixHandle& m) {
+	const MatrixHandle* handle = new MatrixHandle(m);
+	// only writers replace the table and they hold the lock
+	MemoryTable* table = shard.table.load(std::memory_order_relaxed);
+	MemoryEntry* entry = findEntry(table, key, hash);
+	if (entry) {
+		epochRetire((void*)entry->handle.exchange(handle, std::memory_order_acq_rel), destroyHandle);
+		return;
 	}
+	if (2 * (shard.count + 1) > table->capacity) {
+		MemoryTable* grown = new MemoryTable(2 * table->capacity);
+		for (size_t i = 0; i < table->capacity; i++) {
+			MemoryEntry* moved = table->slots[i].load(std::memory_order_relaxed);
+			if (moved) {
+				insertEntry(grown, moved);
+			}
+		}
+		shard.table.store(grown, std::memory_order_release);
+		// the entries now belong to the new table, so only the slots are destroyed
+		epochRetire(table, destroyTable);
+		table = grown;
+	}
+	entry = new MemoryEntry();
+	entry->name = key;
+	entry->hash = hash;
+	entry->handle.store(handle, std::memory_order_relaxed);
+	insertEntry(table, entry);
+	shard.count++;
+}
+
+MatrixHandle getMatrixWithName(char* name) {
+	std::string key(name);
+	size_t hash = hashName(key);
+	// the table, the entry and the handle stay valid while the guard exists
+	EpochGuard guard;
+	MemoryEntry* entry = findEntry(shardFor(hash).table.load(std::memory_order_acquire), key, hash);
+	if (entry) {
+		return *entry->handle.load(std::memory_order_acquire);
+	}
+	return MatrixHandle();
 }
 
-Matrix* getMatrixWithName(char* name) {
-	std::string cppname(name);
-	if (matrixMemory.find(cppname) != matrixMemory.end()) {
-		return matrixMemory[cppname];
+/**
+ * Stores a matrix under a name in the precision declared for the name
+ * @param key Matrix name
+ * @param m Handle to the matrix to store
+ * @return Handle to the stored matrix
+ */
+static MatrixHandle store(const std::string& key, MatrixHandle m) {
+	Precision precision = precisionFor(key);
+	m = m.withPrecision(precision, NULL);
+	size_t hash = hashName(key);
+	MemoryShard& shard = shardFor(hash);
+	std::lock_guard<std::mutex> lock(shard.lock);
+	// the precision may have been declared while the matrix was being converted
+	if (precisionFor(key) != precision) {
+		m = m.withPrecision(precisionFor(key), NULL);
 	}
-	return 0;
+	publish(shard, key, hash, m);
+	return m;
+}
+
+MatrixHandle saveMatrixWithName(char* name, MatrixHandle m) {
+	return store(std::string(name), std::move(m));
 }
 
-void saveMatrixWithName(char* name, Matrix* m) {
-	std::string cppname(name);
-	if (matrixMemory.find(cppname) != matrixMemory.end()) {
-		matrix_destroyMatrix(matrixMemory[cppname]);
+MatrixHandle loadMatrixWithName(const char* name, MatrixHandle m) {
+	std::string key(name);
+	if (m.isTyped()) {
+		std::lock_guard<std::mutex> lock(precisionLock);
+		declaredPrecisions.insert(std::make_pair(key, m.precision()));
 	}
-	matrixMemory[cppname] = m;
+	return store(key, std::move(m));
+}
+
+bool parsePrecision(const char* name, Precision* precision) {
+	for (int i = 0; i < 4; i++) {
+		if (!strcmp(name, precisionNames[i])) {
+			*precision = (Precision)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* precisionName(Precision precision) {
+	return precisionNames[(int)precision];
+}
+
+void setDefaultPrecision(Precision precision) {
+	std::lock_guard<std::mutex> lock(precisionLock);
+	defaultPrecision = precision;
+}
+
+void declarePrecision(char* name, Precision precision) {
+	std::string key(name);
+	size_t hash = hashName(key);
+	MemoryShard& shard = shardFor(hash);
+	// holding the shard's lock keeps a matrix saved meanwhile from being converted to the old precision
+	std::lock_guard<std::mutex> lock(shard.lock);
+	{
+		std::lock_guard<std::mutex> declarations(precisionLock);
+		declaredPrecisions[key] = precision;
+	}
+	MemoryEntry* entry = findEntry(shard.table.load(std::memory_order_relaxed), key, hash);
+	if (entry) {
+		publish(shard, key, hash, entry->handle.load(std::memory_order_relaxed)->withPrecision(precision, NULL));
+	}
+}
+
+void printPrecisions(FILE* file) {
+	std::lock_guard<std::mutex> lock(precisionLock);
+	fprintf(file, "Default precision: %s\n", precisionName(defaultPrecision));
+	for (auto& entry : declaredPrecisions) {
+		fprintf(file, "%s: %s\n", entry.first.c_str(), precisionName(entry.second));
+	}
+}
+
+bool snapshotMemory(const char* path) {
+	std::vector<std::pair<std::string, MatrixHandle>> entries;
+	{
+		EpochGuard guard;
+		for (MemoryShard& shard : matrixMemory) {
+			const MemoryTable* table = shard.table.load(std::memory_order_acquire);
+			for (size_t i = 0; i < table->capacity; i++) {
+				MemoryEntry* entry = table->slots[i].load(std::memory_order_acquire);
+				if (entry) {
+					entries.push_back(std::make_pair(entry->name, *entry->handle.load(std::memory_order_acquire)));
+				}
+			}
+		}
+	}
+	// names are written in order so that the same memory always gives the same archive
+	std::sort(entries.begin(), entries.end(),
+		[](const std::pair<std::string, MatrixHandle>& a, const std::pair<std::string, MatrixHandle>& b) {
+			return a.first < b.first;
+		});
+	MatrixArchive* archive = matrix_createArchive(path);
+	if (!archive) {
+		return false;
+	}
+	// every matrix is written in the format and precision in which it is stored
+	for (auto& entry : entries) {
+		const char* name = entry.first.c_str();
+		const MatrixHandle& m = entry.second;
+		if (m.isSparse()) {
+			matrix_archiveSparse(archive, name, m.sparse());
+			continue;
+		}
+		switch (m.precision()) {
+			case Precision::Double:
+				matrix_archiveMatrix(archive, name, m.get());
+				break;
+			case Precision::F:
+				matrix_archiveMatrixF(archive, name, m.typed<MatrixF>());
+				break;
+			case Precision::I32:
+				matrix_archiveMatrixI32(archive, name, m.typed<MatrixI32>());
+				break;
+			case Precision::I64:
+				matrix_archiveMatrixI64(archive, name, m.typed<MatrixI64>());
+				break;
+		}
+	}
+	return matrix_closeArchive(archive);
+}
+
+static void restoreMatrix(const char* name, int dtype, void* matrix, void*) {
+	loadMatrixWithName(name, MatrixHandle::ownedRecord(dtype, matrix));
+}
+
+int restoreMemory(const char* path) {
+	return matrix_loadArchiveRecords(path, restoreMatrix, NULL);
 }
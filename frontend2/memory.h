@@ -12,28 +12,247 @@
 //You should have received a copy of the GNU General Public License
 //along with this program. If not, see <http://www.gnu.org/licenses/>.
 
+#include <memory>
+
 #include "libmatrix.h"
 
+/**
+ * Element type in which a matrix is stored; see typedmatrix.h for the
+ * non-double types
+ */
+enum class Precision {
+	Double,
+	F,
+	I32,
+	I64
+};
+
+/**
+ * Reference-counted, copy-on-write handle to a matrix. Copying a handle
+ * shares the matrix; a private copy is only made when a shared matrix is
+ * about to be written to. The matrix is stored densely, in sparse (CSR)
+ * format or densely with another element type; get() and operator-> are only
+ * valid for dense double precision matrices.
+ */
+class MatrixHandle {
+	std::shared_ptr<Matrix> matrix;
+	std::shared_ptr<SparseMatrix> sparseMatrix;
+	// a MatrixF, MatrixI32 or MatrixI64 depending on typedPrecision
+	std::shared_ptr<void> typedMatrix;
+	Precision typedPrecision = Precision::Double;
+	bool borrowedStorage = false;
+public:
+	MatrixHandle() {}
+
+	/**
+	 * Wraps a heap-allocated matrix, which is destroyed along with the last handle to it
+	 * @param m Matrix to take ownership of
+	 * @return Handle to the matrix
+	 */
+	static MatrixHandle owned(Matrix* m);
+
+	/**
+	 * Wraps a matrix owned by something else (e.g. an arena), which must outlive every handle to it
+	 * @param m Matrix to refer to
+	 * @return Handle to the matrix
+	 */
+	static MatrixHandle borrowed(Matrix* m);
+
+	/**
+	 * Wraps a heap-allocated sparse matrix, which is destroyed along with the last handle to it
+	 * @param m Sparse matrix to take ownership of
+	 * @return Handle to the matrix
+	 */
+	static MatrixHandle ownedSparse(SparseMatrix* m);
+
+	/**
+	 * Wraps a heap-allocated matrix of another element type, which is
+	 * destroyed along with the last handle to it
+	 * @param precision Element type of the matrix (not Precision::Double)
+	 * @param m MatrixF, MatrixI32 or MatrixI64 to take ownership of
+	 * @return Handle to the matrix
+	 */
+	static MatrixHandle ownedTyped(Precision precision, void* m);
+
+	/**
+	 * Wraps a matrix loaded from a matrix file or an archive
+	 * @param dtype Entry type of the record the matrix was loaded from (MATRIX_DTYPE_*)
+	 * @param m Loaded matrix to take ownership of, of the type matching the entry type
+	 * @return Handle to the matrix
+	 */
+	static MatrixHandle ownedRecord(int dtype, void* m);
+
+	bool isSparse() const {
+		return (bool)sparseMatrix;
+	}
+
+	const SparseMatrix* sparse() const {
+		return sparseMatrix.get();
+	}
+
+	bool isTyped() const {
+		return (bool)typedMatrix;
+	}
+
+	Precision precision() const {
+		return typedPrecision;
+	}
+
+	/**
+	 * Accesses a matrix of another element type
+	 * @return The matrix, which must have the element type of M
+	 */
+	template <typename M>
+	const M* typed() const {
+		return (const M*)typedMatrix.get();
+	}
+
+	// every typed matrix starts with its row and column counts, like Matrix
+	int rows() const {
+		return sparseMatrix ? sparseMatrix->rows : typedMatrix ? typed<MatrixF>()->rows : matrix->rows;
+	}
+
+	int cols() const {
+		return sparseMatrix ? sparseMatrix->cols : typedMatrix ? typed<MatrixF>()->cols : matrix->cols;
+	}
+
+	const Matrix* get() const {
+		return matrix.get();
+	}
+
+	const Matrix* operator->() const {
+		return matrix.get();
+	}
+
+	explicit operator bool() const {
+		return matrix || sparseMatrix || typedMatrix;
+	}
+
+	/**
+	 * Obtains write access to the matrix, first replacing it with a private
+	 * copy if any other handle refers to it
+	 * @param arena Arena in which to allocate the copy, or NULL to allocate it on the heap
+	 * @return Matrix that only this handle refers to
+	 */
+	Matrix* mutate(MatrixArena* arena);
+
+	/**
+	 * Obtains write access to a sparse matrix, first replacing it with a
+	 * private copy if any other handle refers to it
+	 * @return Sparse matrix that only this handle refers to
+	 */
+	SparseMatrix* mutateSparse();
+
+	/**
+	 * Obtains a handle to a dense double precision version of the matrix.
+	 * Dense matrices are shared, sparse ones are expanded and other element
+	 * types are converted.
+	 * @param arena Arena in which to allocate the expanded matrix, or NULL to allocate it on the heap
+	 * @return Handle to a dense matrix
+	 */
+	MatrixHandle dense(MatrixArena* arena) const;
+
+	/**
+	 * Obtains a handle to a version of the matrix with a given element type.
+	 * Matrices that already have it (including sparse double precision ones)
+	 * are shared, others are converted.
+	 * @param precision Desired element type
+	 * @param arena Arena in which to allocate double precision conversions, or NULL to allocate them on the heap
+	 * @return Handle to a matrix with the given element type
+	 */
+	MatrixHandle withPrecision(Precision precision, MatrixArena* arena) const;
+
+	/**
+	 * Obtains a handle that doesn't depend on the lifetime of any arena.
+	 * Owned and sparse matrices are shared, borrowed ones are copied to the heap.
+	 * @return Handle suitable for storing in memory
+	 */
+	MatrixHandle persistent() const;
+};
+
 /**
  * Initializes matrix memory
  */
 void initMemory();
 
 /**
- * Deallocates all matrices in memory
+ * Releases all matrices in memory
  */
 void clearMemory();
 
 /**
- * Search memory for a matrix by name
+ * Search memory for a matrix by name. The matrix is shared, not copied.
  * @param name Matrix name
- * @return Matrix with the given name, or NULL if none is found
+ * @return Handle to the matrix with the given name, or an empty handle if none is found
  */
-Matrix* getMatrixWithName(char* name);
+MatrixHandle getMatrixWithName(char* name);
 
 /**
- * Saves a matrix with a given name
+ * Saves a matrix with a given name, converting it to the precision declared for the name
  * @param name Matrix name
- * @param matrix Matrix to save
+ * @param matrix Handle to the matrix to save (must not refer to an arena)
+ * @return Handle to the saved matrix
+ */
+MatrixHandle saveMatrixWithName(char* name, MatrixHandle matrix);
+
+/**
+ * Saves a matrix loaded from a matrix file or an archive. Matrices stored
+ * in another precision than double keep it: it is declared for the name
+ * unless the name has a declared precision already, in which case the
+ * matrix is converted to that one.
+ * @param name Matrix name
+ * @param matrix Handle to the loaded matrix
+ * @return Handle to the saved matrix
+ */
+MatrixHandle loadMatrixWithName(const char* name, MatrixHandle matrix);
+
+/**
+ * Parses the name of a precision
+ * @param name "double", "float", "int32" or "int64"
+ * @param precision Where to store the precision
+ * @return Whether the name is valid
+ */
+bool parsePrecision(const char* name, Precision* precision);
+
+/**
+ * Determine the name of a precision
+ * @param precision Precision
+ * @return Name accepted by parsePrecision
+ */
+const char* precisionName(Precision precision);
+
+/**
+ * Sets the precision in which matrices are stored under names without a declared precision
+ * @param precision Default precision
+ */
+void setDefaultPrecision(Precision precision);
+
+/**
+ * Declares the precision in which a matrix is stored, converting the matrix
+ * currently stored under the name if there is one
+ * @param name Matrix name
+ * @param precision Precision of the matrix
+ */
+void declarePrecision(char* name, Precision precision);
+
+/**
+ * Prints the default precision and the declared precision of every name
+ * @param file Where to print the precisions
+ */
+void printPrecisions(FILE* file);
+
+/**
+ * Writes every matrix in memory to an archive
+ * @param path Path of the archive
+ * @return Whether the archive was written successfully
+ */
+bool snapshotMemory(const char* path);
+
+/**
+ * Loads every matrix in an archive into memory, replacing matrices with the
+ * same names and keeping their precision like loadMatrixWithName. Large
+ * matrices are mapped rather than read.
+ * @param path Path of the archive
+ * @return Number of matrices loaded, or -1 if the archive couldn't be read
  */
-void saveMatrixWithName(char* name, Matrix* matrix);
+int restoreMemory(const char* path);
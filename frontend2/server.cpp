@@ -0,0 +1,254 @@
+//Copyright (C) 2019-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+
+#include "evaluator.h"
+#include "server.h"
+
+#ifdef THREADSAFE
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+/**
+ * Connections accepted by the listening thread, waiting for a worker or
+ * being served by one
+ */
+static struct {
+	std::mutex lock;
+	std::condition_variable ready;
+	std::deque<int> waiting;
+	std::set<int> active;
+	bool stop;
+} connections;
+
+// write end of the pipe through which the signal handler wakes the listening thread
+static int wakeFd = -1;
+
+static void requestStop(int) {
+	char c = 0;
+	// nothing can be done about a failed write in a signal handler
+	if (write(wakeFd, &c, 1) < 0) {}
+}
+
+/**
+ * Waits for a connection to serve
+ * @param fd Where to store the connection's socket
+ * @return Whether there is a connection, false once the server is stopping
+ */
+static bool nextConnection(int* fd) {
+	std::unique_lock<std::mutex> lock(connections.lock);
+	connections.ready.wait(lock, [] { return connections.stop || !connections.waiting.empty(); });
+	if (connections.stop) {
+		return false;
+	}
+	*fd = connections.waiting.front();
+	connections.waiting.pop_front();
+	connections.active.insert(*fd);
+	return true;
+}
+
+/**
+ * Runs the statements sent by a client until it disconnects or sends exit
+ * @param ev Evaluator of the worker serving the client
+ * @param fd Socket of the connection, which is closed afterwards
+ */
+static void serveConnection(Evaluator& ev, int fd) {
+	int outFd = dup(fd);
+	FILE* in = fdopen(fd, "r");
+	FILE* out = outFd >= 0 ? fdopen(outFd, "w") : NULL;
+	if (in && out) {
+		ev.inputStream = in;
+		ev.resultStream = out;
+		ev.messageStream = out;
+		ev.interactive = 0;
+		ev.infixMode = 1;
+
+		char* input = NULL;
+		size_t capacity = 0;
+		ssize_t length;
+		while ((length = getline(&input, &capacity, in)) >= 0) {
+			while (length > 0 && (input[length - 1] == '\n' || input[length - 1] == '\r')) {
+				input[--length] = '\0';
+			}
+			if (input[strspn(input, " \t")] == '\0' || input[0] == '#') {
+				continue;
+			}
+			int result = runStatement(ev, input);
+			if (result < 0) {
+				break;
+			}
+			fprintf(out, "%s\n", result ? "ok" : "failed");
+			// a client that went away takes its results with it
+			if (fflush(out)) {
+				break;
+			}
+		}
+		free(input);
+	}
+	// the socket leaves the active set before it is closed, so that stopping
+	// the server can't shut down a reused descriptor
+	{
+		std::lock_guard<std::mutex> lock(connections.lock);
+		connections.active.erase(fd);
+	}
+	if (out) {
+		fclose(out);
+	} else if (outFd >= 0) {
+		close(outFd);
+	}
+	if (in) {
+		fclose(in);
+	} else {
+		close(fd);
+	}
+}
+
+static void work() {
+	Evaluator ev;
+	int fd;
+	while (nextConnection(&fd)) {
+		serveConnection(ev, fd);
+	}
+}
+
+int runServer(const char* path, int workers) {
+	struct sockaddr_un address;
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "Socket path %s is too long\n", path);
+		return 2;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+	// a socket left behind by a server that didn't stop cleanly is replaced, but nothing else is
+	struct stat info;
+	if (!stat(path, &info) && S_ISSOCK(info.st_mode)) {
+		unlink(path);
+	}
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) || listen(listener, SOMAXCONN)) {
+		fprintf(stderr, "Failed to listen on %s: %s\n", path, strerror(errno));
+		if (listener >= 0) {
+			close(listener);
+		}
+		return 2;
+	}
+	int wake[2];
+	if (pipe(wake)) {
+		fprintf(stderr, "Failed to create pipe: %s\n", strerror(errno));
+		close(listener);
+		unlink(path);
+		return 2;
+	}
+	wakeFd = wake[1];
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = requestStop;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	// a client that disconnects before reading its results must not stop the server
+	signal(SIGPIPE, SIG_IGN);
+
+	if (workers < 1) {
+		workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		if (workers < 1) {
+			workers = 1;
+		}
+	}
+	connections.stop = false;
+	std::vector<std::thread> pool;
+	for (int i = 0; i < workers; i++) {
+		pool.emplace_back(work);
+	}
+	fprintf(stderr, "Listening on %s with %d workers\n", path, workers);
+
+	struct pollfd fds[2];
+	fds[0].fd = listener;
+	fds[0].events = POLLIN;
+	fds[1].fd = wake[0];
+	fds[1].events = POLLIN;
+	while (1) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "Failed to wait for clients: %s\n", strerror(errno));
+			break;
+		}
+		if (fds[1].revents) {
+			break;
+		}
+		if (fds[0].revents & POLLIN) {
+			int fd = accept(listener, NULL, NULL);
+			if (fd >= 0) {
+				std::lock_guard<std::mutex> lock(connections.lock);
+				connections.waiting.push_back(fd);
+				connections.ready.notify_one();
+			}
+		}
+	}
+
+	// clients that are being served see the end of their input and waiting ones are dropped
+	{
+		std::lock_guard<std::mutex> lock(connections.lock);
+		connections.stop = true;
+		for (int fd : connections.active) {
+			shutdown(fd, SHUT_RDWR);
+		}
+		for (int fd : connections.waiting) {
+			close(fd);
+		}
+		connections.waiting.clear();
+		connections.ready.notify_all();
+	}
+	for (auto& worker : pool) {
+		worker.join();
+	}
+	close(listener);
+	unlink(path);
+	action.sa_handler = SIG_DFL;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	close(wake[0]);
+	close(wake[1]);
+	wakeFd = -1;
+	fprintf(stderr, "Server stopped\n");
+	return 0;
+}
+
+#else
+
+int runServer(const char* path, int workers) {
+	// the library's scratch memory is only per thread when it is built to be thread safe
+	fprintf(stderr, "Server mode is unavailable; rebuild with THREADSAFE=1\n");
+	return 2;
+}
+
+#endif
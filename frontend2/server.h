@@ -0,0 +1,34 @@
+//Copyright (C) 2019-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SERVER_H
+#define SERVER_H
+
+/**
+ * Serves clients connecting to a Unix domain socket until the process
+ * receives SIGINT or SIGTERM. Clients send statements one per line, as in
+ * batch mode; the results and messages of each statement are followed by a
+ * line reading ok or failed. Every client has its own evaluator, which
+ * keeps its input mode and reads the matrices it enters with ? from its
+ * connection, but all clients share the matrix memory. Connections are
+ * handed to a pool of worker threads, each serving one client at a time;
+ * clients connecting while every worker is busy wait for one to finish.
+ * Requires building with THREADSAFE=1.
+ * @param path Path of the socket; a socket already at that path is replaced
+ * @param workers Number of clients served at once, or 0 for one per processor
+ * @return 0 once the server has stopped, or 2 if it couldn't start
+ */
+int runServer(const char* path, int workers);
+
+#endif
@@ -0,0 +1,152 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "arena.h"
+#include "instrument.h"
+
+// size of the first block of the scratch arenas
+#define SCRATCH_CAPACITY (1 << 20)
+
+/**
+ * Block of memory obtained from the system; blocks form a list in the order
+ * in which they are filled
+ */
+struct ArenaBlock {
+	ArenaBlock* next;
+	size_t size;
+	size_t used;
+};
+
+static char* blockData(ArenaBlock* block) {
+	return (char*)block + MATRIX_ALIGN(sizeof(ArenaBlock));
+}
+
+static ArenaBlock* createBlock(size_t size) {
+	ArenaBlock* block = aligned_alloc(MATRIX_ALIGNMENT, MATRIX_ALIGN(sizeof(ArenaBlock)) + size);
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+MatrixArena* matrix_createArena(size_t capacity) {
+	MatrixArena* arena = malloc(sizeof(MatrixArena));
+	arena->first = createBlock(MATRIX_ALIGN(capacity ? capacity : MATRIX_ARENA_DEFAULT_CAPACITY));
+	arena->current = arena->first;
+	return arena;
+}
+
+void matrix_destroyArena(MatrixArena* arena) {
+	ArenaBlock* block = arena->first;
+	while (block) {
+		ArenaBlock* next = block->next;
+		free(block);
+		block = next;
+	}
+	free(arena);
+}
+
+void* matrix_arenaAlloc(MatrixArena* arena, size_t size) {
+	size = MATRIX_ALIGN(size);
+	ArenaBlock* block = arena->current;
+	while (block->used + size > block->size) {
+		if (block->next && block->next->size >= size) {
+			// reuse a block retained from before the last reset or release
+			block = block->next;
+			block->used = 0;
+		} else {
+			// grow geometrically so that few blocks are ever allocated
+			size_t grown = block->size * 2 > size ? block->size * 2 : size;
+			ArenaBlock* added = createBlock(grown);
+			added->next = block->next;
+			block->next = added;
+			block = added;
+		}
+	}
+	arena->current = block;
+	void* ptr = blockData(block) + block->used;
+	block->used += size;
+	return ptr;
+}
+
+Matrix* matrix_arenaMatrix(MatrixArena* arena, int rows, int cols) {
+	MATRIX_INSTRUMENT(0, matrix_storageSize(rows, cols));
+	Matrix* matrix = matrix_placeMatrix(matrix_arenaAlloc(arena, matrix_storageSize(rows, cols)), rows, cols);
+	matrix->flags |= MATRIX_BORROWED;
+	return matrix;
+}
+
+Matrix* matrix_arenaSubMatrix(MatrixArena* arena, const Matrix* matrix, int row, int col, int rows, int cols) {
+	if (row < 0 || col < 0 || rows < 0 || cols < 0 || row + rows > matrix->rows || col + cols > matrix->cols) {
+		return NULL;
+	}
+	Matrix* block = matrix_placeWrappedMatrix(matrix_arenaAlloc(arena, matrix_headerSize(rows, cols)),
+		matrix->data + (size_t)row * matrix->stride + col, rows, cols, matrix->stride);
+	block->flags |= MATRIX_BORROWED;
+	return block;
+}
+
+MatrixArenaMark matrix_arenaMark(const MatrixArena* arena) {
+	MatrixArenaMark mark = { arena->current, arena->current->used };
+	return mark;
+}
+
+void matrix_arenaRelease(MatrixArena* arena, MatrixArenaMark mark) {
+	arena->current = mark.block;
+	arena->current->used = mark.used;
+}
+
+void matrix_resetArena(MatrixArena* arena) {
+	arena->current = arena->first;
+	arena->current->used = 0;
+}
+
+#ifdef THREADSAFE
+
+#include <pthread.h>
+
+static pthread_key_t scratchKey;
+static pthread_once_t scratchOnce = PTHREAD_ONCE_INIT;
+
+static void destroyScratch(void* arena) {
+	matrix_destroyArena(arena);
+}
+
+static void createScratchKey() {
+	pthread_key_create(&scratchKey, destroyScratch);
+}
+
+MatrixArena* matrix_scratchArena() {
+	pthread_once(&scratchOnce, createScratchKey);
+	MatrixArena* arena = pthread_getspecific(scratchKey);
+	if (!arena) {
+		arena = matrix_createArena(SCRATCH_CAPACITY);
+		pthread_setspecific(scratchKey, arena);
+	}
+	return arena;
+}
+
+#else
+
+MatrixArena* matrix_scratchArena() {
+	static MatrixArena* scratch = NULL;
+	if (!scratch) {
+		scratch = matrix_createArena(SCRATCH_CAPACITY);
+	}
+	return scratch;
+}
+
+#endif
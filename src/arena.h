@@ -0,0 +1,127 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "matrix.h"
+
+// default size of the first block of an arena
+#define MATRIX_ARENA_DEFAULT_CAPACITY (1 << 20)
+
+typedef struct ArenaBlock ArenaBlock;
+
+/**
+ * Bump allocator for temporary matrices. Memory is obtained from the system
+ * in a few large blocks that are kept for reuse; individual allocations are
+ * never freed, instead the whole arena (or everything allocated after a
+ * mark) is released at once in O(1).
+ */
+typedef struct MatrixArena {
+	ArenaBlock* first;
+	ArenaBlock* current;
+} MatrixArena;
+
+/**
+ * Position in an arena to which it can later be rolled back
+ */
+typedef struct MatrixArenaMark {
+	ArenaBlock* block;
+	size_t used;
+} MatrixArenaMark;
+
+/**
+ * Creates an empty arena
+ * @param capacity Size of the first block in bytes (further blocks are allocated as needed)
+ * @return Pointer to the newly constructed arena
+ */
+MatrixArena* matrix_createArena(size_t capacity);
+
+/**
+ * Deallocates an arena along with everything allocated from it
+ * @param arena Arena to destroy
+ */
+void matrix_destroyArena(MatrixArena* arena);
+
+/**
+ * Allocates memory from an arena
+ * @param arena Arena from which to allocate
+ * @param size Number of bytes required
+ * @return Pointer to a block of at least size bytes aligned to MATRIX_ALIGNMENT
+ */
+void* matrix_arenaAlloc(MatrixArena* arena, size_t size);
+
+/**
+ * Creates an uninitialized matrix in an arena. The matrix is flagged as
+ * MATRIX_BORROWED, so matrix_destroyMatrix has no effect on it; it stays valid
+ * until the arena is reset, rolled back past it or destroyed.
+ * @param arena Arena from which to allocate
+ * @param rows Desired number of rows in the matrix
+ * @param cols Desired number of columns in the matrix
+ * @return Pointer to the newly constructed matrix
+ */
+Matrix* matrix_arenaMatrix(MatrixArena* arena, int rows, int cols);
+
+/**
+ * Creates a matrix referring to a block of another matrix (see
+ * matrix_subMatrix) with its header in an arena. The block is flagged as
+ * MATRIX_BORROWED and stays valid until the arena is reset, rolled back past
+ * it or destroyed, or until the matrix it refers to is destroyed.
+ * @param arena Arena from which to allocate
+ * @param matrix Matrix containing the block
+ * @param row First row of the block
+ * @param col First column of the block
+ * @param rows Number of rows in the block
+ * @param cols Number of columns in the block
+ * @return Pointer to the newly constructed block, or NULL if it doesn't lie within the matrix
+ */
+Matrix* matrix_arenaSubMatrix(MatrixArena* arena, const Matrix* matrix, int row, int col, int rows, int cols);
+
+/**
+ * Records the current position of an arena
+ * @param arena Arena whose position to record
+ * @return Mark to pass to matrix_arenaRelease
+ */
+MatrixArenaMark matrix_arenaMark(const MatrixArena* arena);
+
+/**
+ * Releases everything allocated from an arena since a mark was taken
+ * @param arena Arena to roll back
+ * @param mark Mark previously obtained from the same arena
+ */
+void matrix_arenaRelease(MatrixArena* arena, MatrixArenaMark mark);
+
+/**
+ * Releases everything allocated from an arena, keeping its blocks for reuse
+ * @param arena Arena to reset
+ */
+void matrix_resetArena(MatrixArena* arena);
+
+/**
+ * Determine the scratch arena of the calling thread, used by the library for
+ * the temporaries of its operations. Callers must release everything they
+ * allocate from it (using a mark) before returning.
+ * @return Arena private to the calling thread
+ */
+MatrixArena* matrix_scratchArena();
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
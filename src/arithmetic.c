@@ -13,27 +13,163 @@
 //along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include "arithmetic.h"
+#include "arena.h"
+#include "inverse.h"
+#include "gemm.h"
+#include "strassen.h"
+#include "parallel.h"
+#include "instrument.h"
+
+// rows per task for elementwise operations
+#define ELEMENTWISE_GRAIN 64
+
+// entries of a row combined at a time by matrix_linearCombination
+#define COMBINATION_CHUNK 256
+
+/**
+ * Arguments for elementwise operations split by rows
+ */
+typedef struct ElementwiseArgs {
+	Matrix* dst;
+	const Matrix* m1;
+	const Matrix* m2;
+	double scale;
+	double scale2;
+} ElementwiseArgs;
+
+static void addRows(int begin, int end, void* arg) {
+	ElementwiseArgs* args = arg;
+	for (int r = begin; r < end; r++) {
+		double* d = args->dst->matrix[r];
+		const double* a = args->m1->matrix[r];
+		const double* b = args->m2->matrix[r];
+		for (int c = 0; c < args->m1->cols; c++) {
+			d[c] = a[c] + b[c];
+		}
+	}
+}
 
 void matrix_add(Matrix* dst, const Matrix* m1, const Matrix* m2) {
+	MATRIX_INSTRUMENT((double)m1->rows * m1->cols, 24.0 * m1->rows * m1->cols);
 	if (m1->rows != m2->rows || m1->cols != m2->cols) {
 		return;
 	}
-	for (int r = 0; r < m1->rows; r++) {
-		for (int c = 0; c < m1->rows; c++) {
-			dst->matrix[r][c] = m1->matrix[r][c] + m2->matrix[r][c];
+	ElementwiseArgs args = { dst, m1, m2, 0, 0 };
+	matrix_parallelFor(0, m1->rows, ELEMENTWISE_GRAIN, (double)m1->rows * m1->cols, addRows, &args);
+}
+
+static void subtractRows(int begin, int end, void* arg) {
+	ElementwiseArgs* args = arg;
+	for (int r = begin; r < end; r++) {
+		double* d = args->dst->matrix[r];
+		const double* a = args->m1->matrix[r];
+		const double* b = args->m2->matrix[r];
+		for (int c = 0; c < args->m1->cols; c++) {
+			d[c] = a[c] - b[c];
 		}
 	}
 }
 
-void matrix_multiplyScalar(Matrix* dst, const Matrix* matrix, double scale) {
-	for (int r = 0; r < matrix->rows; r++) {
-		for (int c = 0; c < matrix->cols; c++) {
-			dst->matrix[r][c] = matrix->matrix[r][c] * scale;
+void matrix_subtract(Matrix* dst, const Matrix* m1, const Matrix* m2) {
+	MATRIX_INSTRUMENT((double)m1->rows * m1->cols, 24.0 * m1->rows * m1->cols);
+	if (m1->rows != m2->rows || m1->cols != m2->cols || dst->rows != m1->rows || dst->cols != m1->cols) {
+		return;
+	}
+	ElementwiseArgs args = { dst, m1, m2, 0, 0 };
+	matrix_parallelFor(0, m1->rows, ELEMENTWISE_GRAIN, (double)m1->rows * m1->cols, subtractRows, &args);
+}
+
+static void axpbyRows(int begin, int end, void* arg) {
+	ElementwiseArgs* args = arg;
+	double alpha = args->scale, beta = args->scale2;
+	for (int r = begin; r < end; r++) {
+		double* d = args->dst->matrix[r];
+		const double* a = args->m1->matrix[r];
+		const double* b = args->m2->matrix[r];
+		for (int c = 0; c < args->m1->cols; c++) {
+			d[c] = alpha * a[c] + beta * b[c];
 		}
 	}
 }
 
+void matrix_axpby(Matrix* dst, double alpha, const Matrix* a, double beta, const Matrix* b) {
+	MATRIX_INSTRUMENT(3.0 * a->rows * a->cols, 24.0 * a->rows * a->cols);
+	if (a->rows != b->rows || a->cols != b->cols || dst->rows != a->rows || dst->cols != a->cols) {
+		return;
+	}
+	ElementwiseArgs args = { dst, a, b, alpha, beta };
+	matrix_parallelFor(0, a->rows, ELEMENTWISE_GRAIN, 3.0 * a->rows * a->cols, axpbyRows, &args);
+}
+
+/**
+ * Arguments for computing a linear combination of matrices split by rows
+ */
+typedef struct CombinationArgs {
+	Matrix* dst;
+	int count;
+	const double* coefficients;
+	const Matrix* const* matrices;
+} CombinationArgs;
+
+static void combineRows(int begin, int end, void* arg) {
+	CombinationArgs* args = arg;
+	int cols = args->dst->cols;
+	// chunks are combined in a buffer, so the destination may be any of the operands
+	double sum[COMBINATION_CHUNK];
+	for (int r = begin; r < end; r++) {
+		for (int c0 = 0; c0 < cols; c0 += COMBINATION_CHUNK) {
+			int length = cols - c0 < COMBINATION_CHUNK ? cols - c0 : COMBINATION_CHUNK;
+			const double* a = args->matrices[0]->matrix[r] + c0;
+			double alpha = args->coefficients[0];
+			for (int c = 0; c < length; c++) {
+				sum[c] = alpha * a[c];
+			}
+			for (int i = 1; i < args->count; i++) {
+				a = args->matrices[i]->matrix[r] + c0;
+				alpha = args->coefficients[i];
+				for (int c = 0; c < length; c++) {
+					sum[c] += alpha * a[c];
+				}
+			}
+			memcpy(args->dst->matrix[r] + c0, sum, length * sizeof(double));
+		}
+	}
+}
+
+void matrix_linearCombination(Matrix* dst, int count, const double* coefficients, const Matrix* const* matrices) {
+	MATRIX_INSTRUMENT(2.0 * count * dst->rows * dst->cols, 8.0 * (count + 1) * dst->rows * dst->cols);
+	if (count < 1) {
+		return;
+	}
+	for (int i = 0; i < count; i++) {
+		if (matrices[i]->rows != dst->rows || matrices[i]->cols != dst->cols) {
+			return;
+		}
+	}
+	CombinationArgs args = { dst, count, coefficients, matrices };
+	matrix_parallelFor(0, dst->rows, ELEMENTWISE_GRAIN, 2.0 * count * dst->rows * dst->cols, combineRows, &args);
+}
+
+static void scaleRows(int begin, int end, void* arg) {
+	ElementwiseArgs* args = arg;
+	for (int r = begin; r < end; r++) {
+		double* d = args->dst->matrix[r];
+		const double* a = args->m1->matrix[r];
+		for (int c = 0; c < args->m1->cols; c++) {
+			d[c] = a[c] * args->scale;
+		}
+	}
+}
+
+void matrix_multiplyScalar(Matrix* dst, const Matrix* matrix, double scale) {
+	MATRIX_INSTRUMENT((double)matrix->rows * matrix->cols, 16.0 * matrix->rows * matrix->cols);
+	ElementwiseArgs args = { dst, matrix, NULL, scale, 0 };
+	matrix_parallelFor(0, matrix->rows, ELEMENTWISE_GRAIN, (double)matrix->rows * matrix->cols, scaleRows, &args);
+}
+
 void matrix_multiplyMatrix(Matrix* dst, const Matrix* m1, const Matrix* m2) {
+	MATRIX_INSTRUMENT(2.0 * m1->rows * m1->cols * m2->cols,
+		8.0 * ((double)m1->rows * m1->cols + (double)m2->rows * m2->cols + (double)m1->rows * m2->cols));
 	// matrices cannot be multiplied
 	if (m1->cols != m2->rows) {
 		return;
@@ -42,13 +178,85 @@ void matrix_multiplyMatrix(Matrix* dst, const Matrix* m1, const Matrix* m2) {
 	if (dst->rows != m1->rows || dst->cols != m2->cols) {
 		return;
 	}
-	for (int r = 0; r < dst->rows; r++) {
-		for (int c = 0; c < dst->cols; c++) {
-			double sum = 0;
-			for (int i = 0; i < m1->cols; i++) {
-				sum += m1->matrix[r][i] * m2->matrix[i][c];
+	int threshold = matrix_getStrassenThreshold();
+	if (threshold > 0 && m1->rows >= threshold && m1->cols >= threshold && m2->cols >= threshold) {
+		matrix_multiplyStrassen(dst, m1, m2, threshold);
+		return;
+	}
+	matrix_dgemm(dst->rows, dst->cols, m1->cols, 1,
+		m1->data, m1->stride, 1,
+		m2->data, m2->stride, 1,
+		0, dst->data, dst->stride);
+}
+
+void matrix_multiplyAccumulate(Matrix* dst, double alpha, const Matrix* m1, const Matrix* m2, double beta) {
+	MATRIX_INSTRUMENT(2.0 * m1->rows * m1->cols * m2->cols,
+		8.0 * ((double)m1->rows * m1->cols + (double)m2->rows * m2->cols + 2.0 * m1->rows * m2->cols));
+	if (m1->cols != m2->rows || dst->rows != m1->rows || dst->cols != m2->cols) {
+		return;
+	}
+	matrix_dgemm(dst->rows, dst->cols, m1->cols, alpha,
+		m1->data, m1->stride, 1,
+		m2->data, m2->stride, 1,
+		beta, dst->data, dst->stride);
+}
+
+int matrix_power(Matrix* dst, const Matrix* matrix, int power) {
+	MATRIX_INSTRUMENT(4.0 * matrix->rows * matrix->rows * matrix->rows * log2((power < 0 ? -(unsigned int)power : (unsigned int)power) + 1.0),
+		16.0 * matrix->rows * matrix->cols);
+	if (!matrix_isSquare(matrix) || dst->rows != matrix->rows || dst->cols != matrix->cols) {
+		return 0;
+	}
+	if (power == 0) {
+		matrix_makeIdentity(dst);
+		return 1;
+	}
+
+	int n = matrix->rows;
+	MatrixArena* scratch = matrix_scratchArena();
+	MatrixArenaMark mark = matrix_arenaMark(scratch);
+	Matrix* base = matrix_arenaMatrix(scratch, n, n);
+	if (power < 0) {
+		// the determinant can underflow for invertible matrices, so only a zero pivot means singular
+		LUFactorization* lu = matrix_arenaLUFactorization(scratch, n);
+		matrix_factorLU(lu, matrix);
+		if (lu->singular) {
+			matrix_arenaRelease(scratch, mark);
+			return 0;
+		}
+		matrix_luInvert(base, lu);
+	} else {
+		matrix_copyEntries(base, matrix);
+	}
+
+	// the product and the squares are ping-ponged with a single scratch
+	// buffer since the destination of a multiplication can't be an operand
+	Matrix* acc = matrix_arenaMatrix(scratch, n, n);
+	Matrix* tmp = matrix_arenaMatrix(scratch, n, n);
+	unsigned int exponent = power < 0 ? -(unsigned int)power : (unsigned int)power;
+	int first = 1;
+	while (1) {
+		if (exponent & 1) {
+			if (first) {
+				matrix_copyEntries(acc, base);
+				first = 0;
+			} else {
+				matrix_multiplyMatrix(tmp, acc, base);
+				Matrix* swap = acc;
+				acc = tmp;
+				tmp = swap;
 			}
-			dst->matrix[r][c] = sum;
 		}
+		exponent >>= 1;
+		if (!exponent) {
+			break;
+		}
+		matrix_multiplyMatrix(tmp, base, base);
+		Matrix* swap = base;
+		base = tmp;
+		tmp = swap;
 	}
+	matrix_copyEntries(dst, acc);
+	matrix_arenaRelease(scratch, mark);
+	return 1;
 }
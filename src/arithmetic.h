@@ -30,6 +30,38 @@ extern "C" {
  */
 void matrix_add(Matrix* dst, const Matrix* m1, const Matrix* m2);
 
+/**
+ * Subtracts the second matrix from the first. If the matrices are not of
+ * equal size, the arguments are left unchanged.
+ * @param dst Destination matrix in which to store the result (can be one of the operands)
+ * @param m1 Matrix to subtract from
+ * @param m2 Matrix to subtract
+ */
+void matrix_subtract(Matrix* dst, const Matrix* m1, const Matrix* m2);
+
+/**
+ * Computes the linear combination alpha * A + beta * B in a single pass over
+ * the entries. If the matrices are not of equal size, the arguments are left
+ * unchanged.
+ * @param dst Destination matrix in which to store the result (can be one of the operands)
+ * @param alpha Scale applied to A
+ * @param a First matrix
+ * @param beta Scale applied to B
+ * @param b Second matrix
+ */
+void matrix_axpby(Matrix* dst, double alpha, const Matrix* a, double beta, const Matrix* b);
+
+/**
+ * Computes the linear combination of any number of matrices in a single pass
+ * over the entries. If the matrices are not all of equal size, the arguments
+ * are left unchanged.
+ * @param dst Destination matrix in which to store the result (can be one of the operands)
+ * @param count Number of matrices (at least 1)
+ * @param coefficients Scale applied to each matrix
+ * @param matrices Matrices to combine
+ */
+void matrix_linearCombination(Matrix* dst, int count, const double* coefficients, const Matrix* const* matrices);
+
 /**
  * Multiplies a matrix by a scalar quantity
  * @param dst Destination matrix in which to store the result (can be the operand)
@@ -40,13 +72,41 @@ void matrix_multiplyScalar(Matrix* dst, const Matrix* matrix, double scale);
 
 /**
  * Multiplies two matrices. If the matrices do not have compatible dimensions,
- * the arguments are left unchanged.
+ * the arguments are left unchanged. Products whose dimensions all reach the
+ * threshold set with matrix_setStrassenThreshold are computed with
+ * matrix_multiplyStrassen.
  * @param dst Destination matrix in which to store the result (cannot be either of the operands)
  * @param m1 First matrix
  * @param m2 Second matrix
  */
 void matrix_multiplyMatrix(Matrix* dst, const Matrix* m1, const Matrix* m2);
 
+/**
+ * Multiplies two matrices and accumulates the product into the destination,
+ * computing dst = alpha * m1 * m2 + beta * dst without a temporary for the
+ * product. If the matrices do not have compatible dimensions, the arguments
+ * are left unchanged.
+ * @param dst Destination matrix (cannot be either of the operands); if beta is zero, its previous entries are ignored
+ * @param alpha Scale applied to the product
+ * @param m1 First matrix
+ * @param m2 Second matrix
+ * @param beta Scale applied to the previous entries of the destination
+ */
+void matrix_multiplyAccumulate(Matrix* dst, double alpha, const Matrix* m1, const Matrix* m2, double beta);
+
+/**
+ * Raises a square matrix to an integer power by repeated squaring, which takes
+ * O(log |power|) multiplications. Negative powers are powers of the inverse.
+ * If the matrix isn't square, the destination matrix has the wrong size or a
+ * negative power of a singular matrix is requested, the arguments are left
+ * unchanged and 0 is returned.
+ * @param dst Destination matrix in which to store the result (can be the operand)
+ * @param matrix Matrix to raise to the given power
+ * @param power Exponent (zero yields the identity matrix)
+ * @return Whether the power was computed
+ */
+int matrix_power(Matrix* dst, const Matrix* matrix, int power);
+
 #endif
 
 #ifdef __cplusplus
@@ -0,0 +1,390 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdatomic.h>
+
+#include "batch.h"
+#include "arena.h"
+#include "parallel.h"
+#include "instrument.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BATCH_X86
+#endif
+
+// chunks of MATRIX_BATCH_LANES matrices per task
+#define BATCH_GRAIN 64
+
+/**
+ * One entry of MATRIX_BATCH_LANES matrices. Arithmetic on vectors is
+ * elementwise, so every formula below is evaluated for a whole chunk of
+ * matrices at once using the widest vector registers of the target.
+ */
+typedef double BatchVec __attribute__((vector_size(MATRIX_BATCH_LANES * sizeof(double))));
+typedef long long BatchMask __attribute__((vector_size(MATRIX_BATCH_LANES * sizeof(long long))));
+
+#define BATCH_INLINE static inline __attribute__((always_inline))
+
+// vectors are passed by address so that their ABI never depends on the target
+BATCH_INLINE void load(BatchVec* v, const double* p) {
+	memcpy(v, p, sizeof(*v));
+}
+
+BATCH_INLINE void store(double* p, const BatchVec* v) {
+	memcpy(p, v, sizeof(*v));
+}
+
+/**
+ * Loads every entry of a chunk of n x n matrices
+ * @param a Entries of the first matrix of the chunk
+ * @param stride Distance between planes
+ * @param n Size of the matrices
+ * @param m Array in which to store the n * n entries
+ */
+BATCH_INLINE void loadChunk(const double* a, size_t stride, int n, BatchVec* m) {
+	for (int e = 0; e < n * n; e++) {
+		load(&m[e], a + e * stride);
+	}
+}
+
+BATCH_INLINE void storeChunk(double* c, size_t stride, int n, const BatchVec* m) {
+	for (int e = 0; e < n * n; e++) {
+		store(c + e * stride, &m[e]);
+	}
+}
+
+/**
+ * Multiplies a chunk of matrices; both operands are loaded before anything
+ * is stored, so the destination may be one of them
+ */
+BATCH_INLINE void multiplyChunk(int n, const double* a, const double* b, double* c, size_t stride) {
+	BatchVec x[MATRIX_BATCH_MAX_SIZE * MATRIX_BATCH_MAX_SIZE];
+	BatchVec y[MATRIX_BATCH_MAX_SIZE * MATRIX_BATCH_MAX_SIZE];
+	BatchVec z[MATRIX_BATCH_MAX_SIZE * MATRIX_BATCH_MAX_SIZE];
+	loadChunk(a, stride, n, x);
+	loadChunk(b, stride, n, y);
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < n; j++) {
+			BatchVec sum = x[i * n] * y[j];
+			for (int k = 1; k < n; k++) {
+				sum += x[i * n + k] * y[k * n + j];
+			}
+			z[i * n + j] = sum;
+		}
+	}
+	storeChunk(c, stride, n, z);
+}
+
+/**
+ * Computes the determinants of a chunk of matrices and, if inv is not NULL,
+ * their adjugates divided by the determinants using closed-form formulas
+ * @param n Size of the matrices (1 to 4)
+ * @param m Entries of the matrices
+ * @param inv Array in which to store the inverses, or NULL
+ * @param dets Where to store the determinants of the matrices
+ */
+BATCH_INLINE void closedForm(int n, const BatchVec* m, BatchVec* inv, BatchVec* dets) {
+	BatchVec det;
+	BatchVec adj[MATRIX_BATCH_MAX_SIZE * MATRIX_BATCH_MAX_SIZE];
+	switch (n) {
+		case 1:
+			det = m[0];
+			adj[0] = (BatchVec){ 0 } + 1;
+			break;
+		case 2:
+			det = m[0] * m[3] - m[1] * m[2];
+			adj[0] = m[3];
+			adj[1] = -m[1];
+			adj[2] = -m[2];
+			adj[3] = m[0];
+			break;
+		case 3:
+		{
+			// cofactors of the first row
+			BatchVec c0 = m[4] * m[8] - m[5] * m[7];
+			BatchVec c1 = m[5] * m[6] - m[3] * m[8];
+			BatchVec c2 = m[3] * m[7] - m[4] * m[6];
+			det = m[0] * c0 + m[1] * c1 + m[2] * c2;
+			if (!inv) {
+				*dets = det;
+				return;
+			}
+			adj[0] = c0;
+			adj[1] = m[2] * m[7] - m[1] * m[8];
+			adj[2] = m[1] * m[5] - m[2] * m[4];
+			adj[3] = c1;
+			adj[4] = m[0] * m[8] - m[2] * m[6];
+			adj[5] = m[2] * m[3] - m[0] * m[5];
+			adj[6] = c2;
+			adj[7] = m[1] * m[6] - m[0] * m[7];
+			adj[8] = m[0] * m[4] - m[1] * m[3];
+			break;
+		}
+		default:
+		{
+			// expansion by complementary minors: 2x2 determinants of the
+			// top two rows (s) and of the bottom two rows (c)
+			BatchVec s0 = m[0] * m[5] - m[4] * m[1];
+			BatchVec s1 = m[0] * m[6] - m[4] * m[2];
+			BatchVec s2 = m[0] * m[7] - m[4] * m[3];
+			BatchVec s3 = m[1] * m[6] - m[5] * m[2];
+			BatchVec s4 = m[1] * m[7] - m[5] * m[3];
+			BatchVec s5 = m[2] * m[7] - m[6] * m[3];
+			BatchVec c5 = m[10] * m[15] - m[14] * m[11];
+			BatchVec c4 = m[9] * m[15] - m[13] * m[11];
+			BatchVec c3 = m[9] * m[14] - m[13] * m[10];
+			BatchVec c2 = m[8] * m[15] - m[12] * m[11];
+			BatchVec c1 = m[8] * m[14] - m[12] * m[10];
+			BatchVec c0 = m[8] * m[13] - m[12] * m[9];
+			det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+			if (!inv) {
+				*dets = det;
+				return;
+			}
+			adj[0] = m[5] * c5 - m[6] * c4 + m[7] * c3;
+			adj[1] = -m[1] * c5 + m[2] * c4 - m[3] * c3;
+			adj[2] = m[13] * s5 - m[14] * s4 + m[15] * s3;
+			adj[3] = -m[9] * s5 + m[10] * s4 - m[11] * s3;
+			adj[4] = -m[4] * c5 + m[6] * c2 - m[7] * c1;
+			adj[5] = m[0] * c5 - m[2] * c2 + m[3] * c1;
+			adj[6] = -m[12] * s5 + m[14] * s2 - m[15] * s1;
+			adj[7] = m[8] * s5 - m[10] * s2 + m[11] * s1;
+			adj[8] = m[4] * c4 - m[5] * c2 + m[7] * c0;
+			adj[9] = -m[0] * c4 + m[1] * c2 - m[3] * c0;
+			adj[10] = m[12] * s4 - m[13] * s2 + m[15] * s0;
+			adj[11] = -m[8] * s4 + m[9] * s2 - m[11] * s0;
+			adj[12] = -m[4] * c3 + m[5] * c1 - m[6] * c0;
+			adj[13] = m[0] * c3 - m[1] * c1 + m[2] * c0;
+			adj[14] = -m[12] * s3 + m[13] * s1 - m[14] * s0;
+			adj[15] = m[8] * s3 - m[9] * s1 + m[10] * s0;
+			break;
+		}
+	}
+	if (inv) {
+		// singular matrices get a zero inverse instead of infinities
+		BatchMask nonsingular = det != 0;
+		BatchVec scale = (BatchVec)((BatchMask)(1 / det) & nonsingular);
+		for (int e = 0; e < n * n; e++) {
+			inv[e] = adj[e] * scale;
+		}
+	}
+	*dets = det;
+}
+
+/**
+ * Stores the lanes of a vector that correspond to matrices in the batch
+ */
+BATCH_INLINE void storeLanes(double* dst, const BatchVec* v, int lanes) {
+	if (lanes >= MATRIX_BATCH_LANES) {
+		store(dst, v);
+	} else {
+		memcpy(dst, v, lanes * sizeof(double));
+	}
+}
+
+/**
+ * Arguments for processing a range of chunks of a batch
+ */
+typedef struct BatchArgs {
+	int size;
+	int count;
+	size_t stride;
+	const double* a;
+	const double* b;
+	double* c;
+	double* dets;
+} BatchArgs;
+
+/**
+ * Kernels processing a range of chunks, compiled once per instruction set
+ */
+typedef void (*BatchKernel)(int begin, int end, void* arg);
+
+typedef struct BatchImpl {
+	BatchKernel multiply;
+	BatchKernel determinant;
+	BatchKernel invert;
+} BatchImpl;
+
+// the size is fixed before entering the loop so that every formula is fully unrolled
+#define BATCH_DISPATCH(n, body) \
+	switch (n) { \
+		case 1: { const int size = 1; body } break; \
+		case 2: { const int size = 2; body } break; \
+		case 3: { const int size = 3; body } break; \
+		default: { const int size = 4; body } break; \
+	}
+
+#define BATCH_KERNELS(suffix, attr) \
+	attr static void multiply##suffix(int begin, int end, void* arg) { \
+		BatchArgs* args = arg; \
+		BATCH_DISPATCH(args->size, \
+			for (int i = begin; i < end; i++) { \
+				size_t lane = (size_t)i * MATRIX_BATCH_LANES; \
+				multiplyChunk(size, args->a + lane, args->b + lane, args->c + lane, args->stride); \
+			}) \
+	} \
+	attr static void determinant##suffix(int begin, int end, void* arg) { \
+		BatchArgs* args = arg; \
+		BATCH_DISPATCH(args->size, \
+			for (int i = begin; i < end; i++) { \
+				int lane = i * MATRIX_BATCH_LANES; \
+				BatchVec m[MATRIX_BATCH_MAX_SIZE * MATRIX_BATCH_MAX_SIZE]; \
+				loadChunk(args->a + lane, args->stride, size, m); \
+				BatchVec det; \
+				closedForm(size, m, NULL, &det); \
+				storeLanes(args->dets + lane, &det, args->count - lane); \
+			}) \
+	} \
+	attr static void invert##suffix(int begin, int end, void* arg) { \
+		BatchArgs* args = arg; \
+		BATCH_DISPATCH(args->size, \
+			for (int i = begin; i < end; i++) { \
+				int lane = i * MATRIX_BATCH_LANES; \
+				BatchVec m[MATRIX_BATCH_MAX_SIZE * MATRIX_BATCH_MAX_SIZE]; \
+				loadChunk(args->a + lane, args->stride, size, m); \
+				BatchVec det; \
+				closedForm(size, m, m, &det); \
+				storeChunk(args->c + lane, args->stride, size, m); \
+				storeLanes(args->dets + lane, &det, args->count - lane); \
+			}) \
+	}
+
+BATCH_KERNELS(Generic, )
+
+#ifdef BATCH_X86
+BATCH_KERNELS(AVX2, __attribute__((target("avx2,fma"))))
+BATCH_KERNELS(AVX512, __attribute__((target("avx512f"))))
+#endif
+
+/**
+ * Selects the kernels for the widest vectors supported by the CPU the library is running on
+ * @return Batch kernels
+ */
+static const BatchImpl* selectImpl() {
+	static const BatchImpl generic = { multiplyGeneric, determinantGeneric, invertGeneric };
+#ifdef BATCH_X86
+	static const BatchImpl avx2 = { multiplyAVX2, determinantAVX2, invertAVX2 };
+	static const BatchImpl avx512 = { multiplyAVX512, determinantAVX512, invertAVX512 };
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return &avx512;
+	}
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		return &avx2;
+	}
+#endif
+	return &generic;
+}
+
+static const BatchImpl* getImpl() {
+	static const BatchImpl* _Atomic selected = NULL;
+	const BatchImpl* impl = atomic_load_explicit(&selected, memory_order_relaxed);
+	if (!impl) {
+		impl = selectImpl();
+		atomic_store_explicit(&selected, impl, memory_order_relaxed);
+	}
+	return impl;
+}
+
+/**
+ * Runs a kernel over every chunk of a batch
+ * @param kernel Kernel to run
+ * @param args Arguments of the kernel
+ * @param flops Number of floating point operations per matrix
+ */
+static void runBatch(BatchKernel kernel, BatchArgs* args, double flops) {
+	int chunks = (args->count + MATRIX_BATCH_LANES - 1) / MATRIX_BATCH_LANES;
+	matrix_parallelFor(0, chunks, BATCH_GRAIN, flops * args->count, kernel, args);
+}
+
+MatrixBatch* matrix_createBatch(int size, int count) {
+	if (size < 1 || size > MATRIX_BATCH_MAX_SIZE || count < 0) {
+		return NULL;
+	}
+	int stride = (count + MATRIX_BATCH_LANES - 1) / MATRIX_BATCH_LANES * MATRIX_BATCH_LANES;
+	size_t header = MATRIX_ALIGN(sizeof(MatrixBatch));
+	size_t bytes = (size_t)size * size * stride * sizeof(double);
+	MatrixBatch* batch = aligned_alloc(MATRIX_ALIGNMENT, MATRIX_ALIGN(header + bytes));
+	batch->size = size;
+	batch->count = count;
+	batch->stride = stride;
+	batch->data = (double*)((char*)batch + header);
+	// the padding lanes are processed along with the others, so they must hold valid numbers
+	memset(batch->data, 0, bytes);
+	return batch;
+}
+
+void matrix_destroyBatch(MatrixBatch* batch) {
+	free(batch);
+}
+
+void matrix_batchSet(MatrixBatch* batch, int index, const Matrix* matrix) {
+	if (matrix->rows != batch->size || matrix->cols != batch->size || index < 0 || index >= batch->count) {
+		return;
+	}
+	for (int r = 0; r < batch->size; r++) {
+		for (int c = 0; c < batch->size; c++) {
+			MATRIX_BATCH_ENTRY(batch, index, r, c) = matrix->matrix[r][c];
+		}
+	}
+}
+
+void matrix_batchGet(Matrix* dst, const MatrixBatch* batch, int index) {
+	if (dst->rows != batch->size || dst->cols != batch->size || index < 0 || index >= batch->count) {
+		return;
+	}
+	for (int r = 0; r < batch->size; r++) {
+		for (int c = 0; c < batch->size; c++) {
+			dst->matrix[r][c] = MATRIX_BATCH_ENTRY(batch, index, r, c);
+		}
+	}
+}
+
+void matrix_batchMultiply(MatrixBatch* dst, const MatrixBatch* b1, const MatrixBatch* b2) {
+	MATRIX_INSTRUMENT(2.0 * b1->count * b1->size * b1->size * b1->size, 24.0 * b1->count * b1->size * b1->size);
+	if (b1->size != b2->size || b1->count != b2->count || dst->size != b1->size || dst->count != b1->count) {
+		return;
+	}
+	BatchArgs args = { b1->size, b1->count, b1->stride, b1->data, b2->data, dst->data, NULL };
+	int n = b1->size;
+	runBatch(getImpl()->multiply, &args, 2.0 * n * n * n);
+}
+
+void matrix_batchDeterminant(double* dets, const MatrixBatch* batch) {
+	MATRIX_INSTRUMENT(2.0 * batch->count * batch->size * batch->size * batch->size, 8.0 * batch->count * (batch->size * batch->size + 1));
+	BatchArgs args = { batch->size, batch->count, batch->stride, batch->data, NULL, NULL, dets };
+	int n = batch->size;
+	runBatch(getImpl()->determinant, &args, n * n * n);
+}
+
+int matrix_batchInvert(MatrixBatch* dst, double* dets, const MatrixBatch* batch) {
+	MATRIX_INSTRUMENT(4.0 * batch->count * batch->size * batch->size * batch->size, 16.0 * batch->count * batch->size * batch->size);
+	if (dst->size != batch->size || dst->count != batch->count) {
+		return -1;
+	}
+	MatrixArena* scratch = matrix_scratchArena();
+	MatrixArenaMark mark = matrix_arenaMark(scratch);
+	double* out = dets ? dets : matrix_arenaAlloc(scratch, batch->count * sizeof(double));
+	BatchArgs args = { batch->size, batch->count, batch->stride, batch->data, NULL, dst->data, out };
+	int n = batch->size;
+	runBatch(getImpl()->invert, &args, 3.0 * n * n * n);
+
+	int singular = 0;
+	for (int i = 0; i < batch->count; i++) {
+		singular += out[i] == 0;
+	}
+	matrix_arenaRelease(scratch, mark);
+	return singular;
+}
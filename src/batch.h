@@ -0,0 +1,111 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "matrix.h"
+
+// number of matrices processed together by the batch kernels
+#define MATRIX_BATCH_LANES 8
+
+// largest size of the matrices in a batch
+#define MATRIX_BATCH_MAX_SIZE 4
+
+// entry (r, c) of matrix index of a batch
+#define MATRIX_BATCH_ENTRY(batch, index, r, c) \
+	((batch)->data[((r) * (batch)->size + (c)) * (size_t)(batch)->stride + (index)])
+
+/**
+ * Batch of small square matrices of the same size in structure-of-arrays
+ * layout: entry (r, c) of every matrix is stored in a contiguous plane, so
+ * the batch kernels can process MATRIX_BATCH_LANES matrices per instruction.
+ * Entry (r, c) of matrix i is at data[(r * size + c) * stride + i].
+ */
+typedef struct MatrixBatch {
+	// row and column count of every matrix (1 to MATRIX_BATCH_MAX_SIZE)
+	int size;
+	// number of matrices
+	int count;
+	// distance between planes, count rounded up to a multiple of MATRIX_BATCH_LANES
+	int stride;
+	double* data;
+} MatrixBatch;
+
+/**
+ * Creates a batch of zero matrices
+ * @param size Row and column count of the matrices (1 to MATRIX_BATCH_MAX_SIZE)
+ * @param count Number of matrices in the batch
+ * @return Pointer to the newly constructed batch, or NULL if the size is not supported
+ */
+MatrixBatch* matrix_createBatch(int size, int count);
+
+/**
+ * Deallocates the memory for a batch
+ * @param batch Batch to destroy
+ */
+void matrix_destroyBatch(MatrixBatch* batch);
+
+/**
+ * Copies a matrix into a batch
+ * @param batch Batch in which to store the matrix
+ * @param index Position of the matrix in the batch
+ * @param matrix Matrix to copy (must have the size of the matrices in the batch)
+ */
+void matrix_batchSet(MatrixBatch* batch, int index, const Matrix* matrix);
+
+/**
+ * Copies a matrix out of a batch
+ * @param dst Matrix in which to store the copy (must have the size of the matrices in the batch)
+ * @param batch Batch containing the matrix
+ * @param index Position of the matrix in the batch
+ */
+void matrix_batchGet(Matrix* dst, const MatrixBatch* batch, int index);
+
+/**
+ * Multiplies the matrices of two batches pairwise. If the batches don't have
+ * the same size and count, the destination is left unchanged.
+ * @param dst Batch in which to store the products (may be one of the operands)
+ * @param b1 Batch of left operands
+ * @param b2 Batch of right operands
+ */
+void matrix_batchMultiply(MatrixBatch* dst, const MatrixBatch* b1, const MatrixBatch* b2);
+
+/**
+ * Determine the determinants of the matrices of a batch
+ * @param dets Array of batch->count entries in which to store the determinants
+ * @param batch Batch of matrices
+ */
+void matrix_batchDeterminant(double* dets, const MatrixBatch* batch);
+
+/**
+ * Inverts the matrices of a batch. Singular matrices have no inverse; their
+ * entries in the destination are set to zero. If the batches don't have the
+ * same size and count, the arguments are left unchanged and -1 is returned.
+ * @param dst Batch in which to store the inverses (may be the same as batch)
+ * @param dets Array of batch->count entries in which to store the determinants, or NULL
+ * @param batch Batch of matrices to invert
+ * @return Number of singular matrices in the batch
+ */
+int matrix_batchInvert(MatrixBatch* dst, double* dets, const MatrixBatch* batch);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
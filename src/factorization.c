@@ -0,0 +1,779 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include "factorization.h"
+#include "gemm.h"
+#include "parallel.h"
+#include "instrument.h"
+
+// rows per task in the trailing update of the factorization
+#define LU_UPDATE_GRAIN 16
+// columns per task when solving for the inverse
+#define LU_SOLVE_GRAIN 32
+// rows of the solution computed together by triangular solves; the rows
+// above (below) a block are applied to it as one matrix product
+#define TRIANGULAR_BLOCK 64
+// columns factorized together by the Cholesky and QR factorizations; the
+// rest of the matrix is updated once per block with matrix products
+#define FACTOR_BLOCK 64
+
+LUFactorization* matrix_createLUFactorization(int size) {
+	LUFactorization* lu = malloc(sizeof(LUFactorization));
+	lu->lu = matrix_createMatrix(size, size);
+	lu->pivots = malloc(size * sizeof(int));
+	lu->sign = 1;
+	lu->singular = 1;
+	lu->rcond = 0;
+	return lu;
+}
+
+LUFactorization* matrix_arenaLUFactorization(MatrixArena* arena, int size) {
+	LUFactorization* lu = matrix_arenaAlloc(arena, sizeof(LUFactorization));
+	lu->lu = matrix_arenaMatrix(arena, size, size);
+	lu->pivots = matrix_arenaAlloc(arena, size * sizeof(int));
+	lu->sign = 1;
+	lu->singular = 1;
+	lu->rcond = 0;
+	return lu;
+}
+
+void matrix_destroyLUFactorization(LUFactorization* lu) {
+	matrix_destroyMatrix(lu->lu);
+	free(lu->pivots);
+	free(lu);
+}
+
+/**
+ * Solves Ax = b or A^T x = b for a single vector using a factorization of A
+ * @param lu Factorization of A (must be nonsingular)
+ * @param x Right hand side b, overwritten with the solution x
+ * @param work Workspace for the size of the matrix
+ * @param transpose Whether to solve the system with A^T instead of A
+ */
+static void solveVector(const LUFactorization* lu, double* x, double* work, int transpose) {
+	int n = lu->lu->rows;
+	double** a = lu->lu->matrix;
+	if (!transpose) {
+		// PAx = LUx = Pb
+		for (int i = 0; i < n; i++) {
+			work[i] = x[lu->pivots[i]];
+		}
+		for (int i = 0; i < n; i++) {
+			double sum = work[i];
+			for (int j = 0; j < i; j++) {
+				sum -= a[i][j] * work[j];
+			}
+			work[i] = sum;
+		}
+		for (int i = n - 1; i >= 0; i--) {
+			double sum = work[i];
+			for (int j = i + 1; j < n; j++) {
+				sum -= a[i][j] * work[j];
+			}
+			work[i] = sum / a[i][i];
+		}
+		memcpy(x, work, n * sizeof(double));
+	} else {
+		// A^T x = U^T L^T P x = b
+		memcpy(work, x, n * sizeof(double));
+		for (int i = 0; i < n; i++) {
+			work[i] /= a[i][i];
+			for (int j = i + 1; j < n; j++) {
+				work[j] -= a[i][j] * work[i];
+			}
+		}
+		for (int i = n - 1; i >= 0; i--) {
+			for (int j = 0; j < i; j++) {
+				work[j] -= a[i][j] * work[i];
+			}
+		}
+		for (int i = 0; i < n; i++) {
+			x[lu->pivots[i]] = work[i];
+		}
+	}
+}
+
+/**
+ * Estimates the 1-norm of the inverse of a factorized matrix using Hager's
+ * method, which only requires a handful of triangular solves
+ * @param lu Factorization of the matrix (must be nonsingular)
+ * @return Lower bound for the 1-norm of the inverse, usually within a small factor of it
+ */
+static double estimateInverseNorm(const LUFactorization* lu) {
+	int n = lu->lu->rows;
+	MatrixArena* scratch = matrix_scratchArena();
+	MatrixArenaMark mark = matrix_arenaMark(scratch);
+	double* x = matrix_arenaAlloc(scratch, 2 * n * sizeof(double));
+	double* work = x + n;
+	for (int i = 0; i < n; i++) {
+		x[i] = 1.0 / n;
+	}
+	double estimate = 0;
+	int last = -1;
+	for (int iter = 0; iter < 5; iter++) {
+		solveVector(lu, x, work, 0);
+		double norm = 0;
+		for (int i = 0; i < n; i++) {
+			norm += fabs(x[i]);
+		}
+		if (norm <= estimate) {
+			break;
+		}
+		estimate = norm;
+		for (int i = 0; i < n; i++) {
+			x[i] = x[i] >= 0 ? 1 : -1;
+		}
+		solveVector(lu, x, work, 1);
+		int j = 0;
+		for (int i = 1; i < n; i++) {
+			if (fabs(x[i]) > fabs(x[j])) {
+				j = i;
+			}
+		}
+		if (j == last) {
+			break;
+		}
+		last = j;
+		memset(x, 0, n * sizeof(double));
+		x[j] = 1;
+	}
+	matrix_arenaRelease(scratch, mark);
+	return estimate;
+}
+
+/**
+ * Arguments for eliminating below one pivot
+ */
+typedef struct EliminationArgs {
+	double** a;
+	int n;
+	int k;
+} EliminationArgs;
+
+static void eliminateRows(int begin, int end, void* arg) {
+	EliminationArgs* args = arg;
+	double** a = args->a;
+	int k = args->k;
+	for (int r = begin; r < end; r++) {
+		double l = a[r][k] /= a[k][k];
+		if (l == 0) {
+			continue;
+		}
+		for (int c = k + 1; c < args->n; c++) {
+			a[r][c] -= l * a[k][c];
+		}
+	}
+}
+
+int matrix_factorLU(LUFactorization* lu, const Matrix* matrix) {
+	MATRIX_INSTRUMENT(2.0 / 3 * matrix->rows * matrix->rows * matrix->rows, 16.0 * matrix->rows * matrix->cols);
+	int n = lu->lu->rows;
+	if (!matrix_isSquare(matrix) || matrix->rows != n) {
+		return 0;
+	}
+	matrix_copyEntries(lu->lu, matrix);
+	double** a = lu->lu->matrix;
+
+	// 1-norm of the input for the condition estimate
+	double anorm = 0;
+	for (int c = 0; c < n; c++) {
+		double sum = 0;
+		for (int r = 0; r < n; r++) {
+			sum += fabs(a[r][c]);
+		}
+		if (sum > anorm) {
+			anorm = sum;
+		}
+	}
+
+	lu->sign = 1;
+	lu->singular = 0;
+	for (int r = 0; r < n; r++) {
+		lu->pivots[r] = r;
+	}
+	for (int k = 0; k < n; k++) {
+		// choose the entry of largest magnitude in the column as the pivot
+		int p = k;
+		for (int r = k + 1; r < n; r++) {
+			if (fabs(a[r][k]) > fabs(a[p][k])) {
+				p = r;
+			}
+		}
+		if (p != k) {
+			for (int c = 0; c < n; c++) {
+				double tmp = a[k][c];
+				a[k][c] = a[p][c];
+				a[p][c] = tmp;
+			}
+			int tmp = lu->pivots[k];
+			lu->pivots[k] = lu->pivots[p];
+			lu->pivots[p] = tmp;
+			lu->sign = -lu->sign;
+		}
+		if (a[k][k] == 0) {
+			lu->singular = 1;
+			continue;
+		}
+		// eliminate below the pivot, updating the trailing rows
+		EliminationArgs args = { a, n, k };
+		double flops = 2.0 * (n - k - 1) * (n - k - 1);
+		matrix_parallelFor(k + 1, n, LU_UPDATE_GRAIN, flops, eliminateRows, &args);
+	}
+
+	if (lu->singular || anorm == 0) {
+		lu->singular = 1;
+		lu->rcond = 0;
+	} else {
+		lu->rcond = 1 / (anorm * estimateInverseNorm(lu));
+	}
+	return !lu->singular;
+}
+
+double matrix_luDeterminant(const LUFactorization* lu) {
+	if (lu->singular) {
+		return 0;
+	}
+	double det = lu->sign;
+	for (int i = 0; i < lu->lu->rows; i++) {
+		det *= lu->lu->matrix[i][i];
+	}
+	return det;
+}
+
+/**
+ * Arguments for solving for a range of columns of the inverse
+ */
+typedef struct InverseArgs {
+	const LUFactorization* lu;
+	Matrix* dst;
+} InverseArgs;
+
+static void solveInverseColumns(int begin, int end, void* arg) {
+	InverseArgs* args = arg;
+	int n = args->lu->lu->rows;
+	double** a = args->lu->lu->matrix;
+	double** x = args->dst->matrix;
+
+	// solve LUX = P one row at a time so that every update is a contiguous row operation
+	for (int r = 0; r < n; r++) {
+		for (int c = begin; c < end; c++) {
+			x[r][c] = args->lu->pivots[r] == c;
+		}
+	}
+	for (int r = 1; r < n; r++) {
+		for (int k = 0; k < r; k++) {
+			double l = a[r][k];
+			if (l == 0) {
+				continue;
+			}
+			for (int c = begin; c < end; c++) {
+				x[r][c] -= l * x[k][c];
+			}
+		}
+	}
+	for (int r = n - 1; r >= 0; r--) {
+		for (int k = r + 1; k < n; k++) {
+			double u = a[r][k];
+			if (u == 0) {
+				continue;
+			}
+			for (int c = begin; c < end; c++) {
+				x[r][c] -= u * x[k][c];
+			}
+		}
+		double scale = 1 / a[r][r];
+		for (int c = begin; c < end; c++) {
+			x[r][c] *= scale;
+		}
+	}
+}
+
+int matrix_luInvert(Matrix* dst, const LUFactorization* lu) {
+	MATRIX_INSTRUMENT(4.0 / 3 * lu->lu->rows * lu->lu->rows * lu->lu->rows, 16.0 * lu->lu->rows * lu->lu->rows);
+	int n = lu->lu->rows;
+	if (lu->singular || dst->rows != n || dst->cols != n) {
+		return 0;
+	}
+	// the columns of the inverse are independent of each other
+	InverseArgs args = { lu, dst };
+	matrix_parallelFor(0, n, LU_SOLVE_GRAIN, 2.0 * n * n * n, solveInverseColumns, &args);
+	return 1;
+}
+
+/**
+ * Arguments for solving a diagonal block of a triangular system for a range of columns
+ */
+typedef struct TriangularArgs {
+	const Matrix* t;
+	Matrix* x;
+	// rows of the diagonal block
+	int first;
+	int last;
+	int triangle;
+} TriangularArgs;
+
+static void solveDiagonalBlock(int begin, int end, void* arg) {
+	TriangularArgs* args = arg;
+	double** t = args->t->matrix;
+	double** x = args->x->matrix;
+	int unit = args->triangle & MATRIX_UNIT_DIAGONAL;
+	int transpose = args->triangle & MATRIX_TRANSPOSE;
+	// the transpose of a lower triangle is upper and vice versa
+	int upper = !(args->triangle & MATRIX_UPPER) != !transpose;
+	// every update is a contiguous row operation on the range of columns
+	for (int i = 0; i < args->last - args->first; i++) {
+		int r = upper ? args->last - 1 - i : args->first + i;
+		int from = upper ? r + 1 : args->first;
+		int to = upper ? args->last : r;
+		for (int k = from; k < to; k++) {
+			double l = transpose ? t[k][r] : t[r][k];
+			if (l == 0) {
+				continue;
+			}
+			for (int c = begin; c < end; c++) {
+				x[r][c] -= l * x[k][c];
+			}
+		}
+		if (!unit) {
+			double scale = 1 / t[r][r];
+			for (int c = begin; c < end; c++) {
+				x[r][c] *= scale;
+			}
+		}
+	}
+}
+
+/**
+ * Solves TX = B in place one block of rows at a time: the rows of X already
+ * solved are applied to a block with a single matrix product, leaving a
+ * small triangular system for the block
+ * @param t Matrix holding T (its diagonal must be nonzero unless MATRIX_UNIT_DIAGONAL is given)
+ * @param x Right hand sides, overwritten with the solution
+ * @param triangle MATRIX_LOWER or MATRIX_UPPER, optionally combined with
+ * MATRIX_UNIT_DIAGONAL and MATRIX_TRANSPOSE
+ */
+static void solveTriangularInPlace(const Matrix* t, Matrix* x, int triangle) {
+	int n = t->rows, m = x->cols;
+	// entry (r, c) of the triangle being solved is t->data[r * rs + c * cs]
+	ptrdiff_t rs = t->stride, cs = 1;
+	if (triangle & MATRIX_TRANSPOSE) {
+		rs = 1;
+		cs = t->stride;
+	}
+	int upper = !(triangle & MATRIX_UPPER) != !(triangle & MATRIX_TRANSPOSE);
+	for (int b = 0; b < n; b += TRIANGULAR_BLOCK) {
+		int size = n - b < TRIANGULAR_BLOCK ? n - b : TRIANGULAR_BLOCK;
+		// blocks are solved top down for lower and bottom up for upper triangles
+		int first = upper ? n - b - size : b;
+		int last = first + size;
+		if (upper) {
+			if (last < n) {
+				matrix_dgemm(size, m, n - last, -1,
+					t->data + first * rs + last * cs, rs, cs,
+					x->data + (size_t)last * x->stride, x->stride, 1,
+					1, x->data + (size_t)first * x->stride, x->stride);
+			}
+		} else if (first > 0) {
+			matrix_dgemm(size, m, first, -1,
+				t->data + first * rs, rs, cs,
+				x->data, x->stride, 1,
+				1, x->data + (size_t)first * x->stride, x->stride);
+		}
+		TriangularArgs args = { t, x, first, last, triangle };
+		matrix_parallelFor(0, m, LU_SOLVE_GRAIN, (double)size * size * m, solveDiagonalBlock, &args);
+	}
+}
+
+int matrix_solveTriangular(Matrix* x, const Matrix* t, const Matrix* b, int triangle) {
+	MATRIX_INSTRUMENT((double)t->rows * t->rows * b->cols, 8.0 * ((double)t->rows * t->rows / 2 + 2.0 * b->rows * b->cols));
+	int n = t->rows;
+	if (!matrix_isSquare(t) || b->rows != n || x->rows != n || x->cols != b->cols) {
+		return 0;
+	}
+	if (!(triangle & MATRIX_UNIT_DIAGONAL)) {
+		for (int i = 0; i < n; i++) {
+			if (t->matrix[i][i] == 0) {
+				return 0;
+			}
+		}
+	}
+	if (x != b) {
+		matrix_copyEntries(x, b);
+	}
+	solveTriangularInPlace(t, x, triangle);
+	return 1;
+}
+
+int matrix_luSolve(Matrix* x, const LUFactorization* lu, const Matrix* b) {
+	MATRIX_INSTRUMENT(2.0 * lu->lu->rows * lu->lu->rows * b->cols, 8.0 * ((double)lu->lu->rows * lu->lu->rows + 2.0 * b->rows * b->cols));
+	int n = lu->lu->rows;
+	if (lu->singular || b->rows != n || x->rows != n || x->cols != b->cols) {
+		return 0;
+	}
+	// PAX = LUX = PB, so the rows of B are permuted first
+	MatrixArena* scratch = matrix_scratchArena();
+	MatrixArenaMark mark = matrix_arenaMark(scratch);
+	const Matrix* source = b;
+	if (x == b) {
+		Matrix* copy = matrix_arenaMatrix(scratch, b->rows, b->cols);
+		matrix_copyEntries(copy, b);
+		source = copy;
+	}
+	for (int r = 0; r < n; r++) {
+		memcpy(x->matrix[r], source->matrix[lu->pivots[r]], b->cols * sizeof(double));
+	}
+	matrix_arenaRelease(scratch, mark);
+	solveTriangularInPlace(lu->lu, x, MATRIX_LOWER | MATRIX_UNIT_DIAGONAL);
+	solveTriangularInPlace(lu->lu, x, MATRIX_UPPER);
+	return 1;
+}
+
+int matrix_solve(Matrix* x, const Matrix* a, const Matrix* b) {
+	if (!matrix_isSquare(a) || b->rows != a->rows || x->rows != a->rows || x->cols != b->cols) {
+		return 0;
+	}
+	MatrixArena* scratch = matrix_scratchArena();
+	MatrixArenaMark mark = matrix_arenaMark(scratch);
+	LUFactorization* lu = matrix_arenaLUFactorization(scratch, a->rows);
+	int solved = matrix_factorLU(lu, a) && matrix_luSolve(x, lu, b);
+	matrix_arenaRelease(scratch, mark);
+	return solved;
+}
+
+CholeskyFactorization* matrix_createCholeskyFactorization(int size) {
+	CholeskyFactorization* chol = malloc(sizeof(CholeskyFactorization));
+	chol->l = matrix_createMatrix(size, size);
+	chol->positiveDefinite = 0;
+	return chol;
+}
+
+CholeskyFactorization* matrix_arenaCholeskyFactorization(MatrixArena* arena, int size) {
+	CholeskyFactorization* chol = matrix_arenaAlloc(arena, sizeof(CholeskyFactorization));
+	chol->l = matrix_arenaMatrix(arena, size, size);
+	chol->positiveDefinite = 0;
+	return chol;
+}
+
+void matrix_destroyCholeskyFactorization(CholeskyFactorization* chol) {
+	matrix_destroyMatrix(chol->l);
+	free(chol);
+}
+
+/**
+ * Arguments for solving the rows below a diagonal block of the Cholesky factor
+ */
+typedef struct CholeskyPanelArgs {
+	double** a;
+	// first column and width of the block
+	int k;
+	int size;
+} CholeskyPanelArgs;
+
+static void solveCholeskyPanel(int begin, int end, void* arg) {
+	CholeskyPanelArgs* args = arg;
+	double** a = args->a;
+	int k = args->k;
+	// row r of the panel is the solution x of L11 x^T = a_r^T
+	for (int r = begin; r < end; r++) {
+		double* x = a[r] + k;
+		for (int j = 0; j < args->size; j++) {
+			const double* l = a[k + j] + k;
+			double sum = x[j];
+			for (int p = 0; p < j; p++) {
+				sum -= x[p] * l[p];
+			}
+			x[j] = sum / l[j];
+		}
+	}
+}
+
+int matrix_factorCholesky(CholeskyFactorization* chol, const Matrix* matrix) {
+	MATRIX_INSTRUMENT(1.0 / 3 * matrix->rows * matrix->rows * matrix->rows, 16.0 * matrix->rows * matrix->cols);
+	int n = chol->l->rows;
+	if (!matrix_isSquare(matrix) || matrix->rows != n) {
+		return 0;
+	}
+	matrix_copyEntries(chol->l, matrix);
+	double** a = chol->l->matrix;
+	double* data = chol->l->data;
+	ptrdiff_t stride = chol->l->stride;
+	chol->positiveDefinite = 0;
+
+	for (int k = 0; k < n; k += FACTOR_BLOCK) {
+		int size = n - k < FACTOR_BLOCK ? n - k : FACTOR_BLOCK;
+		// the diagonal block has already received the updates from the
+		// columns to its left, leaving a small unblocked factorization
+		for (int j = k; j < k + size; j++) {
+			double d = a[j][j];
+			for (int p = k; p < j; p++) {
+				d -= a[j][p] * a[j][p];
+			}
+			if (!(d > 0)) {
+				return 0;
+			}
+			d = sqrt(d);
+			a[j][j] = d;
+			for (int r = j + 1; r < k + size; r++) {
+				double sum = a[r][j];
+				for (int p = k; p < j; p++) {
+					sum -= a[r][p] * a[j][p];
+				}
+				a[r][j] = sum / d;
+			}
+		}
+		int below = n - k - size;
+		if (below == 0) {
+			break;
+		}
+		// L21 = A21 L11^-T, one independent triangular solve per row
+		CholeskyPanelArgs args = { a, k, size };
+		matrix_parallelFor(k + size, n, LU_UPDATE_GRAIN, (double)size * size * below, solveCholeskyPanel, &args);
+		// A22 -= L21 L21^T, restricted to the lower triangle one block column at a time
+		for (int j = k + size; j < n; j += FACTOR_BLOCK) {
+			int width = n - j < FACTOR_BLOCK ? n - j : FACTOR_BLOCK;
+			const double* l21 = data + j * stride + k;
+			matrix_dgemm(n - j, width, size, -1,
+				l21, stride, 1,
+				l21, 1, stride,
+				1, data + j * stride + j, stride);
+		}
+	}
+	for (int r = 0; r < n; r++) {
+		memset(a[r] + r + 1, 0, (n - r - 1) * sizeof(double));
+	}
+	chol->positiveDefinite = 1;
+	return 1;
+}
+
+double matrix_choleskyDeterminant(const CholeskyFactorization* chol) {
+	if (!chol->positiveDefinite) {
+		return 0;
+	}
+	double det = 1;
+	for (int i = 0; i < chol->l->rows; i++) {
+		det *= chol->l->matrix[i][i] * chol->l->matrix[i][i];
+	}
+	return det;
+}
+
+int matrix_choleskySolve(Matrix* x, const CholeskyFactorization* chol, const Matrix* b) {
+	MATRIX_INSTRUMENT(2.0 * chol->l->rows * chol->l->rows * b->cols, 8.0 * ((double)chol->l->rows * chol->l->rows + 2.0 * b->rows * b->cols));
+	int n = chol->l->rows;
+	if (!chol->positiveDefinite || b->rows != n || x->rows != n || x->cols != b->cols) {
+		return 0;
+	}
+	if (x != b) {
+		matrix_copyEntries(x, b);
+	}
+	// LL^T X = B
+	solveTriangularInPlace(chol->l, x, MATRIX_LOWER);
+	solveTriangularInPlace(chol->l, x, MATRIX_LOWER | MATRIX_TRANSPOSE);
+	return 1;
+}
+
+QRFactorization* matrix_createQRFactorization(int rows, int cols) {
+	QRFactorization* qr = malloc(sizeof(QRFactorization));
+	qr->qr = matrix_createMatrix(rows, cols);
+	qr->tau = malloc((rows < cols ? rows : cols) * sizeof(double));
+	qr->rankDeficient = 1;
+	return qr;
+}
+
+QRFactorization* matrix_arenaQRFactorization(MatrixArena* arena, int rows, int cols) {
+	QRFactorization* qr = matrix_arenaAlloc(arena, sizeof(QRFactorization));
+	qr->qr = matrix_arenaMatrix(arena, rows, cols);
+	qr->tau = matrix_arenaAlloc(arena, (rows < cols ? rows : cols) * sizeof(double));
+	qr->rankDeficient = 1;
+	return qr;
+}
+
+void matrix_destroyQRFactorization(QRFactorization* qr) {
+	matrix_destroyMatrix(qr->qr);
+	free(qr->tau);
+	free(qr);
+}
+
+/**
+ * Applies Q^T = H_{k + size - 1} ... H_{k + 1} H_k for a block of reflectors
+ * of a QR factorization to rows k to m - 1 of a matrix C. The reflectors are
+ * combined into I - V T^T V^T with an upper triangular T so that the update
+ * is carried out with matrix products.
+ * @param qr Factorization holding the reflectors
+ * @param k Index of the first reflector of the block
+ * @param size Number of reflectors in the block
+ * @param c Entries of row k of C
+ * @param ldc Row stride of C
+ * @param cols Number of columns of C
+ */
+static void applyReflectorBlock(const QRFactorization* qr, int k, int size, double* c, ptrdiff_t ldc, int cols) {
+	int m = qr->qr->rows - k;
+	double** a = qr->qr->matrix;
+	const double* tau = qr->tau + k;
+	MatrixArena* scratch = matrix_scratchArena();
+	MatrixArenaMark mark = matrix_arenaMark(scratch);
+	double* v = matrix_arenaAlloc(scratch, (size_t)m * size * sizeof(double));
+	double* t = matrix_arenaAlloc(scratch, (size_t)size * size * sizeof(double));
+	double* col = matrix_arenaAlloc(scratch, (size_t)size * sizeof(double));
+	double* w = matrix_arenaAlloc(scratch, 2 * (size_t)size * cols * sizeof(double));
+	double* tw = w + (size_t)size * cols;
+
+	// V is unit lower trapezoidal with the vectors below the diagonal
+	for (int r = 0; r < m; r++) {
+		for (int j = 0; j < size; j++) {
+			v[r * size + j] = r > j ? a[k + r][k + j] : r == j;
+		}
+	}
+	// column i of T is -tau_i T V^T v_i above the diagonal and tau_i on it
+	memset(t, 0, (size_t)size * size * sizeof(double));
+	for (int i = 0; i < size; i++) {
+		t[i * size + i] = tau[i];
+		if (tau[i] == 0) {
+			continue;
+		}
+		for (int p = 0; p < i; p++) {
+			col[p] = 0;
+		}
+		for (int r = i; r < m; r++) {
+			double vi = v[r * size + i];
+			for (int p = 0; p < i; p++) {
+				col[p] += v[r * size + p] * vi;
+			}
+		}
+		for (int p = 0; p < i; p++) {
+			double sum = 0;
+			for (int q = p; q < i; q++) {
+				sum += t[p * size + q] * col[q];
+			}
+			t[p * size + i] = -tau[i] * sum;
+		}
+	}
+	// C -= V (T^T (V^T C))
+	matrix_dgemm(size, cols, m, 1, v, 1, size, c, ldc, 1, 0, w, cols);
+	matrix_dgemm(size, cols, size, 1, t, 1, size, w, cols, 1, 0, tw, cols);
+	matrix_dgemm(m, cols, size, -1, v, size, 1, tw, cols, 1, 1, c, ldc);
+	matrix_arenaRelease(scratch, mark);
+}
+
+int matrix_factorQR(QRFactorization* qr, const Matrix* matrix) {
+	MATRIX_INSTRUMENT(2.0 * matrix->rows * matrix->cols * matrix->cols, 16.0 * matrix->rows * matrix->cols);
+	int m = qr->qr->rows, n = qr->qr->cols;
+	if (matrix->rows != m || matrix->cols != n) {
+		return 0;
+	}
+	matrix_copyEntries(qr->qr, matrix);
+	double** a = qr->qr->matrix;
+	int reflectors = m < n ? m : n;
+	MatrixArena* scratch = matrix_scratchArena();
+	MatrixArenaMark mark = matrix_arenaMark(scratch);
+	double* w = matrix_arenaAlloc(scratch, FACTOR_BLOCK * sizeof(double));
+
+	qr->rankDeficient = 0;
+	for (int k = 0; k < reflectors; k += FACTOR_BLOCK) {
+		int size = reflectors - k < FACTOR_BLOCK ? reflectors - k : FACTOR_BLOCK;
+		// factorize the columns of the block one reflector at a time
+		for (int j = k; j < k + size; j++) {
+			double alpha = a[j][j];
+			double sigma = 0;
+			for (int r = j + 1; r < m; r++) {
+				sigma += a[r][j] * a[r][j];
+			}
+			double tau = 0;
+			if (sigma != 0) {
+				double beta = sqrt(alpha * alpha + sigma);
+				if (alpha > 0) {
+					beta = -beta;
+				}
+				tau = (beta - alpha) / beta;
+				double scale = 1 / (alpha - beta);
+				for (int r = j + 1; r < m; r++) {
+					a[r][j] *= scale;
+				}
+				a[j][j] = beta;
+			}
+			qr->tau[j] = tau;
+			if (a[j][j] == 0) {
+				qr->rankDeficient = 1;
+			}
+			// apply H_j = I - tau v v^T to the rest of the block
+			int width = k + size - j - 1;
+			if (tau == 0 || width == 0) {
+				continue;
+			}
+			memcpy(w, a[j] + j + 1, width * sizeof(double));
+			for (int r = j + 1; r < m; r++) {
+				double vr = a[r][j];
+				for (int c = 0; c < width; c++) {
+					w[c] += vr * a[r][j + 1 + c];
+				}
+			}
+			for (int c = 0; c < width; c++) {
+				a[j][j + 1 + c] -= tau * w[c];
+			}
+			for (int r = j + 1; r < m; r++) {
+				double vr = tau * a[r][j];
+				for (int c = 0; c < width; c++) {
+					a[r][j + 1 + c] -= vr * w[c];
+				}
+			}
+		}
+		// the columns to the right of the block receive all of its reflectors at once
+		if (k + size < n) {
+			applyReflectorBlock(qr, k, size, a[k] + k + size, qr->qr->stride, n - k - size);
+		}
+	}
+	if (m < n) {
+		// A has more columns than rows, so they can't be linearly independent
+		qr->rankDeficient = 1;
+	}
+	matrix_arenaRelease(scratch, mark);
+	return !qr->rankDeficient;
+}
+
+double matrix_qrDeterminant(const QRFactorization* qr) {
+	int n = qr->qr->rows;
+	if (qr->qr->cols != n) {
+		return 0;
+	}
+	// every reflector with a nonzero scale factor has determinant -1
+	double det = 1;
+	for (int i = 0; i < n; i++) {
+		det *= qr->tau[i] != 0 ? -qr->qr->matrix[i][i] : qr->qr->matrix[i][i];
+	}
+	return det;
+}
+
+int matrix_qrSolve(Matrix* x, const QRFactorization* qr, const Matrix* b) {
+	int m = qr->qr->rows, n = qr->qr->cols;
+	MATRIX_INSTRUMENT((4.0 * m - n) * n * b->cols, 8.0 * ((double)m * n + 2.0 * b->rows * b->cols));
+	if (m < n || qr->rankDeficient || b->rows != m || x->rows != n || x->cols != b->cols) {
+		return 0;
+	}
+	MatrixArena* scratch = matrix_scratchArena();
+	MatrixArenaMark mark = matrix_arenaMark(scratch);
+	// R X = (Q^T B) restricted to its first n rows
+	Matrix* y = matrix_arenaMatrix(scratch, m, b->cols);
+	matrix_copyEntries(y, b);
+	for (int k = 0; k < n; k += FACTOR_BLOCK) {
+		int size = n - k < FACTOR_BLOCK ? n - k : FACTOR_BLOCK;
+		applyReflectorBlock(qr, k, size, y->matrix[k], y->stride, y->cols);
+	}
+	// R is the leading n x n block; the header only needs its size changed
+	Matrix r = *qr->qr;
+	r.rows = n;
+	y->rows = n;
+	solveTriangularInPlace(&r, y, MATRIX_UPPER);
+	matrix_copyEntries(x, y);
+	matrix_arenaRelease(scratch, mark);
+	return 1;
+}
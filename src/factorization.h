@@ -0,0 +1,281 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef FACTORIZATION_H
+#define FACTORIZATION_H
+
+#include "matrix.h"
+#include "arena.h"
+
+// triangle of a matrix used by matrix_solveTriangular
+#define MATRIX_LOWER 0
+#define MATRIX_UPPER 1
+
+// flag for triangles whose diagonal entries are all 1; the stored diagonal is ignored
+#define MATRIX_UNIT_DIAGONAL 2
+
+// flag for solving with the transpose of the triangle
+#define MATRIX_TRANSPOSE 4
+
+/**
+ * LU factorization with partial pivoting of a square matrix A, such that
+ * PA = LU for a row permutation P, a unit lower triangular L and an upper
+ * triangular U. A factorization can be reused for any number of matrices of
+ * the size it was created for.
+ */
+typedef struct LUFactorization {
+	// U on and above the diagonal, L below it (the unit diagonal of L is implied)
+	Matrix* lu;
+	// row r of PA is row pivots[r] of A
+	int* pivots;
+	// determinant of P (1 or -1)
+	int sign;
+	// whether a zero pivot was encountered i.e. whether A is singular
+	int singular;
+	// estimate of the reciprocal of the 1-norm condition number of A
+	// (0 if A is singular, close to 1 if A is well conditioned)
+	double rcond;
+} LUFactorization;
+
+/**
+ * Cholesky factorization of a symmetric positive definite matrix A, such
+ * that A = LL^T for a lower triangular L with a positive diagonal.
+ */
+typedef struct CholeskyFactorization {
+	// L on and below the diagonal, zeros above it
+	Matrix* l;
+	// whether A was found to be positive definite
+	int positiveDefinite;
+} CholeskyFactorization;
+
+/**
+ * Householder QR factorization of an m x n matrix A, such that A = QR for an
+ * orthogonal Q and an upper triangular (trapezoidal if m < n) R. Q is the
+ * product of min(m, n) reflectors H_j = I - tau_j v_j v_j^T, which are
+ * applied in blocks through matrix products.
+ */
+typedef struct QRFactorization {
+	// R on and above the diagonal; below it, v_j below the (implied unit) diagonal entry of column j
+	Matrix* qr;
+	// min(m, n) scale factors of the reflectors
+	double* tau;
+	// whether R has a zero on its diagonal i.e. whether the columns of A are linearly dependent
+	int rankDeficient;
+} QRFactorization;
+
+/**
+ * Creates an LU factorization object for matrices of a given size
+ * @param size Row and column count of the matrices to factorize
+ * @return Pointer to the newly constructed factorization object
+ */
+LUFactorization* matrix_createLUFactorization(int size);
+
+/**
+ * Creates an LU factorization object in an arena. It must not be passed to
+ * matrix_destroyLUFactorization; its memory is released along with the arena.
+ * @param arena Arena from which to allocate
+ * @param size Row and column count of the matrices to factorize
+ * @return Pointer to the newly constructed factorization object
+ */
+LUFactorization* matrix_arenaLUFactorization(MatrixArena* arena, int size);
+
+/**
+ * Deallocates the memory for an LU factorization object
+ * @param lu Factorization to destroy
+ */
+void matrix_destroyLUFactorization(LUFactorization* lu);
+
+/**
+ * Computes the LU factorization of a matrix, replacing any factorization
+ * previously stored in the given object. If the matrix is not square or
+ * doesn't have the size of the factorization object, the arguments are left
+ * unchanged and 0 is returned.
+ * @param lu Factorization object in which to store the result
+ * @param matrix Matrix to factorize
+ * @return Whether the matrix is nonsingular
+ */
+int matrix_factorLU(LUFactorization* lu, const Matrix* matrix);
+
+/**
+ * Determine the determinant of a factorized matrix
+ * @param lu Factorization of the matrix
+ * @return Determinant of the matrix
+ */
+double matrix_luDeterminant(const LUFactorization* lu);
+
+/**
+ * Determine the inverse of a factorized matrix. If the matrix is singular
+ * or the destination matrix has the wrong size, the destination is left
+ * unchanged and 0 is returned.
+ * @param dst Destination matrix in which to store the inverse
+ * @param lu Factorization of the matrix
+ * @return Whether the inverse was computed
+ */
+int matrix_luInvert(Matrix* dst, const LUFactorization* lu);
+
+/**
+ * Creates a Cholesky factorization object for matrices of a given size
+ * @param size Row and column count of the matrices to factorize
+ * @return Pointer to the newly constructed factorization object
+ */
+CholeskyFactorization* matrix_createCholeskyFactorization(int size);
+
+/**
+ * Creates a Cholesky factorization object in an arena. It must not be passed
+ * to matrix_destroyCholeskyFactorization; its memory is released along with the arena.
+ * @param arena Arena from which to allocate
+ * @param size Row and column count of the matrices to factorize
+ * @return Pointer to the newly constructed factorization object
+ */
+CholeskyFactorization* matrix_arenaCholeskyFactorization(MatrixArena* arena, int size);
+
+/**
+ * Deallocates the memory for a Cholesky factorization object
+ * @param chol Factorization to destroy
+ */
+void matrix_destroyCholeskyFactorization(CholeskyFactorization* chol);
+
+/**
+ * Computes the Cholesky factorization of a symmetric matrix, replacing any
+ * factorization previously stored in the given object. Only the lower
+ * triangle of the matrix is read. If the matrix is not square or doesn't
+ * have the size of the factorization object, the arguments are left
+ * unchanged and 0 is returned.
+ * @param chol Factorization object in which to store the result
+ * @param matrix Matrix to factorize
+ * @return Whether the matrix is positive definite
+ */
+int matrix_factorCholesky(CholeskyFactorization* chol, const Matrix* matrix);
+
+/**
+ * Determine the determinant of a matrix from its Cholesky factorization
+ * @param chol Factorization of the matrix
+ * @return Determinant of the matrix, or 0 if it isn't positive definite
+ */
+double matrix_choleskyDeterminant(const CholeskyFactorization* chol);
+
+/**
+ * Solves AX = B for X using a Cholesky factorization of A, for any number
+ * of right hand sides at once. If the matrix isn't positive definite or the
+ * sizes don't match, the destination is left unchanged and 0 is returned.
+ * @param x Destination matrix in which to store the solution (can be b)
+ * @param chol Factorization of A
+ * @param b Right hand sides, one per column
+ * @return Whether the system was solved
+ */
+int matrix_choleskySolve(Matrix* x, const CholeskyFactorization* chol, const Matrix* b);
+
+/**
+ * Creates a QR factorization object for matrices of a given size
+ * @param rows Row count of the matrices to factorize
+ * @param cols Column count of the matrices to factorize
+ * @return Pointer to the newly constructed factorization object
+ */
+QRFactorization* matrix_createQRFactorization(int rows, int cols);
+
+/**
+ * Creates a QR factorization object in an arena. It must not be passed to
+ * matrix_destroyQRFactorization; its memory is released along with the arena.
+ * @param arena Arena from which to allocate
+ * @param rows Row count of the matrices to factorize
+ * @param cols Column count of the matrices to factorize
+ * @return Pointer to the newly constructed factorization object
+ */
+QRFactorization* matrix_arenaQRFactorization(MatrixArena* arena, int rows, int cols);
+
+/**
+ * Deallocates the memory for a QR factorization object
+ * @param qr Factorization to destroy
+ */
+void matrix_destroyQRFactorization(QRFactorization* qr);
+
+/**
+ * Computes the QR factorization of a matrix, replacing any factorization
+ * previously stored in the given object. If the matrix doesn't have the size
+ * of the factorization object, the arguments are left unchanged and 0 is
+ * returned.
+ * @param qr Factorization object in which to store the result
+ * @param matrix Matrix to factorize
+ * @return Whether the columns of the matrix are linearly independent
+ */
+int matrix_factorQR(QRFactorization* qr, const Matrix* matrix);
+
+/**
+ * Determine the determinant of a square matrix from its QR factorization
+ * @param qr Factorization of the matrix
+ * @return Determinant of the matrix, or 0 if it isn't square
+ */
+double matrix_qrDeterminant(const QRFactorization* qr);
+
+/**
+ * Computes the least squares solution X minimizing the 2-norm of each column
+ * of AX - B using a QR factorization of an m x n matrix A with m >= n, for
+ * any number of right hand sides at once. For square A, this solves AX = B.
+ * If A has fewer rows than columns, its columns are linearly dependent or
+ * the sizes don't match, the destination is left unchanged and 0 is
+ * returned.
+ * @param x Destination n x k matrix in which to store the solution
+ * @param qr Factorization of A
+ * @param b m x k matrix of right hand sides, one per column
+ * @return Whether the system was solved
+ */
+int matrix_qrSolve(Matrix* x, const QRFactorization* qr, const Matrix* b);
+
+/**
+ * Solves AX = B for X using a factorization of A, for any number of right
+ * hand sides at once. If the matrix is singular or the sizes don't match,
+ * the destination is left unchanged and 0 is returned.
+ * @param x Destination matrix in which to store the solution (can be b)
+ * @param lu Factorization of A
+ * @param b Right hand sides, one per column
+ * @return Whether the system was solved
+ */
+int matrix_luSolve(Matrix* x, const LUFactorization* lu, const Matrix* b);
+
+/**
+ * Solves TX = B for X, where T is the lower or upper triangle of a square
+ * matrix, for any number of right hand sides at once. Entries outside the
+ * triangle are ignored. If T has a zero on its diagonal or the sizes don't
+ * match, the destination is left unchanged and 0 is returned.
+ * @param x Destination matrix in which to store the solution (can be b)
+ * @param t Matrix holding T
+ * @param b Right hand sides, one per column
+ * @param triangle MATRIX_LOWER or MATRIX_UPPER, optionally combined with
+ * MATRIX_UNIT_DIAGONAL and with MATRIX_TRANSPOSE to solve T^T X = B instead
+ * @return Whether the system was solved
+ */
+int matrix_solveTriangular(Matrix* x, const Matrix* t, const Matrix* b, int triangle);
+
+/**
+ * Solves AX = B for X by LU factorization with partial pivoting, without
+ * forming the inverse of A. To solve several systems with the same matrix,
+ * factorize it once with matrix_factorLU and use matrix_luSolve.
+ * If A is singular or the sizes don't match, the destination is left
+ * unchanged and 0 is returned.
+ * @param x Destination matrix in which to store the solution (can be b)
+ * @param a Square matrix of coefficients
+ * @param b Right hand sides, one per column
+ * @return Whether the system was solved
+ */
+int matrix_solve(Matrix* x, const Matrix* a, const Matrix* b);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,555 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+// C++ only: header-only matrices whose size is known at compile time
+
+#ifndef FIXEDMATRIX_H
+#define FIXEDMATRIX_H
+
+#include <cmath>
+#include <type_traits>
+
+#include "matrix.h"
+
+namespace matrix {
+
+/**
+ * Calls a function with 0, 1, ..., N - 1. The calls are expanded at compile
+ * time, so loops written with Unroll have no loop overhead at all.
+ */
+template <int N>
+struct Unroll {
+	template <typename F>
+	static inline void run(F&& f) {
+		Unroll<N - 1>::run(f);
+		f(N - 1);
+	}
+};
+
+template <>
+struct Unroll<0> {
+	template <typename F>
+	static inline void run(F&&) {}
+};
+
+template <typename T, int R, int C>
+class Matrix;
+
+/**
+ * View of a fixed-size double matrix as a C matrix, so that it can be passed
+ * to the functions of the C API without copying or allocating anything. The
+ * view refers to the entries of the fixed-size matrix and must not outlive it.
+ */
+template <int R, int C>
+class MatrixRef {
+	::Matrix header;
+	// like every library matrix, the row table has room for the rows of the
+	// transpose, so the view can be transposed in place
+	double* rowTable[R > C ? R : C];
+public:
+	explicit MatrixRef(double (&entries)[R][C]) {
+		header.rows = R;
+		header.cols = C;
+		header.stride = C;
+		header.flags = MATRIX_BORROWED;
+		header.data = &entries[0][0];
+		header.matrix = rowTable;
+		Unroll<R>::run([&](int r) {
+			rowTable[r] = entries[r];
+		});
+	}
+
+	// the header points into the row table, so copies must point into their own
+	MatrixRef(const MatrixRef& other) : header(other.header) {
+		header.matrix = rowTable;
+		for (int r = 0; r < header.rows; r++) {
+			rowTable[r] = header.data + (size_t)r * header.stride;
+		}
+	}
+
+	MatrixRef& operator=(const MatrixRef&) = delete;
+
+	::Matrix* get() {
+		return &header;
+	}
+
+	operator ::Matrix*() {
+		return &header;
+	}
+
+	operator const ::Matrix*() const {
+		return &header;
+	}
+};
+
+/**
+ * Matrix with entries of type T whose size is part of its type. Entries are
+ * stored inline (on the stack for local variables), every operation is
+ * unrolled at compile time and operands of incompatible sizes are rejected by
+ * the compiler.
+ */
+template <typename T, int R, int C>
+class Matrix {
+	static_assert(R > 0 && C > 0, "matrix dimensions must be positive");
+	static_assert(std::is_arithmetic<T>::value, "matrix entries must be arithmetic");
+
+	T entries[R][C];
+public:
+	static constexpr int rows = R;
+	static constexpr int cols = C;
+
+	/**
+	 * Creates an uninitialized matrix
+	 */
+	Matrix() = default;
+
+	/**
+	 * Creates a matrix with the given entries in row-major order. Exactly
+	 * R * C entries must be given.
+	 */
+	template <typename... Args>
+	Matrix(T first, Args... rest) {
+		static_assert(sizeof...(Args) + 1 == R * C, "wrong number of entries for matrix size");
+		const T values[] = { first, static_cast<T>(rest)... };
+		Unroll<R>::run([&](int r) {
+			Unroll<C>::run([&](int c) {
+				entries[r][c] = values[r * C + c];
+			});
+		});
+	}
+
+	/**
+	 * Creates a matrix with every entry set to the same value
+	 * @param value Value of the entries
+	 * @return New matrix
+	 */
+	static Matrix filled(T value) {
+		Matrix m;
+		Unroll<R>::run([&](int r) {
+			Unroll<C>::run([&](int c) {
+				m.entries[r][c] = value;
+			});
+		});
+		return m;
+	}
+
+	static Matrix zero() {
+		return filled(T(0));
+	}
+
+	static Matrix identity() {
+		static_assert(R == C, "identity matrices must be square");
+		Matrix m = zero();
+		Unroll<R>::run([&](int i) {
+			m.entries[i][i] = T(1);
+		});
+		return m;
+	}
+
+	T& operator()(int r, int c) {
+		return entries[r][c];
+	}
+
+	const T& operator()(int r, int c) const {
+		return entries[r][c];
+	}
+
+	/**
+	 * Copies the entries of a C matrix. If its size differs from the size of
+	 * this matrix, nothing is copied and false is returned.
+	 * @param m Matrix to copy
+	 * @return Whether the entries were copied
+	 */
+	bool load(const ::Matrix* m) {
+		if (m->rows != R || m->cols != C) {
+			return false;
+		}
+		Unroll<R>::run([&](int r) {
+			Unroll<C>::run([&](int c) {
+				entries[r][c] = static_cast<T>(m->matrix[r][c]);
+			});
+		});
+		return true;
+	}
+
+	/**
+	 * Copies the entries of this matrix into a C matrix. If its size differs
+	 * from the size of this matrix, nothing is copied and false is returned.
+	 * @param m Destination matrix
+	 * @return Whether the entries were copied
+	 */
+	bool store(::Matrix* m) const {
+		if (m->rows != R || m->cols != C) {
+			return false;
+		}
+		Unroll<R>::run([&](int r) {
+			Unroll<C>::run([&](int c) {
+				m->matrix[r][c] = static_cast<double>(entries[r][c]);
+			});
+		});
+		return true;
+	}
+
+	/**
+	 * Creates a C matrix with the entries of this matrix
+	 * @return Newly allocated matrix, to be destroyed with matrix_destroyMatrix
+	 */
+	::Matrix* toMatrix() const {
+		::Matrix* m = matrix_createMatrix(R, C);
+		store(m);
+		return m;
+	}
+
+	/**
+	 * Views a double matrix as a C matrix without copying it
+	 * @return View referring to the entries of this matrix
+	 */
+	MatrixRef<R, C> ref() {
+		static_assert(std::is_same<T, double>::value, "only double matrices can be viewed as C matrices");
+		return MatrixRef<R, C>(entries);
+	}
+
+	Matrix<T, C, R> transpose() const {
+		Matrix<T, C, R> t;
+		Unroll<R>::run([&](int r) {
+			Unroll<C>::run([&](int c) {
+				t(c, r) = entries[r][c];
+			});
+		});
+		return t;
+	}
+
+	Matrix operator+(const Matrix& other) const {
+		Matrix sum;
+		Unroll<R>::run([&](int r) {
+			Unroll<C>::run([&](int c) {
+				sum.entries[r][c] = entries[r][c] + other.entries[r][c];
+			});
+		});
+		return sum;
+	}
+
+	Matrix operator-(const Matrix& other) const {
+		Matrix diff;
+		Unroll<R>::run([&](int r) {
+			Unroll<C>::run([&](int c) {
+				diff.entries[r][c] = entries[r][c] - other.entries[r][c];
+			});
+		});
+		return diff;
+	}
+
+	Matrix operator-() const {
+		return *this * T(-1);
+	}
+
+	Matrix operator*(T scale) const {
+		Matrix scaled;
+		Unroll<R>::run([&](int r) {
+			Unroll<C>::run([&](int c) {
+				scaled.entries[r][c] = entries[r][c] * scale;
+			});
+		});
+		return scaled;
+	}
+
+	template <int K>
+	Matrix<T, R, K> operator*(const Matrix<T, C, K>& other) const {
+		Matrix<T, R, K> product;
+		Unroll<R>::run([&](int r) {
+			Unroll<K>::run([&](int c) {
+				T sum = entries[r][0] * other(0, c);
+				Unroll<C - 1>::run([&](int k) {
+					sum += entries[r][k + 1] * other(k + 1, c);
+				});
+				product(r, c) = sum;
+			});
+		});
+		return product;
+	}
+
+	Matrix& operator+=(const Matrix& other) {
+		return *this = *this + other;
+	}
+
+	Matrix& operator-=(const Matrix& other) {
+		return *this = *this - other;
+	}
+
+	Matrix& operator*=(T scale) {
+		return *this = *this * scale;
+	}
+
+	bool operator==(const Matrix& other) const {
+		bool equal = true;
+		Unroll<R>::run([&](int r) {
+			Unroll<C>::run([&](int c) {
+				equal = equal && entries[r][c] == other.entries[r][c];
+			});
+		});
+		return equal;
+	}
+
+	bool operator!=(const Matrix& other) const {
+		return !(*this == other);
+	}
+
+	/**
+	 * Determine the determinant of the matrix using closed-form formulas up to
+	 * 4x4 and Gaussian elimination with partial pivoting for larger matrices
+	 * @return Determinant of the matrix
+	 */
+	T determinant() const;
+
+	/**
+	 * Determine the inverse of the matrix using the adjugate up to 4x4 and
+	 * Gauss-Jordan elimination for larger matrices. If the matrix is singular,
+	 * the destination is left unchanged.
+	 * @param dst Matrix in which to store the inverse
+	 * @return Determinant of the matrix (0 if it is singular)
+	 */
+	T invert(Matrix& dst) const;
+};
+
+template <typename T, int R, int C>
+Matrix<T, R, C> operator*(T scale, const Matrix<T, R, C>& m) {
+	return m * scale;
+}
+
+/**
+ * Closed-form determinants and adjugates of square matrices of size N
+ */
+template <typename T, int N>
+struct SquareOps {
+	// Gaussian elimination with partial pivoting on a copy of the matrix
+	static T determinant(const Matrix<T, N, N>& m) {
+		static_assert(std::is_floating_point<T>::value, "determinants above 4x4 require floating point entries");
+		Matrix<T, N, N> a = m;
+		T det = T(1);
+		for (int k = 0; k < N; k++) {
+			int p = k;
+			for (int r = k + 1; r < N; r++) {
+				if (std::abs(a(r, k)) > std::abs(a(p, k))) {
+					p = r;
+				}
+			}
+			if (a(p, k) == T(0)) {
+				return T(0);
+			}
+			if (p != k) {
+				Unroll<N>::run([&](int c) {
+					T tmp = a(k, c);
+					a(k, c) = a(p, c);
+					a(p, c) = tmp;
+				});
+				det = -det;
+			}
+			det *= a(k, k);
+			for (int r = k + 1; r < N; r++) {
+				T l = a(r, k) / a(k, k);
+				for (int c = k + 1; c < N; c++) {
+					a(r, c) -= l * a(k, c);
+				}
+			}
+		}
+		return det;
+	}
+
+	// Gauss-Jordan elimination with partial pivoting
+	static T invert(const Matrix<T, N, N>& m, Matrix<T, N, N>& dst) {
+		Matrix<T, N, N> a = m;
+		Matrix<T, N, N> inv = Matrix<T, N, N>::identity();
+		T det = T(1);
+		for (int k = 0; k < N; k++) {
+			int p = k;
+			for (int r = k + 1; r < N; r++) {
+				if (std::abs(a(r, k)) > std::abs(a(p, k))) {
+					p = r;
+				}
+			}
+			if (a(p, k) == T(0)) {
+				return T(0);
+			}
+			if (p != k) {
+				Unroll<N>::run([&](int c) {
+					T tmp = a(k, c);
+					a(k, c) = a(p, c);
+					a(p, c) = tmp;
+					tmp = inv(k, c);
+					inv(k, c) = inv(p, c);
+					inv(p, c) = tmp;
+				});
+				det = -det;
+			}
+			T pivot = a(k, k);
+			det *= pivot;
+			Unroll<N>::run([&](int c) {
+				a(k, c) /= pivot;
+				inv(k, c) /= pivot;
+			});
+			for (int r = 0; r < N; r++) {
+				T l = a(r, k);
+				if (r == k || l == T(0)) {
+					continue;
+				}
+				Unroll<N>::run([&](int c) {
+					a(r, c) -= l * a(k, c);
+					inv(r, c) -= l * inv(k, c);
+				});
+			}
+		}
+		dst = inv;
+		return det;
+	}
+};
+
+template <typename T>
+struct SquareOps<T, 1> {
+	static T determinant(const Matrix<T, 1, 1>& m) {
+		return m(0, 0);
+	}
+
+	static T invert(const Matrix<T, 1, 1>& m, Matrix<T, 1, 1>& dst) {
+		T det = m(0, 0);
+		if (det != T(0)) {
+			dst(0, 0) = T(1) / det;
+		}
+		return det;
+	}
+};
+
+template <typename T>
+struct SquareOps<T, 2> {
+	static T determinant(const Matrix<T, 2, 2>& m) {
+		return m(0, 0) * m(1, 1) - m(0, 1) * m(1, 0);
+	}
+
+	static T invert(const Matrix<T, 2, 2>& m, Matrix<T, 2, 2>& dst) {
+		T det = determinant(m);
+		if (det != T(0)) {
+			dst = Matrix<T, 2, 2>(m(1, 1), -m(0, 1), -m(1, 0), m(0, 0)) * (T(1) / det);
+		}
+		return det;
+	}
+};
+
+template <typename T>
+struct SquareOps<T, 3> {
+	static T determinant(const Matrix<T, 3, 3>& m) {
+		return m(0, 0) * (m(1, 1) * m(2, 2) - m(1, 2) * m(2, 1))
+			+ m(0, 1) * (m(1, 2) * m(2, 0) - m(1, 0) * m(2, 2))
+			+ m(0, 2) * (m(1, 0) * m(2, 1) - m(1, 1) * m(2, 0));
+	}
+
+	static T invert(const Matrix<T, 3, 3>& m, Matrix<T, 3, 3>& dst) {
+		Matrix<T, 3, 3> adj(
+			m(1, 1) * m(2, 2) - m(1, 2) * m(2, 1),
+			m(0, 2) * m(2, 1) - m(0, 1) * m(2, 2),
+			m(0, 1) * m(1, 2) - m(0, 2) * m(1, 1),
+			m(1, 2) * m(2, 0) - m(1, 0) * m(2, 2),
+			m(0, 0) * m(2, 2) - m(0, 2) * m(2, 0),
+			m(0, 2) * m(1, 0) - m(0, 0) * m(1, 2),
+			m(1, 0) * m(2, 1) - m(1, 1) * m(2, 0),
+			m(0, 1) * m(2, 0) - m(0, 0) * m(2, 1),
+			m(0, 0) * m(1, 1) - m(0, 1) * m(1, 0));
+		T det = m(0, 0) * adj(0, 0) + m(0, 1) * adj(1, 0) + m(0, 2) * adj(2, 0);
+		if (det != T(0)) {
+			dst = adj * (T(1) / det);
+		}
+		return det;
+	}
+};
+
+template <typename T>
+struct SquareOps<T, 4> {
+	// expansion by complementary minors: 2x2 determinants of the top two rows
+	// (s) and of the bottom two rows (c)
+	static T determinant(const Matrix<T, 4, 4>& m) {
+		T s0 = m(0, 0) * m(1, 1) - m(1, 0) * m(0, 1);
+		T s1 = m(0, 0) * m(1, 2) - m(1, 0) * m(0, 2);
+		T s2 = m(0, 0) * m(1, 3) - m(1, 0) * m(0, 3);
+		T s3 = m(0, 1) * m(1, 2) - m(1, 1) * m(0, 2);
+		T s4 = m(0, 1) * m(1, 3) - m(1, 1) * m(0, 3);
+		T s5 = m(0, 2) * m(1, 3) - m(1, 2) * m(0, 3);
+		T c5 = m(2, 2) * m(3, 3) - m(3, 2) * m(2, 3);
+		T c4 = m(2, 1) * m(3, 3) - m(3, 1) * m(2, 3);
+		T c3 = m(2, 1) * m(3, 2) - m(3, 1) * m(2, 2);
+		T c2 = m(2, 0) * m(3, 3) - m(3, 0) * m(2, 3);
+		T c1 = m(2, 0) * m(3, 2) - m(3, 0) * m(2, 2);
+		T c0 = m(2, 0) * m(3, 1) - m(3, 0) * m(2, 1);
+		return s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+	}
+
+	static T invert(const Matrix<T, 4, 4>& m, Matrix<T, 4, 4>& dst) {
+		T s0 = m(0, 0) * m(1, 1) - m(1, 0) * m(0, 1);
+		T s1 = m(0, 0) * m(1, 2) - m(1, 0) * m(0, 2);
+		T s2 = m(0, 0) * m(1, 3) - m(1, 0) * m(0, 3);
+		T s3 = m(0, 1) * m(1, 2) - m(1, 1) * m(0, 2);
+		T s4 = m(0, 1) * m(1, 3) - m(1, 1) * m(0, 3);
+		T s5 = m(0, 2) * m(1, 3) - m(1, 2) * m(0, 3);
+		T c5 = m(2, 2) * m(3, 3) - m(3, 2) * m(2, 3);
+		T c4 = m(2, 1) * m(3, 3) - m(3, 1) * m(2, 3);
+		T c3 = m(2, 1) * m(3, 2) - m(3, 1) * m(2, 2);
+		T c2 = m(2, 0) * m(3, 3) - m(3, 0) * m(2, 3);
+		T c1 = m(2, 0) * m(3, 2) - m(3, 0) * m(2, 2);
+		T c0 = m(2, 0) * m(3, 1) - m(3, 0) * m(2, 1);
+		T det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+		if (det == T(0)) {
+			return det;
+		}
+		Matrix<T, 4, 4> adj(
+			m(1, 1) * c5 - m(1, 2) * c4 + m(1, 3) * c3,
+			-m(0, 1) * c5 + m(0, 2) * c4 - m(0, 3) * c3,
+			m(3, 1) * s5 - m(3, 2) * s4 + m(3, 3) * s3,
+			-m(2, 1) * s5 + m(2, 2) * s4 - m(2, 3) * s3,
+			-m(1, 0) * c5 + m(1, 2) * c2 - m(1, 3) * c1,
+			m(0, 0) * c5 - m(0, 2) * c2 + m(0, 3) * c1,
+			-m(3, 0) * s5 + m(3, 2) * s2 - m(3, 3) * s1,
+			m(2, 0) * s5 - m(2, 2) * s2 + m(2, 3) * s1,
+			m(1, 0) * c4 - m(1, 1) * c2 + m(1, 3) * c0,
+			-m(0, 0) * c4 + m(0, 1) * c2 - m(0, 3) * c0,
+			m(3, 0) * s4 - m(3, 1) * s2 + m(3, 3) * s0,
+			-m(2, 0) * s4 + m(2, 1) * s2 - m(2, 3) * s0,
+			-m(1, 0) * c3 + m(1, 1) * c1 - m(1, 2) * c0,
+			m(0, 0) * c3 - m(0, 1) * c1 + m(0, 2) * c0,
+			-m(3, 0) * s3 + m(3, 1) * s1 - m(3, 2) * s0,
+			m(2, 0) * s3 - m(2, 1) * s1 + m(2, 2) * s0);
+		dst = adj * (T(1) / det);
+		return det;
+	}
+};
+
+template <typename T, int R, int C>
+T Matrix<T, R, C>::determinant() const {
+	static_assert(R == C, "only square matrices have determinants");
+	return SquareOps<T, R>::determinant(*this);
+}
+
+template <typename T, int R, int C>
+T Matrix<T, R, C>::invert(Matrix& dst) const {
+	static_assert(R == C, "only square matrices have inverses");
+	static_assert(std::is_floating_point<T>::value, "only floating point matrices can be inverted");
+	return SquareOps<T, R>::invert(*this, dst);
+}
+
+typedef Matrix<double, 2, 2> Matrix2d;
+typedef Matrix<double, 3, 3> Matrix3d;
+typedef Matrix<double, 4, 4> Matrix4d;
+typedef Matrix<float, 2, 2> Matrix2f;
+typedef Matrix<float, 3, 3> Matrix3f;
+typedef Matrix<float, 4, 4> Matrix4f;
+
+}
+
+#endif
@@ -0,0 +1,380 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gemm.h"
+#include "matrix.h"
+#include "arena.h"
+#include "parallel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GEMM_X86
+#include <immintrin.h>
+#endif
+
+// products with fewer multiply-adds than this skip packing altogether
+#define GEMM_SMALL 8192
+
+// cache blocking: an MC x KC block of A stays in L2, a KC x NC panel of B in L3
+#define GEMM_MC 144
+#define GEMM_KC 256
+#define GEMM_NC 4080
+
+// columns of C per task when a product is split by columns
+#define GEMM_PARALLEL_COLS 256
+
+// largest register tile of any micro-kernel
+#define GEMM_MAX_MR 12
+#define GEMM_MAX_NR 16
+
+/**
+ * Micro-kernel computing an MR x NR tile C = alpha * A * B + beta * C from a
+ * packed MR x kc sliver of A (column by column) and a packed kc x NR sliver
+ * of B (row by row)
+ */
+typedef void (*GemmKernel)(int kc, const double* a, const double* b,
+	double* c, ptrdiff_t ldc, double alpha, double beta);
+
+typedef struct GemmImpl {
+	int mr;
+	int nr;
+	GemmKernel kernel;
+} GemmImpl;
+
+static void kernelScalar(int kc, const double* a, const double* b,
+	double* c, ptrdiff_t ldc, double alpha, double beta) {
+	double acc[4][4] = { { 0 } };
+	for (int p = 0; p < kc; p++) {
+		for (int i = 0; i < 4; i++) {
+			for (int j = 0; j < 4; j++) {
+				acc[i][j] += a[i] * b[j];
+			}
+		}
+		a += 4;
+		b += 4;
+	}
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 4; j++) {
+			c[i * ldc + j] = alpha * acc[i][j] + (beta == 0 ? 0 : beta * c[i * ldc + j]);
+		}
+	}
+}
+
+#ifdef GEMM_X86
+
+// 6x8 tile: 12 ymm accumulators, two loads of B and one broadcast of A per row
+#define AVX2_ROW_DECL(i) __m256d c##i##0 = _mm256_setzero_pd(), c##i##1 = _mm256_setzero_pd();
+#define AVX2_ROW_FMA(i) { \
+		__m256d ai = _mm256_broadcast_sd(a + i); \
+		c##i##0 = _mm256_fmadd_pd(ai, b0, c##i##0); \
+		c##i##1 = _mm256_fmadd_pd(ai, b1, c##i##1); \
+	}
+#define AVX2_ROW_STORE(i) { \
+		double* ci = c + i * ldc; \
+		__m256d r0 = _mm256_mul_pd(va, c##i##0), r1 = _mm256_mul_pd(va, c##i##1); \
+		if (beta != 0) { \
+			r0 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(ci), r0); \
+			r1 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(ci + 4), r1); \
+		} \
+		_mm256_storeu_pd(ci, r0); \
+		_mm256_storeu_pd(ci + 4, r1); \
+	}
+
+__attribute__((target("avx2,fma")))
+static void kernelAVX2(int kc, const double* a, const double* b,
+	double* c, ptrdiff_t ldc, double alpha, double beta) {
+	AVX2_ROW_DECL(0) AVX2_ROW_DECL(1) AVX2_ROW_DECL(2)
+	AVX2_ROW_DECL(3) AVX2_ROW_DECL(4) AVX2_ROW_DECL(5)
+	for (int p = 0; p < kc; p++) {
+		__m256d b0 = _mm256_load_pd(b), b1 = _mm256_load_pd(b + 4);
+		AVX2_ROW_FMA(0) AVX2_ROW_FMA(1) AVX2_ROW_FMA(2)
+		AVX2_ROW_FMA(3) AVX2_ROW_FMA(4) AVX2_ROW_FMA(5)
+		a += 6;
+		b += 8;
+	}
+	__m256d va = _mm256_set1_pd(alpha), vb = _mm256_set1_pd(beta);
+	AVX2_ROW_STORE(0) AVX2_ROW_STORE(1) AVX2_ROW_STORE(2)
+	AVX2_ROW_STORE(3) AVX2_ROW_STORE(4) AVX2_ROW_STORE(5)
+}
+
+// 12x16 tile: 24 zmm accumulators out of 32 registers
+#define AVX512_ROW_DECL(i) __m512d c##i##0 = _mm512_setzero_pd(), c##i##1 = _mm512_setzero_pd();
+#define AVX512_ROW_FMA(i) { \
+		__m512d ai = _mm512_set1_pd(a[i]); \
+		c##i##0 = _mm512_fmadd_pd(ai, b0, c##i##0); \
+		c##i##1 = _mm512_fmadd_pd(ai, b1, c##i##1); \
+	}
+#define AVX512_ROW_STORE(i) { \
+		double* ci = c + i * ldc; \
+		__m512d r0 = _mm512_mul_pd(va, c##i##0), r1 = _mm512_mul_pd(va, c##i##1); \
+		if (beta != 0) { \
+			r0 = _mm512_fmadd_pd(vb, _mm512_loadu_pd(ci), r0); \
+			r1 = _mm512_fmadd_pd(vb, _mm512_loadu_pd(ci + 8), r1); \
+		} \
+		_mm512_storeu_pd(ci, r0); \
+		_mm512_storeu_pd(ci + 8, r1); \
+	}
+
+__attribute__((target("avx512f")))
+static void kernelAVX512(int kc, const double* a, const double* b,
+	double* c, ptrdiff_t ldc, double alpha, double beta) {
+	AVX512_ROW_DECL(0) AVX512_ROW_DECL(1) AVX512_ROW_DECL(2) AVX512_ROW_DECL(3)
+	AVX512_ROW_DECL(4) AVX512_ROW_DECL(5) AVX512_ROW_DECL(6) AVX512_ROW_DECL(7)
+	AVX512_ROW_DECL(8) AVX512_ROW_DECL(9) AVX512_ROW_DECL(10) AVX512_ROW_DECL(11)
+	for (int p = 0; p < kc; p++) {
+		__m512d b0 = _mm512_load_pd(b), b1 = _mm512_load_pd(b + 8);
+		AVX512_ROW_FMA(0) AVX512_ROW_FMA(1) AVX512_ROW_FMA(2) AVX512_ROW_FMA(3)
+		AVX512_ROW_FMA(4) AVX512_ROW_FMA(5) AVX512_ROW_FMA(6) AVX512_ROW_FMA(7)
+		AVX512_ROW_FMA(8) AVX512_ROW_FMA(9) AVX512_ROW_FMA(10) AVX512_ROW_FMA(11)
+		a += 12;
+		b += 16;
+	}
+	__m512d va = _mm512_set1_pd(alpha), vb = _mm512_set1_pd(beta);
+	AVX512_ROW_STORE(0) AVX512_ROW_STORE(1) AVX512_ROW_STORE(2) AVX512_ROW_STORE(3)
+	AVX512_ROW_STORE(4) AVX512_ROW_STORE(5) AVX512_ROW_STORE(6) AVX512_ROW_STORE(7)
+	AVX512_ROW_STORE(8) AVX512_ROW_STORE(9) AVX512_ROW_STORE(10) AVX512_ROW_STORE(11)
+}
+
+#endif
+
+/**
+ * Selects the widest micro-kernel supported by the CPU the library is running on
+ * @return Micro-kernel and its tile size
+ */
+static const GemmImpl* selectImpl() {
+	static const GemmImpl scalar = { 4, 4, kernelScalar };
+#ifdef GEMM_X86
+	static const GemmImpl avx2 = { 6, 8, kernelAVX2 };
+	static const GemmImpl avx512 = { 12, 16, kernelAVX512 };
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return &avx512;
+	}
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		return &avx2;
+	}
+#endif
+	return &scalar;
+}
+
+/**
+ * Packs an mc x kc block of A into slivers of mr rows stored column by
+ * column, padding the last sliver with zeros
+ */
+static void packA(int mc, int kc, int mr, const double* a, ptrdiff_t rsa, ptrdiff_t csa, double* buf) {
+	for (int i0 = 0; i0 < mc; i0 += mr) {
+		int rows = mc - i0 < mr ? mc - i0 : mr;
+		for (int p = 0; p < kc; p++) {
+			const double* src = a + i0 * rsa + p * csa;
+			int i = 0;
+			for (; i < rows; i++) {
+				buf[i] = src[i * rsa];
+			}
+			for (; i < mr; i++) {
+				buf[i] = 0;
+			}
+			buf += mr;
+		}
+	}
+}
+
+/**
+ * Packs a kc x nc panel of B into slivers of nr columns stored row by row,
+ * padding the last sliver with zeros
+ */
+static void packB(int kc, int nc, int nr, const double* b, ptrdiff_t rsb, ptrdiff_t csb, double* buf) {
+	for (int j0 = 0; j0 < nc; j0 += nr) {
+		int cols = nc - j0 < nr ? nc - j0 : nr;
+		for (int p = 0; p < kc; p++) {
+			const double* src = b + p * rsb + j0 * csb;
+			int j = 0;
+			if (csb == 1) {
+				memcpy(buf, src, cols * sizeof(double));
+				j = cols;
+			} else {
+				for (; j < cols; j++) {
+					buf[j] = src[j * csb];
+				}
+			}
+			for (; j < nr; j++) {
+				buf[j] = 0;
+			}
+			buf += nr;
+		}
+	}
+}
+
+/**
+ * Scales C by beta, setting it to zero if beta is zero
+ */
+static void scaleC(int m, int n, double beta, double* c, ptrdiff_t ldc) {
+	for (int i = 0; i < m; i++) {
+		double* ci = c + i * ldc;
+		for (int j = 0; j < n; j++) {
+			ci[j] = beta == 0 ? 0 : beta * ci[j];
+		}
+	}
+}
+
+/**
+ * Unpacked multiplication for products too small to amortize packing
+ */
+static void gemmSmall(int m, int n, int k, double alpha,
+	const double* a, ptrdiff_t rsa, ptrdiff_t csa,
+	const double* b, ptrdiff_t rsb, ptrdiff_t csb,
+	double beta, double* c, ptrdiff_t ldc) {
+	scaleC(m, n, beta, c, ldc);
+	for (int i = 0; i < m; i++) {
+		double* ci = c + i * ldc;
+		for (int p = 0; p < k; p++) {
+			double aip = alpha * a[i * rsa + p * csa];
+			const double* bp = b + p * rsb;
+			for (int j = 0; j < n; j++) {
+				ci[j] += aip * bp[j * csb];
+			}
+		}
+	}
+}
+
+/**
+ * Packed, cache-blocked multiplication on the calling thread
+ */
+static void gemmBlocked(const GemmImpl* impl, int m, int n, int k, double alpha,
+	const double* a, ptrdiff_t rsa, ptrdiff_t csa,
+	const double* b, ptrdiff_t rsb, ptrdiff_t csb,
+	double beta, double* c, ptrdiff_t ldc) {
+	int mr = impl->mr, nr = impl->nr;
+
+	int mcMax = m < GEMM_MC ? m : GEMM_MC;
+	int kcMax = k < GEMM_KC ? k : GEMM_KC;
+	int ncMax = n < GEMM_NC ? n : GEMM_NC;
+	// keep the packed panel of B aligned for the vector loads in the kernels
+	size_t align = MATRIX_ALIGNMENT / sizeof(double);
+	size_t sizeA = ((size_t)((mcMax + mr - 1) / mr) * mr * kcMax + align - 1) / align * align;
+	size_t sizeB = (size_t)((ncMax + nr - 1) / nr) * nr * kcMax;
+	size_t bytes = (sizeA + sizeB) * sizeof(double);
+	MatrixArena* scratch = matrix_scratchArena();
+	MatrixArenaMark mark = matrix_arenaMark(scratch);
+	double* bufA = matrix_arenaAlloc(scratch, bytes);
+	double* bufB = bufA + sizeA;
+	double edge[GEMM_MAX_MR * GEMM_MAX_NR];
+
+	for (int jc = 0; jc < n; jc += GEMM_NC) {
+		int nc = n - jc < GEMM_NC ? n - jc : GEMM_NC;
+		for (int pc = 0; pc < k; pc += GEMM_KC) {
+			int kc = k - pc < GEMM_KC ? k - pc : GEMM_KC;
+			// only the first pass over k applies beta; later passes accumulate
+			double betaPass = pc == 0 ? beta : 1;
+			packB(kc, nc, nr, b + pc * rsb + jc * csb, rsb, csb, bufB);
+			for (int ic = 0; ic < m; ic += GEMM_MC) {
+				int mc = m - ic < GEMM_MC ? m - ic : GEMM_MC;
+				packA(mc, kc, mr, a + ic * rsa + pc * csa, rsa, csa, bufA);
+				for (int jr = 0; jr < nc; jr += nr) {
+					int cols = nc - jr < nr ? nc - jr : nr;
+					for (int ir = 0; ir < mc; ir += mr) {
+						int rows = mc - ir < mr ? mc - ir : mr;
+						double* cij = c + (ic + ir) * ldc + jc + jr;
+						const double* ap = bufA + ir * kc;
+						const double* bp = bufB + jr * kc;
+						if (rows == mr && cols == nr) {
+							impl->kernel(kc, ap, bp, cij, ldc, alpha, betaPass);
+							continue;
+						}
+						// partial tiles go through a full-size buffer
+						impl->kernel(kc, ap, bp, edge, nr, alpha, 0);
+						for (int i = 0; i < rows; i++) {
+							for (int j = 0; j < cols; j++) {
+								double prev = betaPass == 0 ? 0 : betaPass * cij[i * ldc + j];
+								cij[i * ldc + j] = edge[i * nr + j] + prev;
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+	matrix_arenaRelease(scratch, mark);
+}
+
+/**
+ * Arguments for a product split by blocks of rows or columns of C
+ */
+typedef struct GemmArgs {
+	const GemmImpl* impl;
+	int m, n, k;
+	double alpha;
+	const double* a;
+	ptrdiff_t rsa, csa;
+	const double* b;
+	ptrdiff_t rsb, csb;
+	double beta;
+	double* c;
+	ptrdiff_t ldc;
+} GemmArgs;
+
+static void gemmRowBlocks(int begin, int end, void* arg) {
+	GemmArgs* g = arg;
+	int r0 = begin * GEMM_MC;
+	int r1 = end * GEMM_MC < g->m ? end * GEMM_MC : g->m;
+	gemmBlocked(g->impl, r1 - r0, g->n, g->k, g->alpha,
+		g->a + r0 * g->rsa, g->rsa, g->csa, g->b, g->rsb, g->csb,
+		g->beta, g->c + r0 * g->ldc, g->ldc);
+}
+
+static void gemmColumnBlocks(int begin, int end, void* arg) {
+	GemmArgs* g = arg;
+	int c0 = begin * GEMM_PARALLEL_COLS;
+	int c1 = end * GEMM_PARALLEL_COLS < g->n ? end * GEMM_PARALLEL_COLS : g->n;
+	gemmBlocked(g->impl, g->m, c1 - c0, g->k, g->alpha,
+		g->a, g->rsa, g->csa, g->b + c0 * g->csb, g->rsb, g->csb,
+		g->beta, g->c + c0, g->ldc);
+}
+
+void matrix_dgemm(int m, int n, int k, double alpha,
+	const double* a, ptrdiff_t rsa, ptrdiff_t csa,
+	const double* b, ptrdiff_t rsb, ptrdiff_t csb,
+	double beta, double* c, ptrdiff_t ldc) {
+	if (m <= 0 || n <= 0) {
+		return;
+	}
+	if (k <= 0 || alpha == 0) {
+		scaleC(m, n, beta, c, ldc);
+		return;
+	}
+	if ((size_t)m * n * k < GEMM_SMALL) {
+		gemmSmall(m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, ldc);
+		return;
+	}
+
+	static const GemmImpl* _Atomic selected = NULL;
+	const GemmImpl* impl = atomic_load_explicit(&selected, memory_order_relaxed);
+	if (!impl) {
+		impl = selectImpl();
+		atomic_store_explicit(&selected, impl, memory_order_relaxed);
+	}
+
+	// split C into independent blocks along its larger dimension
+	GemmArgs args = { impl, m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, ldc };
+	double flops = 2.0 * m * n * k;
+	int rowBlocks = (m + GEMM_MC - 1) / GEMM_MC;
+	int colBlocks = (n + GEMM_PARALLEL_COLS - 1) / GEMM_PARALLEL_COLS;
+	if (rowBlocks >= colBlocks) {
+		matrix_parallelFor(0, rowBlocks, 1, flops, gemmRowBlocks, &args);
+	} else {
+		matrix_parallelFor(0, colBlocks, 1, flops, gemmColumnBlocks, &args);
+	}
+}
@@ -0,0 +1,46 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+// Internal header: general matrix multiplication kernel shared by the library
+
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <stddef.h>
+
+/**
+ * Computes C = alpha * A * B + beta * C on raw row-major storage. Element (i, j)
+ * of A is a[i * rsa + j * csa] and likewise for B, so transposed operands are
+ * handled by swapping the strides. C must not overlap A or B. If beta is zero,
+ * C is not read.
+ * @param m Number of rows in A and C
+ * @param n Number of columns in B and C
+ * @param k Number of columns in A and rows in B
+ * @param alpha Scale applied to the product
+ * @param a Entries of A
+ * @param rsa Row stride of A
+ * @param csa Column stride of A
+ * @param b Entries of B
+ * @param rsb Row stride of B
+ * @param csb Column stride of B
+ * @param beta Scale applied to the previous contents of C
+ * @param c Entries of C
+ * @param ldc Row stride of C
+ */
+void matrix_dgemm(int m, int n, int k, double alpha,
+	const double* a, ptrdiff_t rsa, ptrdiff_t csa,
+	const double* b, ptrdiff_t rsb, ptrdiff_t csb,
+	double beta, double* c, ptrdiff_t ldc);
+
+#endif
@@ -0,0 +1,77 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+// Internal header: instrumentation of the library functions (see stats.h)
+
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include "stats.h"
+
+/**
+ * Statistics of one instrumented function, added to the list of counters on
+ * the first call made while recording is on
+ */
+typedef struct MatrixCounter {
+	const char* name;
+	unsigned long long calls;
+	unsigned long long nanoseconds;
+	double flops;
+	double bytes;
+	int registered;
+	struct MatrixCounter* next;
+} MatrixCounter;
+
+/**
+ * Call in progress of an instrumented function
+ */
+typedef struct MatrixProbe {
+	// NULL if the call isn't being recorded
+	MatrixCounter* counter;
+	unsigned long long start;
+	double flops;
+	double bytes;
+} MatrixProbe;
+
+/**
+ * Starts recording a call if recording is on
+ * @param counter Statistics of the called function
+ * @param flops Estimated number of floating point operations of the call
+ * @param bytes Estimated number of bytes read and written by the call
+ * @return Probe to pass to matrix_endProbe when the call returns
+ */
+MatrixProbe matrix_beginProbe(MatrixCounter* counter, double flops, double bytes);
+
+/**
+ * Adds a finished call to the statistics of its function
+ * @param probe Probe returned by matrix_beginProbe
+ */
+void matrix_endProbe(MatrixProbe* probe);
+
+#ifdef INSTRUMENT
+// records a call to the enclosing function; must precede any return and is
+// finished automatically when the function returns
+#define MATRIX_INSTRUMENT(flops, bytes) \
+	static MatrixCounter matrixCounter = { __func__ }; \
+	MatrixProbe matrixProbe __attribute__((cleanup(matrix_endProbe))) = \
+		matrix_beginProbe(&matrixCounter, (flops), (bytes))
+// replaces the estimated number of floating point operations of the call
+// when it is only known after some work has been done
+#define MATRIX_INSTRUMENT_FLOPS(flops) matrixProbe.flops = (flops)
+#else
+#define MATRIX_INSTRUMENT(flops, bytes)
+#define MATRIX_INSTRUMENT_FLOPS(flops)
+#endif
+
+#endif
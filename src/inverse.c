@@ -13,8 +13,157 @@
 //along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include "inverse.h"
+#include "parallel.h"
+#include "instrument.h"
+
+// rows per task in the trailing update of the complete pivoting factorization
+#define ADJUGATE_GRAIN 16
+
+/**
+ * Arguments for eliminating below one pivot
+ */
+typedef struct AdjugateArgs {
+	double** a;
+	int n;
+	int k;
+} AdjugateArgs;
+
+static void eliminateBelow(int begin, int end, void* arg) {
+	AdjugateArgs* args = arg;
+	double** a = args->a;
+	int k = args->k;
+	for (int r = begin; r < end; r++) {
+		double l = a[r][k] /= a[k][k];
+		if (l == 0) {
+			continue;
+		}
+		for (int c = k + 1; c < args->n; c++) {
+			a[r][c] -= l * a[k][c];
+		}
+	}
+}
+
+void matrix_adjugate(Matrix* dst, const Matrix* matrix) {
+	MATRIX_INSTRUMENT(2.0 * matrix->rows * matrix->rows * matrix->rows, 24.0 * matrix->rows * matrix->cols);
+	int n = matrix->rows;
+	if (!matrix_isSquare(matrix) || dst->rows != n || dst->cols != n) {
+		return;
+	}
+	// the adjugate of a 0 x 0 matrix has no entries to compute
+	if (n == 0) {
+		return;
+	}
+	if (n == 1) {
+		dst->matrix[0][0] = 1;
+		return;
+	}
+	MatrixArena* scratch = matrix_scratchArena();
+	MatrixArenaMark mark = matrix_arenaMark(scratch);
+	Matrix* lu = matrix_arenaMatrix(scratch, n, n);
+	matrix_copyEntries(lu, matrix);
+	double** a = lu->matrix;
+	int* p = matrix_arenaAlloc(scratch, 2 * n * sizeof(int));
+	int* q = p + n;
+	for (int i = 0; i < n; i++) {
+		p[i] = q[i] = i;
+	}
+
+	// PAQ = LU with complete pivoting: the pivots decrease in magnitude and
+	// reveal the rank, since the elimination stops once the rest is zero
+	int sign = 1, rank = 0;
+	for (int k = 0; k < n; k++) {
+		int pr = k, pc = k;
+		for (int r = k; r < n; r++) {
+			for (int c = k; c < n; c++) {
+				if (fabs(a[r][c]) > fabs(a[pr][pc])) {
+					pr = r;
+					pc = c;
+				}
+			}
+		}
+		if (a[pr][pc] == 0) {
+			break;
+		}
+		rank++;
+		if (pr != k) {
+			double* row = a[k];
+			a[k] = a[pr];
+			a[pr] = row;
+			int tmp = p[k];
+			p[k] = p[pr];
+			p[pr] = tmp;
+			sign = -sign;
+		}
+		if (pc != k) {
+			for (int r = 0; r < n; r++) {
+				double tmp = a[r][k];
+				a[r][k] = a[r][pc];
+				a[r][pc] = tmp;
+			}
+			int tmp = q[k];
+			q[k] = q[pc];
+			q[pc] = tmp;
+			sign = -sign;
+		}
+		AdjugateArgs args = { a, n, k };
+		double flops = 2.0 * (n - k - 1) * (n - k - 1);
+		matrix_parallelFor(k + 1, n, ADJUGATE_GRAIN, flops, eliminateBelow, &args);
+	}
+	// the row swaps exchanged row pointers; put the rows back in place
+	// so that the factors can be used as matrices
+	Matrix* factors = matrix_arenaMatrix(scratch, n, n);
+	for (int r = 0; r < n; r++) {
+		memcpy(factors->matrix[r], a[r], n * sizeof(double));
+	}
+
+	// a matrix of rank n - 2 or less has no nonzero minor of size n - 1
+	if (rank < n - 1) {
+		matrix_zeroMatrix(dst);
+		matrix_arenaRelease(scratch, mark);
+		return;
+	}
+
+	// with U = [U11 u; 0 d], adj(U) = det(U11) [d U11^-1, -U11^-1 u; 0, 1],
+	// which holds for d = 0 and never divides by it
+	double** f = factors->matrix;
+	double d = f[n - 1][n - 1];
+	double det11 = 1;
+	for (int i = 0; i < n - 1; i++) {
+		det11 *= f[i][i];
+	}
+	Matrix* adjU = matrix_arenaMatrix(scratch, n, n);
+	matrix_zeroMatrix(adjU);
+	for (int i = 0; i < n - 1; i++) {
+		adjU->matrix[i][i] = 1;
+		adjU->matrix[i][n - 1] = f[i][n - 1];
+	}
+	adjU->matrix[n - 1][n - 1] = det11;
+	Matrix* u11 = matrix_arenaSubMatrix(scratch, factors, 0, 0, n - 1, n - 1);
+	Matrix* top = matrix_arenaSubMatrix(scratch, adjU, 0, 0, n - 1, n);
+	matrix_solveTriangular(top, u11, top, MATRIX_UPPER);
+	for (int i = 0; i < n - 1; i++) {
+		for (int j = 0; j < n - 1; j++) {
+			top->matrix[i][j] *= d * det11;
+		}
+		top->matrix[i][n - 1] *= -det11;
+	}
+
+	// adj(PAQ) = adj(U) adj(L) = adj(U) L^-1, found as the solution T of
+	// L^T T = adj(U)^T
+	Matrix* t = matrix_arenaMatrix(scratch, n, n);
+	matrix_transpose(t, adjU);
+	matrix_solveTriangular(t, factors, t, MATRIX_LOWER | MATRIX_UNIT_DIAGONAL | MATRIX_TRANSPOSE);
+	// adj(A) = det(P) det(Q) Q adj(PAQ) P
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < n; j++) {
+			dst->matrix[q[i]][p[j]] = sign * t->matrix[j][i];
+		}
+	}
+	matrix_arenaRelease(scratch, mark);
+}
 
 void matrix_minors(Matrix* dst, const Matrix* matrix) {
+	MATRIX_INSTRUMENT(2.0 * matrix->rows * matrix->rows * matrix->rows, 16.0 * matrix->rows * matrix->cols);
 	// if destination matrix and input matrix are of unequal size, do nothing
 	if (dst->rows != matrix->rows || dst->cols != matrix->cols) {
 		return;
@@ -24,29 +173,21 @@ void matrix_minors(Matrix* dst, const Matrix* matrix) {
 		return;
 	}
 
+	// the cofactors are the entries of the transposed adjugate
+	MatrixArena* scratch = matrix_scratchArena();
+	MatrixArenaMark mark = matrix_arenaMark(scratch);
+	Matrix* adjugate = matrix_arenaMatrix(scratch, matrix->rows, matrix->cols);
+	matrix_adjugate(adjugate, matrix);
 	for (int r = 0; r < matrix->rows; r++) {
 		for (int c = 0; c < matrix->cols; c++) {
-			Matrix* submatrix = matrix_createMatrix(matrix->rows - 1, matrix->cols - 1);
-			int dr = 0;
-			for (int r1 = 0; r1 < submatrix->rows; r1++) {
-				int dc = 0;
-				if (r1 == r) {
-					dr = 1;
-				}
-				for (int c1 = 0; c1 < submatrix->cols; c1++) {
-					if (c1 == c) {
-						dc = 1;
-					}
-					submatrix->matrix[r1][c1] = matrix->matrix[r1 + dr][c1 + dc];
-				}
-			}
-			dst->matrix[r][c] = matrix_determinant(submatrix, NULL);
-			matrix_destroyMatrix(submatrix);
+			dst->matrix[r][c] = adjugate->matrix[c][r] * ((r + c) % 2 == 0 ? 1 : -1);
 		}
 	}
+	matrix_arenaRelease(scratch, mark);
 }
 
 void matrix_cofactors(Matrix* dst, const Matrix* minors) {
+	MATRIX_INSTRUMENT((double)minors->rows * minors->cols, 16.0 * minors->rows * minors->cols);
 	// if matrix of minors and destination matrix are of unequal size, do nothing
 	if (dst->rows != minors->rows || dst->cols != minors->cols) {
 		return;
@@ -64,6 +205,7 @@ void matrix_cofactors(Matrix* dst, const Matrix* minors) {
 }
 
 double matrix_determinant(const Matrix* matrix, const Matrix* cofactors) {
+	MATRIX_INSTRUMENT(2.0 / 3 * matrix->rows * matrix->rows * matrix->rows, 8.0 * matrix->rows * matrix->cols);
 	// determinant of a 1x1 matrix is its only element
 	if (matrix->rows == 1 && matrix->cols == 1) {
 		return matrix->matrix[0][0];
@@ -72,64 +214,56 @@ double matrix_determinant(const Matrix* matrix, const Matrix* cofactors) {
 	if (!matrix_isSquare(matrix)) {
 		return 0;
 	}
+	// the determinant of an empty matrix is one (needed for the minors of a 1x1 matrix)
+	if (matrix->rows == 0) {
+		return 1;
+	}
 
-	const Matrix* mcofactors = cofactors;
-	Matrix* mcf = NULL;
-	// determine cofactors if not given
-	if (!mcofactors) {
-		mcf = matrix_createMatrix(matrix->rows, matrix->cols);
-		Matrix* minors = matrix_createMatrix(matrix->rows, matrix->cols);
-		matrix_minors(minors, matrix);
-		matrix_cofactors(mcf, minors);
-		matrix_destroyMatrix(minors);
-		mcofactors = mcf;
-	} else {
+	// expand along the first row if the cofactors are already known
+	if (cofactors) {
 		// if cofactors matrix and input matrix are of unequal size, do nothing
 		if (matrix->rows != cofactors->rows || matrix->cols != cofactors->cols) {
 			return 0;
 		}
+		double det = 0;
+		for (int c = 0; c < matrix->cols; c++) {
+			det += matrix->matrix[0][c] * cofactors->matrix[0][c];
+		}
+		return det;
 	}
-	double det = 0;
-	for (int c = 0; c < matrix->cols; c++) {
-		det += matrix->matrix[0][c] * mcofactors->matrix[0][c];
-	}
-	// destroy temporary cofactors matrix if none was given
-	if (mcf) {
-		matrix_destroyMatrix(mcf);
-	}
+
+	MatrixArena* scratch = matrix_scratchArena();
+	MatrixArenaMark mark = matrix_arenaMark(scratch);
+	LUFactorization* lu = matrix_arenaLUFactorization(scratch, matrix->rows);
+	matrix_factorLU(lu, matrix);
+	double det = matrix_luDeterminant(lu);
+	matrix_arenaRelease(scratch, mark);
 	return det;
 }
 
 double matrix_invert(Matrix* dst, const Matrix* matrix, Matrix* minors, Matrix* cofactors) {
+	MATRIX_INSTRUMENT(2.0 * matrix->rows * matrix->rows * matrix->rows, 16.0 * matrix->rows * matrix->cols);
 	// only square matrices allowed
 	if (matrix->rows != matrix->cols) {
 		return 0;
 	}
 
-	// determine matrix of minors
-	Matrix* mminors = minors ? minors : matrix_createMatrix(matrix->rows, matrix->cols);
-	matrix_minors(mminors, matrix);
-
-	// determine matrix of cofactors
-	Matrix* mcofactors = cofactors ? cofactors : matrix_createMatrix(matrix->rows, matrix->cols);
-	matrix_cofactors(mcofactors, mminors);
-
-	double det = matrix_determinant(matrix, mcofactors);
+	MatrixArena* scratch = matrix_scratchArena();
+	MatrixArenaMark mark = matrix_arenaMark(scratch);
 
-	// transpose cofactors to get adjugate
-	matrix_transpose(mcofactors, mcofactors);
-
-	matrix_multiplyScalar(dst, mcofactors, 1 / det);
-
-	// transpose adjugate to get back cofactors
-	matrix_transpose(mcofactors, mcofactors);
-
-	// if the caller didn't provide destination matrices, destroy the created ones
-	if (!minors) {
-		matrix_destroyMatrix(mminors);
-	}
-	if (!cofactors) {
-		matrix_destroyMatrix(mcofactors);
+	// determine the matrices of minors and cofactors only if requested
+	if (minors || cofactors) {
+		Matrix* mminors = minors ? minors : matrix_arenaMatrix(scratch, matrix->rows, matrix->cols);
+		matrix_minors(mminors, matrix);
+		if (cofactors) {
+			matrix_cofactors(cofactors, mminors);
+		}
 	}
+
+	LUFactorization* lu = matrix_arenaLUFactorization(scratch, matrix->rows);
+	matrix_factorLU(lu, matrix);
+	double det = matrix_luDeterminant(lu);
+	matrix_luInvert(dst, lu);
+	matrix_arenaRelease(scratch, mark);
 	return det;
 }
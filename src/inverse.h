@@ -21,9 +21,23 @@ extern "C" {
 
 #include "matrix.h"
 #include "arithmetic.h"
+#include "factorization.h"
 
 /**
- * Determine the matrix of minors for a given matrix
+ * Determine the adjugate (the transposed matrix of cofactors) of a matrix.
+ * It is computed in O(n^3) from an LU factorization with complete pivoting,
+ * PAQ = LU, as adj(A) = det(P) det(Q) Q adj(U) L^-1 P, where adj(U) is found
+ * without dividing by the last pivot. This is accurate for singular and
+ * nearly singular matrices, whereas det(A) A^-1 is not; the adjugate of a
+ * matrix whose rank is n - 2 or less is zero.
+ * @param dst Destination matrix in which to store the adjugate (can be the operand)
+ * @param matrix Matrix whose adjugate to find. If the matrix isn't a square matrix or the sizes differ, the arguments are left unchanged.
+ */
+void matrix_adjugate(Matrix* dst, const Matrix* matrix);
+
+/**
+ * Determine the matrix of minors for a given matrix from its adjugate (see
+ * matrix_adjugate)
  * @param dst Destination matrix in which to store the matrix of minors (cannot be the operand)
  * @param matrix Matrix whose matrix of minors to find. If the matrix isn't a square matrix, the arguments are left unchanged.
  */
@@ -39,18 +53,22 @@ void matrix_cofactors(Matrix* dst, const Matrix* minors);
 /**
  * Determine the determinant of a matrix. The determinant of a nonsquare matrix is always zero.
  * @param matrix Matrix whose determinant to find
- * @param cofactors Matrix of cofactors for the given matrix. If NULL, this will be calculated.
+ * @param cofactors Matrix of cofactors for the given matrix. If NULL, the determinant is found from an LU factorization of the matrix.
  * @return Determinant of the matrix
  */
 double matrix_determinant(const Matrix* matrix, const Matrix* cofactors);
 
 /**
- * Determine the inverse of a matrix
+ * Determine the inverse of a matrix using an LU factorization. If the matrix is singular,
+ * the destination matrix is left unchanged (the minors and cofactors are still computed).
+ * Use matrix_factorLU directly to obtain an estimate of the condition number of the matrix.
  * @param dst Destination matrix in which to store the inverse matrix (can be the operand)
  * @param matrix Matrix whose inverse to find. If the matrix isn't a square matrix, the arguments are left unchanged and 0 is returned
  * @param minors Destination matrix in which to store the matrix of minors (optional)
  * @param cofactors Destination matrix in which to store the matrix of cofactors (optional)
- * @return The determinant of the matrix
+ * @return The determinant of the matrix. It is 0 for singular matrices, but it can also underflow
+ * to 0 for invertible ones, whose inverse is still computed; use matrix_factorLU and its singular
+ * flag to tell them apart.
  */
 double matrix_invert(Matrix* dst, const Matrix* matrix, Matrix* minors, Matrix* cofactors);
 
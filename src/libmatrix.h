@@ -15,3 +15,14 @@
 #include "matrix.h"
 #include "arithmetic.h"
 #include "inverse.h"
+#include "factorization.h"
+#include "parallel.h"
+#include "arena.h"
+#include "matrixfile.h"
+#include "batch.h"
+#include "sparse.h"
+#include "outofcore.h"
+#include "stats.h"
+#include "typedmatrix.h"
+#include "strassen.h"
+#include "view.h"
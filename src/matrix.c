@@ -12,19 +12,88 @@
 //You should have received a copy of the GNU General Public License
 //along with this program. If not, see <http://www.gnu.org/licenses/>.
 
+#include <stdint.h>
+#include <stdatomic.h>
+
 #include "matrix.h"
+#include "matrixfile.h"
+#include "arena.h"
+#include "parallel.h"
+#include "instrument.h"
 
-Matrix* matrix_createMatrix(int rows, int cols) {
-	Matrix* matrix = malloc(sizeof(Matrix));
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MATRIX_X86
+#endif
+
+// largest edge of the blocks into which transposes are divided
+#define TRANSPOSE_BLOCK 32
+
+/**
+ * Determine the offset of the entries from the start of a matrix's storage.
+ * The row table has room for the rows of the transpose as well, so that
+ * matrices can be transposed in place.
+ * @param rows Number of rows in the matrix
+ * @param cols Number of columns in the matrix
+ * @return Size of the struct and row table rounded up to the alignment
+ */
+size_t matrix_headerSize(int rows, int cols) {
+	return MATRIX_ALIGN(sizeof(Matrix) + (rows > cols ? rows : cols) * sizeof(double*));
+}
+
+size_t matrix_storageSize(int rows, int cols) {
+	return MATRIX_ALIGN(matrix_headerSize(rows, cols) + (size_t)rows * cols * sizeof(double));
+}
+
+Matrix* matrix_placeMatrix(void* storage, int rows, int cols) {
+	// the struct, the row table and the entries share a single block;
+	// the entries start at the first aligned offset after the row table
+	Matrix* matrix = storage;
 	matrix->rows = rows;
 	matrix->cols = cols;
-	matrix->matrix = malloc(rows * sizeof(double*));
+	matrix->stride = cols;
+	matrix->flags = 0;
+	matrix->matrix = (double**)(matrix + 1);
+	matrix->data = (double*)((char*)matrix + matrix_headerSize(rows, cols));
 	for (int r = 0; r < rows; r++) {
-		matrix->matrix[r] = malloc(cols * sizeof(double));
+		matrix->matrix[r] = matrix->data + (size_t)r * matrix->stride;
 	}
 	return matrix;
 }
 
+Matrix* matrix_placeWrappedMatrix(void* storage, double* data, int rows, int cols, int stride) {
+	Matrix* matrix = storage;
+	matrix->rows = rows;
+	matrix->cols = cols;
+	matrix->stride = stride;
+	matrix->flags = 0;
+	matrix->matrix = (double**)(matrix + 1);
+	matrix->data = data;
+	for (int r = 0; r < rows; r++) {
+		matrix->matrix[r] = data + (size_t)r * stride;
+	}
+	return matrix;
+}
+
+Matrix* matrix_wrapMatrix(double* data, int rows, int cols, int stride) {
+	if (stride < cols) {
+		return NULL;
+	}
+	// the header is allocated on its own, so freeing it leaves the entries alone
+	return matrix_placeWrappedMatrix(aligned_alloc(MATRIX_ALIGNMENT, matrix_headerSize(rows, cols)), data, rows, cols, stride);
+}
+
+Matrix* matrix_subMatrix(const Matrix* matrix, int row, int col, int rows, int cols) {
+	if (row < 0 || col < 0 || rows < 0 || cols < 0 || row + rows > matrix->rows || col + cols > matrix->cols) {
+		return NULL;
+	}
+	return matrix_wrapMatrix(matrix->data + (size_t)row * matrix->stride + col, rows, cols, matrix->stride);
+}
+
+Matrix* matrix_createMatrix(int rows, int cols) {
+	MATRIX_INSTRUMENT(0, matrix_storageSize(rows, cols));
+	return matrix_placeMatrix(aligned_alloc(MATRIX_ALIGNMENT, matrix_storageSize(rows, cols)), rows, cols);
+}
+
 Matrix* matrix_createZeroMatrix(int rows, int cols) {
 	Matrix* matrix = matrix_createMatrix(rows, cols);
 	matrix_zeroMatrix(matrix);
@@ -61,9 +130,7 @@ Matrix* matrix_createMatrixWithElements(int rows, int cols, ...) {
 
 Matrix* matrix_createMatrixWithElementsFrom1D(int rows, int cols, double* elements) {
 	Matrix* matrix = matrix_createMatrix(rows, cols);
-	for (int r = 0; r < rows; r++) {
-		memcpy(matrix->matrix[r], elements + r * cols, cols * sizeof(double));
-	}
+	memcpy(matrix->data, elements, (size_t)rows * cols * sizeof(double));
 	return matrix;
 }
 
@@ -75,6 +142,10 @@ Matrix* matrix_createMatrixWithElementsFrom2D(int rows, int cols, double** eleme
 	return matrix;
 }
 
+int matrix_isContiguous(const Matrix* matrix) {
+	return matrix->stride == matrix->cols;
+}
+
 Matrix* matrix_copyMatrix(const Matrix* matrix) {
 	Matrix* copy = matrix_createMatrix(matrix->rows, matrix->cols);
 	matrix_copyEntries(copy, matrix);
@@ -82,53 +153,385 @@ Matrix* matrix_copyMatrix(const Matrix* matrix) {
 }
 
 void matrix_copyEntries(Matrix* dst, const Matrix* src) {
+	MATRIX_INSTRUMENT(0, 16.0 * src->rows * src->cols);
 	if (dst->rows != src->rows || dst->cols != src->cols) {
 		return;
 	}
+	if (matrix_isContiguous(dst) && matrix_isContiguous(src)) {
+		memcpy(dst->data, src->data, (size_t)src->rows * src->cols * sizeof(double));
+		return;
+	}
 	for (int r = 0; r < src->rows; r++) {
 		memcpy(dst->matrix[r], src->matrix[r], src->cols * sizeof(double));
 	}
 }
 
 void matrix_destroyMatrix(Matrix* matrix) {
-	for (int r = 0; r < matrix->rows; r++) {
-		free(matrix->matrix[r]);
+	MATRIX_INSTRUMENT(0, 0);
+	if (matrix->flags & MATRIX_BORROWED) {
+		return;
+	}
+	if (matrix->flags & MATRIX_MAPPED) {
+		matrix_unmapMatrix(matrix);
+		return;
 	}
-	free(matrix->matrix);
 	free(matrix);
 }
 
+/**
+ * Arguments for transposing a range of bands of a matrix. Entry (r, c) of
+ * the source is at src[r * lds + c] and its destination at dst[c * ldd + r].
+ */
+typedef struct TransposeArgs {
+	const double* src;
+	size_t lds;
+	double* dst;
+	size_t ldd;
+	int rows;
+	int cols;
+} TransposeArgs;
+
+/*
+ * Tiles of LANES x LANES entries are transposed in registers: each of the
+ * log2(LANES) stages swaps the off-diagonal s x s blocks of every 2s x 2s
+ * block, pairing rows i and i + s with two shuffles.
+ */
+typedef double TransposeVec4 __attribute__((vector_size(4 * sizeof(double))));
+typedef long long TransposeMask4 __attribute__((vector_size(4 * sizeof(long long))));
+typedef double TransposeVec8 __attribute__((vector_size(8 * sizeof(double))));
+typedef long long TransposeMask8 __attribute__((vector_size(8 * sizeof(long long))));
+
+#define TRANSPOSE_INLINE static inline __attribute__((always_inline))
+
+// tiles are only passed to helpers that are always inlined, so their ABI never matters
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+#define TRANSPOSE_STAGE(t, i, j, lo, hi) { \
+	__typeof__(t[0]) a = t[i], b = t[j]; \
+	t[i] = __builtin_shuffle(a, b, lo); \
+	t[j] = __builtin_shuffle(a, b, hi); \
+}
+
+TRANSPOSE_INLINE void transposeTile4(TransposeVec4* t) {
+	const TransposeMask4 lo1 = { 0, 4, 2, 6 }, hi1 = { 1, 5, 3, 7 };
+	const TransposeMask4 lo2 = { 0, 1, 4, 5 }, hi2 = { 2, 3, 6, 7 };
+	TRANSPOSE_STAGE(t, 0, 1, lo1, hi1);
+	TRANSPOSE_STAGE(t, 2, 3, lo1, hi1);
+	TRANSPOSE_STAGE(t, 0, 2, lo2, hi2);
+	TRANSPOSE_STAGE(t, 1, 3, lo2, hi2);
+}
+
+TRANSPOSE_INLINE void transposeTile8(TransposeVec8* t) {
+	const TransposeMask8 lo1 = { 0, 8, 2, 10, 4, 12, 6, 14 }, hi1 = { 1, 9, 3, 11, 5, 13, 7, 15 };
+	const TransposeMask8 lo2 = { 0, 1, 8, 9, 4, 5, 12, 13 }, hi2 = { 2, 3, 10, 11, 6, 7, 14, 15 };
+	const TransposeMask8 lo4 = { 0, 1, 2, 3, 8, 9, 10, 11 }, hi4 = { 4, 5, 6, 7, 12, 13, 14, 15 };
+	for (int i = 0; i < 8; i += 2) {
+		TRANSPOSE_STAGE(t, i, i + 1, lo1, hi1);
+	}
+	for (int i = 0; i < 8; i += 4) {
+		TRANSPOSE_STAGE(t, i, i + 2, lo2, hi2);
+		TRANSPOSE_STAGE(t, i + 1, i + 3, lo2, hi2);
+	}
+	for (int i = 0; i < 4; i++) {
+		TRANSPOSE_STAGE(t, i, i + 4, lo4, hi4);
+	}
+}
+
+/**
+ * Transposition kernels using tiles of a given width
+ * @param suffix Name of the instruction set the kernels are compiled for
+ * @param attr Attributes selecting the instruction set
+ * @param L Width of the tiles (4 or 8)
+ */
+#define TRANSPOSE_KERNELS(suffix, attr, L) \
+	/* transposes the tile at src into dst */ \
+	attr TRANSPOSE_INLINE void loadTile##suffix(TransposeVec##L* t, const double* src, size_t lds) { \
+		for (int i = 0; i < L; i++) { \
+			memcpy(&t[i], src + i * lds, sizeof(t[i])); \
+		} \
+		transposeTile##L(t); \
+	} \
+	\
+	attr TRANSPOSE_INLINE void storeTile##suffix(double* dst, size_t ldd, const TransposeVec##L* t) { \
+		for (int i = 0; i < L; i++) { \
+			memcpy(dst + i * ldd, &t[i], sizeof(t[i])); \
+		} \
+	} \
+	\
+	/* transposes a block small enough to stay in cache */ \
+	attr static void transposeBlock##suffix(const double* src, size_t lds, double* dst, size_t ldd, int rows, int cols) { \
+		int r = 0; \
+		for (; r + L <= rows; r += L) { \
+			int c = 0; \
+			for (; c + L <= cols; c += L) { \
+				TransposeVec##L t[L]; \
+				loadTile##suffix(t, src + r * lds + c, lds); \
+				storeTile##suffix(dst + c * ldd + r, ldd, t); \
+			} \
+			for (; c < cols; c++) { \
+				for (int i = 0; i < L; i++) { \
+					dst[c * ldd + r + i] = src[(r + i) * lds + c]; \
+				} \
+			} \
+		} \
+		for (; r < rows; r++) { \
+			for (int c = 0; c < cols; c++) { \
+				dst[c * ldd + r] = src[r * lds + c]; \
+			} \
+		} \
+	} \
+	\
+	/* halves the larger dimension until the block fits in cache, whatever the cache size */ \
+	attr static void transposeRecursive##suffix(const double* src, size_t lds, double* dst, size_t ldd, int rows, int cols) { \
+		if (rows <= TRANSPOSE_BLOCK && cols <= TRANSPOSE_BLOCK) { \
+			transposeBlock##suffix(src, lds, dst, ldd, rows, cols); \
+		} else if (rows >= cols) { \
+			int half = (rows / 2 + L - 1) / L * L; \
+			transposeRecursive##suffix(src, lds, dst, ldd, half, cols); \
+			transposeRecursive##suffix(src + half * lds, lds, dst + half, ldd, rows - half, cols); \
+		} else { \
+			int half = (cols / 2 + L - 1) / L * L; \
+			transposeRecursive##suffix(src, lds, dst, ldd, rows, half); \
+			transposeRecursive##suffix(src + half, lds, dst + half * ldd, ldd, rows, cols - half); \
+		} \
+	} \
+	\
+	/* bands of TRANSPOSE_BLOCK source columns i.e. destination rows */ \
+	attr static void transposeBands##suffix(int begin, int end, void* arg) { \
+		TransposeArgs* args = arg; \
+		int first = begin * TRANSPOSE_BLOCK; \
+		int last = end * TRANSPOSE_BLOCK < args->cols ? end * TRANSPOSE_BLOCK : args->cols; \
+		transposeRecursive##suffix(args->src + first, args->lds, args->dst + first * args->ldd, args->ldd, \
+			args->rows, last - first); \
+	} \
+	\
+	/* \
+	 * Bands of L rows of a square matrix. Band b swaps its tiles right of the \
+	 * diagonal with those below it, so bands are independent and the \
+	 * destination may be the source. \
+	 */ \
+	attr static void transposeSquareBands##suffix(int begin, int end, void* arg) { \
+		TransposeArgs* args = arg; \
+		const double* src = args->src; \
+		double* dst = args->dst; \
+		size_t lds = args->lds, ldd = args->ldd; \
+		int n = args->rows; \
+		int full = n / L * L; \
+		for (int band = begin; band < end; band++) { \
+			int i = band * L; \
+			if (i + L > n) { \
+				/* the rows and columns left over after the last full tile */ \
+				for (int r = i; r < n; r++) { \
+					dst[r * ldd + r] = src[r * lds + r]; \
+					for (int c = r + 1; c < n; c++) { \
+						double toSwap = src[c * lds + r]; \
+						dst[c * ldd + r] = src[r * lds + c]; \
+						dst[r * ldd + c] = toSwap; \
+					} \
+				} \
+				continue; \
+			} \
+			for (int j = i; j < full; j += L) { \
+				TransposeVec##L upper[L], lower[L]; \
+				loadTile##suffix(upper, src + i * lds + j, lds); \
+				loadTile##suffix(lower, src + j * lds + i, lds); \
+				storeTile##suffix(dst + j * ldd + i, ldd, upper); \
+				storeTile##suffix(dst + i * ldd + j, ldd, lower); \
+			} \
+			for (int r = i; r < i + L; r++) { \
+				for (int c = full; c < n; c++) { \
+					double toSwap = src[c * lds + r]; \
+					dst[c * ldd + r] = src[r * lds + c]; \
+					dst[r * ldd + c] = toSwap; \
+				} \
+			} \
+		} \
+	}
+
+TRANSPOSE_KERNELS(Generic, , 4)
+
+#ifdef MATRIX_X86
+TRANSPOSE_KERNELS(AVX2, __attribute__((target("avx2"))), 4)
+TRANSPOSE_KERNELS(AVX512, __attribute__((target("avx512f"))), 8)
+#endif
+
+/**
+ * Transposition kernels for one instruction set
+ */
+typedef struct TransposeImpl {
+	// width of the tiles, i.e. rows per band of transposeSquareBands
+	int lanes;
+	MatrixParallelTask bands;
+	MatrixParallelTask squareBands;
+} TransposeImpl;
+
+/**
+ * Selects the kernels for the widest vectors supported by the CPU the library is running on
+ * @return Transposition kernels
+ */
+static const TransposeImpl* selectTransposeImpl() {
+	static const TransposeImpl generic = { 4, transposeBandsGeneric, transposeSquareBandsGeneric };
+#ifdef MATRIX_X86
+	static const TransposeImpl avx2 = { 4, transposeBandsAVX2, transposeSquareBandsAVX2 };
+	static const TransposeImpl avx512 = { 8, transposeBandsAVX512, transposeSquareBandsAVX512 };
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return &avx512;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		return &avx2;
+	}
+#endif
+	return &generic;
+}
+
+static const TransposeImpl* getTransposeImpl() {
+	static const TransposeImpl* _Atomic selected = NULL;
+	const TransposeImpl* impl = atomic_load_explicit(&selected, memory_order_relaxed);
+	if (!impl) {
+		impl = selectTransposeImpl();
+		atomic_store_explicit(&selected, impl, memory_order_relaxed);
+	}
+	return impl;
+}
+
+/**
+ * Transposes a square block of entries
+ * @param src Entries of the block
+ * @param lds Row stride of the block
+ * @param dst Where to store the transpose (may be src)
+ * @param ldd Row stride of the destination
+ * @param n Size of the block
+ */
+static void transposeSquare(const double* src, size_t lds, double* dst, size_t ldd, int n) {
+	const TransposeImpl* impl = getTransposeImpl();
+	TransposeArgs args = { src, lds, dst, ldd, n, n };
+	int bands = (n + impl->lanes - 1) / impl->lanes;
+	matrix_parallelFor(0, bands, 1, (double)n * n, impl->squareBands, &args);
+}
+
 void matrix_transpose(Matrix* dst, const Matrix* matrix) {
+	MATRIX_INSTRUMENT(0, 16.0 * matrix->rows * matrix->cols);
 	if (dst->cols != matrix->rows || dst->rows != matrix->cols) {
 		return;
 	}
 	if (matrix->rows == matrix->cols) {
-		for (int r = 0; r < matrix->rows; r++) {
-			dst->matrix[r][r] = matrix->matrix[r][r];
-			for (int c = r + 1; c < matrix->cols; c++) {
-				double toSwap = matrix->matrix[c][r];
-				dst->matrix[c][r] = matrix->matrix[r][c];
-				dst->matrix[r][c] = toSwap;
-			}
+		transposeSquare(matrix->data, matrix->stride, dst->data, dst->stride, matrix->rows);
+		return;
+	}
+	TransposeArgs args = { matrix->data, matrix->stride, dst->data, dst->stride, matrix->rows, matrix->cols };
+	int bands = (matrix->cols + TRANSPOSE_BLOCK - 1) / TRANSPOSE_BLOCK;
+	matrix_parallelFor(0, bands, 1, (double)matrix->rows * matrix->cols, getTransposeImpl()->bands, &args);
+}
+
+/**
+ * Transposes a contiguous rows x cols array of segments in place by
+ * following the cycles of the permutation, marking the positions already
+ * visited in a bitmap
+ * @param data Array of rows * cols segments
+ * @param rows Number of rows of segments
+ * @param cols Number of columns of segments
+ * @param length Number of entries in each segment
+ */
+static void transposeSegments(double* data, int rows, int cols, size_t length) {
+	size_t count = (size_t)rows * cols;
+	MatrixArena* scratch = matrix_scratchArena();
+	MatrixArenaMark mark = matrix_arenaMark(scratch);
+	size_t words = (count + 63) / 64;
+	uint64_t* visited = matrix_arenaAlloc(scratch, words * sizeof(uint64_t));
+	memset(visited, 0, words * sizeof(uint64_t));
+	double* carry = matrix_arenaAlloc(scratch, length * sizeof(double));
+	double* next = matrix_arenaAlloc(scratch, length * sizeof(double));
+	size_t bytes = length * sizeof(double);
+	// the first and last segments never move
+	for (size_t start = 1; start + 1 < count; start++) {
+		if (visited[start / 64] & (1ull << start % 64)) {
+			continue;
 		}
-	} else {
-		for (int r = 0; r < matrix->rows; r++) {
-			for (int c = 0; c < matrix->cols; c++) {
-				dst->matrix[c][r] = matrix->matrix[r][c];
-			}
+		// segment (p / cols, p % cols) belongs at (p % cols, p / cols)
+		size_t p = start;
+		if (length == 1) {
+			double moving = data[p];
+			do {
+				p = p % cols * rows + p / cols;
+				double displaced = data[p];
+				data[p] = moving;
+				moving = displaced;
+				visited[p / 64] |= 1ull << p % 64;
+			} while (p != start);
+			continue;
+		}
+		memcpy(carry, data + p * length, bytes);
+		do {
+			p = p % cols * rows + p / cols;
+			memcpy(next, data + p * length, bytes);
+			memcpy(data + p * length, carry, bytes);
+			double* swap = carry;
+			carry = next;
+			next = swap;
+			visited[p / 64] |= 1ull << p % 64;
+		} while (p != start);
+	}
+	matrix_arenaRelease(scratch, mark);
+}
+
+int matrix_transposeInPlace(Matrix* matrix) {
+	MATRIX_INSTRUMENT(0, 16.0 * matrix->rows * matrix->cols);
+	if (!matrix_isContiguous(matrix)) {
+		return 0;
+	}
+	int rows = matrix->rows, cols = matrix->cols;
+	double* data = matrix->data;
+	if (rows == cols) {
+		transposeSquare(data, cols, data, cols, rows);
+	} else if (rows > 1 && cols > 1 && rows % cols == 0) {
+		// a stack of square blocks: transpose each block, then place the
+		// rows of the transposed blocks side by side
+		size_t block = (size_t)cols * cols;
+		for (int b = 0; b < rows / cols; b++) {
+			transposeSquare(data + b * block, cols, data + b * block, cols, cols);
+		}
+		transposeSegments(data, rows / cols, cols, cols);
+	} else if (rows > 1 && cols > 1 && cols % rows == 0) {
+		// a row of square blocks: stack the blocks, then transpose each one
+		size_t block = (size_t)rows * rows;
+		transposeSegments(data, rows, cols / rows, rows);
+		for (int b = 0; b < cols / rows; b++) {
+			transposeSquare(data + b * block, rows, data + b * block, rows, rows);
 		}
+	} else if (rows > 1 && cols > 1) {
+		transposeSegments(data, rows, cols, 1);
+	}
+	// the row table has room for max(rows, cols) entries
+	matrix->rows = cols;
+	matrix->cols = rows;
+	matrix->stride = rows;
+	for (int r = 0; r < matrix->rows; r++) {
+		matrix->matrix[r] = data + (size_t)r * matrix->stride;
 	}
+	return 1;
 }
 
 void matrix_zeroMatrix(Matrix* matrix) {
+	if (matrix_isContiguous(matrix)) {
+		memset(matrix->data, 0, (size_t)matrix->rows * matrix->cols * sizeof(double));
+		return;
+	}
 	for (int r = 0; r < matrix->rows; r++) {
-		for (int c = 0; c < matrix->cols; c++) {
-			matrix->matrix[r][c] = 0;
-		}
+		memset(matrix->matrix[r], 0, matrix->cols * sizeof(double));
 	}
 }
 
 int matrix_isZero(const Matrix* matrix) {
+	if (matrix_isContiguous(matrix)) {
+		size_t count = (size_t)matrix->rows * matrix->cols;
+		for (size_t i = 0; i < count; i++) {
+			if (matrix->data[i] != 0) {
+				return 0;
+			}
+		}
+		return 1;
+	}
 	for (int r = 0; r < matrix->rows; r++) {
 		for (int c = 0; c < matrix->cols; c++) {
 			if (matrix->matrix[r][c] != 0) {
@@ -143,10 +546,9 @@ void matrix_makeIdentity(Matrix* matrix) {
 	if (matrix->rows != matrix->cols) {
 		return;
 	}
+	matrix_zeroMatrix(matrix);
 	for (int r = 0; r < matrix->rows; r++) {
-		for (int c = 0; c < matrix->cols; c++) {
-			matrix->matrix[r][c] = r == c;
-		}
+		matrix->matrix[r][r] = 1;
 	}
 }
 
@@ -168,6 +570,15 @@ int matrix_areEqual(const Matrix* m1, const Matrix* m2, double tolerance) {
 	if (m1->rows != m2->rows || m1->cols != m2->cols) {
 		return 0;
 	}
+	if (matrix_isContiguous(m1) && matrix_isContiguous(m2)) {
+		size_t count = (size_t)m1->rows * m1->cols;
+		for (size_t i = 0; i < count; i++) {
+			if (fabs(m1->data[i] - m2->data[i]) >= tolerance) {
+				return 0;
+			}
+		}
+		return 1;
+	}
 	for (int r = 0; r < m1->rows; r++) {
 		for (int c = 0; c < m1->cols; c++) {
 			if (fabs(m1->matrix[r][c] - m2->matrix[r][c]) >= tolerance) {
@@ -24,10 +24,33 @@ extern "C" {
 #include <stdarg.h>
 #include <string.h>
 
+// alignment (in bytes) of the entry block of matrices created by the library
+#define MATRIX_ALIGNMENT 64
+
+// rounds a size in bytes up to a multiple of MATRIX_ALIGNMENT
+#define MATRIX_ALIGN(size) (((size) + MATRIX_ALIGNMENT - 1) & ~(size_t)(MATRIX_ALIGNMENT - 1))
+
+// flag for matrices whose storage is owned by something else (e.g. an arena);
+// matrix_destroyMatrix leaves such matrices alone
+#define MATRIX_BORROWED 1
+
+// flag for matrices whose entries are mapped from a file (see matrixfile.h);
+// matrix_destroyMatrix unmaps the file
+#define MATRIX_MAPPED 2
+
+/**
+ * Matrix of double precision entries. The entries are stored row-major in a
+ * single block starting at data; entry (r, c) is at data[r * stride + c].
+ * The row table in matrix points into this block, so matrix[r][c] refers to
+ * the same entry.
+ */
 typedef struct Matrix {
 	int rows;
 	int cols;
 	double** matrix;
+	double* data;
+	int stride;
+	int flags;
 } Matrix;
 
 /**
@@ -38,6 +61,77 @@ typedef struct Matrix {
  */
 Matrix* matrix_createMatrix(int rows, int cols);
 
+/**
+ * Determine the size of the single block of storage holding a matrix
+ * @param rows Number of rows in the matrix
+ * @param cols Number of columns in the matrix
+ * @return Size in bytes, a multiple of MATRIX_ALIGNMENT
+ */
+size_t matrix_storageSize(int rows, int cols);
+
+/**
+ * Constructs an uninitialized matrix in caller-provided storage. The row
+ * table has room for max(rows, cols) rows so that the matrix can be
+ * transposed in place. Add
+ * MATRIX_BORROWED to the flags of the matrix if matrix_destroyMatrix must not
+ * free the storage.
+ * @param storage Block of at least matrix_storageSize(rows, cols) bytes aligned to MATRIX_ALIGNMENT
+ * @param rows Desired number of rows in the matrix
+ * @param cols Desired number of columns in the matrix
+ * @return Pointer to the matrix (equal to storage)
+ */
+Matrix* matrix_placeMatrix(void* storage, int rows, int cols);
+
+/**
+ * Determine the size of the header (struct and row table) of a matrix whose
+ * entries are stored elsewhere
+ * @param rows Number of rows in the matrix
+ * @param cols Number of columns in the matrix
+ * @return Size in bytes, a multiple of MATRIX_ALIGNMENT
+ */
+size_t matrix_headerSize(int rows, int cols);
+
+/**
+ * Constructs a matrix header in caller-provided storage over entries that
+ * are stored elsewhere, without copying them. The row table has room for
+ * max(rows, cols) rows.
+ * @param storage Block of at least matrix_headerSize(rows, cols) bytes aligned to MATRIX_ALIGNMENT
+ * @param data Entries of the matrix; entry (r, c) is at data[r * stride + c]
+ * @param rows Number of rows in the matrix
+ * @param cols Number of columns in the matrix
+ * @param stride Distance between the starts of consecutive rows
+ * @return Pointer to the matrix (equal to storage)
+ */
+Matrix* matrix_placeWrappedMatrix(void* storage, double* data, int rows, int cols, int stride);
+
+/**
+ * Creates a matrix over caller-owned entries without copying them. Changes
+ * made through the matrix are visible in the caller's array and vice versa.
+ * matrix_destroyMatrix frees only the header; the entries are never freed by
+ * the library and must outlive the matrix.
+ * @param data Entries of the matrix; entry (r, c) is at data[r * stride + c]
+ * @param rows Number of rows in the matrix
+ * @param cols Number of columns in the matrix
+ * @param stride Distance between the starts of consecutive rows (at least cols)
+ * @return Pointer to the newly constructed matrix, or NULL if the stride is smaller than the column count
+ */
+Matrix* matrix_wrapMatrix(double* data, int rows, int cols, int stride);
+
+/**
+ * Creates a matrix referring to a block of another matrix without copying
+ * it, such as a range of rows or columns. The block shares its entries with
+ * the matrix, so every function accepting a matrix can operate on part of a
+ * larger one in place. matrix_destroyMatrix frees only the header of the
+ * block, which must not outlive the matrix it refers to.
+ * @param matrix Matrix containing the block
+ * @param row First row of the block
+ * @param col First column of the block
+ * @param rows Number of rows in the block
+ * @param cols Number of columns in the block
+ * @return Pointer to the newly constructed block, or NULL if it doesn't lie within the matrix
+ */
+Matrix* matrix_subMatrix(const Matrix* matrix, int row, int col, int rows, int cols);
+
 /**
  * Creates and returns a pointer to a new zero matrix
  * @param rows Desired number of rows in the matrix
@@ -63,7 +157,8 @@ Matrix* matrix_createIdentityMatrix(int size);
 Matrix* matrix_createMatrixWithElements(int rows, int cols, ...);
 
 /**
- * Creates a new matrix with the entries in a given 1D array
+ * Creates a new matrix with the entries in a given 1D array (see
+ * matrix_wrapMatrix to use the array without copying it)
  * @param rows Desired number of rows in the matrix
  * @param cols Desired number of columns in the matrix
  * @param elements A list of rows*cols elements
@@ -80,6 +175,14 @@ Matrix* matrix_createMatrixWithElementsFrom1D(int rows, int cols, double* elemen
  */
 Matrix* matrix_createMatrixWithElementsFrom2D(int rows, int cols, double** elements);
 
+/**
+ * Determines whether the entries of a matrix occupy a single gap-free block
+ * i.e. whether the leading dimension is equal to the number of columns
+ * @param matrix Matrix to check
+ * @return Whether the rows*cols entries can be accessed as one array at matrix->data
+ */
+int matrix_isContiguous(const Matrix* matrix);
+
 /**
  * Copies a matrix
  * @param matrix Matrix to copy
@@ -96,7 +199,8 @@ Matrix* matrix_copyMatrix(const Matrix* matrix);
 void matrix_copyEntries(Matrix* dst, const Matrix* src);
 
 /**
- * Deallocates the memory for a matrix
+ * Deallocates the memory for a matrix. Does nothing for matrices flagged as
+ * MATRIX_BORROWED, whose memory is released by their owner.
  * @param matrix Matrix to destroy
  */
 void matrix_destroyMatrix(Matrix* matrix);
@@ -109,6 +213,16 @@ void matrix_destroyMatrix(Matrix* matrix);
  */
 void matrix_transpose(Matrix* dst, const Matrix* matrix);
 
+/**
+ * Transposes a contiguous matrix of any shape in place, swapping its
+ * dimensions. The row table must have room for max(rows, cols) rows, as it
+ * does for every matrix created, placed or mapped by the library.
+ * Non-contiguous matrices are left unchanged.
+ * @param matrix Matrix to transpose
+ * @return Whether the matrix was transposed
+ */
+int matrix_transposeInPlace(Matrix* matrix);
+
 /**
  * Sets all the entries in a matrix to zero
  * @param matrix Matrix to turn into a zero matrix
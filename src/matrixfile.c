@@ -0,0 +1,835 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "matrixfile.h"
+
+#define FILE_VERSION 1
+#define BYTE_ORDER_MARK 0x01020304
+
+/**
+ * Header of a matrix record (see matrixfile.h for the layout)
+ */
+typedef struct FileHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t dtype;
+	uint32_t alignment;
+	uint32_t reserved;
+	uint64_t rows;
+	uint64_t cols;
+	uint64_t dataOffset;
+	uint64_t nnz;
+	uint64_t padding;
+} FileHeader;
+
+/**
+ * Header of an archive
+ */
+typedef struct ArchiveHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t count;
+	uint32_t reserved;
+	uint64_t directoryOffset;
+	uint64_t padding[4];
+} ArchiveHeader;
+
+/**
+ * Matrix whose entries live in a mapping of a file; the row table follows it
+ */
+typedef struct MappedMatrix {
+	Matrix matrix;
+	void* base;
+	size_t length;
+} MappedMatrix;
+
+static const char fileMagic[4] = { 'M', 'T', 'R', 'X' };
+static const char archiveMagic[8] = { 'M', 'T', 'R', 'X', 'A', 'R', 'C', 'H' };
+
+/**
+ * Determine the size of the entries of dense matrix records
+ * @param dtype Entry type of the record
+ * @return Size of an entry in bytes, or 0 if the type isn't a dense one
+ */
+static size_t entrySize(uint32_t dtype) {
+	switch (dtype) {
+		case MATRIX_DTYPE_DOUBLE:
+			return sizeof(double);
+		case MATRIX_DTYPE_F:
+			return sizeof(float);
+		case MATRIX_DTYPE_I32:
+			return sizeof(int32_t);
+		case MATRIX_DTYPE_I64:
+			return sizeof(int64_t);
+		default:
+			return 0;
+	}
+}
+
+static uint64_t dataSize(const FileHeader* header) {
+	if (header->dtype == MATRIX_DTYPE_CSR) {
+		return header->nnz * sizeof(double) + (header->rows + 1 + header->nnz) * sizeof(int32_t);
+	}
+	return header->rows * header->cols * entrySize(header->dtype);
+}
+
+/**
+ * Fills in the header of a matrix record
+ * @param header Header to fill in
+ * @param dtype Entry type of the record
+ * @param rows Number of rows in the matrix
+ * @param cols Number of columns in the matrix
+ */
+static void initHeader(FileHeader* header, uint32_t dtype, int rows, int cols) {
+	memset(header, 0, sizeof(FileHeader));
+	memcpy(header->magic, fileMagic, sizeof(fileMagic));
+	header->version = FILE_VERSION;
+	header->byteOrder = BYTE_ORDER_MARK;
+	header->dtype = dtype;
+	header->alignment = MATRIX_ALIGNMENT;
+	header->rows = rows;
+	header->cols = cols;
+	header->dataOffset = MATRIX_ALIGN(sizeof(FileHeader));
+}
+
+/**
+ * Writes the header of a matrix record and the padding up to its entries
+ * @param file File to write to
+ * @param header Header to write
+ * @return Whether the header was written successfully
+ */
+static int writeHeader(FILE* file, const FileHeader* header) {
+	if (fwrite(header, sizeof(FileHeader), 1, file) != 1) {
+		return 0;
+	}
+	static const char zeros[MATRIX_ALIGNMENT] = { 0 };
+	size_t pad = header->dataOffset - sizeof(FileHeader);
+	return !pad || fwrite(zeros, 1, pad, file) == pad;
+}
+
+/**
+ * Writes a matrix record at the current position of a file
+ * @param file File to write to
+ * @param matrix Matrix to write
+ * @return Whether the record was written successfully
+ */
+static int writeRecord(FILE* file, const Matrix* matrix) {
+	FileHeader header;
+	initHeader(&header, MATRIX_DTYPE_DOUBLE, matrix->rows, matrix->cols);
+	if (!writeHeader(file, &header)) {
+		return 0;
+	}
+	if (matrix_isContiguous(matrix)) {
+		size_t count = (size_t)matrix->rows * matrix->cols;
+		return fwrite(matrix->data, sizeof(double), count, file) == count;
+	}
+	for (int r = 0; r < matrix->rows; r++) {
+		if (fwrite(matrix->matrix[r], sizeof(double), matrix->cols, file) != (size_t)matrix->cols) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Writes a sparse matrix record at the current position of a file
+ * @param file File to write to
+ * @param matrix Sparse matrix to write, in CSR format
+ * @return Whether the record was written successfully
+ */
+static int writeSparseRecord(FILE* file, const SparseMatrix* matrix) {
+	FileHeader header;
+	initHeader(&header, MATRIX_DTYPE_CSR, matrix->rows, matrix->cols);
+	header.nnz = matrix->nnz;
+	size_t nnz = matrix->nnz;
+	size_t offsets = (size_t)matrix->rows + 1;
+	return writeHeader(file, &header)
+		&& fwrite(matrix->values, sizeof(double), nnz, file) == nnz
+		&& fwrite(matrix->ptr, sizeof(int32_t), offsets, file) == offsets
+		&& fwrite(matrix->indices, sizeof(int32_t), nnz, file) == nnz;
+}
+
+/**
+ * Pads a file with zeros up to the next multiple of MATRIX_ALIGNMENT
+ * @param file File to pad
+ * @return Whether the padding was written successfully
+ */
+static int alignFile(FILE* file) {
+	static const char zeros[MATRIX_ALIGNMENT] = { 0 };
+	off_t pos = ftello(file);
+	if (pos < 0) {
+		return 0;
+	}
+	size_t pad = MATRIX_ALIGN(pos) - pos;
+	return !pad || fwrite(zeros, 1, pad, file) == pad;
+}
+
+/**
+ * Reads exactly the requested number of bytes from a file
+ * @param fd File descriptor
+ * @param buf Buffer to read into
+ * @param size Number of bytes to read
+ * @param offset Position in the file at which to start reading
+ * @return Whether all bytes were read
+ */
+static int readFully(int fd, void* buf, size_t size, off_t offset) {
+	char* dst = buf;
+	while (size) {
+		ssize_t got = pread(fd, dst, size, offset);
+		if (got <= 0) {
+			return 0;
+		}
+		dst += got;
+		size -= got;
+		offset += got;
+	}
+	return 1;
+}
+
+/**
+ * Writes exactly the requested number of bytes to a file
+ * @param fd File descriptor
+ * @param buf Buffer to write from
+ * @param size Number of bytes to write
+ * @param offset Position in the file at which to start writing
+ * @return Whether all bytes were written
+ */
+static int writeFully(int fd, const void* buf, size_t size, off_t offset) {
+	const char* src = buf;
+	while (size) {
+		ssize_t put = pwrite(fd, src, size, offset);
+		if (put <= 0) {
+			return 0;
+		}
+		src += put;
+		size -= put;
+		offset += put;
+	}
+	return 1;
+}
+
+/**
+ * Reads and validates the header of a matrix record
+ * @param fd File descriptor
+ * @param offset Position of the record in the file
+ * @param fileSize Size of the file
+ * @param header Header in which to store the result
+ * @return Whether the header describes a valid record that fits in the file
+ */
+static int readHeader(int fd, off_t offset, uint64_t fileSize, FileHeader* header) {
+	if (!readFully(fd, header, sizeof(FileHeader), offset)) {
+		return 0;
+	}
+	if (memcmp(header->magic, fileMagic, sizeof(fileMagic)) || header->version != FILE_VERSION
+			|| header->byteOrder != BYTE_ORDER_MARK) {
+		return 0;
+	}
+	// the writer always puts the data right after the header, so larger offsets are corrupt
+	if (header->rows > INT_MAX || header->cols > INT_MAX || header->dataOffset < sizeof(FileHeader)
+			|| header->dataOffset > sizeof(FileHeader) + MATRIX_ALIGNMENT
+			|| header->dataOffset % MATRIX_ALIGNMENT || header->dataOffset > fileSize - offset) {
+		return 0;
+	}
+	if (header->dtype == MATRIX_DTYPE_CSR) {
+		if (header->nnz > INT_MAX || header->nnz > header->rows * header->cols) {
+			return 0;
+		}
+	} else if (!entrySize(header->dtype)
+			|| (header->cols && header->rows > SIZE_MAX / entrySize(header->dtype) / header->cols)) {
+		return 0;
+	}
+	return dataSize(header) <= fileSize - offset - header->dataOffset;
+}
+
+/**
+ * Maps a matrix record into memory
+ * @param fd File descriptor
+ * @param offset Position of the record in the file, a multiple of MATRIX_ALIGNMENT
+ * @param header Validated header of the record
+ * @return Mapped matrix, or NULL if the mapping failed
+ */
+static Matrix* mapRecord(int fd, off_t offset, const FileHeader* header) {
+	// mappings must start on a page boundary
+	long page = sysconf(_SC_PAGESIZE);
+	off_t start = offset / page * page;
+	size_t skip = offset - start + header->dataOffset;
+	size_t length = skip + dataSize(header);
+	void* base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, start);
+	if (base == MAP_FAILED) {
+		return NULL;
+	}
+
+	int rows = (int)header->rows;
+	// like the row tables of other matrices, leave room for the transpose's rows
+	int tableRows = header->cols > header->rows ? (int)header->cols : rows;
+	MappedMatrix* mapped = malloc(sizeof(MappedMatrix) + tableRows * sizeof(double*));
+	mapped->base = base;
+	mapped->length = length;
+	Matrix* matrix = &mapped->matrix;
+	matrix->rows = rows;
+	matrix->cols = (int)header->cols;
+	matrix->stride = matrix->cols;
+	matrix->flags = MATRIX_MAPPED;
+	matrix->matrix = (double**)(mapped + 1);
+	matrix->data = (double*)((char*)base + skip);
+	for (int r = 0; r < rows; r++) {
+		matrix->matrix[r] = matrix->data + (size_t)r * matrix->stride;
+	}
+	return matrix;
+}
+
+/**
+ * Reads a matrix record into a newly allocated matrix
+ * @param fd File descriptor
+ * @param offset Position of the record in the file
+ * @param header Validated header of the record
+ * @return Matrix holding the entries of the record, or NULL if they couldn't be read
+ */
+static Matrix* readRecord(int fd, off_t offset, const FileHeader* header) {
+	Matrix* matrix = matrix_createMatrix((int)header->rows, (int)header->cols);
+	if (!readFully(fd, matrix->data, dataSize(header), offset + header->dataOffset)) {
+		matrix_destroyMatrix(matrix);
+		return NULL;
+	}
+	return matrix;
+}
+
+/**
+ * Reads a sparse matrix record into a newly allocated sparse matrix
+ * @param fd File descriptor
+ * @param offset Position of the record in the file
+ * @param header Validated header of a record of type MATRIX_DTYPE_CSR
+ * @return Sparse matrix in CSR format, or NULL if the record couldn't be read or its structure is invalid
+ */
+static SparseMatrix* readSparseRecord(int fd, off_t offset, const FileHeader* header) {
+	int rows = (int)header->rows;
+	int cols = (int)header->cols;
+	int nnz = (int)header->nnz;
+	SparseMatrix* matrix = matrix_createSparse(rows, cols, MATRIX_CSR, nnz);
+	off_t pos = offset + header->dataOffset;
+	int valid = readFully(fd, matrix->values, nnz * sizeof(double), pos)
+		&& readFully(fd, matrix->ptr, ((size_t)rows + 1) * sizeof(int32_t), pos + nnz * sizeof(double))
+		&& readFully(fd, matrix->indices, nnz * sizeof(int32_t),
+			pos + nnz * sizeof(double) + ((size_t)rows + 1) * sizeof(int32_t));
+	// a damaged record mustn't make the sparse kernels index out of bounds
+	valid = valid && matrix->ptr[0] == 0 && matrix->ptr[rows] == nnz;
+	for (int r = 0; valid && r < rows; r++) {
+		valid = matrix->ptr[r] <= matrix->ptr[r + 1] && matrix->ptr[r + 1] <= nnz;
+		for (int k = matrix->ptr[r]; valid && k < matrix->ptr[r + 1]; k++) {
+			valid = matrix->indices[k] >= 0 && matrix->indices[k] < cols
+				&& (k == matrix->ptr[r] || matrix->indices[k - 1] < matrix->indices[k]);
+		}
+	}
+	if (!valid) {
+		matrix_destroySparse(matrix);
+		return NULL;
+	}
+	matrix->nnz = nnz;
+	return matrix;
+}
+
+int matrix_saveMatrix(const Matrix* matrix, const char* path) {
+	FILE* file = fopen(path, "wb");
+	if (!file) {
+		return 0;
+	}
+	int success = writeRecord(file, matrix);
+	return fclose(file) == 0 && success;
+}
+
+/**
+ * Record functions of an element type other than double
+ * @param S Suffix of the element type
+ * @param T Element type
+ */
+#define MATRIXFILE_ELEMENT_TYPE(S, T) \
+	static int writeRecord##S(FILE* file, const Matrix##S* matrix) { \
+		FileHeader header; \
+		initHeader(&header, MATRIX_DTYPE_##S, matrix->rows, matrix->cols); \
+		if (!writeHeader(file, &header)) { \
+			return 0; \
+		} \
+		if (matrix->stride == matrix->cols) { \
+			size_t count = (size_t)matrix->rows * matrix->cols; \
+			return fwrite(matrix->data, sizeof(T), count, file) == count; \
+		} \
+		for (int r = 0; r < matrix->rows; r++) { \
+			if (fwrite(matrix->matrix[r], sizeof(T), matrix->cols, file) != (size_t)matrix->cols) { \
+				return 0; \
+			} \
+		} \
+		return 1; \
+	} \
+	\
+	static Matrix##S* readRecord##S(int fd, off_t offset, const FileHeader* header) { \
+		Matrix##S* matrix = matrix_createMatrix##S((int)header->rows, (int)header->cols); \
+		if (!readFully(fd, matrix->data, dataSize(header), offset + header->dataOffset)) { \
+			matrix_destroyMatrix##S(matrix); \
+			return NULL; \
+		} \
+		return matrix; \
+	} \
+	\
+	int matrix_saveMatrix##S(const Matrix##S* matrix, const char* path) { \
+		FILE* file = fopen(path, "wb"); \
+		if (!file) { \
+			return 0; \
+		} \
+		int success = writeRecord##S(file, matrix); \
+		return fclose(file) == 0 && success; \
+	}
+
+MATRIX_ELEMENT_TYPES(MATRIXFILE_ELEMENT_TYPE)
+
+/**
+ * Reads a record of any entry type
+ * @param fd File descriptor
+ * @param offset Position of the record in the file
+ * @param header Validated header of the record
+ * @return Matrix of the record's type (see MatrixRecordVisitor), or NULL if it couldn't be read
+ */
+static void* loadRecord(int fd, off_t offset, const FileHeader* header) {
+	switch (header->dtype) {
+		case MATRIX_DTYPE_CSR:
+			return readSparseRecord(fd, offset, header);
+		case MATRIX_DTYPE_F:
+			return readRecordF(fd, offset, header);
+		case MATRIX_DTYPE_I32:
+			return readRecordI32(fd, offset, header);
+		case MATRIX_DTYPE_I64:
+			return readRecordI64(fd, offset, header);
+		default:
+			// small matrices are copied so that they don't each take up a mapping
+			if (dataSize(header) >= MATRIX_ARCHIVE_MAP_THRESHOLD) {
+				return mapRecord(fd, offset, header);
+			}
+			return readRecord(fd, offset, header);
+	}
+}
+
+void* matrix_loadRecord(const char* path, int* dtype) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	FileHeader header;
+	void* matrix = NULL;
+	if (fstat(fd, &st) == 0 && readHeader(fd, 0, st.st_size, &header) && header.dtype != MATRIX_DTYPE_CSR) {
+		*dtype = header.dtype;
+		// double precision files are mapped regardless of their size, like matrix_mapMatrix does
+		matrix = header.dtype == MATRIX_DTYPE_DOUBLE ? mapRecord(fd, 0, &header) : loadRecord(fd, 0, &header);
+	}
+	close(fd);
+	return matrix;
+}
+
+Matrix* matrix_mapMatrix(const char* path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	FileHeader header;
+	Matrix* matrix = NULL;
+	if (fstat(fd, &st) == 0 && readHeader(fd, 0, st.st_size, &header) && header.dtype == MATRIX_DTYPE_DOUBLE) {
+		matrix = mapRecord(fd, 0, &header);
+	}
+	// the mapping remains valid after the file is closed
+	close(fd);
+	return matrix;
+}
+
+void matrix_unmapMatrix(Matrix* matrix) {
+	MappedMatrix* mapped = (MappedMatrix*)matrix;
+	munmap(mapped->base, mapped->length);
+	free(mapped);
+}
+
+MatrixFile* matrix_openMatrixFile(const char* path, int writable) {
+	int fd = open(path, writable ? O_RDWR : O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	FileHeader header;
+	if (fstat(fd, &st) || !readHeader(fd, 0, st.st_size, &header) || header.dtype != MATRIX_DTYPE_DOUBLE) {
+		close(fd);
+		return NULL;
+	}
+	MatrixFile* file = malloc(sizeof(MatrixFile));
+	file->fd = fd;
+	file->rows = (int)header.rows;
+	file->cols = (int)header.cols;
+	file->writable = writable;
+	file->dataOffset = header.dataOffset;
+	return file;
+}
+
+MatrixFile* matrix_createMatrixFile(const char* path, int rows, int cols) {
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return NULL;
+	}
+	FileHeader header;
+	initHeader(&header, MATRIX_DTYPE_DOUBLE, rows, cols);
+	// extending the file fills it with zeros without writing them
+	if (!writeFully(fd, &header, sizeof(header), 0) || ftruncate(fd, header.dataOffset + dataSize(&header))) {
+		close(fd);
+		return NULL;
+	}
+	MatrixFile* file = malloc(sizeof(MatrixFile));
+	file->fd = fd;
+	file->rows = rows;
+	file->cols = cols;
+	file->writable = 1;
+	file->dataOffset = header.dataOffset;
+	return file;
+}
+
+int matrix_closeMatrixFile(MatrixFile* file) {
+	int success = 1;
+	if (file->writable) {
+		success = fsync(file->fd) == 0;
+	}
+	success = close(file->fd) == 0 && success;
+	free(file);
+	return success;
+}
+
+/**
+ * Determine the position of an entry of a matrix file
+ * @param file Matrix file
+ * @param row Row of the entry
+ * @param col Column of the entry
+ * @return Offset of the entry from the start of the file
+ */
+static off_t entryOffset(const MatrixFile* file, int row, int col) {
+	return file->dataOffset + ((uint64_t)row * file->cols + col) * sizeof(double);
+}
+
+/**
+ * Determine whether a block lies within the matrix of a file
+ */
+static int blockInFile(const MatrixFile* file, int row, int col, int rows, int cols) {
+	return row >= 0 && col >= 0 && rows >= 0 && cols >= 0
+		&& rows <= file->rows - row && cols <= file->cols - col;
+}
+
+int matrix_readBlock(Matrix* dst, const MatrixFile* file, int row, int col) {
+	if (!blockInFile(file, row, col, dst->rows, dst->cols)) {
+		return 0;
+	}
+	// whole rows of the file are contiguous, so they are read at once
+	if (dst->cols == file->cols && matrix_isContiguous(dst)) {
+		return readFully(file->fd, dst->data, (size_t)dst->rows * dst->cols * sizeof(double),
+			entryOffset(file, row, col));
+	}
+	for (int r = 0; r < dst->rows; r++) {
+		if (!readFully(file->fd, dst->matrix[r], dst->cols * sizeof(double), entryOffset(file, row + r, col))) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int matrix_writeBlock(MatrixFile* file, const Matrix* matrix, int row, int col) {
+	if (!file->writable || !blockInFile(file, row, col, matrix->rows, matrix->cols)) {
+		return 0;
+	}
+	if (matrix->cols == file->cols && matrix_isContiguous(matrix)) {
+		return writeFully(file->fd, matrix->data, (size_t)matrix->rows * matrix->cols * sizeof(double),
+			entryOffset(file, row, col));
+	}
+	for (int r = 0; r < matrix->rows; r++) {
+		if (!writeFully(file->fd, matrix->matrix[r], matrix->cols * sizeof(double), entryOffset(file, row + r, col))) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void matrix_prefetchBlock(const MatrixFile* file, int row, int col, int rows, int cols) {
+	if (!blockInFile(file, row, col, rows, cols)) {
+		return;
+	}
+	if (cols == file->cols) {
+		posix_fadvise(file->fd, entryOffset(file, row, col), (off_t)rows * cols * sizeof(double), POSIX_FADV_WILLNEED);
+		return;
+	}
+	for (int r = 0; r < rows; r++) {
+		posix_fadvise(file->fd, entryOffset(file, row + r, col), cols * sizeof(double), POSIX_FADV_WILLNEED);
+	}
+}
+
+/**
+ * Header of an archive with no matrices yet
+ * @param header Header to fill in
+ */
+static void initArchiveHeader(ArchiveHeader* header) {
+	memset(header, 0, sizeof(ArchiveHeader));
+	memcpy(header->magic, archiveMagic, sizeof(archiveMagic));
+	header->version = FILE_VERSION;
+	header->byteOrder = BYTE_ORDER_MARK;
+}
+
+MatrixArchive* matrix_createArchive(const char* path) {
+	FILE* file = fopen(path, "wb");
+	if (!file) {
+		return NULL;
+	}
+	// the header is rewritten once the position of the directory is known
+	ArchiveHeader header;
+	initArchiveHeader(&header);
+	if (fwrite(&header, sizeof(header), 1, file) != 1) {
+		fclose(file);
+		return NULL;
+	}
+	MatrixArchive* archive = malloc(sizeof(MatrixArchive));
+	archive->file = file;
+	archive->count = 0;
+	archive->capacity = 0;
+	archive->offsets = NULL;
+	archive->names = NULL;
+	archive->valid = 1;
+	return archive;
+}
+
+/**
+ * Starts a record in an archive: aligns the file and adds the record to
+ * the directory
+ * @param archive Archive to write to
+ * @param name Name of the matrix in the record
+ * @return Whether the record can be written
+ */
+static int beginRecord(MatrixArchive* archive, const char* name) {
+	if (!archive->valid || !alignFile(archive->file)) {
+		return archive->valid = 0;
+	}
+	off_t pos = ftello(archive->file);
+	if (pos < 0) {
+		return archive->valid = 0;
+	}
+	if (archive->count == archive->capacity) {
+		archive->capacity = archive->capacity ? 2 * archive->capacity : 16;
+		archive->offsets = realloc(archive->offsets, archive->capacity * sizeof(uint64_t));
+		archive->names = realloc(archive->names, archive->capacity * sizeof(char*));
+	}
+	archive->offsets[archive->count] = pos;
+	archive->names[archive->count] = strdup(name);
+	archive->count++;
+	return 1;
+}
+
+int matrix_archiveMatrix(MatrixArchive* archive, const char* name, const Matrix* matrix) {
+	if (!beginRecord(archive, name)) {
+		return 0;
+	}
+	return archive->valid = writeRecord(archive->file, matrix);
+}
+
+/**
+ * Archive function of an element type other than double
+ * @param S Suffix of the element type
+ * @param T Element type
+ */
+#define MATRIXFILE_ARCHIVE_ELEMENT_TYPE(S, T) \
+	int matrix_archiveMatrix##S(MatrixArchive* archive, const char* name, const Matrix##S* matrix) { \
+		if (!beginRecord(archive, name)) { \
+			return 0; \
+		} \
+		return archive->valid = writeRecord##S(archive->file, matrix); \
+	}
+
+MATRIX_ELEMENT_TYPES(MATRIXFILE_ARCHIVE_ELEMENT_TYPE)
+
+int matrix_archiveSparse(MatrixArchive* archive, const char* name, const SparseMatrix* matrix) {
+	if (!beginRecord(archive, name)) {
+		return 0;
+	}
+	if (matrix->format == MATRIX_CSR) {
+		return archive->valid = writeSparseRecord(archive->file, matrix);
+	}
+	SparseMatrix* rows = matrix_sparseConvert(matrix, MATRIX_CSR);
+	archive->valid = writeSparseRecord(archive->file, rows);
+	matrix_destroySparse(rows);
+	return archive->valid;
+}
+
+int matrix_closeArchive(MatrixArchive* archive) {
+	FILE* file = archive->file;
+	ArchiveHeader header;
+	initArchiveHeader(&header);
+	header.count = archive->count;
+	int success = archive->valid;
+	if (success) {
+		off_t pos = ftello(file);
+		success = pos >= 0;
+		header.directoryOffset = pos;
+	}
+	for (int i = 0; success && i < archive->count; i++) {
+		uint32_t length = strlen(archive->names[i]);
+		success = fwrite(&archive->offsets[i], sizeof(uint64_t), 1, file) == 1
+			&& fwrite(&length, sizeof(uint32_t), 1, file) == 1
+			&& fwrite(archive->names[i], 1, length, file) == length;
+	}
+	if (success) {
+		success = fseeko(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+	}
+	for (int i = 0; i < archive->count; i++) {
+		free(archive->names[i]);
+	}
+	free(archive->names);
+	free(archive->offsets);
+	free(archive);
+	return fclose(file) == 0 && success;
+}
+
+int matrix_saveArchive(const char* path, int count, const char* const* names, const Matrix* const* matrices) {
+	MatrixArchive* archive = matrix_createArchive(path);
+	if (!archive) {
+		return 0;
+	}
+	for (int i = 0; i < count; i++) {
+		if (!matrix_archiveMatrix(archive, names[i], matrices[i])) {
+			break;
+		}
+	}
+	return matrix_closeArchive(archive);
+}
+
+int matrix_loadArchiveRecords(const char* path, MatrixRecordVisitor visit, void* arg) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	struct stat st;
+	ArchiveHeader header;
+	if (fstat(fd, &st) || !readFully(fd, &header, sizeof(header), 0)
+			|| memcmp(header.magic, archiveMagic, sizeof(archiveMagic)) || header.version != FILE_VERSION
+			|| header.byteOrder != BYTE_ORDER_MARK || header.count > INT_MAX
+			|| header.directoryOffset < sizeof(header) || header.directoryOffset > (uint64_t)st.st_size) {
+		close(fd);
+		return -1;
+	}
+
+	// read the directory and check every record before loading any of them
+	size_t dirSize = st.st_size - header.directoryOffset;
+	char* dir = malloc(dirSize + 1);
+	int count = header.count;
+	FileHeader* records = malloc(count * sizeof(FileHeader) + 1);
+	int valid = readFully(fd, dir, dirSize, header.directoryOffset);
+	size_t pos = 0;
+	for (int i = 0; valid && i < count; i++) {
+		uint64_t offset;
+		uint32_t length;
+		if (dirSize - pos < sizeof(offset) + sizeof(length)) {
+			valid = 0;
+			break;
+		}
+		memcpy(&offset, dir + pos, sizeof(offset));
+		memcpy(&length, dir + pos + sizeof(offset), sizeof(length));
+		pos += sizeof(offset) + sizeof(length) + length;
+		valid = pos <= dirSize && offset % MATRIX_ALIGNMENT == 0 && offset < header.directoryOffset
+			&& readHeader(fd, offset, header.directoryOffset, &records[i]);
+	}
+	if (!valid) {
+		free(records);
+		free(dir);
+		close(fd);
+		return -1;
+	}
+
+	pos = 0;
+	int loaded = 0;
+	for (int i = 0; i < count; i++) {
+		uint64_t offset;
+		uint32_t length;
+		memcpy(&offset, dir + pos, sizeof(offset));
+		memcpy(&length, dir + pos + sizeof(offset), sizeof(length));
+		char* name = dir + pos + sizeof(offset) + sizeof(length);
+		pos += sizeof(offset) + sizeof(length) + length;
+
+		void* matrix = loadRecord(fd, offset, &records[i]);
+		if (!matrix) {
+			continue;
+		}
+		// names are stored without terminators; the directory has a spare byte at the end
+		char saved = name[length];
+		name[length] = '\0';
+		visit(name, records[i].dtype, matrix, arg);
+		name[length] = saved;
+		loaded++;
+	}
+	free(records);
+	free(dir);
+	close(fd);
+	return loaded;
+}
+
+/**
+ * Function to which matrix_loadArchive passes the dense matrices and the
+ * argument given to it
+ */
+typedef struct DenseVisitor {
+	MatrixArchiveVisitor visit;
+	void* arg;
+} DenseVisitor;
+
+static void visitDense(const char* name, int dtype, void* matrix, void* arg) {
+	DenseVisitor* dense = arg;
+	if (dtype == MATRIX_DTYPE_DOUBLE) {
+		dense->visit(name, matrix, dense->arg);
+		return;
+	}
+	// every matrix type starts with its row and column counts
+	Matrix* expanded = matrix_createMatrix(((Matrix*)matrix)->rows, ((Matrix*)matrix)->cols);
+	switch (dtype) {
+		case MATRIX_DTYPE_CSR:
+			matrix_sparseToDense(expanded, matrix);
+			matrix_destroySparse(matrix);
+			break;
+		case MATRIX_DTYPE_F:
+			matrix_convertFromF(expanded, matrix);
+			matrix_destroyMatrixF(matrix);
+			break;
+		case MATRIX_DTYPE_I32:
+			matrix_convertFromI32(expanded, matrix);
+			matrix_destroyMatrixI32(matrix);
+			break;
+		case MATRIX_DTYPE_I64:
+			matrix_convertFromI64(expanded, matrix);
+			matrix_destroyMatrixI64(matrix);
+			break;
+	}
+	dense->visit(name, expanded, dense->arg);
+}
+
+int matrix_loadArchive(const char* path, MatrixArchiveVisitor visit, void* arg) {
+	DenseVisitor dense = { visit, arg };
+	return matrix_loadArchiveRecords(path, visitDense, &dense);
+}
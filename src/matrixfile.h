@@ -0,0 +1,294 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef MATRIXFILE_H
+#define MATRIXFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "matrix.h"
+#include "sparse.h"
+#include "typedmatrix.h"
+
+/*
+ * Binary matrix files consist of a 64 byte header followed by the entries.
+ * All header fields are in the byte order of the machine that wrote the file.
+ *
+ * offset  size  field
+ *      0     4  magic "MTRX"
+ *      4     4  format version (1)
+ *      8     4  byte order mark 0x01020304
+ *     12     4  entry type (1 for double, 2 for a sparse matrix in CSR format,
+ *                3 for float, 4 for int32_t, 5 for int64_t)
+ *     16     4  alignment of the entries in bytes (64)
+ *     20     4  reserved
+ *     24     8  row count
+ *     32     8  column count
+ *     40     8  offset of the first entry from the start of the header
+ *     48     8  number of stored entries (sparse matrices only)
+ *     56     8  reserved
+ *
+ * The entries are stored row-major without padding between rows. Sparse
+ * matrices store the values of their entries followed by the rows + 1 row
+ * offsets and the column of each entry, as 32-bit integers (see sparse.h).
+ * Only archives hold sparse matrices.
+ *
+ * Archives store any number of named matrices in a single file: a 64 byte
+ * header (magic "MTRXARCH", version, entry count, offset of the directory),
+ * the matrix records, each in the format above starting at an aligned
+ * offset, and a directory holding the name and record offset of each matrix.
+ */
+
+// entry types of the matrices in matrix files
+#define MATRIX_DTYPE_DOUBLE 1
+#define MATRIX_DTYPE_CSR 2
+#define MATRIX_DTYPE_F 3
+#define MATRIX_DTYPE_I32 4
+#define MATRIX_DTYPE_I64 5
+
+// records of at least this many bytes are mapped rather than read from archives
+#define MATRIX_ARCHIVE_MAP_THRESHOLD (1 << 16)
+
+/**
+ * Open matrix file whose entries are accessed in blocks rather than all at
+ * once, for matrices too large to keep in memory
+ */
+typedef struct MatrixFile {
+	int fd;
+	int rows;
+	int cols;
+	// whether blocks may be written to the file
+	int writable;
+	// position of the first entry in the file
+	uint64_t dataOffset;
+} MatrixFile;
+
+/**
+ * Archive being written one matrix at a time; the directory is written when
+ * it is closed
+ */
+typedef struct MatrixArchive {
+	FILE* file;
+	int count;
+	int capacity;
+	// position and name of each matrix written so far
+	uint64_t* offsets;
+	char** names;
+	// whether every matrix so far was written successfully
+	int valid;
+} MatrixArchive;
+
+/**
+ * Writes a matrix to a binary matrix file
+ * @param matrix Matrix to write
+ * @param path Path of the file, which is replaced if it exists
+ * @return Whether the file was written successfully
+ */
+int matrix_saveMatrix(const Matrix* matrix, const char* path);
+
+/*
+ * For an element type S other than double (see typedmatrix.h):
+ *
+ * int matrix_saveMatrixS(const MatrixS* matrix, const char* path)
+ *     Writes a matrix to a binary matrix file of entry type MATRIX_DTYPE_S
+ * int matrix_archiveMatrixS(MatrixArchive* archive, const char* name, const MatrixS* matrix)
+ *     Writes a matrix to an archive, keeping its entry type
+ */
+#define MATRIXFILE_DECLARE_ELEMENT_TYPE(S, T) \
+	int matrix_saveMatrix##S(const Matrix##S* matrix, const char* path); \
+	int matrix_archiveMatrix##S(MatrixArchive* archive, const char* name, const Matrix##S* matrix);
+
+MATRIX_ELEMENT_TYPES(MATRIXFILE_DECLARE_ELEMENT_TYPE)
+
+/**
+ * Loads a binary matrix file of any entry type. Double precision matrices
+ * are mapped like matrix_mapMatrix does, others are read into newly
+ * allocated matrices.
+ * @param path Path of the file
+ * @param dtype Where to store the entry type of the matrix (MATRIX_DTYPE_*)
+ * @return Pointer to the loaded Matrix, MatrixF, MatrixI32 or MatrixI64 depending on the entry type, or NULL if the file can't be read or isn't a valid matrix file
+ */
+void* matrix_loadRecord(const char* path, int* dtype);
+
+/**
+ * Maps a binary matrix file into memory. Nothing is read until the entries
+ * are accessed, so matrices of any size are available immediately. The
+ * mapping is private: changes to the matrix are not written back to the
+ * file. matrix_destroyMatrix unmaps the file.
+ * @param path Path of the file
+ * @return Pointer to the mapped matrix, or NULL if the file can't be mapped or isn't a valid matrix file
+ */
+Matrix* matrix_mapMatrix(const char* path);
+
+/**
+ * Releases the mapping of a matrix created by matrix_mapMatrix or
+ * matrix_loadArchive. Called by matrix_destroyMatrix for matrices flagged as
+ * MATRIX_MAPPED.
+ * @param matrix Mapped matrix to release
+ */
+void matrix_unmapMatrix(Matrix* matrix);
+
+/**
+ * Opens a binary matrix file for block access
+ * @param path Path of the file
+ * @param writable Whether blocks will be written to the file
+ * @return Pointer to the open file, or NULL if the file can't be opened or isn't a valid matrix file
+ */
+MatrixFile* matrix_openMatrixFile(const char* path, int writable);
+
+/**
+ * Creates a binary matrix file holding a zero matrix and opens it for block
+ * access. The entries take up no disk space until they are written on file
+ * systems that support sparse files.
+ * @param path Path of the file, which is replaced if it exists
+ * @param rows Number of rows in the matrix
+ * @param cols Number of columns in the matrix
+ * @return Pointer to the open file, or NULL if the file couldn't be created
+ */
+MatrixFile* matrix_createMatrixFile(const char* path, int rows, int cols);
+
+/**
+ * Closes a matrix file opened for block access
+ * @param file File to close
+ * @return Whether all written blocks were stored successfully
+ */
+int matrix_closeMatrixFile(MatrixFile* file);
+
+/**
+ * Reads a block of a matrix file into a matrix. If the block doesn't lie
+ * within the file's matrix, the destination is left unchanged.
+ * @param dst Matrix in which to store the block; its size is the size of the block
+ * @param file File to read from
+ * @param row First row of the block
+ * @param col First column of the block
+ * @return Whether the block was read successfully
+ */
+int matrix_readBlock(Matrix* dst, const MatrixFile* file, int row, int col);
+
+/**
+ * Writes a matrix to a block of a matrix file
+ * @param file File to write to
+ * @param matrix Matrix to write; its size is the size of the block
+ * @param row First row of the block
+ * @param col First column of the block
+ * @return Whether the block was written successfully (false if it doesn't lie within the file's matrix)
+ */
+int matrix_writeBlock(MatrixFile* file, const Matrix* matrix, int row, int col);
+
+/**
+ * Asks the operating system to start reading a block of a matrix file in
+ * the background so that a later matrix_readBlock doesn't have to wait
+ * @param file File to read from
+ * @param row First row of the block
+ * @param col First column of the block
+ * @param rows Number of rows in the block
+ * @param cols Number of columns in the block
+ */
+void matrix_prefetchBlock(const MatrixFile* file, int row, int col, int rows, int cols);
+
+/**
+ * Creates an archive to which matrices are written one at a time, so that
+ * only the matrix being written has to be in memory
+ * @param path Path of the archive, which is replaced if it exists
+ * @return Pointer to the archive, or NULL if the file couldn't be created
+ */
+MatrixArchive* matrix_createArchive(const char* path);
+
+/**
+ * Writes a matrix to an archive
+ * @param archive Archive to write to
+ * @param name Name of the matrix
+ * @param matrix Matrix to write
+ * @return Whether the matrix was written successfully
+ */
+int matrix_archiveMatrix(MatrixArchive* archive, const char* name, const Matrix* matrix);
+
+/**
+ * Writes a sparse matrix to an archive without expanding it
+ * @param archive Archive to write to
+ * @param name Name of the matrix
+ * @param matrix Sparse matrix to write, in either format
+ * @return Whether the matrix was written successfully
+ */
+int matrix_archiveSparse(MatrixArchive* archive, const char* name, const SparseMatrix* matrix);
+
+/**
+ * Writes the directory of an archive and closes it
+ * @param archive Archive to close
+ * @return Whether the archive and every matrix in it were written successfully
+ */
+int matrix_closeArchive(MatrixArchive* archive);
+
+/**
+ * Writes any number of named matrices to an archive
+ * @param path Path of the archive, which is replaced if it exists
+ * @param count Number of matrices
+ * @param names Names of the matrices
+ * @param matrices Matrices to write
+ * @return Whether the archive was written successfully
+ */
+int matrix_saveArchive(const char* path, int count, const char* const* names, const Matrix* const* matrices);
+
+/**
+ * Function receiving each matrix loaded from an archive. The matrix belongs
+ * to the function and must eventually be destroyed with matrix_destroyMatrix.
+ * @param name Name of the matrix (only valid for the duration of the call)
+ * @param matrix Loaded matrix
+ * @param arg Argument passed to matrix_loadArchive
+ */
+typedef void (*MatrixArchiveVisitor)(const char* name, Matrix* matrix, void* arg);
+
+/**
+ * Function receiving each record loaded from an archive. The matrix belongs
+ * to the function and must eventually be destroyed with the destruction
+ * function of its type.
+ * @param name Name of the matrix (only valid for the duration of the call)
+ * @param dtype Entry type of the record (MATRIX_DTYPE_*)
+ * @param matrix Loaded matrix: a Matrix* for MATRIX_DTYPE_DOUBLE, a SparseMatrix* in CSR format for MATRIX_DTYPE_CSR and a MatrixF*, MatrixI32* or MatrixI64* for the other entry types
+ * @param arg Argument passed to matrix_loadArchiveRecords
+ */
+typedef void (*MatrixRecordVisitor)(const char* name, int dtype, void* matrix, void* arg);
+
+/**
+ * Loads every matrix in an archive in the format in which it is stored.
+ * Large dense matrices are mapped like matrix_mapMatrix does, small ones are
+ * read into newly allocated matrices.
+ * @param path Path of the archive
+ * @param visit Function to call with each matrix
+ * @param arg Argument to pass to the function
+ * @return Number of matrices loaded, or -1 if the file isn't a valid archive
+ */
+int matrix_loadArchiveRecords(const char* path, MatrixRecordVisitor visit, void* arg);
+
+/**
+ * Loads every matrix in an archive. Large matrices are mapped like
+ * matrix_mapMatrix does, small ones are read into newly allocated matrices,
+ * sparse ones are expanded and other entry types are converted to double.
+ * @param path Path of the archive
+ * @param visit Function to call with each matrix
+ * @param arg Argument to pass to the function
+ * @return Number of matrices loaded, or -1 if the file isn't a valid archive
+ */
+int matrix_loadArchive(const char* path, MatrixArchiveVisitor visit, void* arg);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
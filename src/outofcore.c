@@ -0,0 +1,350 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+
+#ifdef THREADSAFE
+#include <pthread.h>
+#endif
+
+#include "outofcore.h"
+#include "gemm.h"
+#include "instrument.h"
+
+// states of the operand tile buffers
+#define SLOT_EMPTY 0
+#define SLOT_FULL 1
+
+/**
+ * State of an out-of-core multiplication. The product is computed in steps,
+ * one per pair of operand tiles, ordered by tile row of the product, then
+ * tile column, then position along the shared dimension. The operand tiles
+ * of consecutive steps go in alternating slots so that one pair can be read
+ * while the other is multiplied.
+ */
+typedef struct OutOfCore {
+	MatrixFile* dst;
+	const MatrixFile* m1;
+	const MatrixFile* m2;
+	// tile edges along the rows of the product, the columns of the product and the shared dimension
+	int tileRows;
+	int tileCols;
+	int tileInner;
+	// number of tiles along each of these
+	int countRows;
+	int countCols;
+	int countInner;
+	// tiny tiles of huge matrices take more steps than an int can count
+	int64_t steps;
+	// storage of the operand tiles (two slots each) and the product tile
+	void* bufA[2];
+	void* bufB[2];
+	void* bufC;
+	Matrix* a[2];
+	Matrix* b[2];
+	int state[2];
+	int failed;
+#ifdef THREADSAFE
+	// whether a separate thread reads the tiles; if it couldn't be started, they are read when needed
+	int reader;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+#endif
+} OutOfCore;
+
+/**
+ * Determine the block of the operands used in a step
+ * @param ooc Multiplication state
+ * @param step Step index
+ * @param row Set to the first row of the product tile
+ * @param col Set to the first column of the product tile
+ * @param inner Set to the first index along the shared dimension
+ */
+static void stepBlock(const OutOfCore* ooc, int64_t step, int* row, int* col, int* inner) {
+	*inner = (int)(step % ooc->countInner) * ooc->tileInner;
+	step /= ooc->countInner;
+	*col = (int)(step % ooc->countCols) * ooc->tileCols;
+	*row = (int)(step / ooc->countCols) * ooc->tileRows;
+}
+
+static int min(int a, int b) {
+	return a < b ? a : b;
+}
+
+/**
+ * Reads the operand tiles of a step into its slot
+ * @param ooc Multiplication state
+ * @param step Step index
+ * @return Whether the tiles were read successfully
+ */
+static int loadStep(OutOfCore* ooc, int64_t step) {
+	int row, col, inner;
+	stepBlock(ooc, step, &row, &col, &inner);
+	int rows = min(ooc->tileRows, ooc->m1->rows - row);
+	int cols = min(ooc->tileCols, ooc->m2->cols - col);
+	int depth = min(ooc->tileInner, ooc->m1->cols - inner);
+	int slot = step % 2;
+	ooc->a[slot] = matrix_placeMatrix(ooc->bufA[slot], rows, depth);
+	ooc->b[slot] = matrix_placeMatrix(ooc->bufB[slot], depth, cols);
+	return matrix_readBlock(ooc->a[slot], ooc->m1, row, inner)
+		&& matrix_readBlock(ooc->b[slot], ooc->m2, inner, col);
+}
+
+#ifndef THREADSAFE
+/**
+ * Asks the operating system to read the operand tiles of a step in the background
+ * @param ooc Multiplication state
+ * @param step Step index
+ */
+static void prefetchStep(const OutOfCore* ooc, int64_t step) {
+	int row, col, inner;
+	stepBlock(ooc, step, &row, &col, &inner);
+	int rows = min(ooc->tileRows, ooc->m1->rows - row);
+	int cols = min(ooc->tileCols, ooc->m2->cols - col);
+	int depth = min(ooc->tileInner, ooc->m1->cols - inner);
+	matrix_prefetchBlock(ooc->m1, row, inner, rows, depth);
+	matrix_prefetchBlock(ooc->m2, inner, col, depth, cols);
+}
+#else
+/**
+ * Reads the operand tiles of every step as soon as their slot is free
+ * @param arg Multiplication state
+ * @return NULL
+ */
+static void* prefetchLoop(void* arg) {
+	OutOfCore* ooc = arg;
+	for (int64_t step = 0; step < ooc->steps; step++) {
+		int slot = step % 2;
+		pthread_mutex_lock(&ooc->lock);
+		while (ooc->state[slot] != SLOT_EMPTY && !ooc->failed) {
+			pthread_cond_wait(&ooc->changed, &ooc->lock);
+		}
+		int failed = ooc->failed;
+		pthread_mutex_unlock(&ooc->lock);
+		if (failed) {
+			break;
+		}
+
+		int loaded = loadStep(ooc, step);
+
+		pthread_mutex_lock(&ooc->lock);
+		if (loaded) {
+			ooc->state[slot] = SLOT_FULL;
+		} else {
+			ooc->failed = 1;
+		}
+		pthread_cond_broadcast(&ooc->changed);
+		pthread_mutex_unlock(&ooc->lock);
+		if (!loaded) {
+			break;
+		}
+	}
+	return NULL;
+}
+#endif
+
+/**
+ * Waits until the operand tiles of a step are available
+ * @param ooc Multiplication state
+ * @param step Step index
+ * @return Whether the tiles were read successfully
+ */
+static int acquireStep(OutOfCore* ooc, int64_t step) {
+#ifdef THREADSAFE
+	if (ooc->reader) {
+		int slot = step % 2;
+		pthread_mutex_lock(&ooc->lock);
+		while (ooc->state[slot] != SLOT_FULL && !ooc->failed) {
+			pthread_cond_wait(&ooc->changed, &ooc->lock);
+		}
+		int failed = ooc->failed;
+		pthread_mutex_unlock(&ooc->lock);
+		return !failed;
+	}
+	int loaded = loadStep(ooc, step);
+#else
+	// let the operating system read the next tiles while these are multiplied
+	int loaded = loadStep(ooc, step);
+	if (step + 1 < ooc->steps) {
+		prefetchStep(ooc, step + 1);
+	}
+#endif
+	ooc->failed |= !loaded;
+	return loaded;
+}
+
+/**
+ * Hands the slot of a step back to the reader
+ * @param ooc Multiplication state
+ * @param step Step index
+ * @param failed Whether the multiplication failed and must be abandoned
+ */
+static void releaseStep(OutOfCore* ooc, int64_t step, int failed) {
+#ifdef THREADSAFE
+	pthread_mutex_lock(&ooc->lock);
+	ooc->state[step % 2] = SLOT_EMPTY;
+	ooc->failed |= failed;
+	pthread_cond_broadcast(&ooc->changed);
+	pthread_mutex_unlock(&ooc->lock);
+#else
+	ooc->failed |= failed;
+#endif
+}
+
+/**
+ * Determine the memory needed for the tiles of a multiplication
+ * @param ooc Multiplication state with the operands and the tile edges filled in
+ * @return Number of bytes to allocate
+ */
+static size_t tileMemory(const OutOfCore* ooc) {
+	return 2 * matrix_storageSize(ooc->tileRows, ooc->tileInner)
+		+ 2 * matrix_storageSize(ooc->tileInner, ooc->tileCols)
+		+ matrix_storageSize(ooc->tileRows, ooc->tileCols);
+}
+
+/**
+ * Sets the tile edges to the largest edge whose tiles fit in the budget.
+ * Edges are the same in every direction, except where a matrix is smaller.
+ * @param ooc Multiplication state with the operands filled in
+ * @param budget Largest number of bytes to allocate
+ * @return Whether tiles of at least MATRIX_OOC_MIN_TILE (or the whole operands) fit
+ */
+static int chooseTiles(OutOfCore* ooc, size_t budget) {
+	int m = ooc->m1->rows, n = ooc->m2->cols, k = ooc->m1->cols;
+	int lo = 1, hi = m > n ? m : n;
+	hi = hi > k ? hi : k;
+	int smallest = min(MATRIX_OOC_MIN_TILE, hi);
+	// largest edge whose tiles fit, by bisection (the memory needed grows with the edge)
+	while (lo < hi) {
+		int edge = lo + (hi - lo + 1) / 2;
+		ooc->tileRows = min(edge, m);
+		ooc->tileCols = min(edge, n);
+		ooc->tileInner = min(edge, k);
+		if (tileMemory(ooc) <= budget) {
+			lo = edge;
+		} else {
+			hi = edge - 1;
+		}
+	}
+	ooc->tileRows = min(lo, m);
+	ooc->tileCols = min(lo, n);
+	ooc->tileInner = min(lo, k);
+	return lo >= smallest && tileMemory(ooc) <= budget;
+}
+
+int matrix_multiplyMatrixFiles(MatrixFile* dst, const MatrixFile* m1, const MatrixFile* m2, size_t budget) {
+	MATRIX_INSTRUMENT(2.0 * m1->rows * m1->cols * m2->cols,
+		8.0 * ((double)m1->rows * m1->cols + (double)m2->rows * m2->cols + (double)m1->rows * m2->cols));
+	if (m1->cols != m2->rows || dst->rows != m1->rows || dst->cols != m2->cols || !dst->writable) {
+		return 0;
+	}
+	if (!dst->rows || !dst->cols) {
+		return 1;
+	}
+	OutOfCore ooc;
+	memset(&ooc, 0, sizeof(ooc));
+	ooc.dst = dst;
+	ooc.m1 = m1;
+	ooc.m2 = m2;
+	if (!chooseTiles(&ooc, budget)) {
+		return 0;
+	}
+	ooc.countRows = (dst->rows + ooc.tileRows - 1) / ooc.tileRows;
+	ooc.countCols = (dst->cols + ooc.tileCols - 1) / ooc.tileCols;
+	// an empty shared dimension still takes one step per tile to write the zero product
+	ooc.countInner = m1->cols ? (m1->cols + ooc.tileInner - 1) / ooc.tileInner : 1;
+	ooc.steps = (int64_t)ooc.countRows * ooc.countCols * ooc.countInner;
+	for (int slot = 0; slot < 2; slot++) {
+		ooc.bufA[slot] = aligned_alloc(MATRIX_ALIGNMENT, matrix_storageSize(ooc.tileRows, ooc.tileInner));
+		ooc.bufB[slot] = aligned_alloc(MATRIX_ALIGNMENT, matrix_storageSize(ooc.tileInner, ooc.tileCols));
+	}
+	ooc.bufC = aligned_alloc(MATRIX_ALIGNMENT, matrix_storageSize(ooc.tileRows, ooc.tileCols));
+	// the budget may be more than the system can provide, in which case nothing is written
+	if (!ooc.bufA[0] || !ooc.bufA[1] || !ooc.bufB[0] || !ooc.bufB[1] || !ooc.bufC) {
+		ooc.failed = 1;
+		ooc.steps = 0;
+	}
+
+#ifdef THREADSAFE
+	pthread_mutex_init(&ooc.lock, NULL);
+	pthread_cond_init(&ooc.changed, NULL);
+	pthread_t reader;
+	ooc.reader = ooc.steps && !pthread_create(&reader, NULL, prefetchLoop, &ooc);
+#endif
+
+	for (int64_t step = 0; step < ooc.steps; step++) {
+		if (!acquireStep(&ooc, step)) {
+			break;
+		}
+		int row, col, inner;
+		stepBlock(&ooc, step, &row, &col, &inner);
+		const Matrix* a = ooc.a[step % 2];
+		const Matrix* b = ooc.b[step % 2];
+		Matrix* c = matrix_placeMatrix(ooc.bufC, a->rows, b->cols);
+		// the product tile accumulates over the shared dimension
+		if (a->cols) {
+			matrix_dgemm(c->rows, c->cols, a->cols, 1, a->data, a->stride, 1,
+				b->data, b->stride, 1, inner ? 1 : 0, c->data, c->stride);
+		} else {
+			matrix_zeroMatrix(c);
+		}
+		int failed = 0;
+		if (step % ooc.countInner == ooc.countInner - 1) {
+			failed = !matrix_writeBlock(dst, c, row, col);
+		}
+		releaseStep(&ooc, step, failed);
+		if (failed) {
+			break;
+		}
+	}
+
+#ifdef THREADSAFE
+	if (ooc.reader) {
+		pthread_join(reader, NULL);
+	}
+	pthread_cond_destroy(&ooc.changed);
+	pthread_mutex_destroy(&ooc.lock);
+#endif
+	for (int slot = 0; slot < 2; slot++) {
+		free(ooc.bufA[slot]);
+		free(ooc.bufB[slot]);
+	}
+	free(ooc.bufC);
+	return !ooc.failed;
+}
+
+int matrix_multiplyFiles(const char* dstPath, const char* path1, const char* path2, size_t budget) {
+	MatrixFile* m1 = matrix_openMatrixFile(path1, 0);
+	MatrixFile* m2 = matrix_openMatrixFile(path2, 0);
+	int success = 0;
+	if (m1 && m2 && m1->cols == m2->rows) {
+		MatrixFile* dst = matrix_createMatrixFile(dstPath, m1->rows, m2->cols);
+		if (dst) {
+			success = matrix_multiplyMatrixFiles(dst, m1, m2, budget);
+			success = matrix_closeMatrixFile(dst) && success;
+			if (!success) {
+				unlink(dstPath);
+			}
+		}
+	}
+	if (m1) {
+		matrix_closeMatrixFile(m1);
+	}
+	if (m2) {
+		matrix_closeMatrixFile(m2);
+	}
+	return success;
+}
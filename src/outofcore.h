@@ -0,0 +1,59 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef OUTOFCORE_H
+#define OUTOFCORE_H
+
+#include "matrixfile.h"
+
+// smallest tile edge the out-of-core kernels work with (unless a matrix is smaller)
+#define MATRIX_OOC_MIN_TILE 64
+
+/**
+ * Multiplies two matrices stored in matrix files and stores the product in
+ * a third without loading any of them completely. The operands are read in
+ * tiles, each pair of tiles is multiplied with the in-memory kernel and the
+ * product is written back a tile at a time. Tiles are read ahead of the
+ * computation: by a separate thread when built with THREADSAFE, otherwise by
+ * the operating system at the library's request. If the dimensions are
+ * incompatible or the budget is too small, the destination is left
+ * unchanged.
+ * @param dst Writable file in which to store the product (must not be one of the operands)
+ * @param m1 File holding the left operand
+ * @param m2 File holding the right operand
+ * @param budget Largest number of bytes to allocate for tiles
+ * @return Whether the product was computed and written successfully
+ */
+int matrix_multiplyMatrixFiles(MatrixFile* dst, const MatrixFile* m1, const MatrixFile* m2, size_t budget);
+
+/**
+ * Multiplies two matrices stored in matrix files as matrix_multiplyMatrixFiles
+ * does, creating the file holding the product
+ * @param dstPath Path of the file in which to store the product, which is replaced if it exists
+ * @param path1 Path of the file holding the left operand
+ * @param path2 Path of the file holding the right operand
+ * @param budget Largest number of bytes to allocate for tiles
+ * @return Whether the product was computed and written successfully
+ */
+int matrix_multiplyFiles(const char* dstPath, const char* path1, const char* path2, size_t budget);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,308 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "parallel.h"
+
+static double parallelThreshold = MATRIX_DEFAULT_PARALLEL_THRESHOLD;
+
+void matrix_setParallelThreshold(double flops) {
+	parallelThreshold = flops;
+}
+
+double matrix_getParallelThreshold() {
+	return parallelThreshold;
+}
+
+#ifdef THREADSAFE
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * A call to matrix_parallelFor; lives on the stack of the calling thread
+ */
+typedef struct Job {
+	MatrixParallelTask task;
+	void* arg;
+	int grain;
+	// number of indices not yet processed, only decremented while holding lock
+	atomic_int remaining;
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+} Job;
+
+/**
+ * Subrange of a job waiting to be processed
+ */
+typedef struct Range {
+	Job* job;
+	int begin;
+	int end;
+} Range;
+
+/**
+ * Double-ended queue of ranges. The owner pushes and pops at the tail while
+ * other threads steal the oldest (and hence largest) ranges from the head.
+ */
+typedef struct Deque {
+	pthread_mutex_t lock;
+	Range* items;
+	int head;
+	int tail;
+	int capacity;
+} Deque;
+
+static struct {
+	pthread_t* threads;
+	// one deque per worker followed by one shared by all other threads
+	Deque* deques;
+	int workers;
+	int stop;
+	// number of ranges in all deques
+	atomic_int pending;
+	pthread_mutex_t sleepLock;
+	pthread_cond_t wake;
+} pool;
+
+// index of the deque owned by the current thread
+static _Thread_local int ownDeque = -1;
+// whether the current thread is running the body of a parallel loop
+static _Thread_local int inTask = 0;
+static _Thread_local unsigned int stealSeed = 1;
+
+static void pushRange(Range range) {
+	Deque* dq = &pool.deques[ownDeque >= 0 ? ownDeque : pool.workers];
+	pthread_mutex_lock(&dq->lock);
+	if (dq->tail == dq->capacity) {
+		if (dq->head > 0) {
+			// reclaim the space freed by steals before growing
+			memmove(dq->items, dq->items + dq->head, (dq->tail - dq->head) * sizeof(Range));
+			dq->tail -= dq->head;
+			dq->head = 0;
+		} else {
+			dq->capacity = dq->capacity ? dq->capacity * 2 : 64;
+			dq->items = realloc(dq->items, dq->capacity * sizeof(Range));
+		}
+	}
+	dq->items[dq->tail++] = range;
+	pthread_mutex_unlock(&dq->lock);
+
+	atomic_fetch_add(&pool.pending, 1);
+	pthread_mutex_lock(&pool.sleepLock);
+	pthread_cond_signal(&pool.wake);
+	pthread_mutex_unlock(&pool.sleepLock);
+}
+
+static int takeRange(Deque* dq, Range* range, int steal) {
+	int found = 0;
+	pthread_mutex_lock(&dq->lock);
+	if (dq->head < dq->tail) {
+		*range = steal ? dq->items[dq->head++] : dq->items[--dq->tail];
+		if (dq->head == dq->tail) {
+			dq->head = dq->tail = 0;
+		}
+		found = 1;
+	}
+	pthread_mutex_unlock(&dq->lock);
+	if (found) {
+		atomic_fetch_sub(&pool.pending, 1);
+	}
+	return found;
+}
+
+/**
+ * Finds a range to work on, first in the deque of the current thread and
+ * then in the deques of the other threads starting at a random one
+ */
+static int findWork(Range* range) {
+	if (atomic_load(&pool.pending) == 0) {
+		return 0;
+	}
+	int own = ownDeque >= 0 ? ownDeque : pool.workers;
+	if (takeRange(&pool.deques[own], range, 0)) {
+		return 1;
+	}
+	int count = pool.workers + 1;
+	stealSeed = stealSeed * 1103515245 + 12345;
+	int start = (stealSeed >> 16) % count;
+	for (int i = 0; i < count; i++) {
+		int victim = (start + i) % count;
+		if (victim != own && takeRange(&pool.deques[victim], range, 1)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Processes a range, repeatedly splitting off the upper half for other threads
+ * to steal until it is no larger than the grain size of its job
+ */
+static void runRange(Range range) {
+	Job* job = range.job;
+	while (range.end - range.begin > job->grain) {
+		int mid = range.begin + (range.end - range.begin) / 2;
+		pushRange((Range){ job, mid, range.end });
+		range.end = mid;
+	}
+	int wasInTask = inTask;
+	inTask = 1;
+	job->task(range.begin, range.end, job->arg);
+	inTask = wasInTask;
+
+	pthread_mutex_lock(&job->lock);
+	if (atomic_fetch_sub(&job->remaining, range.end - range.begin) == range.end - range.begin) {
+		pthread_cond_broadcast(&job->done);
+	}
+	pthread_mutex_unlock(&job->lock);
+}
+
+static void* workerMain(void* arg) {
+	ownDeque = (int)(size_t)arg;
+	stealSeed = ownDeque + 1;
+	while (1) {
+		Range range;
+		if (findWork(&range)) {
+			runRange(range);
+			continue;
+		}
+		pthread_mutex_lock(&pool.sleepLock);
+		while (!pool.stop && atomic_load(&pool.pending) == 0) {
+			pthread_cond_wait(&pool.wake, &pool.sleepLock);
+		}
+		int stop = pool.stop;
+		pthread_mutex_unlock(&pool.sleepLock);
+		if (stop) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+int matrix_initThreads(int count) {
+	matrix_shutdownThreads();
+	if (count <= 0) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		count = online > 0 ? (int)online : 1;
+	}
+	if (count == 1) {
+		return 1;
+	}
+	pool.workers = count - 1;
+	pool.stop = 0;
+	atomic_store(&pool.pending, 0);
+	pthread_mutex_init(&pool.sleepLock, NULL);
+	pthread_cond_init(&pool.wake, NULL);
+	pool.deques = calloc(count, sizeof(Deque));
+	for (int i = 0; i < count; i++) {
+		pthread_mutex_init(&pool.deques[i].lock, NULL);
+	}
+	pool.threads = malloc(pool.workers * sizeof(pthread_t));
+	for (int i = 0; i < pool.workers; i++) {
+		pthread_create(&pool.threads[i], NULL, workerMain, (void*)(size_t)i);
+	}
+	return count;
+}
+
+void matrix_shutdownThreads() {
+	if (!pool.workers) {
+		return;
+	}
+	pthread_mutex_lock(&pool.sleepLock);
+	pool.stop = 1;
+	pthread_cond_broadcast(&pool.wake);
+	pthread_mutex_unlock(&pool.sleepLock);
+	for (int i = 0; i < pool.workers; i++) {
+		pthread_join(pool.threads[i], NULL);
+	}
+	for (int i = 0; i <= pool.workers; i++) {
+		pthread_mutex_destroy(&pool.deques[i].lock);
+		free(pool.deques[i].items);
+	}
+	free(pool.deques);
+	free(pool.threads);
+	pthread_mutex_destroy(&pool.sleepLock);
+	pthread_cond_destroy(&pool.wake);
+	pool.workers = 0;
+}
+
+int matrix_getThreadCount() {
+	return pool.workers + 1;
+}
+
+void matrix_parallelFor(int begin, int end, int grain, double flops, MatrixParallelTask task, void* arg) {
+	if (begin >= end) {
+		return;
+	}
+	if (grain < 1) {
+		grain = 1;
+	}
+	if (!pool.workers || inTask || end - begin <= grain || flops < parallelThreshold) {
+		task(begin, end, arg);
+		return;
+	}
+
+	Job job;
+	job.task = task;
+	job.arg = arg;
+	job.grain = grain;
+	atomic_init(&job.remaining, end - begin);
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.done, NULL);
+
+	// work on the job (and whatever else is available) until all of it is done
+	runRange((Range){ &job, begin, end });
+	while (atomic_load(&job.remaining) > 0) {
+		Range range;
+		if (findWork(&range)) {
+			runRange(range);
+			continue;
+		}
+		pthread_mutex_lock(&job.lock);
+		while (atomic_load(&job.remaining) > 0) {
+			pthread_cond_wait(&job.done, &job.lock);
+		}
+		pthread_mutex_unlock(&job.lock);
+	}
+	// make sure the thread that finished the job has released it
+	pthread_mutex_lock(&job.lock);
+	pthread_mutex_unlock(&job.lock);
+	pthread_mutex_destroy(&job.lock);
+	pthread_cond_destroy(&job.done);
+}
+
+#else
+
+int matrix_initThreads(int count) {
+	return 1;
+}
+
+void matrix_shutdownThreads() {}
+
+int matrix_getThreadCount() {
+	return 1;
+}
+
+void matrix_parallelFor(int begin, int end, int grain, double flops, MatrixParallelTask task, void* arg) {
+	if (begin < end) {
+		task(begin, end, arg);
+	}
+}
+
+#endif
@@ -0,0 +1,90 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+
+// operations estimated to cost less than this many floating point
+// operations run on the calling thread only, unless configured otherwise
+#define MATRIX_DEFAULT_PARALLEL_THRESHOLD 100000
+
+/**
+ * Starts the worker threads used by the library to split large operations.
+ * The calling thread also takes part in the work, so count - 1 workers are
+ * started. If the library was built without THREADSAFE, no threads are
+ * started and all operations run on the calling thread. Calling this again
+ * restarts the workers with the new count.
+ * @param count Total number of threads to use, or 0 or less to use one per online processor
+ * @return Number of threads that will be used
+ */
+int matrix_initThreads(int count);
+
+/**
+ * Stops and joins the worker threads. Operations run on the calling thread
+ * until matrix_initThreads is called again.
+ */
+void matrix_shutdownThreads();
+
+/**
+ * Determine the number of threads used by the library
+ * @return Number of threads among which operations are split (1 if the workers aren't running)
+ */
+int matrix_getThreadCount();
+
+/**
+ * Sets the minimum estimated cost of an operation before it is split across threads
+ * @param flops Approximate number of floating point operations
+ */
+void matrix_setParallelThreshold(double flops);
+
+/**
+ * Determine the minimum estimated cost of an operation before it is split across threads
+ * @return Approximate number of floating point operations
+ */
+double matrix_getParallelThreshold();
+
+/**
+ * Body of a parallel loop, called for disjoint subranges of the iteration space
+ * @param begin First index of the subrange
+ * @param end One past the last index of the subrange
+ * @param arg Argument passed to matrix_parallelFor
+ */
+typedef void (*MatrixParallelTask)(int begin, int end, void* arg);
+
+/**
+ * Runs a loop over [begin, end) by recursively splitting it among the worker
+ * threads, which steal halves of each other's ranges when idle. Runs the
+ * whole range on the calling thread if the workers aren't running, if the
+ * estimated cost is below the parallel threshold or if called from within
+ * another parallel loop. Returns once every index has been processed.
+ * @param begin First index of the loop
+ * @param end One past the last index of the loop
+ * @param grain Ranges of this many indices or fewer are not split any further
+ * @param flops Estimated cost of the whole loop
+ * @param task Loop body
+ * @param arg Argument for the loop body
+ */
+void matrix_parallelFor(int begin, int end, int grain, double flops, MatrixParallelTask task, void* arg);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,514 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include "sparse.h"
+#include "arena.h"
+#include "parallel.h"
+#include "instrument.h"
+
+// rows per task in the sparse kernels
+#define SPARSE_GRAIN 64
+
+/**
+ * Determine the number of compressed rows (CSR) or columns (CSC)
+ */
+static int outerSize(const SparseMatrix* matrix) {
+	return matrix->format == MATRIX_CSR ? matrix->rows : matrix->cols;
+}
+
+static int innerSize(const SparseMatrix* matrix) {
+	return matrix->format == MATRIX_CSR ? matrix->cols : matrix->rows;
+}
+
+SparseMatrix* matrix_createSparse(int rows, int cols, int format, int capacity) {
+	SparseMatrix* matrix = malloc(sizeof(SparseMatrix));
+	matrix->rows = rows;
+	matrix->cols = cols;
+	matrix->format = format;
+	matrix->nnz = 0;
+	matrix->capacity = capacity;
+	matrix->ptr = calloc(outerSize(matrix) + 1, sizeof(int));
+	// keep the arrays valid even when empty so they can always be passed to memcpy
+	matrix->indices = malloc((capacity ? capacity : 1) * sizeof(int));
+	matrix->values = malloc((capacity ? capacity : 1) * sizeof(double));
+	return matrix;
+}
+
+void matrix_destroySparse(SparseMatrix* matrix) {
+	free(matrix->ptr);
+	free(matrix->indices);
+	free(matrix->values);
+	free(matrix);
+}
+
+SparseMatrix* matrix_copySparse(const SparseMatrix* matrix) {
+	SparseMatrix* copy = matrix_createSparse(matrix->rows, matrix->cols, matrix->format, matrix->nnz);
+	copy->nnz = matrix->nnz;
+	memcpy(copy->ptr, matrix->ptr, (outerSize(matrix) + 1) * sizeof(int));
+	memcpy(copy->indices, matrix->indices, matrix->nnz * sizeof(int));
+	memcpy(copy->values, matrix->values, matrix->nnz * sizeof(double));
+	return copy;
+}
+
+/**
+ * Re-compresses the entries of a sparse matrix along its other dimension
+ * with a counting sort. Since the CSR arrays of a matrix are the CSC arrays
+ * of its transpose, this both converts between formats (keeping the size)
+ * and transposes (keeping the format). The indices of the result are sorted
+ * even if those of the source aren't.
+ * @param src Source matrix
+ * @param rows Row count of the result
+ * @param cols Column count of the result
+ * @param format Format of the result
+ * @return Pointer to the new matrix
+ */
+static SparseMatrix* swapLayout(const SparseMatrix* src, int rows, int cols, int format) {
+	SparseMatrix* dst = matrix_createSparse(rows, cols, format, src->nnz);
+	int outer = outerSize(src);
+	int inner = innerSize(src);
+	int* next = dst->ptr;
+	for (int i = 0; i < src->nnz; i++) {
+		next[src->indices[i] + 1]++;
+	}
+	for (int j = 0; j < inner; j++) {
+		next[j + 1] += next[j];
+	}
+	// scatter while using ptr[j] as the insertion point of segment j, which
+	// leaves every entry of ptr shifted by one segment afterwards
+	for (int o = 0; o < outer; o++) {
+		for (int i = src->ptr[o]; i < src->ptr[o + 1]; i++) {
+			int slot = next[src->indices[i]]++;
+			dst->indices[slot] = o;
+			dst->values[slot] = src->values[i];
+		}
+	}
+	for (int j = inner; j > 0; j--) {
+		next[j] = next[j - 1];
+	}
+	next[0] = 0;
+	dst->nnz = src->nnz;
+	return dst;
+}
+
+SparseMatrix* matrix_createSparseFromTriplets(int rows, int cols, int format, int count,
+	const int* r, const int* c, const double* v) {
+	for (int i = 0; i < count; i++) {
+		if (r[i] < 0 || r[i] >= rows || c[i] < 0 || c[i] >= cols) {
+			return NULL;
+		}
+	}
+	// bucket the entries in the other format, then swap the layout to sort them
+	int other = format == MATRIX_CSR ? MATRIX_CSC : MATRIX_CSR;
+	SparseMatrix* staged = matrix_createSparse(rows, cols, other, count);
+	const int* outerIdx = other == MATRIX_CSR ? r : c;
+	const int* innerIdx = other == MATRIX_CSR ? c : r;
+	int outer = outerSize(staged);
+	for (int i = 0; i < count; i++) {
+		staged->ptr[outerIdx[i] + 1]++;
+	}
+	for (int o = 0; o < outer; o++) {
+		staged->ptr[o + 1] += staged->ptr[o];
+	}
+	for (int i = 0; i < count; i++) {
+		int slot = staged->ptr[outerIdx[i]]++;
+		staged->indices[slot] = innerIdx[i];
+		staged->values[slot] = v[i];
+	}
+	for (int o = outer; o > 0; o--) {
+		staged->ptr[o] = staged->ptr[o - 1];
+	}
+	staged->ptr[0] = 0;
+	staged->nnz = count;
+	SparseMatrix* matrix = swapLayout(staged, rows, cols, format);
+	matrix_destroySparse(staged);
+
+	// duplicates are now adjacent; merge them in place
+	int nnz = 0;
+	int start = 0;
+	for (int o = 0; o < outerSize(matrix); o++) {
+		int end = matrix->ptr[o + 1];
+		for (int i = start; i < end; i++) {
+			if (nnz > matrix->ptr[o] && matrix->indices[nnz - 1] == matrix->indices[i]) {
+				matrix->values[nnz - 1] += matrix->values[i];
+			} else {
+				matrix->indices[nnz] = matrix->indices[i];
+				matrix->values[nnz] = matrix->values[i];
+				nnz++;
+			}
+		}
+		start = end;
+		matrix->ptr[o + 1] = nnz;
+	}
+	matrix->nnz = nnz;
+	return matrix;
+}
+
+SparseMatrix* matrix_sparseFromDense(const Matrix* matrix, int format, double tolerance) {
+	int nnz = 0;
+	for (int r = 0; r < matrix->rows; r++) {
+		for (int c = 0; c < matrix->cols; c++) {
+			nnz += fabs(matrix->matrix[r][c]) > tolerance;
+		}
+	}
+	SparseMatrix* sparse = matrix_createSparse(matrix->rows, matrix->cols, format, nnz);
+	int outer = outerSize(sparse);
+	int inner = innerSize(sparse);
+	int k = 0;
+	for (int o = 0; o < outer; o++) {
+		for (int i = 0; i < inner; i++) {
+			double v = format == MATRIX_CSR ? matrix->matrix[o][i] : matrix->matrix[i][o];
+			if (fabs(v) > tolerance) {
+				sparse->indices[k] = i;
+				sparse->values[k] = v;
+				k++;
+			}
+		}
+		sparse->ptr[o + 1] = k;
+	}
+	sparse->nnz = nnz;
+	return sparse;
+}
+
+void matrix_sparseToDense(Matrix* dst, const SparseMatrix* matrix) {
+	if (dst->rows != matrix->rows || dst->cols != matrix->cols) {
+		return;
+	}
+	matrix_zeroMatrix(dst);
+	matrix_sparseAddToDense(dst, 1, matrix);
+}
+
+double matrix_sparseDensity(const SparseMatrix* matrix) {
+	double size = (double)matrix->rows * matrix->cols;
+	return size > 0 ? matrix->nnz / size : 0;
+}
+
+SparseMatrix* matrix_sparseConvert(const SparseMatrix* matrix, int format) {
+	MATRIX_INSTRUMENT(0, 24.0 * matrix->nnz);
+	if (format == matrix->format) {
+		return matrix_copySparse(matrix);
+	}
+	return swapLayout(matrix, matrix->rows, matrix->cols, format);
+}
+
+SparseMatrix* matrix_sparseTranspose(const SparseMatrix* matrix) {
+	MATRIX_INSTRUMENT(0, 24.0 * matrix->nnz);
+	return swapLayout(matrix, matrix->cols, matrix->rows, matrix->format);
+}
+
+void matrix_sparseMultiplyScalar(SparseMatrix* matrix, double scale) {
+	for (int i = 0; i < matrix->nnz; i++) {
+		matrix->values[i] *= scale;
+	}
+}
+
+SparseMatrix* matrix_sparseAdd(double alpha, const SparseMatrix* a, double beta, const SparseMatrix* b) {
+	MATRIX_INSTRUMENT(3.0 * (a->nnz + b->nnz), 24.0 * (a->nnz + b->nnz));
+	if (a->rows != b->rows || a->cols != b->cols) {
+		return NULL;
+	}
+	SparseMatrix* converted = b->format == a->format ? NULL : matrix_sparseConvert(b, a->format);
+	if (converted) {
+		b = converted;
+	}
+	// merge the sorted segments of both operands, counting first
+	int outer = outerSize(a);
+	int nnz = 0;
+	for (int o = 0; o < outer; o++) {
+		int i = a->ptr[o], j = b->ptr[o];
+		while (i < a->ptr[o + 1] || j < b->ptr[o + 1]) {
+			if (j == b->ptr[o + 1] || (i < a->ptr[o + 1] && a->indices[i] < b->indices[j])) {
+				i++;
+			} else if (i == a->ptr[o + 1] || b->indices[j] < a->indices[i]) {
+				j++;
+			} else {
+				i++;
+				j++;
+			}
+			nnz++;
+		}
+	}
+	SparseMatrix* sum = matrix_createSparse(a->rows, a->cols, a->format, nnz);
+	int k = 0;
+	for (int o = 0; o < outer; o++) {
+		int i = a->ptr[o], j = b->ptr[o];
+		while (i < a->ptr[o + 1] || j < b->ptr[o + 1]) {
+			if (j == b->ptr[o + 1] || (i < a->ptr[o + 1] && a->indices[i] < b->indices[j])) {
+				sum->indices[k] = a->indices[i];
+				sum->values[k] = alpha * a->values[i++];
+			} else if (i == a->ptr[o + 1] || b->indices[j] < a->indices[i]) {
+				sum->indices[k] = b->indices[j];
+				sum->values[k] = beta * b->values[j++];
+			} else {
+				sum->indices[k] = a->indices[i];
+				sum->values[k] = alpha * a->values[i++] + beta * b->values[j++];
+			}
+			k++;
+		}
+		sum->ptr[o + 1] = k;
+	}
+	sum->nnz = nnz;
+	if (converted) {
+		matrix_destroySparse(converted);
+	}
+	return sum;
+}
+
+void matrix_sparseAddToDense(Matrix* dst, double alpha, const SparseMatrix* matrix) {
+	if (dst->rows != matrix->rows || dst->cols != matrix->cols) {
+		return;
+	}
+	for (int o = 0; o < outerSize(matrix); o++) {
+		for (int i = matrix->ptr[o]; i < matrix->ptr[o + 1]; i++) {
+			if (matrix->format == MATRIX_CSR) {
+				dst->matrix[o][matrix->indices[i]] += alpha * matrix->values[i];
+			} else {
+				dst->matrix[matrix->indices[i]][o] += alpha * matrix->values[i];
+			}
+		}
+	}
+}
+
+/**
+ * Arguments for the row-parallel sparse kernels
+ */
+typedef struct SparseArgs {
+	const SparseMatrix* a;
+	const SparseMatrix* b;
+	const Matrix* dense;
+	Matrix* dst;
+	const double* x;
+	double* y;
+	SparseMatrix* product;
+} SparseArgs;
+
+static void spmvRows(int begin, int end, void* arg) {
+	SparseArgs* args = arg;
+	const SparseMatrix* a = args->a;
+	for (int r = begin; r < end; r++) {
+		double sum = 0;
+		for (int i = a->ptr[r]; i < a->ptr[r + 1]; i++) {
+			sum += a->values[i] * args->x[a->indices[i]];
+		}
+		args->y[r] = sum;
+	}
+}
+
+void matrix_sparseMultiplyVector(double* y, const SparseMatrix* matrix, const double* x) {
+	MATRIX_INSTRUMENT(2.0 * matrix->nnz, 12.0 * matrix->nnz + 8.0 * (matrix->rows + matrix->cols));
+	if (matrix->format == MATRIX_CSR) {
+		SparseArgs args = { matrix, NULL, NULL, NULL, x, y, NULL };
+		matrix_parallelFor(0, matrix->rows, SPARSE_GRAIN, 2.0 * matrix->nnz, spmvRows, &args);
+		return;
+	}
+	// columns scatter into y, so CSC products are computed serially
+	memset(y, 0, matrix->rows * sizeof(double));
+	for (int c = 0; c < matrix->cols; c++) {
+		double xc = x[c];
+		for (int i = matrix->ptr[c]; i < matrix->ptr[c + 1]; i++) {
+			y[matrix->indices[i]] += matrix->values[i] * xc;
+		}
+	}
+}
+
+/**
+ * Adds a multiple of one row to another
+ */
+static void axpy(int n, double alpha, const double* x, double* y) {
+	for (int c = 0; c < n; c++) {
+		y[c] += alpha * x[c];
+	}
+}
+
+static void spmmRows(int begin, int end, void* arg) {
+	SparseArgs* args = arg;
+	const SparseMatrix* a = args->a;
+	int n = args->dst->cols;
+	for (int r = begin; r < end; r++) {
+		double* out = args->dst->matrix[r];
+		memset(out, 0, n * sizeof(double));
+		for (int i = a->ptr[r]; i < a->ptr[r + 1]; i++) {
+			axpy(n, a->values[i], args->dense->matrix[a->indices[i]], out);
+		}
+	}
+}
+
+void matrix_sparseMultiplyDense(Matrix* dst, const SparseMatrix* a, const Matrix* b) {
+	MATRIX_INSTRUMENT(2.0 * a->nnz * b->cols, 12.0 * a->nnz + 8.0 * ((double)b->rows * b->cols + (double)a->rows * b->cols));
+	if (a->cols != b->rows || dst->rows != a->rows || dst->cols != b->cols) {
+		return;
+	}
+	// each row of the product combines the rows of B selected by a row of A
+	SparseMatrix* csr = a->format == MATRIX_CSR ? NULL : matrix_sparseConvert(a, MATRIX_CSR);
+	SparseArgs args = { csr ? csr : a, NULL, b, dst, NULL, NULL, NULL };
+	matrix_parallelFor(0, a->rows, SPARSE_GRAIN, 2.0 * a->nnz * b->cols, spmmRows, &args);
+	if (csr) {
+		matrix_destroySparse(csr);
+	}
+}
+
+static void dsmmRows(int begin, int end, void* arg) {
+	SparseArgs* args = arg;
+	const SparseMatrix* b = args->b;
+	int n = args->dst->cols;
+	for (int r = begin; r < end; r++) {
+		double* out = args->dst->matrix[r];
+		const double* row = args->dense->matrix[r];
+		memset(out, 0, n * sizeof(double));
+		for (int k = 0; k < b->rows; k++) {
+			double l = row[k];
+			if (l == 0) {
+				continue;
+			}
+			for (int i = b->ptr[k]; i < b->ptr[k + 1]; i++) {
+				out[b->indices[i]] += l * b->values[i];
+			}
+		}
+	}
+}
+
+void matrix_denseMultiplySparse(Matrix* dst, const Matrix* a, const SparseMatrix* b) {
+	MATRIX_INSTRUMENT(2.0 * a->rows * b->nnz, 12.0 * b->nnz + 8.0 * ((double)a->rows * a->cols + (double)a->rows * b->cols));
+	if (a->cols != b->rows || dst->rows != a->rows || dst->cols != b->cols) {
+		return;
+	}
+	SparseMatrix* csr = b->format == MATRIX_CSR ? NULL : matrix_sparseConvert(b, MATRIX_CSR);
+	SparseArgs args = { NULL, csr ? csr : b, a, dst, NULL, NULL, NULL };
+	matrix_parallelFor(0, a->rows, SPARSE_GRAIN, 2.0 * a->rows * b->nnz, dsmmRows, &args);
+	if (csr) {
+		matrix_destroySparse(csr);
+	}
+}
+
+static int compareIndices(const void* a, const void* b) {
+	return *(const int*)a - *(const int*)b;
+}
+
+/**
+ * Symbolic phase of Gustavson's algorithm: counts the distinct columns of
+ * each row of the product, storing the count of row r in ptr[r + 1]
+ */
+static void spgemmCount(int begin, int end, void* arg) {
+	SparseArgs* args = arg;
+	const SparseMatrix* a = args->a;
+	const SparseMatrix* b = args->b;
+	MatrixArena* scratch = matrix_scratchArena();
+	MatrixArenaMark mark = matrix_arenaMark(scratch);
+	// marker[c] is the last row whose product touched column c
+	int* marker = matrix_arenaAlloc(scratch, b->cols * sizeof(int));
+	for (int c = 0; c < b->cols; c++) {
+		marker[c] = -1;
+	}
+	for (int r = begin; r < end; r++) {
+		int count = 0;
+		for (int i = a->ptr[r]; i < a->ptr[r + 1]; i++) {
+			int k = a->indices[i];
+			for (int j = b->ptr[k]; j < b->ptr[k + 1]; j++) {
+				if (marker[b->indices[j]] != r) {
+					marker[b->indices[j]] = r;
+					count++;
+				}
+			}
+		}
+		args->product->ptr[r + 1] = count;
+	}
+	matrix_arenaRelease(scratch, mark);
+}
+
+/**
+ * Numeric phase of Gustavson's algorithm: accumulates each row of the
+ * product in a dense workspace and gathers it in column order
+ */
+static void spgemmFill(int begin, int end, void* arg) {
+	SparseArgs* args = arg;
+	const SparseMatrix* a = args->a;
+	const SparseMatrix* b = args->b;
+	SparseMatrix* p = args->product;
+	MatrixArena* scratch = matrix_scratchArena();
+	MatrixArenaMark mark = matrix_arenaMark(scratch);
+	int* marker = matrix_arenaAlloc(scratch, b->cols * sizeof(int));
+	double* acc = matrix_arenaAlloc(scratch, b->cols * sizeof(double));
+	for (int c = 0; c < b->cols; c++) {
+		marker[c] = -1;
+	}
+	for (int r = begin; r < end; r++) {
+		int* cols = p->indices + p->ptr[r];
+		int count = 0;
+		for (int i = a->ptr[r]; i < a->ptr[r + 1]; i++) {
+			int k = a->indices[i];
+			double l = a->values[i];
+			for (int j = b->ptr[k]; j < b->ptr[k + 1]; j++) {
+				int c = b->indices[j];
+				if (marker[c] != r) {
+					marker[c] = r;
+					acc[c] = 0;
+					cols[count++] = c;
+				}
+				acc[c] += l * b->values[j];
+			}
+		}
+		qsort(cols, count, sizeof(int), compareIndices);
+		for (int i = 0; i < count; i++) {
+			p->values[p->ptr[r] + i] = acc[cols[i]];
+		}
+	}
+	matrix_arenaRelease(scratch, mark);
+}
+
+SparseMatrix* matrix_sparseMultiply(const SparseMatrix* a, const SparseMatrix* b) {
+	MATRIX_INSTRUMENT(0, 12.0 * (a->nnz + b->nnz));
+	if (a->cols != b->rows) {
+		return NULL;
+	}
+	SparseMatrix* csrA = a->format == MATRIX_CSR ? NULL : matrix_sparseConvert(a, MATRIX_CSR);
+	SparseMatrix* csrB = b->format == MATRIX_CSR ? NULL : matrix_sparseConvert(b, MATRIX_CSR);
+	a = csrA ? csrA : a;
+	b = csrB ? csrB : b;
+
+	// estimate of the work for the thread pool: one multiply-add per pair of entries
+	double flops = 0;
+	for (int i = 0; i < a->nnz; i++) {
+		int k = a->indices[i];
+		flops += 2.0 * (b->ptr[k + 1] - b->ptr[k]);
+	}
+	MATRIX_INSTRUMENT_FLOPS(flops);
+
+	// every task clears a workspace of b->cols entries, so a task gets at least
+	// as many rows as it takes for their products to cost as much
+	int grain = SPARSE_GRAIN;
+	if (flops * grain < (double)b->cols * a->rows) {
+		grain = flops > 0 && (double)b->cols * a->rows / flops < a->rows ?
+			(int)ceil((double)b->cols * a->rows / flops) : a->rows;
+	}
+
+	SparseMatrix* product = matrix_createSparse(a->rows, b->cols, MATRIX_CSR, 0);
+	SparseArgs args = { a, b, NULL, NULL, NULL, NULL, product };
+	matrix_parallelFor(0, a->rows, grain, flops, spgemmCount, &args);
+	for (int r = 0; r < a->rows; r++) {
+		product->ptr[r + 1] += product->ptr[r];
+	}
+	product->nnz = product->capacity = product->ptr[a->rows];
+	free(product->indices);
+	free(product->values);
+	product->indices = malloc((product->nnz ? product->nnz : 1) * sizeof(int));
+	product->values = malloc((product->nnz ? product->nnz : 1) * sizeof(double));
+	matrix_parallelFor(0, a->rows, grain, flops, spgemmFill, &args);
+
+	if (csrA) {
+		matrix_destroySparse(csrA);
+	}
+	if (csrB) {
+		matrix_destroySparse(csrB);
+	}
+	return product;
+}
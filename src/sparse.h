@@ -0,0 +1,193 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include "matrix.h"
+
+// storage formats of sparse matrices
+#define MATRIX_CSR 0
+#define MATRIX_CSC 1
+
+/**
+ * Sparse matrix in compressed sparse row (CSR) or column (CSC) format. In CSR
+ * format, the entries of row r are values[ptr[r]] to values[ptr[r + 1] - 1]
+ * and indices holds their columns; CSC format is the same with the roles of
+ * rows and columns swapped. Indices are sorted within each row (column) and
+ * never repeated.
+ */
+typedef struct SparseMatrix {
+	int rows;
+	int cols;
+	// MATRIX_CSR or MATRIX_CSC
+	int format;
+	// number of stored entries
+	int nnz;
+	// number of entries for which indices and values have room
+	int capacity;
+	// rows + 1 (CSR) or cols + 1 (CSC) offsets into indices and values
+	int* ptr;
+	int* indices;
+	double* values;
+} SparseMatrix;
+
+/**
+ * Creates a sparse matrix with no stored entries i.e. a zero matrix
+ * @param rows Desired number of rows in the matrix
+ * @param cols Desired number of columns in the matrix
+ * @param format MATRIX_CSR or MATRIX_CSC
+ * @param capacity Number of entries to allocate room for
+ * @return Pointer to the newly constructed matrix
+ */
+SparseMatrix* matrix_createSparse(int rows, int cols, int format, int capacity);
+
+/**
+ * Creates a sparse matrix from a list of entries in any order. Entries given
+ * more than once are summed.
+ * @param rows Desired number of rows in the matrix
+ * @param cols Desired number of columns in the matrix
+ * @param format MATRIX_CSR or MATRIX_CSC
+ * @param count Number of entries
+ * @param r Row of each entry
+ * @param c Column of each entry
+ * @param v Value of each entry
+ * @return Pointer to the newly constructed matrix, or NULL if an entry lies outside the matrix
+ */
+SparseMatrix* matrix_createSparseFromTriplets(int rows, int cols, int format, int count,
+	const int* r, const int* c, const double* v);
+
+/**
+ * Deallocates the memory for a sparse matrix
+ * @param matrix Matrix to destroy
+ */
+void matrix_destroySparse(SparseMatrix* matrix);
+
+/**
+ * Creates a copy of a sparse matrix
+ * @param matrix Matrix to copy
+ * @return Pointer to the copy
+ */
+SparseMatrix* matrix_copySparse(const SparseMatrix* matrix);
+
+/**
+ * Creates a sparse matrix holding the entries of a dense matrix whose
+ * magnitude exceeds a tolerance
+ * @param matrix Dense matrix
+ * @param format MATRIX_CSR or MATRIX_CSC
+ * @param tolerance Entries with magnitude at most this are dropped (0 keeps all nonzero entries)
+ * @return Pointer to the newly constructed matrix
+ */
+SparseMatrix* matrix_sparseFromDense(const Matrix* matrix, int format, double tolerance);
+
+/**
+ * Stores a sparse matrix in a dense matrix of the same size. If the sizes
+ * differ, the destination is left unchanged.
+ * @param dst Destination matrix
+ * @param matrix Sparse matrix
+ */
+void matrix_sparseToDense(Matrix* dst, const SparseMatrix* matrix);
+
+/**
+ * Determine the fraction of the entries of a matrix that are stored
+ * @param matrix Sparse matrix
+ * @return Number of stored entries divided by the number of entries
+ */
+double matrix_sparseDensity(const SparseMatrix* matrix);
+
+/**
+ * Creates a copy of a sparse matrix in another storage format
+ * @param matrix Matrix to convert
+ * @param format MATRIX_CSR or MATRIX_CSC
+ * @return Pointer to the converted matrix
+ */
+SparseMatrix* matrix_sparseConvert(const SparseMatrix* matrix, int format);
+
+/**
+ * Creates the transpose of a sparse matrix in the same storage format
+ * @param matrix Matrix to transpose
+ * @return Pointer to the transpose
+ */
+SparseMatrix* matrix_sparseTranspose(const SparseMatrix* matrix);
+
+/**
+ * Multiplies every stored entry of a sparse matrix by a scalar in place
+ * @param matrix Matrix to scale
+ * @param scale Scalar by which to multiply
+ */
+void matrix_sparseMultiplyScalar(SparseMatrix* matrix, double scale);
+
+/**
+ * Computes the linear combination alpha * A + beta * B of two sparse
+ * matrices, in the storage format of A
+ * @param alpha Scale applied to A
+ * @param a First matrix
+ * @param beta Scale applied to B
+ * @param b Second matrix
+ * @return Pointer to the sum, or NULL if the matrices have different sizes
+ */
+SparseMatrix* matrix_sparseAdd(double alpha, const SparseMatrix* a, double beta, const SparseMatrix* b);
+
+/**
+ * Adds a multiple of a sparse matrix to a dense matrix. If the sizes differ,
+ * the destination is left unchanged.
+ * @param dst Dense matrix to which to add
+ * @param alpha Scale applied to the sparse matrix
+ * @param matrix Sparse matrix
+ */
+void matrix_sparseAddToDense(Matrix* dst, double alpha, const SparseMatrix* matrix);
+
+/**
+ * Multiplies a sparse matrix by a vector (SpMV)
+ * @param y Array of matrix->rows entries in which to store the product (must not overlap x)
+ * @param matrix Sparse matrix
+ * @param x Array of matrix->cols entries
+ */
+void matrix_sparseMultiplyVector(double* y, const SparseMatrix* matrix, const double* x);
+
+/**
+ * Multiplies a sparse matrix by a dense matrix (SpMM). If the dimensions are
+ * incompatible, the destination is left unchanged.
+ * @param dst Destination matrix
+ * @param a Sparse left operand
+ * @param b Dense right operand
+ */
+void matrix_sparseMultiplyDense(Matrix* dst, const SparseMatrix* a, const Matrix* b);
+
+/**
+ * Multiplies a dense matrix by a sparse matrix. If the dimensions are
+ * incompatible, the destination is left unchanged.
+ * @param dst Destination matrix
+ * @param a Dense left operand
+ * @param b Sparse right operand
+ */
+void matrix_denseMultiplySparse(Matrix* dst, const Matrix* a, const SparseMatrix* b);
+
+/**
+ * Multiplies two sparse matrices (SpGEMM). The product is in CSR format.
+ * @param a Left operand
+ * @param b Right operand
+ * @return Pointer to the product, or NULL if the dimensions are incompatible
+ */
+SparseMatrix* matrix_sparseMultiply(const SparseMatrix* a, const SparseMatrix* b);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
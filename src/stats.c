@@ -0,0 +1,246 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef THREADSAFE
+#include <pthread.h>
+#endif
+
+#include "stats.h"
+#include "instrument.h"
+
+/**
+ * Call recorded by a trace
+ */
+typedef struct TraceEvent {
+	const char* name;
+	unsigned long long start;
+	unsigned long long duration;
+	int thread;
+} TraceEvent;
+
+// the flags and the list of counters are accessed atomically since any thread may call the library
+static int statsEnabled = 0;
+static int tracing = 0;
+static MatrixCounter* counters = NULL;
+
+static TraceEvent* traceEvents = NULL;
+static int traceCount = 0;
+static int traceDropped = 0;
+static unsigned long long traceStart = 0;
+#ifdef THREADSAFE
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+static int threadCount = 0;
+// index of the calling thread in the trace, assigned on its first event
+static _Thread_local int threadIndex = -1;
+#endif
+
+static unsigned long long now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static double loadDouble(double* source) {
+	double value;
+	__atomic_load(source, &value, __ATOMIC_RELAXED);
+	return value;
+}
+
+static void storeDouble(double* target, double value) {
+	__atomic_store(target, &value, __ATOMIC_RELAXED);
+}
+
+static void addDouble(double* target, double value) {
+	double old = loadDouble(target);
+	double sum;
+	do {
+		sum = old + value;
+	} while (!__atomic_compare_exchange(target, &old, &sum, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+MatrixProbe matrix_beginProbe(MatrixCounter* counter, double flops, double bytes) {
+	MatrixProbe probe = { NULL, 0, flops, bytes };
+	if (!__atomic_load_n(&statsEnabled, __ATOMIC_RELAXED)) {
+		return probe;
+	}
+	// the first thread to record a call of the function adds its counter to the list
+	int expected = 0;
+	if (!__atomic_load_n(&counter->registered, __ATOMIC_ACQUIRE)
+			&& __atomic_compare_exchange_n(&counter->registered, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		MatrixCounter* head = __atomic_load_n(&counters, __ATOMIC_ACQUIRE);
+		do {
+			counter->next = head;
+		} while (!__atomic_compare_exchange_n(&counters, &head, counter, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+	}
+	probe.counter = counter;
+	probe.start = now();
+	return probe;
+}
+
+/**
+ * Appends a call to the trace
+ */
+static void recordEvent(const char* name, unsigned long long start, unsigned long long duration) {
+#ifdef THREADSAFE
+	pthread_mutex_lock(&traceLock);
+	if (threadIndex < 0) {
+		threadIndex = threadCount++;
+	}
+	int thread = threadIndex;
+#else
+	int thread = 0;
+#endif
+	// events from calls that started before the trace are dropped
+	if (tracing && start >= traceStart) {
+		if (traceCount < MATRIX_TRACE_MAX_EVENTS) {
+			TraceEvent event = { name, start - traceStart, duration, thread };
+			traceEvents[traceCount++] = event;
+		} else {
+			traceDropped++;
+		}
+	}
+#ifdef THREADSAFE
+	pthread_mutex_unlock(&traceLock);
+#endif
+}
+
+void matrix_endProbe(MatrixProbe* probe) {
+	MatrixCounter* counter = probe->counter;
+	if (!counter) {
+		return;
+	}
+	unsigned long long elapsed = now() - probe->start;
+	__atomic_fetch_add(&counter->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&counter->nanoseconds, elapsed, __ATOMIC_RELAXED);
+	addDouble(&counter->flops, probe->flops);
+	addDouble(&counter->bytes, probe->bytes);
+	if (__atomic_load_n(&tracing, __ATOMIC_RELAXED)) {
+		recordEvent(counter->name, probe->start, elapsed);
+	}
+}
+
+int matrix_enableStats(int enabled) {
+#ifdef INSTRUMENT
+	__atomic_store_n(&statsEnabled, enabled, __ATOMIC_RELAXED);
+	return 1;
+#else
+	(void)enabled;
+	return 0;
+#endif
+}
+
+int matrix_statsEnabled() {
+	return __atomic_load_n(&statsEnabled, __ATOMIC_RELAXED);
+}
+
+int matrix_getStats(MatrixStats* stats, int capacity) {
+	int count = 0;
+	for (MatrixCounter* c = __atomic_load_n(&counters, __ATOMIC_ACQUIRE); c; c = c->next) {
+		unsigned long long calls = __atomic_load_n(&c->calls, __ATOMIC_RELAXED);
+		if (!calls) {
+			continue;
+		}
+		if (stats && count < capacity) {
+			stats[count].name = c->name;
+			stats[count].calls = calls;
+			stats[count].seconds = __atomic_load_n(&c->nanoseconds, __ATOMIC_RELAXED) * 1e-9;
+			stats[count].flops = loadDouble(&c->flops);
+			stats[count].bytes = loadDouble(&c->bytes);
+		}
+		count++;
+	}
+	return count;
+}
+
+void matrix_resetStats() {
+	for (MatrixCounter* c = __atomic_load_n(&counters, __ATOMIC_ACQUIRE); c; c = c->next) {
+		__atomic_store_n(&c->calls, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&c->nanoseconds, 0, __ATOMIC_RELAXED);
+		storeDouble(&c->flops, 0);
+		storeDouble(&c->bytes, 0);
+	}
+}
+
+static int compareTime(const void* a, const void* b) {
+	double ta = ((const MatrixStats*)a)->seconds;
+	double tb = ((const MatrixStats*)b)->seconds;
+	return (ta < tb) - (ta > tb);
+}
+
+void matrix_printStats(FILE* out) {
+	int count = matrix_getStats(NULL, 0);
+	MatrixStats* stats = malloc((count + 1) * sizeof(MatrixStats));
+	// functions may have been called for the first time in the meantime
+	count = matrix_getStats(stats, count);
+	qsort(stats, count, sizeof(MatrixStats), compareTime);
+	fprintf(out, "%-32s %10s %12s %12s %10s %12s\n", "function", "calls", "total ms", "us/call", "GFLOP/s", "MB");
+	for (int i = 0; i < count; i++) {
+		double seconds = stats[i].seconds;
+		fprintf(out, "%-32s %10llu %12.3f %12.3f %10.2f %12.2f\n", stats[i].name, stats[i].calls,
+			seconds * 1e3, seconds * 1e6 / stats[i].calls,
+			seconds > 0 ? stats[i].flops / seconds * 1e-9 : 0, stats[i].bytes / (1 << 20));
+	}
+	free(stats);
+}
+
+int matrix_startTrace() {
+	if (!matrix_enableStats(1)) {
+		return 0;
+	}
+#ifdef THREADSAFE
+	pthread_mutex_lock(&traceLock);
+#endif
+	if (!traceEvents) {
+		traceEvents = malloc(MATRIX_TRACE_MAX_EVENTS * sizeof(TraceEvent));
+	}
+	traceCount = 0;
+	traceDropped = 0;
+	traceStart = now();
+	__atomic_store_n(&tracing, 1, __ATOMIC_RELAXED);
+#ifdef THREADSAFE
+	pthread_mutex_unlock(&traceLock);
+#endif
+	return 1;
+}
+
+int matrix_stopTrace(const char* path) {
+#ifdef THREADSAFE
+	pthread_mutex_lock(&traceLock);
+#endif
+	__atomic_store_n(&tracing, 0, __ATOMIC_RELAXED);
+	int success = 0;
+	FILE* file = path && traceEvents ? fopen(path, "w") : NULL;
+	if (file) {
+		// complete events ("ph": "X") with timestamps and durations in microseconds
+		fprintf(file, "{\"traceEvents\":[\n");
+		for (int i = 0; i < traceCount; i++) {
+			TraceEvent* e = &traceEvents[i];
+			fprintf(file, "{\"name\":\"%s\",\"cat\":\"matrix\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}%s\n",
+				e->name, e->start * 1e-3, e->duration * 1e-3, e->thread, i + 1 < traceCount ? "," : "");
+		}
+		fprintf(file, "],\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":%d}}\n", traceDropped);
+		success = fclose(file) == 0;
+	}
+	traceCount = 0;
+#ifdef THREADSAFE
+	pthread_mutex_unlock(&traceLock);
+#endif
+	return success;
+}
@@ -0,0 +1,100 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+// largest number of events recorded by a trace; later events are dropped
+#define MATRIX_TRACE_MAX_EVENTS (1 << 20)
+
+/**
+ * Statistics of an instrumented library function. Calls made from within
+ * other instrumented functions are counted too, so the time of a function
+ * includes that of the functions it calls.
+ */
+typedef struct MatrixStats {
+	// name of the function
+	const char* name;
+	// number of calls
+	unsigned long long calls;
+	// total wall time of the calls in seconds
+	double seconds;
+	// estimated number of floating point operations performed
+	double flops;
+	// estimated number of bytes read and written (for allocation functions, bytes allocated)
+	double bytes;
+} MatrixStats;
+
+/**
+ * Turns the recording of statistics on or off. Statistics are only
+ * available if the library was built with INSTRUMENT; otherwise nothing is
+ * recorded and the library runs without any instrumentation overhead.
+ * @param enabled Whether to record statistics
+ * @return Whether statistics are available
+ */
+int matrix_enableStats(int enabled);
+
+/**
+ * Determine whether statistics are being recorded
+ * @return Whether statistics are being recorded
+ */
+int matrix_statsEnabled();
+
+/**
+ * Copies the statistics of every function called while recording was on
+ * @param stats Array in which to store the statistics, or NULL to only count the functions
+ * @param capacity Number of entries in the array
+ * @return Number of functions with statistics (may exceed capacity)
+ */
+int matrix_getStats(MatrixStats* stats, int capacity);
+
+/**
+ * Sets every statistic back to zero
+ */
+void matrix_resetStats();
+
+/**
+ * Prints a table of the statistics of every function, slowest first
+ * @param out Stream to print to
+ */
+void matrix_printStats(FILE* out);
+
+/**
+ * Starts recording an event for every call to an instrumented function, in
+ * addition to the statistics, discarding any events recorded earlier.
+ * Turns the recording of statistics on.
+ * @return Whether tracing is available (see matrix_enableStats)
+ */
+int matrix_startTrace();
+
+/**
+ * Stops recording events and writes those recorded since the trace started
+ * in Chrome's trace event format, which chrome://tracing and Perfetto display
+ * as a timeline of the calls on each thread
+ * @param path Path of the trace file, which is replaced if it exists, or NULL to discard the events
+ * @return Whether the trace was written successfully
+ */
+int matrix_stopTrace(const char* path);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,263 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "strassen.h"
+#include "arena.h"
+#include "gemm.h"
+#include "parallel.h"
+#include "instrument.h"
+
+static int strassenThreshold = 0;
+
+void matrix_setStrassenThreshold(int size) {
+	strassenThreshold = size > 0 ? size : 0;
+}
+
+int matrix_getStrassenThreshold() {
+	return strassenThreshold;
+}
+
+/**
+ * Computes D = X + sign * Y for blocks of the same size
+ */
+static void combine(int m, int n, const double* x, ptrdiff_t ldx, double sign,
+	const double* y, ptrdiff_t ldy, double* d, ptrdiff_t ldd) {
+	for (int i = 0; i < m; i++) {
+		const double* xi = x + i * ldx;
+		const double* yi = y + i * ldy;
+		double* di = d + i * ldd;
+		for (int j = 0; j < n; j++) {
+			di[j] = xi[j] + sign * yi[j];
+		}
+	}
+}
+
+/**
+ * Determine whether a product is split further or handed to the regular kernel
+ */
+static int recurses(int m, int n, int k, int crossover) {
+	return m >= crossover && n >= crossover && k >= crossover;
+}
+
+/**
+ * Determine the workspace needed by strassenSerial
+ * @return Number of doubles
+ */
+static size_t serialWorkspace(int m, int n, int k, int crossover) {
+	if (!recurses(m, n, k, crossover)) {
+		return 0;
+	}
+	int mh = m / 2, nh = n / 2, kh = k / 2;
+	return (size_t)mh * (kh > nh ? kh : nh) + (size_t)kh * nh + serialWorkspace(mh, nh, kh, crossover);
+}
+
+/**
+ * Completes a product whose leading even-sized part has been computed by
+ * applying the last inner index, row and column of odd dimensions with the
+ * regular kernel
+ */
+static void peel(int m, int n, int k, const double* a, ptrdiff_t lda,
+	const double* b, ptrdiff_t ldb, double* c, ptrdiff_t ldc) {
+	int m2 = m & ~1, n2 = n & ~1;
+	if (k & 1) {
+		matrix_dgemm(m2, n2, 1, 1, a + k - 1, lda, 1, b + (k - 1) * ldb, ldb, 1, 1, c, ldc);
+	}
+	if (n & 1) {
+		matrix_dgemm(m2, 1, k, 1, a, lda, 1, b + n - 1, ldb, 1, 0, c + n - 1, ldc);
+	}
+	if (m & 1) {
+		matrix_dgemm(1, n, k, 1, a + (m - 1) * lda, lda, 1, b, ldb, 1, 0, c + (m - 1) * ldc, ldc);
+	}
+}
+
+/**
+ * Computes C = AB on the calling thread with two temporaries per level: the
+ * quadrants of C hold the subproducts until they are combined
+ * @param work Workspace of serialWorkspace(m, n, k, crossover) doubles
+ */
+static void strassenSerial(int m, int n, int k, const double* a, ptrdiff_t lda,
+	const double* b, ptrdiff_t ldb, double* c, ptrdiff_t ldc, double* work, int crossover) {
+	if (!recurses(m, n, k, crossover)) {
+		matrix_dgemm(m, n, k, 1, a, lda, 1, b, ldb, 1, 0, c, ldc);
+		return;
+	}
+	int mh = m / 2, nh = n / 2, kh = k / 2;
+	const double* a11 = a;
+	const double* a12 = a + kh;
+	const double* a21 = a + mh * lda;
+	const double* a22 = a21 + kh;
+	const double* b11 = b;
+	const double* b12 = b + nh;
+	const double* b21 = b + kh * ldb;
+	const double* b22 = b21 + nh;
+	double* c11 = c;
+	double* c12 = c + nh;
+	double* c21 = c + mh * ldc;
+	double* c22 = c21 + nh;
+	// X holds one S_i or P1, Y one T_i
+	double* x = work;
+	double* y = x + (size_t)mh * (kh > nh ? kh : nh);
+	double* next = y + (size_t)kh * nh;
+
+	combine(mh, kh, a11, lda, -1, a21, lda, x, kh);
+	combine(kh, nh, b22, ldb, -1, b12, ldb, y, nh);
+	// P7 = S3 T3
+	strassenSerial(mh, nh, kh, x, kh, y, nh, c21, ldc, next, crossover);
+	combine(mh, kh, a21, lda, 1, a22, lda, x, kh);
+	combine(kh, nh, b12, ldb, -1, b11, ldb, y, nh);
+	// P5 = S1 T1
+	strassenSerial(mh, nh, kh, x, kh, y, nh, c22, ldc, next, crossover);
+	combine(kh, nh, b22, ldb, -1, y, nh, y, nh);
+	combine(mh, kh, x, kh, -1, a11, lda, x, kh);
+	// P6 = S2 T2
+	strassenSerial(mh, nh, kh, x, kh, y, nh, c12, ldc, next, crossover);
+	combine(mh, kh, a12, lda, -1, x, kh, x, kh);
+	// P3 = S4 B22
+	strassenSerial(mh, nh, kh, x, kh, b22, ldb, c11, ldc, next, crossover);
+	// P1 = A11 B11
+	strassenSerial(mh, nh, kh, a11, lda, b11, ldb, x, nh, next, crossover);
+	// U2 = P1 + P6, U3 = U2 + P7, U4 = U2 + P5, U7 = U3 + P5, U5 = U4 + P3
+	combine(mh, nh, x, nh, 1, c12, ldc, c12, ldc);
+	combine(mh, nh, c12, ldc, 1, c21, ldc, c21, ldc);
+	combine(mh, nh, c12, ldc, 1, c22, ldc, c12, ldc);
+	combine(mh, nh, c21, ldc, 1, c22, ldc, c22, ldc);
+	combine(mh, nh, c12, ldc, 1, c11, ldc, c12, ldc);
+	// P4 = A22 T4, U6 = U3 - P4
+	combine(kh, nh, y, nh, -1, b21, ldb, y, nh);
+	strassenSerial(mh, nh, kh, a22, lda, y, nh, c11, ldc, next, crossover);
+	combine(mh, nh, c21, ldc, -1, c11, ldc, c21, ldc);
+	// P2 = A12 B21, U1 = P1 + P2
+	strassenSerial(mh, nh, kh, a12, lda, b21, ldb, c11, ldc, next, crossover);
+	combine(mh, nh, x, nh, 1, c11, ldc, c11, ldc);
+
+	peel(m, n, k, a, lda, b, ldb, c, ldc);
+}
+
+/**
+ * One of the seven half-size products of the top level
+ */
+typedef struct StrassenProduct {
+	const double* a;
+	ptrdiff_t lda;
+	const double* b;
+	ptrdiff_t ldb;
+	double* c;
+	ptrdiff_t ldc;
+	double* work;
+} StrassenProduct;
+
+/**
+ * Arguments for computing the products of the top level in parallel
+ */
+typedef struct StrassenArgs {
+	int m, n, k;
+	int crossover;
+	StrassenProduct products[7];
+} StrassenArgs;
+
+static void computeProducts(int begin, int end, void* arg) {
+	StrassenArgs* args = arg;
+	for (int i = begin; i < end; i++) {
+		StrassenProduct* p = &args->products[i];
+		strassenSerial(args->m, args->n, args->k, p->a, p->lda, p->b, p->ldb,
+			p->c, p->ldc, p->work, args->crossover);
+	}
+}
+
+void matrix_multiplyStrassen(Matrix* dst, const Matrix* m1, const Matrix* m2, int crossover) {
+	MATRIX_INSTRUMENT(2.0 * m1->rows * m1->cols * m2->cols,
+		8.0 * ((double)m1->rows * m1->cols + (double)m2->rows * m2->cols + (double)m1->rows * m2->cols));
+	if (m1->cols != m2->rows || dst->rows != m1->rows || dst->cols != m2->cols) {
+		return;
+	}
+	if (crossover <= 0) {
+		crossover = MATRIX_DEFAULT_STRASSEN_CROSSOVER;
+	} else if (crossover < 2) {
+		crossover = 2;
+	}
+	int m = m1->rows, n = m2->cols, k = m1->cols;
+	const double* a = m1->data;
+	const double* b = m2->data;
+	double* c = dst->data;
+	ptrdiff_t lda = m1->stride, ldb = m2->stride, ldc = dst->stride;
+	MatrixArena* scratch = matrix_scratchArena();
+	MatrixArenaMark mark = matrix_arenaMark(scratch);
+
+	if (!recurses(m, n, k, crossover) || matrix_getThreadCount() <= 1) {
+		double* work = matrix_arenaAlloc(scratch, serialWorkspace(m, n, k, crossover) * sizeof(double));
+		strassenSerial(m, n, k, a, lda, b, ldb, c, ldc, work, crossover);
+		matrix_arenaRelease(scratch, mark);
+		return;
+	}
+
+	// the top level keeps every S_i, T_i and P_i so that the seven products
+	// are independent, each with its own workspace for the levels below
+	int mh = m / 2, nh = n / 2, kh = k / 2;
+	size_t sizeS = (size_t)mh * kh, sizeT = (size_t)kh * nh, sizeP = (size_t)mh * nh;
+	size_t below = serialWorkspace(mh, nh, kh, crossover);
+	double* s1 = matrix_arenaAlloc(scratch, (4 * sizeS + 4 * sizeT + 3 * sizeP + 7 * below) * sizeof(double));
+	double* s2 = s1 + sizeS;
+	double* s3 = s2 + sizeS;
+	double* s4 = s3 + sizeS;
+	double* t1 = s4 + sizeS;
+	double* t2 = t1 + sizeT;
+	double* t3 = t2 + sizeT;
+	double* t4 = t3 + sizeT;
+	double* p1 = t4 + sizeT;
+	double* p3 = p1 + sizeP;
+	double* p4 = p3 + sizeP;
+	double* work = p4 + sizeP;
+	const double* a11 = a;
+	const double* a12 = a + kh;
+	const double* a21 = a + mh * lda;
+	const double* a22 = a21 + kh;
+	const double* b11 = b;
+	const double* b12 = b + nh;
+	const double* b21 = b + kh * ldb;
+	const double* b22 = b21 + nh;
+	double* c11 = c;
+	double* c12 = c + nh;
+	double* c21 = c + mh * ldc;
+	double* c22 = c21 + nh;
+
+	combine(mh, kh, a21, lda, 1, a22, lda, s1, kh);
+	combine(mh, kh, s1, kh, -1, a11, lda, s2, kh);
+	combine(mh, kh, a11, lda, -1, a21, lda, s3, kh);
+	combine(mh, kh, a12, lda, -1, s2, kh, s4, kh);
+	combine(kh, nh, b12, ldb, -1, b11, ldb, t1, nh);
+	combine(kh, nh, b22, ldb, -1, t1, nh, t2, nh);
+	combine(kh, nh, b22, ldb, -1, b12, ldb, t3, nh);
+	combine(kh, nh, t2, nh, -1, b21, ldb, t4, nh);
+	StrassenArgs args = { mh, nh, kh, crossover, {
+		{ a11, lda, b11, ldb, p1, nh, work },
+		{ a12, lda, b21, ldb, c11, ldc, work + below },
+		{ s4, kh, b22, ldb, p3, nh, work + 2 * below },
+		{ a22, lda, t4, nh, p4, nh, work + 3 * below },
+		{ s1, kh, t1, nh, c22, ldc, work + 4 * below },
+		{ s2, kh, t2, nh, c12, ldc, work + 5 * below },
+		{ s3, kh, t3, nh, c21, ldc, work + 6 * below }
+	} };
+	matrix_parallelFor(0, 7, 1, 2.0 * m * n * k, computeProducts, &args);
+	// C11 = U1 = P1 + P2, C12 = U5, C21 = U6, C22 = U7
+	combine(mh, nh, p1, nh, 1, c11, ldc, c11, ldc);
+	combine(mh, nh, p1, nh, 1, c12, ldc, c12, ldc);
+	combine(mh, nh, c12, ldc, 1, c21, ldc, c21, ldc);
+	combine(mh, nh, c12, ldc, 1, c22, ldc, c12, ldc);
+	combine(mh, nh, c21, ldc, 1, c22, ldc, c22, ldc);
+	combine(mh, nh, c12, ldc, 1, p3, nh, c12, ldc);
+	combine(mh, nh, c21, ldc, -1, p4, nh, c21, ldc);
+	peel(m, n, k, a, lda, b, ldb, c, ldc);
+	matrix_arenaRelease(scratch, mark);
+}
@@ -0,0 +1,75 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef STRASSEN_H
+#define STRASSEN_H
+
+#include "matrix.h"
+
+// dimension below which matrix_multiplyStrassen hands off to the regular
+// kernel when no other crossover is given
+#define MATRIX_DEFAULT_STRASSEN_CROSSOVER 2048
+
+/**
+ * Multiplies two matrices with the Strassen-Winograd algorithm, which
+ * replaces 8 half-size products with 7 and 15 additions. Each level of
+ * recursion halves the dimensions until one of them is below the crossover,
+ * where the regular kernel takes over, saving up to 1/8 of the work per
+ * level. Odd dimensions are handled by peeling off the last row, column or
+ * inner index and applying it with the regular kernel. The temporaries are
+ * allocated once from the scratch arena before the recursion: about 2/3 of
+ * the size of the product on a single thread, or about 4 times its size if
+ * the seven half-size products of the top level run in parallel.
+ *
+ * The result is less accurate than the regular product: the error is only
+ * bounded normwise, by about [(n0^2 + 6 n0) 18^l - 6n] u max|A| max|B| for
+ * square matrices, where l is the number of levels, n0 = n / 2^l and u is
+ * the unit roundoff, whereas the regular product satisfies the componentwise
+ * bound n u |A||B|. Entries of the product much smaller than the operands
+ * can therefore lose all relative accuracy.
+ *
+ * If the dimensions are incompatible, the destination is left unchanged.
+ * @param dst Destination matrix (must not be one of the operands)
+ * @param m1 Left operand
+ * @param m2 Right operand
+ * @param crossover Recursion stops once a dimension is smaller than this
+ * (at least 2), or 0 or less for MATRIX_DEFAULT_STRASSEN_CROSSOVER
+ */
+void matrix_multiplyStrassen(Matrix* dst, const Matrix* m1, const Matrix* m2, int crossover);
+
+/**
+ * Sets the size from which matrix_multiplyMatrix uses matrix_multiplyStrassen,
+ * which is then also used as the crossover. Strassen-Winograd multiplication
+ * is turned off by default because of its weaker error bounds.
+ * @param size Smallest dimension of the products to compute with
+ * Strassen-Winograd, or 0 or less to always use the regular kernel
+ */
+void matrix_setStrassenThreshold(int size);
+
+/**
+ * Determine the size from which matrix_multiplyMatrix uses matrix_multiplyStrassen
+ * @return Smallest dimension of the products computed with Strassen-Winograd (0 if turned off)
+ */
+int matrix_getStrassenThreshold();
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
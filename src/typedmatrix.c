@@ -0,0 +1,607 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <limits.h>
+#include <stdatomic.h>
+
+#include "typedmatrix.h"
+#include "arena.h"
+#include "parallel.h"
+#include "instrument.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TYPED_X86
+#endif
+
+// rows per task in the elementwise kernels
+#define TYPED_GRAIN 16
+
+// blocking of the multiplication kernels: rows computed together, and the
+// depth and width of the block of the right operand kept in cache
+#define TYPED_MR 4
+#define TYPED_KC 256
+#define TYPED_NC 512
+
+// width in bytes of the vectors used by the multiplication kernels
+#define TYPED_VECTOR_BYTES 64
+
+#define TYPED_INLINE static inline __attribute__((always_inline))
+
+// vectors are only passed to helpers that are always inlined, so their ABI never matters
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+/*
+ * Arithmetic is carried out in an accumulator type per element type. Integer
+ * entries are accumulated in the unsigned type of the same width so that
+ * overflow wraps around rather than being undefined.
+ */
+typedef float AccF;
+typedef uint32_t AccI32;
+typedef uint64_t AccI64;
+
+typedef AccF VecF __attribute__((vector_size(TYPED_VECTOR_BYTES)));
+typedef AccI32 VecI32 __attribute__((vector_size(TYPED_VECTOR_BYTES)));
+typedef AccI64 VecI64 __attribute__((vector_size(TYPED_VECTOR_BYTES)));
+
+/**
+ * Conversions from double, rounding to the nearest value and saturating at
+ * the limits of integer types
+ */
+TYPED_INLINE float toF(double x) {
+	return (float)x;
+}
+
+TYPED_INLINE int32_t toI32(double x) {
+	if (x != x) {
+		return 0;
+	}
+	if (x >= INT32_MAX) {
+		return INT32_MAX;
+	}
+	if (x <= INT32_MIN) {
+		return INT32_MIN;
+	}
+	return (int32_t)llround(x);
+}
+
+TYPED_INLINE int64_t toI64(double x) {
+	if (x != x) {
+		return 0;
+	}
+	// 2^63 is the smallest double beyond the range of int64_t
+	if (x >= 9223372036854775808.0) {
+		return INT64_MAX;
+	}
+	if (x <= -9223372036854775808.0) {
+		return INT64_MIN;
+	}
+	return llround(x);
+}
+
+/**
+ * Functions shared by every element type, except the multiplication kernels
+ * @param S Suffix of the element type
+ * @param T Element type
+ */
+#define TYPED_COMMON(S, T) \
+	/* offset of the entries from the start of a matrix's storage */ \
+	static size_t headerSize##S(int rows) { \
+		return MATRIX_ALIGN(sizeof(Matrix##S) + rows * sizeof(T*)); \
+	} \
+	\
+	Matrix##S* matrix_createMatrix##S(int rows, int cols) { \
+		MATRIX_INSTRUMENT(0, headerSize##S(rows) + (double)rows * cols * sizeof(T)); \
+		size_t size = MATRIX_ALIGN(headerSize##S(rows) + (size_t)rows * cols * sizeof(T)); \
+		Matrix##S* matrix = aligned_alloc(MATRIX_ALIGNMENT, size); \
+		matrix->rows = rows; \
+		matrix->cols = cols; \
+		matrix->stride = cols; \
+		matrix->flags = 0; \
+		matrix->matrix = (T**)(matrix + 1); \
+		matrix->data = (T*)((char*)matrix + headerSize##S(rows)); \
+		for (int r = 0; r < rows; r++) { \
+			matrix->matrix[r] = matrix->data + (size_t)r * matrix->stride; \
+		} \
+		return matrix; \
+	} \
+	\
+	Matrix##S* matrix_createZeroMatrix##S(int rows, int cols) { \
+		Matrix##S* matrix = matrix_createMatrix##S(rows, cols); \
+		matrix_zeroMatrix##S(matrix); \
+		return matrix; \
+	} \
+	\
+	void matrix_destroyMatrix##S(Matrix##S* matrix) { \
+		MATRIX_INSTRUMENT(0, 0); \
+		if (!(matrix->flags & MATRIX_BORROWED)) { \
+			free(matrix); \
+		} \
+	} \
+	\
+	void matrix_zeroMatrix##S(Matrix##S* matrix) { \
+		for (int r = 0; r < matrix->rows; r++) { \
+			memset(matrix->matrix[r], 0, matrix->cols * sizeof(T)); \
+		} \
+	} \
+	\
+	void matrix_makeIdentity##S(Matrix##S* matrix) { \
+		if (matrix->rows != matrix->cols) { \
+			return; \
+		} \
+		matrix_zeroMatrix##S(matrix); \
+		for (int r = 0; r < matrix->rows; r++) { \
+			matrix->matrix[r][r] = 1; \
+		} \
+	} \
+	\
+	void matrix_copyEntries##S(Matrix##S* dst, const Matrix##S* src) { \
+		if (dst->rows != src->rows || dst->cols != src->cols) { \
+			return; \
+		} \
+		for (int r = 0; r < src->rows; r++) { \
+			memcpy(dst->matrix[r], src->matrix[r], src->cols * sizeof(T)); \
+		} \
+	} \
+	\
+	int matrix_areEqual##S(const Matrix##S* m1, const Matrix##S* m2, double tolerance) { \
+		if (m1->rows != m2->rows || m1->cols != m2->cols) { \
+			return 0; \
+		} \
+		for (int r = 0; r < m1->rows; r++) { \
+			for (int c = 0; c < m1->cols; c++) { \
+				if (fabs((double)m1->matrix[r][c] - (double)m2->matrix[r][c]) >= tolerance) { \
+					return 0; \
+				} \
+			} \
+		} \
+		return 1; \
+	} \
+	\
+	void matrix_transpose##S(Matrix##S* dst, const Matrix##S* matrix) { \
+		MATRIX_INSTRUMENT(0, 2.0 * sizeof(T) * matrix->rows * matrix->cols); \
+		if (dst->cols != matrix->rows || dst->rows != matrix->cols) { \
+			return; \
+		} \
+		/* swapping pairs of entries also works when transposing in place */ \
+		if (matrix->rows == matrix->cols) { \
+			for (int r = 0; r < matrix->rows; r++) { \
+				dst->matrix[r][r] = matrix->matrix[r][r]; \
+				for (int c = r + 1; c < matrix->cols; c++) { \
+					T toSwap = matrix->matrix[c][r]; \
+					dst->matrix[c][r] = matrix->matrix[r][c]; \
+					dst->matrix[r][c] = toSwap; \
+				} \
+			} \
+			return; \
+		} \
+		for (int r = 0; r < dst->rows; r++) { \
+			for (int c = 0; c < dst->cols; c++) { \
+				dst->matrix[r][c] = matrix->matrix[c][r]; \
+			} \
+		} \
+	} \
+	\
+	/* arguments of the row-parallel kernels */ \
+	typedef struct TypedArgs##S { \
+		Matrix##S* dst; \
+		const Matrix##S* m1; \
+		const Matrix##S* m2; \
+		T scale; \
+	} TypedArgs##S; \
+	\
+	static void addRows##S(int begin, int end, void* arg) { \
+		TypedArgs##S* args = arg; \
+		for (int r = begin; r < end; r++) { \
+			T* d = args->dst->matrix[r]; \
+			const T* a = args->m1->matrix[r]; \
+			const T* b = args->m2->matrix[r]; \
+			for (int c = 0; c < args->m1->cols; c++) { \
+				d[c] = (T)((Acc##S)a[c] + (Acc##S)b[c]); \
+			} \
+		} \
+	} \
+	\
+	void matrix_add##S(Matrix##S* dst, const Matrix##S* m1, const Matrix##S* m2) { \
+		MATRIX_INSTRUMENT((double)m1->rows * m1->cols, 3.0 * sizeof(T) * m1->rows * m1->cols); \
+		if (m1->rows != m2->rows || m1->cols != m2->cols || dst->rows != m1->rows || dst->cols != m1->cols) { \
+			return; \
+		} \
+		TypedArgs##S args = { dst, m1, m2, 0 }; \
+		matrix_parallelFor(0, m1->rows, TYPED_GRAIN, (double)m1->rows * m1->cols, addRows##S, &args); \
+	} \
+	\
+	static void scaleRows##S(int begin, int end, void* arg) { \
+		TypedArgs##S* args = arg; \
+		Acc##S scale = (Acc##S)args->scale; \
+		for (int r = begin; r < end; r++) { \
+			T* d = args->dst->matrix[r]; \
+			const T* a = args->m1->matrix[r]; \
+			for (int c = 0; c < args->m1->cols; c++) { \
+				d[c] = (T)((Acc##S)a[c] * scale); \
+			} \
+		} \
+	} \
+	\
+	void matrix_multiplyScalar##S(Matrix##S* dst, const Matrix##S* matrix, T scale) { \
+		MATRIX_INSTRUMENT((double)matrix->rows * matrix->cols, 2.0 * sizeof(T) * matrix->rows * matrix->cols); \
+		if (dst->rows != matrix->rows || dst->cols != matrix->cols) { \
+			return; \
+		} \
+		TypedArgs##S args = { dst, matrix, NULL, scale }; \
+		matrix_parallelFor(0, matrix->rows, TYPED_GRAIN, (double)matrix->rows * matrix->cols, scaleRows##S, &args); \
+	} \
+	\
+	void matrix_convertTo##S(Matrix##S* dst, const Matrix* src) { \
+		MATRIX_INSTRUMENT(0, (8.0 + sizeof(T)) * src->rows * src->cols); \
+		if (dst->rows != src->rows || dst->cols != src->cols) { \
+			return; \
+		} \
+		for (int r = 0; r < src->rows; r++) { \
+			for (int c = 0; c < src->cols; c++) { \
+				dst->matrix[r][c] = to##S(src->matrix[r][c]); \
+			} \
+		} \
+	} \
+	\
+	void matrix_convertFrom##S(Matrix* dst, const Matrix##S* src) { \
+		MATRIX_INSTRUMENT(0, (8.0 + sizeof(T)) * src->rows * src->cols); \
+		if (dst->rows != src->rows || dst->cols != src->cols) { \
+			return; \
+		} \
+		for (int r = 0; r < src->rows; r++) { \
+			for (int c = 0; c < src->cols; c++) { \
+				dst->matrix[r][c] = (double)src->matrix[r][c]; \
+			} \
+		} \
+	}
+
+MATRIX_ELEMENT_TYPES(TYPED_COMMON)
+
+/**
+ * Multiplication kernels of an element type. Each task computes blocks of
+ * TYPED_MR rows of the product, TYPED_KC x TYPED_NC blocks of the right
+ * operand at a time, accumulating 2 vectors of each row in registers.
+ * @param S Suffix of the element type
+ * @param T Element type
+ * @param suffix Name of the instruction set the kernel is compiled for
+ * @param attr Attributes selecting the instruction set
+ */
+#define TYPED_MULTIPLY(S, T, suffix, attr) \
+	attr TYPED_INLINE void multiplyBlock##S##suffix(const Matrix##S* a, const Matrix##S* b, Matrix##S* c, \
+			int i0, int rows, int jb, int je, int kb, int ke) { \
+		enum { LANES = sizeof(Vec##S) / sizeof(Acc##S) }; \
+		int j = jb; \
+		for (; j + 2 * LANES <= je; j += 2 * LANES) { \
+			Vec##S acc[TYPED_MR][2]; \
+			for (int r = 0; r < rows; r++) { \
+				if (kb) { \
+					memcpy(&acc[r][0], c->matrix[i0 + r] + j, sizeof(Vec##S)); \
+					memcpy(&acc[r][1], c->matrix[i0 + r] + j + LANES, sizeof(Vec##S)); \
+				} else { \
+					acc[r][0] = acc[r][1] = (Vec##S){ 0 }; \
+				} \
+			} \
+			for (int k = kb; k < ke; k++) { \
+				Vec##S b0, b1; \
+				memcpy(&b0, b->matrix[k] + j, sizeof(Vec##S)); \
+				memcpy(&b1, b->matrix[k] + j + LANES, sizeof(Vec##S)); \
+				for (int r = 0; r < rows; r++) { \
+					Vec##S l = (Vec##S){ 0 } + (Acc##S)a->matrix[i0 + r][k]; \
+					acc[r][0] += l * b0; \
+					acc[r][1] += l * b1; \
+				} \
+			} \
+			for (int r = 0; r < rows; r++) { \
+				memcpy(c->matrix[i0 + r] + j, &acc[r][0], sizeof(Vec##S)); \
+				memcpy(c->matrix[i0 + r] + j + LANES, &acc[r][1], sizeof(Vec##S)); \
+			} \
+		} \
+		/* columns left over after the last pair of vectors */ \
+		for (; j < je; j++) { \
+			for (int r = 0; r < rows; r++) { \
+				Acc##S sum = kb ? (Acc##S)c->matrix[i0 + r][j] : 0; \
+				for (int k = kb; k < ke; k++) { \
+					sum += (Acc##S)a->matrix[i0 + r][k] * (Acc##S)b->matrix[k][j]; \
+				} \
+				c->matrix[i0 + r][j] = (T)sum; \
+			} \
+		} \
+	} \
+	\
+	attr static void multiplyRows##S##suffix(int begin, int end, void* arg) { \
+		TypedArgs##S* args = arg; \
+		const Matrix##S* a = args->m1; \
+		const Matrix##S* b = args->m2; \
+		Matrix##S* c = args->dst; \
+		for (int jb = 0; jb < b->cols; jb += TYPED_NC) { \
+			int je = jb + TYPED_NC < b->cols ? jb + TYPED_NC : b->cols; \
+			for (int kb = 0; kb < a->cols; kb += TYPED_KC) { \
+				int ke = kb + TYPED_KC < a->cols ? kb + TYPED_KC : a->cols; \
+				for (int block = begin; block < end; block++) { \
+					int i0 = block * TYPED_MR; \
+					int rows = a->rows - i0 < TYPED_MR ? a->rows - i0 : TYPED_MR; \
+					/* full blocks get a copy of the kernel with a constant row count */ \
+					if (rows == TYPED_MR) { \
+						multiplyBlock##S##suffix(a, b, c, i0, TYPED_MR, jb, je, kb, ke); \
+					} else { \
+						multiplyBlock##S##suffix(a, b, c, i0, rows, jb, je, kb, ke); \
+					} \
+				} \
+			} \
+		} \
+	}
+
+#define TYPED_KERNELS(suffix, attr) \
+	TYPED_MULTIPLY(F, float, suffix, attr) \
+	TYPED_MULTIPLY(I32, int32_t, suffix, attr) \
+	TYPED_MULTIPLY(I64, int64_t, suffix, attr)
+
+TYPED_KERNELS(Generic, )
+
+#ifdef TYPED_X86
+TYPED_KERNELS(AVX2, __attribute__((target("avx2,fma"))))
+TYPED_KERNELS(AVX512, __attribute__((target("avx512f"))))
+#endif
+
+/**
+ * Multiplication kernels for one instruction set
+ */
+typedef struct TypedImpl {
+	MatrixParallelTask multiplyF;
+	MatrixParallelTask multiplyI32;
+	MatrixParallelTask multiplyI64;
+} TypedImpl;
+
+/**
+ * Selects the kernels for the widest vectors supported by the CPU the library is running on
+ * @return Multiplication kernels
+ */
+static const TypedImpl* selectImpl() {
+	static const TypedImpl generic = { multiplyRowsFGeneric, multiplyRowsI32Generic, multiplyRowsI64Generic };
+#ifdef TYPED_X86
+	static const TypedImpl avx2 = { multiplyRowsFAVX2, multiplyRowsI32AVX2, multiplyRowsI64AVX2 };
+	static const TypedImpl avx512 = { multiplyRowsFAVX512, multiplyRowsI32AVX512, multiplyRowsI64AVX512 };
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return &avx512;
+	}
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		return &avx2;
+	}
+#endif
+	return &generic;
+}
+
+static const TypedImpl* getImpl() {
+	static const TypedImpl* _Atomic selected = NULL;
+	const TypedImpl* impl = atomic_load_explicit(&selected, memory_order_relaxed);
+	if (!impl) {
+		impl = selectImpl();
+		atomic_store_explicit(&selected, impl, memory_order_relaxed);
+	}
+	return impl;
+}
+
+#define TYPED_MULTIPLY_ENTRY(S, T) \
+	void matrix_multiplyMatrix##S(Matrix##S* dst, const Matrix##S* m1, const Matrix##S* m2) { \
+		MATRIX_INSTRUMENT(2.0 * m1->rows * m1->cols * m2->cols, sizeof(T) * \
+			((double)m1->rows * m1->cols + (double)m2->rows * m2->cols + (double)m1->rows * m2->cols)); \
+		if (m1->cols != m2->rows || dst->rows != m1->rows || dst->cols != m2->cols) { \
+			return; \
+		} \
+		/* the kernels accumulate over the shared dimension, which may be empty */ \
+		if (!m1->cols) { \
+			matrix_zeroMatrix##S(dst); \
+			return; \
+		} \
+		TypedArgs##S args = { dst, m1, m2, 0 }; \
+		int blocks = (m1->rows + TYPED_MR - 1) / TYPED_MR; \
+		matrix_parallelFor(0, blocks, 1, 2.0 * m1->rows * m1->cols * m2->cols, getImpl()->multiply##S, &args); \
+	}
+
+MATRIX_ELEMENT_TYPES(TYPED_MULTIPLY_ENTRY)
+
+/**
+ * Reduces a single precision matrix with Gaussian elimination with partial
+ * pivoting. If an inverse is requested, the elimination continues above the
+ * diagonal (Gauss-Jordan) and the same row operations are applied to it.
+ * @param m Row table of the matrix to reduce, which is overwritten
+ * @param n Size of the matrix
+ * @param inv Row table of an identity matrix in which to store the inverse, or NULL
+ * @param singular Where to store whether a pivot was zero, or NULL. The
+ * determinant can underflow to zero without the matrix being singular.
+ * @return Determinant of the matrix
+ */
+static float eliminateF(float** m, int n, float** inv, int* singular) {
+	float det = 1;
+	if (singular) {
+		*singular = 0;
+	}
+	for (int p = 0; p < n; p++) {
+		int pivot = p;
+		for (int r = p + 1; r < n; r++) {
+			if (fabsf(m[r][p]) > fabsf(m[pivot][p])) {
+				pivot = r;
+			}
+		}
+		if (m[pivot][p] == 0) {
+			if (singular) {
+				*singular = 1;
+			}
+			return 0;
+		}
+		// rows are swapped by swapping their pointers in the row tables
+		if (pivot != p) {
+			float* row = m[p];
+			m[p] = m[pivot];
+			m[pivot] = row;
+			if (inv) {
+				row = inv[p];
+				inv[p] = inv[pivot];
+				inv[pivot] = row;
+			}
+			det = -det;
+		}
+		float diag = m[p][p];
+		det *= diag;
+		if (inv) {
+			float scale = 1 / diag;
+			for (int c = 0; c < n; c++) {
+				m[p][c] *= scale;
+				inv[p][c] *= scale;
+			}
+			diag = 1;
+		}
+		for (int r = inv ? 0 : p + 1; r < n; r++) {
+			if (r == p || m[r][p] == 0) {
+				continue;
+			}
+			float factor = m[r][p] / diag;
+			for (int c = p; c < n; c++) {
+				m[r][c] -= factor * m[p][c];
+			}
+			if (inv) {
+				for (int c = 0; c < n; c++) {
+					inv[r][c] -= factor * inv[p][c];
+				}
+			}
+		}
+	}
+	return det;
+}
+
+/**
+ * Creates a copy of a single precision matrix in the scratch arena whose row
+ * table can be permuted freely
+ * @param scratch Arena in which to allocate the copy
+ * @param matrix Matrix to copy
+ * @return Row table of the copy
+ */
+static float** scratchCopyF(MatrixArena* scratch, const MatrixF* matrix) {
+	int n = matrix->rows;
+	float** rows = matrix_arenaAlloc(scratch, n * sizeof(float*));
+	float* data = matrix_arenaAlloc(scratch, (size_t)n * matrix->cols * sizeof(float));
+	for (int r = 0; r < n; r++) {
+		rows[r] = data + (size_t)r * matrix->cols;
+		memcpy(rows[r], matrix->matrix[r], matrix->cols * sizeof(float));
+	}
+	return rows;
+}
+
+float matrix_determinantF(const MatrixF* matrix) {
+	MATRIX_INSTRUMENT(2.0 / 3 * matrix->rows * matrix->rows * matrix->rows, 4.0 * matrix->rows * matrix->cols);
+	if (matrix->rows != matrix->cols) {
+		return 0;
+	}
+	MatrixArena* scratch = matrix_scratchArena();
+	MatrixArenaMark mark = matrix_arenaMark(scratch);
+	float det = eliminateF(scratchCopyF(scratch, matrix), matrix->rows, NULL, NULL);
+	matrix_arenaRelease(scratch, mark);
+	return det;
+}
+
+float matrix_invertF(MatrixF* dst, const MatrixF* matrix, int* singular) {
+	MATRIX_INSTRUMENT(2.0 * matrix->rows * matrix->rows * matrix->rows, 8.0 * matrix->rows * matrix->cols);
+	if (matrix->rows != matrix->cols || dst->rows != matrix->rows || dst->cols != matrix->cols) {
+		if (singular) {
+			*singular = 1;
+		}
+		return 0;
+	}
+	int n = matrix->rows;
+	MatrixArena* scratch = matrix_scratchArena();
+	MatrixArenaMark mark = matrix_arenaMark(scratch);
+	float** m = scratchCopyF(scratch, matrix);
+	float** inv = matrix_arenaAlloc(scratch, n * sizeof(float*));
+	float* data = matrix_arenaAlloc(scratch, (size_t)n * n * sizeof(float));
+	memset(data, 0, (size_t)n * n * sizeof(float));
+	for (int r = 0; r < n; r++) {
+		inv[r] = data + (size_t)r * n;
+		inv[r][r] = 1;
+	}
+	int zeroPivot;
+	float det = eliminateF(m, n, inv, &zeroPivot);
+	if (singular) {
+		*singular = zeroPivot;
+	}
+	// the destination is only written once the matrix is known to be invertible
+	if (!zeroPivot) {
+		for (int r = 0; r < n; r++) {
+			memcpy(dst->matrix[r], inv[r], n * sizeof(float));
+		}
+	}
+	matrix_arenaRelease(scratch, mark);
+	return det;
+}
+
+/**
+ * Computes the determinant of an integer matrix with the Bareiss algorithm,
+ * whose divisions are all exact
+ * @param m Row table of the matrix, which is overwritten
+ * @param n Size of the matrix
+ * @return Determinant of the matrix
+ */
+static int64_t bareiss(int64_t** m, int n) {
+	int64_t previous = 1;
+	int64_t sign = 1;
+	for (int p = 0; p < n; p++) {
+		if (m[p][p] == 0) {
+			int pivot = p + 1;
+			while (pivot < n && m[pivot][p] == 0) {
+				pivot++;
+			}
+			if (pivot == n) {
+				return 0;
+			}
+			int64_t* row = m[p];
+			m[p] = m[pivot];
+			m[pivot] = row;
+			sign = -sign;
+		}
+		for (int r = p + 1; r < n; r++) {
+			for (int c = p + 1; c < n; c++) {
+				__int128 cross = (__int128)m[r][c] * m[p][p] - (__int128)m[r][p] * m[p][c];
+				m[r][c] = (int64_t)(cross / previous);
+			}
+		}
+		previous = m[p][p];
+	}
+	return n ? sign * m[n - 1][n - 1] : 1;
+}
+
+#define TYPED_DETERMINANT(S, T) \
+	int64_t matrix_determinant##S(const Matrix##S* matrix) { \
+		MATRIX_INSTRUMENT(2.0 / 3 * matrix->rows * matrix->rows * matrix->rows, \
+			(double)sizeof(T) * matrix->rows * matrix->cols); \
+		if (matrix->rows != matrix->cols) { \
+			return 0; \
+		} \
+		int n = matrix->rows; \
+		MatrixArena* scratch = matrix_scratchArena(); \
+		MatrixArenaMark mark = matrix_arenaMark(scratch); \
+		int64_t** m = matrix_arenaAlloc(scratch, n * sizeof(int64_t*)); \
+		int64_t* data = matrix_arenaAlloc(scratch, (size_t)n * n * sizeof(int64_t)); \
+		for (int r = 0; r < n; r++) { \
+			m[r] = data + (size_t)r * n; \
+			for (int c = 0; c < n; c++) { \
+				m[r][c] = matrix->matrix[r][c]; \
+			} \
+		} \
+		int64_t det = bareiss(m, n); \
+		matrix_arenaRelease(scratch, mark); \
+		return det; \
+	}
+
+TYPED_DETERMINANT(I32, int32_t)
+TYPED_DETERMINANT(I64, int64_t)
@@ -0,0 +1,149 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef TYPEDMATRIX_H
+#define TYPEDMATRIX_H
+
+#include <stdint.h>
+
+#include "matrix.h"
+
+/*
+ * Matrices of single precision and integer entries, for data that doesn't
+ * need double precision: they take up half (float, int32_t) or the same
+ * (int64_t) memory and the arithmetic kernels process correspondingly more
+ * entries per vector instruction.
+ *
+ * Each element type has its own matrix type, laid out like Matrix, and the
+ * same set of functions, named after the double precision functions with a
+ * suffix for the type:
+ *
+ * suffix  matrix type  entry type
+ *    F    MatrixF      float
+ *    I32  MatrixI32    int32_t
+ *    I64  MatrixI64    int64_t
+ *
+ * Integer arithmetic wraps around on overflow. Conversions from double round
+ * to the nearest representable value, saturating at the limits of integer
+ * types (NaN becomes zero).
+ */
+
+// expands X(suffix, type) for every element type other than double
+#define MATRIX_ELEMENT_TYPES(X) \
+	X(F, float) \
+	X(I32, int32_t) \
+	X(I64, int64_t)
+
+/*
+ * For an element type T with suffix S:
+ *
+ * MatrixS
+ *     Matrix of T entries; see Matrix
+ * MatrixS* matrix_createMatrixS(int rows, int cols)
+ *     Creates an uninitialized matrix
+ * MatrixS* matrix_createZeroMatrixS(int rows, int cols)
+ *     Creates a zero matrix
+ * void matrix_destroyMatrixS(MatrixS* matrix)
+ *     Deallocates the memory for a matrix
+ * void matrix_zeroMatrixS(MatrixS* matrix)
+ *     Sets every entry of a matrix to zero
+ * void matrix_makeIdentityS(MatrixS* matrix)
+ *     Sets a square matrix to the identity; non-square matrices are left unchanged
+ * void matrix_copyEntriesS(MatrixS* dst, const MatrixS* src)
+ *     Copies the entries of a matrix into another of the same size
+ * int matrix_areEqualS(const MatrixS* m1, const MatrixS* m2, double tolerance)
+ *     Determine whether two matrices have the same size and entries differing by less than the tolerance
+ * void matrix_transposeS(MatrixS* dst, const MatrixS* matrix)
+ *     Transposes a matrix into another (which must not be the same unless the matrix is square)
+ * void matrix_addS(MatrixS* dst, const MatrixS* m1, const MatrixS* m2)
+ *     Adds two matrices of the same size
+ * void matrix_multiplyScalarS(MatrixS* dst, const MatrixS* matrix, T scale)
+ *     Multiplies a matrix by a scalar
+ * void matrix_multiplyMatrixS(MatrixS* dst, const MatrixS* m1, const MatrixS* m2)
+ *     Multiplies two matrices; dst must not be one of the operands
+ * void matrix_convertToS(MatrixS* dst, const Matrix* src)
+ *     Converts a double precision matrix to a matrix of the same size
+ * void matrix_convertFromS(Matrix* dst, const MatrixS* src)
+ *     Converts a matrix to a double precision matrix of the same size
+ *
+ * If the sizes of the arguments don't match, the destination is left
+ * unchanged, as with the double precision functions.
+ */
+#define MATRIX_DECLARE_ELEMENT_TYPE(S, T) \
+	typedef struct Matrix##S { \
+		int rows; \
+		int cols; \
+		T** matrix; \
+		T* data; \
+		int stride; \
+		int flags; \
+	} Matrix##S; \
+	Matrix##S* matrix_createMatrix##S(int rows, int cols); \
+	Matrix##S* matrix_createZeroMatrix##S(int rows, int cols); \
+	void matrix_destroyMatrix##S(Matrix##S* matrix); \
+	void matrix_zeroMatrix##S(Matrix##S* matrix); \
+	void matrix_makeIdentity##S(Matrix##S* matrix); \
+	void matrix_copyEntries##S(Matrix##S* dst, const Matrix##S* src); \
+	int matrix_areEqual##S(const Matrix##S* m1, const Matrix##S* m2, double tolerance); \
+	void matrix_transpose##S(Matrix##S* dst, const Matrix##S* matrix); \
+	void matrix_add##S(Matrix##S* dst, const Matrix##S* m1, const Matrix##S* m2); \
+	void matrix_multiplyScalar##S(Matrix##S* dst, const Matrix##S* matrix, T scale); \
+	void matrix_multiplyMatrix##S(Matrix##S* dst, const Matrix##S* m1, const Matrix##S* m2); \
+	void matrix_convertTo##S(Matrix##S* dst, const Matrix* src); \
+	void matrix_convertFrom##S(Matrix* dst, const Matrix##S* src);
+
+MATRIX_ELEMENT_TYPES(MATRIX_DECLARE_ELEMENT_TYPE)
+
+/**
+ * Determine the determinant of a single precision matrix
+ * @param matrix Matrix whose determinant to compute
+ * @return Determinant of the matrix (zero if it isn't square)
+ */
+float matrix_determinantF(const MatrixF* matrix);
+
+/**
+ * Inverts a single precision matrix. If the matrix is singular or the sizes
+ * don't match, the destination is left unchanged.
+ * @param dst Destination matrix (may be the same as matrix)
+ * @param matrix Matrix to invert
+ * @param singular Where to store whether the matrix has no inverse (optional)
+ * @return Determinant of the matrix, which can underflow to zero for matrices that have an inverse
+ */
+float matrix_invertF(MatrixF* dst, const MatrixF* matrix, int* singular);
+
+/**
+ * Determine the determinant of an integer matrix exactly using fraction-free
+ * elimination. The result is exact as long as it and the intermediate
+ * minors fit in 64 bits.
+ * @param matrix Matrix whose determinant to compute
+ * @return Determinant of the matrix (zero if it isn't square)
+ */
+int64_t matrix_determinantI32(const MatrixI32* matrix);
+
+/**
+ * Determine the determinant of an integer matrix exactly; see matrix_determinantI32
+ * @param matrix Matrix whose determinant to compute
+ * @return Determinant of the matrix (zero if it isn't square)
+ */
+int64_t matrix_determinantI64(const MatrixI64* matrix);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
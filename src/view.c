@@ -0,0 +1,261 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <limits.h>
+
+#include "view.h"
+#include "arena.h"
+#include "gemm.h"
+#include "parallel.h"
+#include "instrument.h"
+
+// elementwise operations on views proceed in square tiles so that both a
+// view and its transpose are traversed with few cache misses
+#define VIEW_TILE 32
+
+MatrixView matrix_view(const Matrix* matrix) {
+	MatrixView view = { matrix->data, matrix->rows, matrix->cols, matrix->stride, 1 };
+	return view;
+}
+
+MatrixView matrix_viewOf(double* data, int rows, int cols, ptrdiff_t rowStride, ptrdiff_t colStride) {
+	MatrixView view = { data, rows, cols, rowStride, colStride };
+	return view;
+}
+
+MatrixView matrix_viewBlock(MatrixView view, int row, int col, int rows, int cols) {
+	if (row < 0 || col < 0 || rows < 0 || cols < 0 || row + rows > view.rows || col + cols > view.cols) {
+		MatrixView empty = { view.data, 0, 0, view.rowStride, view.colStride };
+		return empty;
+	}
+	MatrixView block = { view.data + row * view.rowStride + col * view.colStride,
+		rows, cols, view.rowStride, view.colStride };
+	return block;
+}
+
+MatrixView matrix_viewRow(MatrixView view, int row) {
+	return matrix_viewBlock(view, row, 0, 1, view.cols);
+}
+
+MatrixView matrix_viewColumn(MatrixView view, int col) {
+	return matrix_viewBlock(view, 0, col, view.rows, 1);
+}
+
+MatrixView matrix_viewDiagonal(MatrixView view) {
+	int size = view.rows < view.cols ? view.rows : view.cols;
+	MatrixView diagonal = { view.data, size, 1, view.rowStride + view.colStride, 1 };
+	return diagonal;
+}
+
+MatrixView matrix_viewTranspose(MatrixView view) {
+	MatrixView transpose = { view.data, view.cols, view.rows, view.colStride, view.rowStride };
+	return transpose;
+}
+
+Matrix* matrix_wrapView(MatrixView view) {
+	if (view.colStride != 1 || view.rowStride < view.cols || view.rowStride > INT_MAX) {
+		return NULL;
+	}
+	return matrix_wrapMatrix(view.data, view.rows, view.cols, (int)view.rowStride);
+}
+
+/**
+ * Elementwise operations on views
+ */
+typedef enum ViewOp {
+	VIEW_COPY,
+	VIEW_FILL,
+	VIEW_SCALE,
+	VIEW_AXPBY
+} ViewOp;
+
+/**
+ * Arguments for an elementwise operation split by tiles of rows
+ */
+typedef struct ViewArgs {
+	ViewOp op;
+	MatrixView dst;
+	MatrixView a;
+	MatrixView b;
+	double alpha;
+	double beta;
+} ViewArgs;
+
+/**
+ * Applies an operation to a range of the rows of one tile; every view
+ * involved has adjacent entries within its rows
+ */
+static void rowsContiguous(const ViewArgs* args, int r0, int r1, int c0, int c1) {
+	for (int r = r0; r < r1; r++) {
+		double* d = args->dst.data + r * args->dst.rowStride;
+		const double* a = args->a.data + r * args->a.rowStride;
+		const double* b = args->b.data + r * args->b.rowStride;
+		switch (args->op) {
+		case VIEW_COPY:
+			memmove(d + c0, a + c0, (c1 - c0) * sizeof(double));
+			break;
+		case VIEW_FILL:
+			for (int c = c0; c < c1; c++) {
+				d[c] = args->alpha;
+			}
+			break;
+		case VIEW_SCALE:
+			for (int c = c0; c < c1; c++) {
+				d[c] *= args->alpha;
+			}
+			break;
+		case VIEW_AXPBY:
+			for (int c = c0; c < c1; c++) {
+				d[c] = args->alpha * a[c] + args->beta * b[c];
+			}
+			break;
+		}
+	}
+}
+
+/**
+ * Applies an operation to one tile of views with arbitrary strides
+ */
+static void tileStrided(const ViewArgs* args, int r0, int r1, int c0, int c1) {
+	const MatrixView* d = &args->dst;
+	const MatrixView* a = &args->a;
+	const MatrixView* b = &args->b;
+	for (int r = r0; r < r1; r++) {
+		for (int c = c0; c < c1; c++) {
+			double* entry = d->data + r * d->rowStride + c * d->colStride;
+			switch (args->op) {
+			case VIEW_COPY:
+				*entry = MATRIX_VIEW_ENTRY(*a, r, c);
+				break;
+			case VIEW_FILL:
+				*entry = args->alpha;
+				break;
+			case VIEW_SCALE:
+				*entry *= args->alpha;
+				break;
+			case VIEW_AXPBY:
+				*entry = args->alpha * MATRIX_VIEW_ENTRY(*a, r, c) + args->beta * MATRIX_VIEW_ENTRY(*b, r, c);
+				break;
+			}
+		}
+	}
+}
+
+static void viewTiles(int begin, int end, void* arg) {
+	ViewArgs* args = arg;
+	int rows = args->dst.rows, cols = args->dst.cols;
+	int contiguous = args->dst.colStride == 1
+		&& (args->op == VIEW_FILL || args->op == VIEW_SCALE || args->a.colStride == 1)
+		&& (args->op != VIEW_AXPBY || args->b.colStride == 1);
+	for (int t = begin; t < end; t++) {
+		int r0 = t * VIEW_TILE;
+		int r1 = r0 + VIEW_TILE < rows ? r0 + VIEW_TILE : rows;
+		if (contiguous) {
+			rowsContiguous(args, r0, r1, 0, cols);
+			continue;
+		}
+		for (int c0 = 0; c0 < cols; c0 += VIEW_TILE) {
+			int c1 = c0 + VIEW_TILE < cols ? c0 + VIEW_TILE : cols;
+			tileStrided(args, r0, r1, c0, c1);
+		}
+	}
+}
+
+/**
+ * Runs an elementwise operation over the tiles of the destination
+ */
+static void applyView(ViewArgs* args) {
+	if (args->dst.rows <= 0 || args->dst.cols <= 0) {
+		return;
+	}
+	// traverse the destination along its smaller stride
+	if (args->dst.colStride != 1 && (args->dst.rowStride == 1
+		|| labs(args->dst.rowStride) < labs(args->dst.colStride))) {
+		args->dst = matrix_viewTranspose(args->dst);
+		args->a = matrix_viewTranspose(args->a);
+		args->b = matrix_viewTranspose(args->b);
+	}
+	int tiles = (args->dst.rows + VIEW_TILE - 1) / VIEW_TILE;
+	matrix_parallelFor(0, tiles, 1, (double)args->dst.rows * args->dst.cols, viewTiles, args);
+}
+
+static int sameSize(MatrixView a, MatrixView b) {
+	return a.rows == b.rows && a.cols == b.cols;
+}
+
+int matrix_viewCopy(MatrixView dst, MatrixView src) {
+	MATRIX_INSTRUMENT(0, 16.0 * src.rows * src.cols);
+	if (!sameSize(dst, src)) {
+		return 0;
+	}
+	if (dst.data == src.data && dst.rowStride == src.rowStride && dst.colStride == src.colStride) {
+		return 1;
+	}
+	ViewArgs args = { VIEW_COPY, dst, src, src, 0, 0 };
+	applyView(&args);
+	return 1;
+}
+
+void matrix_viewFill(MatrixView dst, double value) {
+	MATRIX_INSTRUMENT(0, 8.0 * dst.rows * dst.cols);
+	ViewArgs args = { VIEW_FILL, dst, dst, dst, value, 0 };
+	applyView(&args);
+}
+
+void matrix_viewScale(MatrixView dst, double scale) {
+	MATRIX_INSTRUMENT((double)dst.rows * dst.cols, 16.0 * dst.rows * dst.cols);
+	ViewArgs args = { VIEW_SCALE, dst, dst, dst, scale, 0 };
+	applyView(&args);
+}
+
+int matrix_viewAxpby(MatrixView dst, double alpha, MatrixView a, double beta, MatrixView b) {
+	MATRIX_INSTRUMENT(3.0 * dst.rows * dst.cols, 24.0 * dst.rows * dst.cols);
+	if (!sameSize(dst, a) || !sameSize(dst, b)) {
+		return 0;
+	}
+	ViewArgs args = { VIEW_AXPBY, dst, a, b, alpha, beta };
+	applyView(&args);
+	return 1;
+}
+
+int matrix_viewMultiply(MatrixView c, double alpha, MatrixView a, MatrixView b, double beta) {
+	MATRIX_INSTRUMENT(2.0 * a.rows * a.cols * b.cols,
+		8.0 * ((double)a.rows * a.cols + (double)b.rows * b.cols + 2.0 * c.rows * c.cols));
+	if (a.cols != b.rows || c.rows != a.rows || c.cols != b.cols) {
+		return 0;
+	}
+	if (c.colStride == 1) {
+		matrix_dgemm(c.rows, c.cols, a.cols, alpha, a.data, a.rowStride, a.colStride,
+			b.data, b.rowStride, b.colStride, beta, c.data, c.rowStride);
+	} else if (c.rowStride == 1) {
+		// C^T = B^T A^T has adjacent entries within its rows
+		matrix_dgemm(c.cols, c.rows, a.cols, alpha, b.data, b.colStride, b.rowStride,
+			a.data, a.colStride, a.rowStride, beta, c.data, c.colStride);
+	} else {
+		// the kernel needs adjacent entries in the rows of the result
+		MatrixArena* scratch = matrix_scratchArena();
+		MatrixArenaMark mark = matrix_arenaMark(scratch);
+		Matrix* product = matrix_arenaMatrix(scratch, c.rows, c.cols);
+		matrix_dgemm(c.rows, c.cols, a.cols, alpha, a.data, a.rowStride, a.colStride,
+			b.data, b.rowStride, b.colStride, 0, product->data, product->stride);
+		if (beta == 0) {
+			matrix_viewCopy(c, matrix_view(product));
+		} else {
+			matrix_viewAxpby(c, 1, matrix_view(product), beta, c);
+		}
+		matrix_arenaRelease(scratch, mark);
+	}
+	return 1;
+}
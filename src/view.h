@@ -0,0 +1,172 @@
+//Copyright (C) 2018-20 Arc676/Alessandro Vinciguerra <alesvinciguerra@gmail.com>
+
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation (version 3).
+
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+//GNU General Public License for more details.
+
+//You should have received a copy of the GNU General Public License
+//along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef VIEW_H
+#define VIEW_H
+
+#include <stddef.h>
+
+#include "matrix.h"
+
+// entry (r, c) of a view
+#define MATRIX_VIEW_ENTRY(view, r, c) ((view).data[(r) * (view).rowStride + (c) * (view).colStride])
+
+/**
+ * Non-owning view of entries stored elsewhere with arbitrary row and column
+ * strides. Entry (r, c) is at data[r * rowStride + c * colStride], so
+ * blocks, single rows or columns, diagonals and transposes of a matrix, as
+ * well as caller-owned arrays in either row-major or column-major order, can
+ * be described without copying anything. Views are small and passed by
+ * value; they never allocate or free memory and must not outlive the
+ * entries they refer to.
+ */
+typedef struct MatrixView {
+	double* data;
+	int rows;
+	int cols;
+	ptrdiff_t rowStride;
+	ptrdiff_t colStride;
+} MatrixView;
+
+/**
+ * Creates a view of all the entries of a matrix
+ * @param matrix Matrix to view
+ * @return View of the matrix
+ */
+MatrixView matrix_view(const Matrix* matrix);
+
+/**
+ * Creates a view of caller-owned entries
+ * @param data Entries to view
+ * @param rows Number of rows in the view
+ * @param cols Number of columns in the view
+ * @param rowStride Distance between entries in consecutive rows
+ * @param colStride Distance between entries in consecutive columns
+ * @return View of the entries
+ */
+MatrixView matrix_viewOf(double* data, int rows, int cols, ptrdiff_t rowStride, ptrdiff_t colStride);
+
+/**
+ * Creates a view of a block of a view. If the block doesn't lie within the
+ * view, an empty view (with no rows or columns) is returned.
+ * @param view View containing the block
+ * @param row First row of the block
+ * @param col First column of the block
+ * @param rows Number of rows in the block
+ * @param cols Number of columns in the block
+ * @return View of the block
+ */
+MatrixView matrix_viewBlock(MatrixView view, int row, int col, int rows, int cols);
+
+/**
+ * Creates a 1 x cols view of a row of a view. If the row doesn't exist, an
+ * empty view is returned.
+ * @param view View containing the row
+ * @param row Index of the row
+ * @return View of the row
+ */
+MatrixView matrix_viewRow(MatrixView view, int row);
+
+/**
+ * Creates a rows x 1 view of a column of a view. If the column doesn't exist,
+ * an empty view is returned.
+ * @param view View containing the column
+ * @param col Index of the column
+ * @return View of the column
+ */
+MatrixView matrix_viewColumn(MatrixView view, int col);
+
+/**
+ * Creates a column view of the main diagonal of a view
+ * @param view View containing the diagonal
+ * @return min(rows, cols) x 1 view of the diagonal
+ */
+MatrixView matrix_viewDiagonal(MatrixView view);
+
+/**
+ * Creates the transpose of a view by swapping its dimensions and strides
+ * @param view View to transpose
+ * @return Transposed view of the same entries
+ */
+MatrixView matrix_viewTranspose(MatrixView view);
+
+/**
+ * Creates a matrix referring to the entries of a view without copying them,
+ * so that they can be passed to functions taking a matrix. This requires the
+ * entries of each row to be adjacent. matrix_destroyMatrix frees only the
+ * header of the matrix.
+ * @param view View whose entries to refer to
+ * @return Pointer to the newly constructed matrix, or NULL if the column stride isn't 1
+ */
+Matrix* matrix_wrapView(MatrixView view);
+
+/**
+ * Copies the entries of a view into another one. If the views have different
+ * sizes, the destination is left unchanged and 0 is returned.
+ * @param dst View in which to store the entries (must not overlap src unless it is equal to it)
+ * @param src View whose entries to copy
+ * @return Whether the entries were copied
+ */
+int matrix_viewCopy(MatrixView dst, MatrixView src);
+
+/**
+ * Sets every entry of a view to a value
+ * @param dst View whose entries to set
+ * @param value Value of the entries
+ */
+void matrix_viewFill(MatrixView dst, double value);
+
+/**
+ * Multiplies every entry of a view by a scalar
+ * @param dst View whose entries to scale
+ * @param scale Scalar by which to multiply
+ */
+void matrix_viewScale(MatrixView dst, double scale);
+
+/**
+ * Computes alpha * A + beta * B. If the views have different sizes, the
+ * destination is left unchanged and 0 is returned.
+ * @param dst View in which to store the result (may be a or b, but must not partially overlap them)
+ * @param alpha Scale applied to A
+ * @param a First operand
+ * @param beta Scale applied to B
+ * @param b Second operand
+ * @return Whether the result was computed
+ */
+int matrix_viewAxpby(MatrixView dst, double alpha, MatrixView a, double beta, MatrixView b);
+
+/**
+ * Computes C = alpha * AB + beta * C with the matrix multiplication kernel,
+ * which reads the operands through their strides (transposed views are not
+ * copied). If the dimensions are incompatible, the destination is left
+ * unchanged and 0 is returned.
+ * @param c View in which to store the result (must not overlap a or b)
+ * @param alpha Scale applied to the product
+ * @param a Left operand
+ * @param b Right operand
+ * @param beta Scale applied to the previous contents of C (not read if zero)
+ * @return Whether the product was computed
+ */
+int matrix_viewMultiply(MatrixView c, double alpha, MatrixView a, MatrixView b, double beta);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif